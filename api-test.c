@@ -382,6 +382,53 @@ static void module_serde(void)
     JS_FreeRuntime(rt);
 }
 
+static void rom_bytecode(void)
+{
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    static const char code[] =
+        "var tag = 'x';"
+        "function f(o) { return o.foo + o.bar.length + tag.length; }"
+        "f({foo: 1, bar: 'abc'})";
+    JSValue obj = JS_Eval(ctx, code, strlen(code), "rom",
+                          JS_EVAL_TYPE_GLOBAL|JS_EVAL_FLAG_COMPILE_ONLY);
+    assert(!JS_IsException(obj));
+    size_t len = 0, len2 = 0;
+    uint8_t *buf2 = JS_WriteObject(ctx, &len, obj, JS_WRITE_OBJ_BYTECODE);
+    assert(buf2);
+    JS_FreeValue(ctx, obj);
+    // the bytecode of 'buf' is executed in place: it must outlive 'rt'
+    uint8_t *buf = malloc(len);
+    assert(buf);
+    memcpy(buf, buf2, len);
+    js_free(ctx, buf2);
+    obj = JS_ReadObject(ctx, buf, len,
+                        JS_READ_OBJ_BYTECODE|JS_READ_OBJ_ROM_DATA);
+    assert(!JS_IsException(obj));
+    // the atoms are translated back when serializing
+    buf2 = JS_WriteObject(ctx, &len2, obj, JS_WRITE_OBJ_BYTECODE);
+    assert(buf2);
+    assert(len2 == len);
+    assert(!memcmp(buf, buf2, len));
+    js_free(ctx, buf2);
+    JSValue ret = JS_EvalFunction(ctx, obj);
+    assert(!JS_IsException(ret));
+    int32_t v;
+    assert(JS_ToInt32(ctx, &v, ret) == 0);
+    assert(v == 5);
+    JS_FreeValue(ctx, ret);
+    JSContext *ctx2 = JS_CloneContext(ctx);
+    assert(ctx2);
+    ret = eval(ctx2, "f({foo: 2, bar: 'a'})");
+    assert(JS_ToInt32(ctx2, &v, ret) == 0);
+    assert(v == 4);
+    JS_FreeValue(ctx2, ret);
+    JS_FreeContext(ctx2);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+    free(buf);
+}
+
 static void runtime_cstring_free(void)
 {
     JSRuntime *rt = JS_NewRuntime();
@@ -858,6 +905,691 @@ static void slice_string_tocstring(void)
     JS_FreeRuntime(rt);
 }
 
+static void compact_string_slices(void)
+{
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    JSMemoryUsage stats;
+    JSValue ret = eval(ctx, "'.'.repeat(16384).slice(1, 2049)");
+    assert(!JS_IsException(ret));
+    JS_ComputeMemoryUsage(rt, &stats);
+    assert(stats.str_slice_count == 1);
+    assert(stats.str_slice_retained_size > 14000);
+    // the parent is only held by the slice, gc gives the slice its own copy
+    JS_RunGC(rt);
+    JS_ComputeMemoryUsage(rt, &stats);
+    assert(stats.str_slice_count == 1);
+    assert(stats.str_slice_retained_size < 100);
+    const char *str = JS_ToCString(ctx, ret);
+    assert(strlen(str) == 2048);
+    assert(str[0] == '.' && str[2047] == '.');
+    JS_FreeCString(ctx, str);
+    JS_FreeValue(ctx, ret);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static void gc_step(void)
+{
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    JSMemoryUsage before, after;
+    JSGCStats st;
+    JSValue ret;
+    int n;
+
+    JS_SetGCThreshold(rt, -1);
+    JS_RunGC(rt);
+    JS_ComputeMemoryUsage(rt, &before);
+    // garbage cycles mixed with live ones reachable from the global object
+    ret = eval(ctx, "globalThis.live = [];"
+                    "for (let i = 0; i < 10000; i++) {"
+                    "  const a = {i}, b = {a}; a.b = b;"
+                    "  if (i % 100 == 0) live.push(a);"
+                    "}");
+    assert(!JS_IsException(ret));
+    JS_FreeValue(ctx, ret);
+    JS_ComputeMemoryUsage(rt, &after);
+    assert(after.obj_count > before.obj_count + 20000);
+    while (!JS_RunGCStep(rt, 0))
+        continue;
+    JS_ComputeMemoryUsage(rt, &after);
+    assert(after.obj_count < before.obj_count + 1000);
+    ret = eval(ctx, "live.length == 100 &&"
+                    "live.every((a, i) => a.i == i * 100 && a.b.a === a)");
+    assert(JS_IsBool(ret) && JS_VALUE_GET_BOOL(ret));
+    // a cycle spanning many steps, while the program moves the live
+    // objects to new boxes and drops another cycle
+    ret = eval(ctx, "let r = globalThis.ring = {n: 0};"
+                    "for (let i = 1; i < 20000; i++) r = r.next = {n: i};"
+                    "r.next = ring; r = null;"
+                    "globalThis.boxes = [];"
+                    "for (let i = 0; i < 5000; i++) {"
+                    "  const o = {i}; o.self = o; boxes.push({o});"
+                    "}"
+                    "globalThis.move = (k) => {"
+                    "  for (let j = 0; j < 20; j++) {"
+                    "    const i = (k * 31 + j * 977) % boxes.length;"
+                    "    boxes[i] = {o: boxes[i].o};"
+                    "  }"
+                    "}");
+    assert(!JS_IsException(ret));
+    JS_FreeValue(ctx, ret);
+    ret = eval(ctx, "ring = null");
+    JS_FreeValue(ctx, ret);
+    n = 0;
+    while (!JS_RunGCStep(rt, 0)) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "move(%d)", n++);
+        ret = eval(ctx, buf);
+        assert(!JS_IsException(ret));
+        JS_FreeValue(ctx, ret);
+    }
+    assert(n > 10);
+    JS_ComputeMemoryUsage(rt, &after);
+    assert(after.obj_count < before.obj_count + 13000);
+    ret = eval(ctx, "boxes.every(({o}, i) => o.i == i && o.self === o) &&"
+                    "live.every((a, i) => a.i == i * 100 && a.b.a === a)");
+    assert(JS_IsBool(ret) && JS_VALUE_GET_BOOL(ret));
+    // automatic mode, the steps keep the heap bounded without any full
+    // collection
+    JS_SetGCThreshold(rt, 256 * 1024);
+    JS_SetGCStepBudget(rt, 1000);
+    ret = eval(ctx, "for (let i = 0; i < 200000; i++) {"
+                    "  const a = {i}, b = {a}; a.b = b;"
+                    "}");
+    assert(!JS_IsException(ret));
+    JS_FreeValue(ctx, ret);
+    JS_ComputeMemoryUsage(rt, &after);
+    assert(after.obj_count < before.obj_count + 100000);
+    JS_GetGCStats(rt, &st);
+    assert(st.gc_count > 0);
+    assert(st.full_gc_count == 0);
+    ret = eval(ctx, "live.every((a, i) => a.i == i * 100 && a.b.a === a)");
+    assert(JS_IsBool(ret) && JS_VALUE_GET_BOOL(ret));
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static void gc_candidate_roots(void)
+{
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    JSMemoryUsage before, after;
+    JSValue ret;
+
+    JS_SetGCThreshold(rt, -1);
+    // a large stable cache, never a candidate root
+    ret = eval(ctx, "globalThis.cache = [];"
+                    "for (let i = 0; i < 50000; i++) {"
+                    "  const a = {i}, b = {a}; a.b = b; cache.push(a);"
+                    "}");
+    assert(!JS_IsException(ret));
+    JS_FreeValue(ctx, ret);
+    JS_RunGC(rt);
+    JS_ComputeMemoryUsage(rt, &before);
+    // the automatic collections only trace from the dropped objects
+    JS_SetGCThreshold(rt, 256 * 1024);
+    ret = eval(ctx, "for (let i = 0; i < 200000; i++) {"
+                    "  const a = {i}, b = {a}; a.b = b;"
+                    "  if (i % 10 == 0) cache[i % 50000].b.c = a;"
+                    "}");
+    assert(!JS_IsException(ret));
+    JS_FreeValue(ctx, ret);
+    JS_ComputeMemoryUsage(rt, &after);
+    assert(after.obj_count < before.obj_count + 100000);
+    ret = eval(ctx, "cache.every((a, i) => a.i == i && a.b.a === a &&"
+                    "  (a.b.c === undefined || a.b.c.b.a === a.b.c))");
+    assert(JS_IsBool(ret) && JS_VALUE_GET_BOOL(ret));
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static void slab_allocator(void)
+{
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    JSMemoryUsage before, after;
+    JSValue ret;
+
+    JS_RunGC(rt);
+    JS_ComputeMemoryUsage(rt, &before);
+    ret = eval(ctx, "globalThis.objs = [];"
+                    "for (let i = 0; i < 100000; i++)"
+                    "  objs.push({i, j: i, k: () => i});");
+    assert(!JS_IsException(ret));
+    JS_FreeValue(ctx, ret);
+    JS_ComputeMemoryUsage(rt, &after);
+    assert(after.malloc_size > before.malloc_size + 100000 * 64);
+    // the emptied pages are given back
+    ret = eval(ctx, "objs = null");
+    JS_FreeValue(ctx, ret);
+    JS_RunGC(rt);
+    JS_ComputeMemoryUsage(rt, &after);
+    assert(after.malloc_size < before.malloc_size + 256 * 1024);
+    // the limit applies to the slab pages
+    JS_SetMemoryLimit(rt, after.malloc_size + 1024 * 1024);
+    ret = eval(ctx, "const t = []; for (;;) t.push({})");
+    assert(JS_IsException(ret));
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static void gc_adaptive(void)
+{
+    JSGCStats st;
+    JSValue ret;
+
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    JS_GetGCStats(rt, &st);
+    assert(st.gc_count == 0);
+    assert(st.heap_growth == 50);
+    // the collections free little memory while the heap grows
+    ret = eval(ctx, "const a = [];"
+                    "for (let i = 0; i < 300000; i++) a.push({ i });");
+    assert(!JS_IsException(ret));
+    JS_FreeValue(ctx, ret);
+    JS_GetGCStats(rt, &st);
+    assert(st.gc_count > 0);
+    assert(st.full_gc_count > 0);
+    assert(st.heap_growth > 50);
+    assert(st.alloc_rate > 0);
+    assert(st.gc_threshold > st.heap_size);
+    JS_SetGCHeapGrowth(rt, 20);
+    JS_GetGCStats(rt, &st);
+    assert(st.heap_growth == 20);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static void heap_snapshot(void)
+{
+    size_t len, size = 4 << 20;
+    char *buf;
+    FILE *f;
+
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    JSValue ret = eval(ctx, "class Leak { constructor() { this.self = this } };"
+                            "globalThis.leak = new Leak()");
+    assert(!JS_IsException(ret));
+    JS_FreeValue(ctx, ret);
+    f = tmpfile();
+    assert(f);
+    assert(JS_WriteHeapSnapshot(rt, f) == 0);
+    rewind(f);
+    buf = malloc(size);
+    assert(buf);
+    len = fread(buf, 1, size - 1, f);
+    assert(len < size - 1);
+    buf[len] = '\0';
+    fclose(f);
+    assert(!strncmp(buf, "{\"snapshot\":{\"meta\":", 20));
+    assert(strstr(buf, "\"(GC roots)\""));
+    assert(strstr(buf, "\"Leak\""));
+    free(buf);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static void alloc_profile(void)
+{
+    size_t len, size = 1 << 20;
+    char *buf;
+    FILE *f;
+
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    JS_StartAllocationSampling(rt, 1024, 16);
+    JSValue ret = eval(ctx, "function makeObjects() {"
+                            "  var a = [];"
+                            "  for (var i = 0; i < 10000; i++) a.push({i});"
+                            "  return a;"
+                            "}"
+                            "makeObjects().length");
+    assert(!JS_IsException(ret));
+    JS_FreeValue(ctx, ret);
+    JS_StopAllocationSampling(rt);
+    f = tmpfile();
+    assert(f);
+    assert(JS_WriteAllocationProfile(rt, f) == 0);
+    rewind(f);
+    buf = malloc(size);
+    assert(buf);
+    len = fread(buf, 1, size - 1, f);
+    assert(len < size - 1);
+    buf[len] = '\0';
+    fclose(f);
+    assert(!strncmp(buf, "{\"head\":", 8));
+    assert(strstr(buf, "\"makeObjects\""));
+    assert(strstr(buf, "\"(object)\""));
+    assert(strstr(buf, "\"samples\":[{"));
+    free(buf);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static void lazy_compile(void)
+{
+    char src[8192];
+    size_t len;
+    int32_t v;
+    int i;
+
+    JSRuntime *rt = JS_NewRuntime();
+    JS_SetLazyCompilation(rt, true);
+    JSContext *ctx = JS_NewContext(rt);
+    // inner functions large enough for their code generation to be deferred
+    len = snprintf(src, sizeof(src),
+                   "function outer(x) {"
+                   "  var shared = x;"
+                   "  function used(y) { var s = shared;");
+    for (i = 0; i < 40; i++)
+        len += snprintf(src + len, sizeof(src) - len, " s += y * %d;", i);
+    len += snprintf(src + len, sizeof(src) - len,
+                    "    shared++; return s; }"
+                    "  function unused(y) { var s = shared;");
+    for (i = 0; i < 40; i++)
+        len += snprintf(src + len, sizeof(src) - len, " s -= y * %d;", i);
+    snprintf(src + len, sizeof(src) - len,
+             "    return s; }"
+             "  return { used, unused };"
+             "}"
+             "var o = outer(1), p = outer(2);"
+             "var r = o.used(1) + o.used(1) + p.used(0);"
+             "if (!p.unused.toString().startsWith('function unused(y)'))"
+             "  throw new Error('toString');"
+             "r");
+    JSValue ret = eval(ctx, src);
+    assert(!JS_IsException(ret));
+    assert(JS_ToInt32(ctx, &v, ret) == 0);
+    // 1 + 780, 2 + 780 and 2
+    assert(v == 1565);
+    JS_FreeValue(ctx, ret);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static void shared_source(void)
+{
+    static const char code[] =
+        "function outer(a) {\n"
+        "  function inner(b) { return a + b; }\n"
+        "  const arrow = (x) => x * 2;\n"
+        "  class C { m() { throw new Error('here'); } }\n"
+        "  return [inner, arrow, C];\n"
+        "}\n"
+        "var [inner, arrow, C] = outer(1);\n"
+        "function check() {\n"
+        "  if (inner.toString() !== 'function inner(b) { return a + b; }' ||\n"
+        "      arrow.toString() !== '(x) => x * 2' ||\n"
+        "      !C.toString().startsWith('class C {') ||\n"
+        "      !outer.toString().endsWith('return [inner, arrow, C];\\n}'))\n"
+        "    throw new Error('toString');\n"
+        "  try { new C().m(); } catch (e) { return e.stack; }\n"
+        "}\n"
+        "check()";
+    const char *stack;
+    size_t len;
+    uint8_t *buf;
+
+    JSRuntime *rt = JS_NewRuntime();
+    JS_SetSharedFunctionSource(rt, true);
+    JS_SetLazyCompilation(rt, true);
+    JSContext *ctx = JS_NewContext(rt);
+    JSValue obj = JS_Eval(ctx, code, strlen(code), "shared.js",
+                          JS_EVAL_TYPE_GLOBAL|JS_EVAL_FLAG_COMPILE_ONLY);
+    assert(!JS_IsException(obj));
+    uint8_t *buf2 = JS_WriteObject(ctx, &len, obj, JS_WRITE_OBJ_BYTECODE);
+    assert(buf2);
+    // read back as ROM data by another runtime below
+    buf = malloc(len);
+    assert(buf);
+    memcpy(buf, buf2, len);
+    js_free(ctx, buf2);
+    JSValue ret = JS_EvalFunction(ctx, obj);
+    assert(!JS_IsException(ret));
+    stack = JS_ToCString(ctx, ret);
+    assert(stack);
+    assert(strstr(stack, "shared.js:4:"));
+    JS_FreeCString(ctx, stack);
+    JS_FreeValue(ctx, ret);
+    // the clone shares the source of the template
+    JSContext *ctx2 = JS_CloneContext(ctx);
+    assert(ctx2);
+    ret = eval(ctx2, "check()");
+    assert(!JS_IsException(ret));
+    JS_FreeValue(ctx2, ret);
+    JS_FreeContext(ctx2);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+
+    // the line tables and sources of ROM data are used in place
+    rt = JS_NewRuntime();
+    ctx = JS_NewContext(rt);
+    obj = JS_ReadObject(ctx, buf, len,
+                        JS_READ_OBJ_BYTECODE|JS_READ_OBJ_ROM_DATA);
+    assert(!JS_IsException(obj));
+    ret = JS_EvalFunction(ctx, obj);
+    assert(!JS_IsException(ret));
+    stack = JS_ToCString(ctx, ret);
+    assert(stack);
+    assert(strstr(stack, "shared.js:4:"));
+    JS_FreeCString(ctx, stack);
+    JS_FreeValue(ctx, ret);
+    ctx2 = JS_CloneContext(ctx);
+    assert(ctx2);
+    ret = eval(ctx2, "check()");
+    assert(!JS_IsException(ret));
+    JS_FreeValue(ctx2, ret);
+    JS_FreeContext(ctx2);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+    free(buf);
+}
+
+static void eval_opt_level(void)
+{
+    static const char src[] =
+        "function f(a) {"
+        "  const n = 10;"
+        "  let x = n * 2 + 1;"
+        "  var y = a, z = y + x, dead = -0 * 4;"
+        "  var k = -7 % 7, d = 7 / 2;"
+        "  if (1 / k !== -Infinity || d !== 3.5) throw new Error('fold');"
+        "  return z + (1 << 31) + (~5 & 0xff) + (3 < 4);"
+        "}"
+        "function tdz() {"
+        "  try { t = 1; let t = 2; return t; } catch (e) { return e.name; }"
+        "}"
+        "f(1) + ' ' + tdz()";
+    JSEvalOptions options;
+    JSValue ret[2];
+    const char *s;
+    int i;
+
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    for (i = 0; i < 2; i++) {
+        options = (JSEvalOptions){
+            .version = JS_EVAL_OPTIONS_VERSION,
+            .filename = "<input>",
+            .opt_level = i ? 0 : -1,
+        };
+        ret[i] = JS_Eval2(ctx, src, strlen(src), &options);
+        assert(JS_IsString(ret[i]));
+    }
+    s = JS_ToCString(ctx, ret[0]);
+    assert(!strcmp(s, "-2147483375 ReferenceError"));
+    JS_FreeCString(ctx, s);
+    assert(JS_IsStrictEqual(ctx, ret[0], ret[1]));
+    JS_FreeValue(ctx, ret[0]);
+    JS_FreeValue(ctx, ret[1]);
+    // version 1 options have no opt_level field
+    options = (JSEvalOptions){ .version = 1, .filename = "<input>" };
+    ret[0] = JS_Eval2(ctx, "2 * 3", 5, &options);
+    assert(JS_VALUE_GET_INT(ret[0]) == 6);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static JSValue native_answer(JSContext *ctx, JSValueConst this_val,
+                             JSValue *arg_buf, JSValue *var_buf)
+{
+    return JS_NewInt32(ctx, 42);
+}
+
+static void native_code(void)
+{
+    static const char code[] =
+        "function f() { return 1; }\n"
+        "function g(a) { try { return a.x; } catch (e) { return 2; } }\n"
+        "f() + g(null)";
+    JSNativeCodeEntry tab[3];
+    const char *p;
+    char *text;
+    size_t len;
+    int i;
+
+    JSRuntime *rt = JS_NewRuntime();
+    JS_SetLazyCompilation(rt, true);
+    JSContext *ctx = JS_NewContext(rt);
+    JSValue obj = JS_Eval(ctx, code, strlen(code), "native.js",
+                          JS_EVAL_TYPE_GLOBAL|JS_EVAL_FLAG_COMPILE_ONLY);
+    assert(!JS_IsException(obj));
+    text = JS_WriteNativeCode(ctx, &len, obj, "t");
+    assert(text);
+    assert(len == strlen(text));
+    assert(strstr(text, "const uint32_t t_native_count = 3;"));
+    // try/catch is not translated
+    p = strstr(text, "t_native[3] = {\n");
+    assert(p);
+    p += strlen("t_native[3] = {\n");
+    for (i = 0; i < 3; i++) {
+        char name[32];
+        assert(sscanf(p, " { %31[^,], %u },", name,
+                      &tab[i].byte_code_len) == 2);
+        assert(!strcmp(name, i == 1 ? "t_native_1" : "NULL"));
+        tab[i].func = NULL;
+        p = strchr(p, '\n') + 1;
+    }
+    js_free(ctx, text);
+    // the table must match the bytecode
+    assert(JS_SetNativeCode(ctx, obj, tab, 2) == -1);
+    JSValue exc = JS_GetException(ctx);
+    assert(JS_IsError(exc));
+    JS_FreeValue(ctx, exc);
+    tab[1].func = native_answer;
+    assert(JS_SetNativeCode(ctx, obj, tab, 3) == 0);
+    JSValue ret = JS_EvalFunction(ctx, obj);
+    assert(!JS_IsException(ret));
+    assert(JS_VALUE_GET_TAG(ret) == JS_TAG_INT);
+    assert(JS_VALUE_GET_INT(ret) == 44);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static void clone_context(void)
+{
+    JSValue ret, exc;
+    int32_t v;
+
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    ret = eval(ctx, "var counter = 0;"
+                    "const cache = new Map([[1, 'one']]);"
+                    "class A { #n = 1; get n() { return this.#n; } }"
+                    "var inc = (function() { var n = 0; return () => ++n; })();"
+                    "Array.prototype.sum = function() {"
+                    "  return this.reduce((a, b) => a + b, 0);"
+                    "};");
+    assert(!JS_IsException(ret));
+    JS_FreeValue(ctx, ret);
+    JSContext *ctx2 = JS_CloneContext(ctx);
+    assert(ctx2);
+    ret = eval(ctx2, "counter = inc() + inc();"
+                     "cache.set(2, 'two');"
+                     "if (!(new A() instanceof A) || new A().n !== 1)"
+                     "  throw new Error('class');"
+                     "if (Object.getPrototypeOf([]) !== Array.prototype)"
+                     "  throw new Error('intrinsics');"
+                     "[counter, cache.size, cache.get(1).length].sum()");
+    assert(!JS_IsException(ret));
+    assert(JS_ToInt32(ctx2, &v, ret) == 0);
+    assert(v == 3 + 2 + 3);
+    JS_FreeValue(ctx2, ret);
+    JS_FreeContext(ctx2);
+    // the template is unchanged
+    ret = eval(ctx, "counter + cache.size + inc()");
+    assert(!JS_IsException(ret));
+    assert(JS_ToInt32(ctx, &v, ret) == 0);
+    assert(v == 0 + 1 + 1);
+    JS_FreeValue(ctx, ret);
+    ret = eval(ctx, "var p = new Promise(() => {});");
+    assert(!JS_IsException(ret));
+    JS_FreeValue(ctx, ret);
+    assert(!JS_CloneContext(ctx));
+    exc = JS_GetException(ctx);
+    assert(JS_IsError(exc));
+    JS_FreeValue(ctx, exc);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static int arena_finalized;
+
+static void arena_class_finalizer(JSRuntime *rt, JSValueConst val)
+{
+    arena_finalized++;
+}
+
+static void arena_free_buffer(JSRuntime *rt, void *opaque, void *ptr)
+{
+    arena_finalized++;
+    free(ptr);
+}
+
+static void arena_closure_finalize(void *opaque)
+{
+    arena_finalized++;
+}
+
+static void arena_runtime(void)
+{
+    JSClassDef def = { .class_name = "Arena", .finalizer = arena_class_finalizer };
+    JSClassID class_id = 0;
+    JSValue global, obj, ret;
+    int32_t len;
+    int i;
+
+    JSRuntime *rt = JS_NewArenaRuntime();
+    assert(rt);
+    // the blocks are aligned as with malloc(), large ones included
+    for (i = 1; i < 512 * 1024; i = i * 3 + 1) {
+        void *ptr = js_malloc_rt(rt, i);
+        assert(ptr);
+        assert(((uintptr_t)ptr & 15) == 0);
+        js_free_rt(rt, ptr);
+    }
+    JS_NewClassID(rt, &class_id);
+    assert(JS_NewClass(rt, class_id, &def) == 0);
+    JSContext *ctx = JS_NewContext(rt);
+    global = JS_GetGlobalObject(ctx);
+    for (i = 0; i < 3; i++) {
+        obj = JS_NewObjectClass(ctx, class_id);
+        assert(JS_IsObject(obj));
+        // a cycle, never freed before the runtime
+        JS_SetPropertyStr(ctx, obj, "self", JS_DupValue(ctx, obj));
+        JS_FreeValue(ctx, obj);
+    }
+    obj = JS_NewObjectClass(ctx, class_id);
+    JS_SetPropertyStr(ctx, global, "o", obj);
+    JS_SetPropertyStr(ctx, global, "b",
+                      JS_NewArrayBuffer(ctx, malloc(16), 16, arena_free_buffer,
+                                        NULL, false));
+    JS_SetPropertyStr(ctx, global, "c",
+                      JS_NewCClosure(ctx, cclosure_callback, "c",
+                                     arena_closure_finalize, 0, 0, NULL));
+    JS_FreeValue(ctx, global);
+    // freed before the runtime
+    obj = JS_NewObjectClass(ctx, class_id);
+    JS_FreeValue(ctx, obj);
+    assert(arena_finalized == 1);
+    ret = eval(ctx, "const a = [];"
+                    "for (let i = 0; i < 100000; i++) a.push({ i, s: 'x' + i });"
+                    "a.push(new Array(100000).fill(1));"
+                    "a.length");
+    assert(!JS_IsException(ret));
+    assert(JS_ToInt32(ctx, &len, ret) == 0);
+    assert(len == 100001);
+    JS_RunGC(rt);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+    assert(arena_finalized == 1 + 4 + 1 + 1);
+    // freed without any prior collection
+    rt = JS_NewArenaRuntime();
+    assert(rt);
+    ctx = JS_NewContext(rt);
+    ret = eval(ctx, "const o = {}; o.self = o; o");
+    assert(JS_IsObject(ret));
+    JS_FreeValue(ctx, ret);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static JSModuleDef *tree_shake_loader(JSContext *ctx, const char *name,
+                                      void *opaque)
+{
+    assert(!strcmp(name, "c"));
+    static const char code[] =
+        "function h() { return new Proxy({}, {}); }\n"
+        "export function f(x) { return x + 1; }\n"
+        "export function g() { return h(); }\n";
+    JSValue ret = JS_Eval(ctx, code, strlen(code), "c",
+                          JS_EVAL_TYPE_MODULE|JS_EVAL_FLAG_COMPILE_ONLY);
+    assert(!JS_IsException(ret));
+    // keep a reference to inspect the module
+    *(JSValue *)opaque = ret;
+    return JS_VALUE_GET_PTR(ret);
+}
+
+static void tree_shake_atom(JSContext *ctx, JSAtom atom, void *opaque)
+{
+    const char *str = JS_AtomToCString(ctx, atom);
+    assert(str);
+    if (!strcmp(str, "Proxy"))
+        *(int *)opaque |= 1;
+    if (!strcmp(str, "Promise"))
+        *(int *)opaque |= 2;
+    JS_FreeCString(ctx, str);
+}
+
+static void tree_shake(void)
+{
+    static const char code[] = "import {f} from 'c'; globalThis.r = f(41);";
+    JSValue c = JS_UNDEFINED;
+    size_t len, len2;
+    uint8_t *buf;
+    int found;
+
+    JSRuntime *rt = JS_NewRuntime();
+    JS_SetModuleLoaderFunc(rt, NULL, tree_shake_loader, &c);
+    JSContext *ctx = JS_NewContext(rt);
+    JSValue mod = JS_Eval(ctx, code, strlen(code), "a",
+                          JS_EVAL_TYPE_MODULE|JS_EVAL_FLAG_COMPILE_ONLY);
+    assert(!JS_IsException(mod));
+    assert(JS_IsModule(c));
+    buf = JS_WriteObject(ctx, &len, c, JS_WRITE_OBJ_BYTECODE);
+    assert(buf);
+    js_free(ctx, buf);
+    found = 0;
+    assert(JS_EnumBytecodeAtoms(ctx, c, tree_shake_atom, &found) == 0);
+    assert(found == 3);
+    // 'g' is not imported and 'h' is only used by 'g'
+    JSValueConst roots[] = { mod };
+    assert(JS_TreeShake(ctx, roots, 1) == 2);
+    buf = JS_WriteObject(ctx, &len2, c, JS_WRITE_OBJ_BYTECODE);
+    assert(buf);
+    js_free(ctx, buf);
+    assert(len2 < len);
+    found = 0;
+    assert(JS_EnumBytecodeAtoms(ctx, c, tree_shake_atom, &found) == 0);
+    assert(found == 2);
+    JS_FreeValue(ctx, c);
+    JSValue ret = JS_EvalFunction(ctx, mod);
+    assert(!JS_IsException(ret));
+    JS_FreeValue(ctx, ret);
+    JSValue global = JS_GetGlobalObject(ctx);
+    JSValue r = JS_GetPropertyStr(ctx, global, "r");
+    assert(JS_VALUE_GET_TAG(r) == JS_TAG_INT);
+    assert(JS_VALUE_GET_INT(r) == 42);
+    JS_FreeValue(ctx, global);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
 int main(void)
 {
     cfunctions();
@@ -867,6 +1599,7 @@ int main(void)
     raw_context_global_var();
     is_array();
     module_serde();
+    rom_bytecode();
     runtime_cstring_free();
     utf16_string();
     weak_map_gc_check();
@@ -875,5 +1608,19 @@ int main(void)
     new_errors();
     global_object_prototype();
     slice_string_tocstring();
+    compact_string_slices();
+    gc_step();
+    gc_candidate_roots();
+    slab_allocator();
+    arena_runtime();
+    gc_adaptive();
+    heap_snapshot();
+    alloc_profile();
+    lazy_compile();
+    shared_source();
+    clone_context();
+    eval_opt_level();
+    native_code();
+    tree_shake();
     return 0;
 }
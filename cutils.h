@@ -241,6 +241,30 @@ static inline int ctz64(uint64_t a)
 #endif
 }
 
+/* 64x64 -> 128 bit multiplication. Return the low 64 bits and store the
+   high 64 bits in *phi */
+static inline uint64_t mul_u64(uint64_t *phi, uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 r = (unsigned __int128)a * b;
+    *phi = (uint64_t)(r >> 64);
+    return (uint64_t)r;
+#else
+    uint64_t a0, a1, b0, b1, p00, p01, p10, p11, mid;
+    a0 = (uint32_t)a;
+    a1 = a >> 32;
+    b0 = (uint32_t)b;
+    b1 = b >> 32;
+    p00 = a0 * b0;
+    p01 = a0 * b1;
+    p10 = a1 * b0;
+    p11 = a1 * b1;
+    mid = (p00 >> 32) + (uint32_t)p01 + (uint32_t)p10;
+    *phi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+    return (mid << 32) | (uint32_t)p00;
+#endif
+}
+
 static inline uint64_t get_u64(const uint8_t *tab)
 {
     uint64_t v;
@@ -76,7 +76,8 @@ static JSValue load_standalone_module(JSContext *ctx)
 {
     JSModuleDef *m;
     JSValue obj, val;
-    obj = JS_ReadObject(ctx, qjsc_standalone, qjsc_standalone_size, JS_READ_OBJ_BYTECODE);
+    obj = JS_ReadObject(ctx, qjsc_standalone, qjsc_standalone_size,
+                        JS_READ_OBJ_BYTECODE | JS_READ_OBJ_ROM_DATA);
     if (JS_IsException(obj))
         goto exception;
     assert(JS_VALUE_GET_TAG(obj) == JS_TAG_MODULE);
@@ -104,10 +105,74 @@ static JSValue load_standalone_module(JSContext *ctx)
     return JS_GetModuleNamespace(ctx, m);
 }
 
+/* the bundled bytecode is executed in place from the mapped executable,
+   so that its pages are shared by all the running instances */
+static JSValue run_standalone(JSContext *ctx, const char *exe)
+{
+    const uint8_t *buf, *p;
+    size_t buf_len;
+    uint32_t offset;
+    JSValue obj;
+
+    buf = js_map_file(&buf_len, exe);
+    if (!buf)
+        return JS_ThrowReferenceError(ctx, "failed to open executable: %s", exe);
+    if (buf_len < trailer_size)
+        goto corrupted;
+    p = buf + buf_len - trailer_size + trailer_magic_size;
+    offset = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    if (offset > buf_len - trailer_size) {
+    corrupted:
+        return JS_ThrowSyntaxError(ctx, "corrupted binary");
+    }
+    obj = JS_ReadObject(ctx, buf + offset, buf_len - trailer_size - offset,
+                        JS_READ_OBJ_BYTECODE | JS_READ_OBJ_REFERENCE |
+                        JS_READ_OBJ_ROM_DATA);
+    if (JS_IsException(obj))
+        return obj;
+    if (JS_VALUE_GET_TAG(obj) != JS_TAG_MODULE) {
+        JS_FreeValue(ctx, obj);
+        goto corrupted;
+    }
+    if (JS_ResolveModule(ctx, obj) < 0 ||
+        js_module_set_import_meta(ctx, obj, false, false) < 0) {
+        JS_FreeValue(ctx, obj);
+        return JS_EXCEPTION;
+    }
+    return JS_EvalFunction(ctx, obj);
+}
+
+/* run the compiled main module 'val' */
+static int eval_module(JSContext *ctx, JSValue val, const char *filename)
+{
+    bool use_realpath;
+    int ret;
+
+    if (!JS_IsException(val)) {
+        // ex. "<cmdline>" pr "/dev/stdin"
+        use_realpath =
+            !(*filename == '<' || !strncmp(filename, "/dev/", 5));
+        if (js_module_set_import_meta(ctx, val, use_realpath, true) < 0) {
+            js_std_dump_error(ctx);
+            JS_FreeValue(ctx, val);
+            return -1;
+        }
+        val = JS_EvalFunction(ctx, val);
+    }
+    val = js_std_await(ctx, val);
+    if (JS_IsException(val)) {
+        js_std_dump_error(ctx);
+        ret = -1;
+    } else {
+        ret = 0;
+    }
+    JS_FreeValue(ctx, val);
+    return ret;
+}
+
 static int eval_buf(JSContext *ctx, const void *buf, int buf_len,
                     const char *filename, int eval_flags)
 {
-    bool use_realpath;
     JSValue val;
     int ret;
 
@@ -116,37 +181,26 @@ static int eval_buf(JSContext *ctx, const void *buf, int buf_len,
            import.meta */
         val = JS_Eval(ctx, buf, buf_len, filename,
                       eval_flags | JS_EVAL_FLAG_COMPILE_ONLY);
-        if (!JS_IsException(val)) {
-            // ex. "<cmdline>" pr "/dev/stdin"
-            use_realpath =
-                !(*filename == '<' || !strncmp(filename, "/dev/", 5));
-            if (js_module_set_import_meta(ctx, val, use_realpath, true) < 0) {
-                js_std_dump_error(ctx);
-                ret = -1;
-                goto end;
-            }
-            val = JS_EvalFunction(ctx, val);
-        }
-        val = js_std_await(ctx, val);
-    } else {
-        val = JS_Eval(ctx, buf, buf_len, filename, eval_flags);
+        return eval_module(ctx, val, filename);
     }
+    val = JS_Eval(ctx, buf, buf_len, filename, eval_flags);
     if (JS_IsException(val)) {
         js_std_dump_error(ctx);
         ret = -1;
     } else {
         ret = 0;
     }
-end:
     JS_FreeValue(ctx, val);
     return ret;
 }
 
-static int eval_file(JSContext *ctx, const char *filename, int module)
+static int eval_file(JSContext *ctx, const char *filename, int module,
+                     int module_threads)
 {
     uint8_t *buf;
     int ret, eval_flags;
     size_t buf_len;
+    JSValue val;
 
     buf = js_load_file(ctx, &buf_len, filename);
     if (!buf) {
@@ -162,6 +216,23 @@ static int eval_file(JSContext *ctx, const char *filename, int module)
         eval_flags = JS_EVAL_TYPE_MODULE;
     else
         eval_flags = JS_EVAL_TYPE_GLOBAL;
+    /* only an optimization: on failure the modules are loaded on demand */
+    if (module && module_threads > 0) {
+        if (js_std_preload_modules(ctx, filename, module_threads) < 0) {
+            JS_FreeValue(ctx, JS_GetException(ctx));
+        } else {
+            /* the entry module was compiled with the others */
+            val = js_std_load_preloaded_module(ctx, filename);
+            if (!JS_IsUndefined(val)) {
+                js_free(ctx, buf);
+                if (JS_ResolveModule(ctx, val) < 0) {
+                    JS_FreeValue(ctx, val);
+                    val = JS_EXCEPTION;
+                }
+                return eval_module(ctx, val, filename);
+            }
+        }
+    }
     ret = eval_buf(ctx, buf, buf_len, filename, eval_flags);
     js_free(ctx, buf);
     return ret;
@@ -391,6 +462,12 @@ void help(void)
            "    --exe          select the executable to use as the base, defaults to the current one\n"
            "    --memory-limit n       limit the memory usage to 'n' Kbytes\n"
            "    --stack-size n         limit the stack size to 'n' Kbytes\n"
+           "    --heap-snapshot FILE   write a heap snapshot to FILE at exit\n"
+           "    --alloc-profile FILE   write a sampling allocation profile to FILE at exit\n"
+           "    --lazy-compile         compile the inner functions when first called\n"
+           "    --shared-source        share one copy of the script source between its functions\n"
+           "    --module-cache DIR     cache the bytecode of the imported modules in DIR\n"
+           "    --module-threads n     compile the imported modules on 'n' threads\n"
            "-q  --quit         just instantiate the interpreter and quit\n", JS_GetVersion());
     exit(1);
 }
@@ -410,6 +487,8 @@ int main(int argc, char **argv)
     char *expr = NULL;
     char *dump_flags_str = NULL;
     char *out = NULL;
+    char *heap_snapshot = NULL;
+    char *alloc_profile = NULL;
     int standalone = 0;
     int interactive = 0;
     int dump_memory = 0;
@@ -418,6 +497,9 @@ int main(int argc, char **argv)
     int empty_run = 0;
     int module = -1;
     int load_std = 0;
+    int lazy_compile = 0;
+    int shared_source = 0;
+    int module_threads = 0;
     char *include_list[32];
     int i, include_count = 0;
     int64_t memory_limit = -1;
@@ -519,6 +601,14 @@ int main(int argc, char **argv)
                 load_std = 1;
                 continue;
             }
+            if (!strcmp(longopt, "lazy-compile")) {
+                lazy_compile = 1;
+                continue;
+            }
+            if (!strcmp(longopt, "shared-source")) {
+                shared_source = 1;
+                continue;
+            }
             if (opt == 'q' || !strcmp(longopt, "quit")) {
                 empty_run++;
                 continue;
@@ -545,6 +635,50 @@ int main(int argc, char **argv)
                 stack_size = parse_limit(optarg);
                 break;
             }
+            if (!strcmp(longopt, "heap-snapshot")) {
+                if (!optarg) {
+                    if (optind >= argc) {
+                        fprintf(stderr, "qjs: missing file for --heap-snapshot\n");
+                        exit(1);
+                    }
+                    optarg = argv[optind++];
+                }
+                heap_snapshot = optarg;
+                break;
+            }
+            if (!strcmp(longopt, "module-cache")) {
+                if (!optarg) {
+                    if (optind >= argc) {
+                        fprintf(stderr, "qjs: missing directory for --module-cache\n");
+                        exit(1);
+                    }
+                    optarg = argv[optind++];
+                }
+                js_std_set_module_cache_dir(optarg);
+                break;
+            }
+            if (!strcmp(longopt, "module-threads")) {
+                if (!optarg) {
+                    if (optind >= argc) {
+                        fprintf(stderr, "qjs: missing count for --module-threads\n");
+                        exit(1);
+                    }
+                    optarg = argv[optind++];
+                }
+                module_threads = atoi(optarg);
+                break;
+            }
+            if (!strcmp(longopt, "alloc-profile")) {
+                if (!optarg) {
+                    if (optind >= argc) {
+                        fprintf(stderr, "qjs: missing file for --alloc-profile\n");
+                        exit(1);
+                    }
+                    optarg = argv[optind++];
+                }
+                alloc_profile = optarg;
+                break;
+            }
             if (opt == 'c' || !strcmp(longopt, "compile")) {
                 if (!optarg) {
                     if (optind >= argc) {
@@ -612,6 +746,12 @@ start:
         JS_SetMaxStackSize(rt, (size_t)stack_size);
     if (dump_flags != 0)
         JS_SetDumpFlags(rt, dump_flags);
+    if (alloc_profile)
+        JS_StartAllocationSampling(rt, 32 * 1024, 64);
+    if (lazy_compile)
+        JS_SetLazyCompilation(rt, true);
+    if (shared_source)
+        JS_SetSharedFunctionSource(rt, true);
     js_std_set_worker_new_context_func(JS_NewCustomContext);
     js_std_init_handlers(rt);
     ctx = JS_NewCustomContext(rt);
@@ -642,20 +782,12 @@ start:
         }
 
         for(i = 0; i < include_count; i++) {
-            if (eval_file(ctx, include_list[i], 0))
+            if (eval_file(ctx, include_list[i], 0, 0))
                 goto fail;
         }
 
         if (standalone) {
-            JSValue ns = load_standalone_module(ctx);
-            if (JS_IsException(ns))
-                goto fail;
-            JSValue func = JS_GetPropertyStr(ctx, ns, "runStandalone");
-            JS_FreeValue(ctx, ns);
-            if (JS_IsException(func))
-                goto fail;
-            ret = JS_Call(ctx, func, JS_UNDEFINED, 0, NULL);
-            JS_FreeValue(ctx, func);
+            ret = run_standalone(ctx, exebuf);
         } else if (compile_file) {
             JSValue ns = load_standalone_module(ctx);
             if (JS_IsException(ns))
@@ -683,7 +815,7 @@ start:
         } else {
             const char *filename;
             filename = argv[optind];
-            if (eval_file(ctx, filename, module))
+            if (eval_file(ctx, filename, module, module_threads))
                 goto fail;
         }
         if (interactive) {
@@ -711,6 +843,25 @@ start:
         JS_ComputeMemoryUsage(rt, &stats);
         JS_DumpMemoryUsage(stdout, &stats, rt);
     }
+    if (heap_snapshot) {
+        FILE *f = fopen(heap_snapshot, "w");
+        if (!f || JS_WriteHeapSnapshot(rt, f) < 0) {
+            fprintf(stderr, "qjs: could not write %s\n", heap_snapshot);
+            r = 1;
+        }
+        if (f)
+            fclose(f);
+    }
+    if (alloc_profile) {
+        FILE *f = fopen(alloc_profile, "w");
+        JS_StopAllocationSampling(rt);
+        if (!f || JS_WriteAllocationProfile(rt, f) < 0) {
+            fprintf(stderr, "qjs: could not write %s\n", alloc_profile);
+            r = 1;
+        }
+        if (f)
+            fclose(f);
+    }
     js_std_free_handlers(rt);
     JS_FreeContext(ctx);
     JS_FreeRuntime(rt);
@@ -739,7 +890,7 @@ start:
                best[1] + best[2] + best[3] + best[4],
                best[1], best[2], best[3], best[4]);
     }
-    return 0;
+    return r;
  fail:
     js_std_free_handlers(rt);
     JS_FreeContext(ctx);
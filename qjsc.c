@@ -59,6 +59,18 @@ static OutputTypeEnum output_type;
 static FILE *outfile;
 static const char *c_ident_prefix = "qjsc_";
 static int strip;
+static bool aot;
+static bool tree_shake;
+
+/* objects whose output is delayed until the whole program is compiled */
+typedef struct {
+    JSValue obj;
+    char *c_name;
+    bool is_root;
+} object_entry_t;
+
+static object_entry_t *object_list;
+static int object_count;
 
 void namelist_add(namelist_t *lp, const char *name, const char *short_name,
                   int flags)
@@ -151,9 +163,8 @@ static void dump_hex(FILE *f, const uint8_t *buf, size_t len)
         fprintf(f, "\n");
 }
 
-static void output_object_code(JSContext *ctx,
-                               FILE *fo, JSValue obj, const char *c_name,
-                               bool load_only)
+static void write_object_code(JSContext *ctx,
+                              FILE *fo, JSValueConst obj, const char *c_name)
 {
     uint8_t *out_buf;
     size_t out_buf_len;
@@ -171,8 +182,6 @@ static void output_object_code(JSContext *ctx,
         exit(1);
     }
 
-    namelist_add(&cname_list, c_name, NULL, load_only);
-
     if (output_type == OUTPUT_RAW) {
         fwrite(out_buf, 1, out_buf_len, fo);
     } else {
@@ -185,6 +194,152 @@ static void output_object_code(JSContext *ctx,
     }
 
     js_free(ctx, out_buf);
+
+    if (aot) {
+        char *native_buf;
+        size_t native_len;
+
+        native_buf = JS_WriteNativeCode(ctx, &native_len, obj, c_name);
+        if (!native_buf) {
+            js_std_dump_error(ctx);
+            exit(1);
+        }
+        fwrite(native_buf, 1, native_len, fo);
+        js_free(ctx, native_buf);
+    }
+}
+
+static void output_object_code(JSContext *ctx,
+                               FILE *fo, JSValueConst obj, const char *c_name,
+                               bool load_only)
+{
+    object_entry_t *e;
+
+    namelist_add(&cname_list, c_name, NULL, load_only);
+    if (!tree_shake) {
+        write_object_code(ctx, fo, obj, c_name);
+        return;
+    }
+    e = realloc(object_list, sizeof(object_list[0]) * (object_count + 1));
+    if (!e) {
+        fprintf(stderr, "qjsc: out of memory\n");
+        exit(1);
+    }
+    object_list = e;
+    e = &object_list[object_count++];
+    e->obj = JS_DupValue(ctx, obj);
+    e->c_name = strdup(c_name);
+    e->is_root = !load_only;
+}
+
+/* intrinsic objects added to the context when one of 'names' is
+   referenced by the program */
+static const struct {
+    const char *func;
+    const char *names;
+} intrinsic_list[] = {
+    { "JS_AddIntrinsicDate", "Date" },
+    { "JS_AddIntrinsicEval", "eval Function constructor evalScript Worker" },
+    { "JS_AddIntrinsicRegExp", "RegExp match matchAll search" },
+    { "JS_AddIntrinsicJSON", "JSON" },
+    { "JS_AddIntrinsicProxy", "Proxy" },
+    { "JS_AddIntrinsicMapSet", "Map Set WeakMap WeakSet" },
+    { "JS_AddIntrinsicTypedArrays", "ArrayBuffer SharedArrayBuffer DataView "
+      "Atomics Int8Array Uint8Array Uint8ClampedArray Int16Array "
+      "Uint16Array Int32Array Uint32Array BigInt64Array BigUint64Array "
+      "Float16Array Float32Array Float64Array" },
+    { "JS_AddIntrinsicPromise", "Promise fromAsync" },
+    { "JS_AddIntrinsicBigInt", "BigInt BigInt64Array BigUint64Array" },
+    { "JS_AddIntrinsicWeakRef", "WeakRef FinalizationRegistry" },
+    { "JS_AddIntrinsicDOMException", "DOMException" },
+    { "JS_AddPerformance", "performance" },
+};
+
+static uint32_t used_intrinsics;
+
+static void mark_intrinsic(const char *name)
+{
+    const char *p;
+    size_t len, i;
+
+    len = strlen(name);
+    if (len == 0)
+        return;
+    for(i = 0; i < countof(intrinsic_list); i++) {
+        for(p = intrinsic_list[i].names; (p = strstr(p, name)); p += len) {
+            if ((p == intrinsic_list[i].names || p[-1] == ' ') &&
+                (p[len] == ' ' || p[len] == '\0')) {
+                used_intrinsics |= 1 << i;
+                break;
+            }
+        }
+    }
+}
+
+static void mark_intrinsic_atom(JSContext *ctx, JSAtom atom, void *opaque)
+{
+    const char *str;
+
+    str = JS_AtomToCString(ctx, atom);
+    if (!str)
+        return;
+    mark_intrinsic(str);
+    JS_FreeCString(ctx, str);
+}
+
+/* remove the unused code of the delayed objects, find the intrinsic
+   objects they use and output them */
+static void output_tree_shaken_objects(JSContext *ctx, FILE *fo)
+{
+    JSValueConst *roots;
+    int i, n, removed;
+
+    roots = malloc(sizeof(roots[0]) * (object_count + 1));
+    if (!roots) {
+        fprintf(stderr, "qjsc: out of memory\n");
+        exit(1);
+    }
+    n = 0;
+    for(i = 0; i < object_count; i++) {
+        if (object_list[i].is_root)
+            roots[n++] = object_list[i].obj;
+    }
+    removed = JS_TreeShake(ctx, roots, n);
+    free(roots);
+    if (removed < 0) {
+        js_std_dump_error(ctx);
+        exit(1);
+    }
+    /* the C modules use typed arrays and promises */
+    if (init_module_list.count > 0) {
+        mark_intrinsic("ArrayBuffer");
+        mark_intrinsic("Promise");
+    }
+    for(i = 0; i < object_count; i++) {
+        object_entry_t *e = &object_list[i];
+        if (JS_EnumBytecodeAtoms(ctx, e->obj, mark_intrinsic_atom, NULL) < 0) {
+            js_std_dump_error(ctx);
+            exit(1);
+        }
+        write_object_code(ctx, fo, e->obj, e->c_name);
+        JS_FreeValue(ctx, e->obj);
+        free(e->c_name);
+    }
+    free(object_list);
+    object_list = NULL;
+    object_count = 0;
+}
+
+static void output_eval_binary(FILE *fo, const char *c_name, int load_only)
+{
+    if (aot) {
+        fprintf(fo, "  js_std_eval_binary_native(ctx, %s, %s_size, %d,\n"
+                "                            %s_native, %s_native_count);\n",
+                c_name, c_name, load_only, c_name, c_name);
+    } else {
+        fprintf(fo, "  js_std_eval_binary(ctx, %s, %s_size, %d);\n",
+                c_name, c_name, load_only);
+    }
 }
 
 static int js_module_dummy_init(JSContext *ctx, JSModuleDef *m)
@@ -337,6 +492,7 @@ void help(void)
            "usage: " PROG_NAME " [options] [files]\n"
            "\n"
            "options are:\n"
+           "-a          also translate the functions to C (ahead-of-time compilation)\n"
            "-b          output raw bytecode instead of C code\n"
            "-e          output main() and bytecode in a C file\n"
            "-o output   set the output filename\n"
@@ -349,6 +505,8 @@ void help(void)
            "-p prefix   set the prefix of the generated C names\n"
            "-P          do not add default system modules\n"
            "-s          strip the source code, specify twice to also strip debug info\n"
+           "-t          remove the unused module exports and functions and, with -e,\n"
+           "            the unused intrinsic objects (tree shaking)\n"
            "-S n        set the maximum stack size to 'n' bytes (default=%d)\n",
            JS_GetVersion(),
            JS_DEFAULT_STACK_SIZE);
@@ -446,6 +604,14 @@ int main(int argc, char **argv)
                 help();
                 continue;
             }
+            if (opt == 'a') {
+                aot = true;
+                continue;
+            }
+            if (opt == 't') {
+                tree_shake = true;
+                continue;
+            }
             if (opt == 'b') {
                 output_type = OUTPUT_RAW;
                 continue;
@@ -554,6 +720,11 @@ int main(int argc, char **argv)
     if (optind >= argc)
         help();
 
+    if (aot && output_type == OUTPUT_RAW) {
+        fprintf(stderr, "qjsc: -a cannot be used with -b\n");
+        exit(1);
+    }
+
     if (!out_filename)
         out_filename = "out.c";
 
@@ -586,6 +757,10 @@ int main(int argc, char **argv)
         fprintf(fo, "#include \"quickjs-libc.h\"\n"
                 "\n"
                 );
+    } else if (aot) {
+        fprintf(fo, "#include \"quickjs.h\"\n"
+                "\n"
+                );
     } else if (output_type == OUTPUT_C) {
         fprintf(fo, "#include <inttypes.h>\n"
                 "\n"
@@ -599,20 +774,45 @@ int main(int argc, char **argv)
     }
 
     for(i = 0; i < dynamic_module_list.count; i++) {
-        if (!jsc_module_loader(ctx, dynamic_module_list.array[i].name, NULL)) {
+        JSModuleDef *m;
+        int j;
+
+        m = jsc_module_loader(ctx, dynamic_module_list.array[i].name, NULL);
+        if (!m) {
             fprintf(stderr, "Could not load dynamic module '%s'\n",
                     dynamic_module_list.array[i].name);
             exit(1);
         }
+        /* the exports of the dynamic modules are all used */
+        for(j = 0; j < object_count; j++) {
+            if (JS_VALUE_GET_PTR(object_list[j].obj) == m)
+                object_list[j].is_root = true;
+        }
     }
 
+    if (tree_shake)
+        output_tree_shaken_objects(ctx, fo);
+
     if (output_type == OUTPUT_C_MAIN) {
         fprintf(fo,
                 "static JSContext *JS_NewCustomContext(JSRuntime *rt)\n"
-                "{\n"
-                "  JSContext *ctx = JS_NewContext(rt);\n"
-                "  if (!ctx)\n"
-                "    return NULL;\n");
+                "{\n");
+        if (tree_shake) {
+            fprintf(fo,
+                    "  JSContext *ctx = JS_NewContextRaw(rt);\n"
+                    "  if (!ctx)\n"
+                    "    return NULL;\n"
+                    "  JS_AddIntrinsicBaseObjects(ctx);\n");
+            for(i = 0; i < countof(intrinsic_list); i++) {
+                if (used_intrinsics & (1 << i))
+                    fprintf(fo, "  %s(ctx);\n", intrinsic_list[i].func);
+            }
+        } else {
+            fprintf(fo,
+                    "  JSContext *ctx = JS_NewContext(rt);\n"
+                    "  if (!ctx)\n"
+                    "    return NULL;\n");
+        }
         /* add the precompiled modules (XXX: could modify the module
            loader instead) */
         for(i = 0; i < init_module_list.count; i++) {
@@ -629,8 +829,7 @@ int main(int argc, char **argv)
         for(i = 0; i < cname_list.count; i++) {
             namelist_entry_t *e = &cname_list.array[i];
             if (e->flags) {
-                fprintf(fo, "  js_std_eval_binary(ctx, %s, %s_size, 1);\n",
-                        e->name, e->name);
+                output_eval_binary(fo, e->name, 1);
             }
         }
         fprintf(fo,
@@ -654,8 +853,7 @@ int main(int argc, char **argv)
         for(i = 0; i < cname_list.count; i++) {
             namelist_entry_t *e = &cname_list.array[i];
             if (!e->flags) {
-                fprintf(fo, "  js_std_eval_binary(ctx, %s, %s_size, 0);\n",
-                        e->name, e->name);
+                output_eval_binary(fo, e->name, 0);
             }
         }
         fputs(main_c_template2, fo);
@@ -61,6 +61,7 @@
 #if !defined(__wasi__)
 #include <dlfcn.h>
 #include <termios.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
 #include <sys/wait.h>
 #include <grp.h>
@@ -197,6 +198,7 @@ typedef struct JSThreadState {
 #endif // USE_WORKER
     JSClassID std_file_class_id;
     JSClassID worker_class_id;
+    struct JSPreloadState *preload; /* see js_std_preload_modules() */
 } JSThreadState;
 
 static uint64_t os_pending_signals;
@@ -487,6 +489,33 @@ uint8_t *js_load_file(JSContext *ctx, size_t *pbuf_len, const char *filename)
     return buf;
 }
 
+/* map a file read-only: its pages are shared with the other processes
+   mapping it. The mapping is never released. */
+const uint8_t *js_map_file(size_t *pbuf_len, const char *filename)
+{
+#if defined(_WIN32) || defined(__wasi__)
+    return js_load_file(NULL, pbuf_len, filename);
+#else
+    struct stat st;
+    void *p;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return NULL;
+    *pbuf_len = st.st_size;
+    return p;
+#endif
+}
+
 /* load and evaluate a file */
 static JSValue js_loadScript(JSContext *ctx, JSValueConst this_val,
                              int argc, JSValueConst *argv)
@@ -788,6 +817,484 @@ int js_module_set_import_meta(JSContext *ctx, JSValueConst func_val,
     return 0;
 }
 
+/* bytecode cache of the modules loaded by js_module_loader(), disabled
+   if NULL */
+static const char *js_module_cache_dir;
+
+#define JS_MODULE_CACHE_MAGIC "QJMC"
+
+typedef struct JSModuleCacheHeader {
+    char magic[4];
+    uint32_t name_len; /* followed by the module name */
+    uint64_t source_len;
+    uint64_t source_hash;
+    uint64_t data_hash; /* of the bytecode, which follows the name */
+    char version[32]; /* JS_GetVersion() of the writer */
+} JSModuleCacheHeader;
+
+void js_std_set_module_cache_dir(const char *dir)
+{
+    js_module_cache_dir = dir;
+}
+
+#define JS_MODULE_CACHE_HASH_INIT 0xcbf29ce484222325
+
+/* FNV-1a */
+static uint64_t js_module_cache_hash(uint64_t h, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3;
+    }
+    return h;
+}
+
+static void js_module_cache_init_header(JSModuleCacheHeader *h,
+                                        const char *module_name,
+                                        const uint8_t *source,
+                                        size_t source_len)
+{
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, JS_MODULE_CACHE_MAGIC, sizeof(h->magic));
+    h->name_len = strlen(module_name);
+    h->source_len = source_len;
+    h->source_hash = js_module_cache_hash(JS_MODULE_CACHE_HASH_INIT,
+                                          source, source_len);
+    js__pstrcpy(h->version, sizeof(h->version), JS_GetVersion());
+}
+
+/* The module name is stored in the bytecode, so it is part of the key.
+   The absolute path is added when available so that modules with the
+   same relative name in different directories do not share an entry. */
+static void js_module_cache_get_path(char *cache_path, size_t cache_path_size,
+                                     const char *module_name)
+{
+    uint64_t h = JS_MODULE_CACHE_HASH_INIT;
+#if !defined(_WIN32) && !defined(__wasi__)
+    char buf[JS__PATH_MAX];
+    if (realpath(module_name, buf))
+        h = js_module_cache_hash(h, buf, strlen(buf) + 1);
+#endif
+    h = js_module_cache_hash(h, module_name, strlen(module_name));
+    snprintf(cache_path, cache_path_size, "%s/%016" PRIx64 ".qjbc",
+             js_module_cache_dir, h);
+}
+
+/* return JS_UNDEFINED if there is no valid cache entry for the module */
+static JSValue js_module_cache_load(JSContext *ctx, const char *module_name,
+                                    const uint8_t *source, size_t source_len)
+{
+    char cache_path[JS__PATH_MAX + 32];
+    JSModuleCacheHeader h, h1;
+    uint8_t *buf;
+    size_t buf_len, hdr_len;
+    JSValue obj;
+
+    js_module_cache_get_path(cache_path, sizeof(cache_path), module_name);
+    buf = js_load_file(ctx, &buf_len, cache_path);
+    if (!buf)
+        return JS_UNDEFINED;
+    js_module_cache_init_header(&h, module_name, source, source_len);
+    hdr_len = sizeof(h) + h.name_len;
+    if (buf_len < hdr_len)
+        goto invalid;
+    memcpy(&h1, buf, sizeof(h1));
+    h.data_hash = h1.data_hash;
+    if (memcmp(&h, &h1, sizeof(h)) ||
+        memcmp(buf + sizeof(h), module_name, h.name_len))
+        goto invalid;
+    /* a truncated or corrupted entry must not reach JS_ReadObject() */
+    if (js_module_cache_hash(JS_MODULE_CACHE_HASH_INIT, buf + hdr_len,
+                             buf_len - hdr_len) != h.data_hash)
+        goto invalid;
+    obj = JS_ReadObject(ctx, buf + hdr_len, buf_len - hdr_len,
+                        JS_READ_OBJ_BYTECODE);
+    js_free(ctx, buf);
+    if (JS_IsException(obj)) {
+        /* e.g. written by an incompatible build: recompile */
+        JS_FreeValue(ctx, JS_GetException(ctx));
+        return JS_UNDEFINED;
+    }
+    if (JS_VALUE_GET_TAG(obj) != JS_TAG_MODULE) {
+        JS_FreeValue(ctx, obj);
+        return JS_UNDEFINED;
+    }
+    return obj;
+ invalid:
+    js_free(ctx, buf);
+    return JS_UNDEFINED;
+}
+
+/* errors are ignored: the module is compiled again next time */
+static void js_module_cache_store(JSContext *ctx, const char *module_name,
+                                  const uint8_t *source, size_t source_len,
+                                  JSValueConst func_val)
+{
+    char cache_path[JS__PATH_MAX + 32], tmp_path[JS__PATH_MAX + 64];
+    JSModuleCacheHeader h;
+    uint8_t *data;
+    size_t data_len;
+    FILE *f;
+    bool ok;
+
+    data = JS_WriteObject(ctx, &data_len, func_val, JS_WRITE_OBJ_BYTECODE);
+    if (!data) {
+        JS_FreeValue(ctx, JS_GetException(ctx));
+        return;
+    }
+    js_module_cache_get_path(cache_path, sizeof(cache_path), module_name);
+    js_module_cache_init_header(&h, module_name, source, source_len);
+    h.data_hash = js_module_cache_hash(JS_MODULE_CACHE_HASH_INIT,
+                                       data, data_len);
+    /* write to a temporary file first so that concurrent processes
+       never read a partial entry */
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", cache_path,
+             (int)getpid());
+    f = fopen(tmp_path, "wb");
+    if (f) {
+        ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+            fwrite(module_name, 1, h.name_len, f) == h.name_len &&
+            fwrite(data, 1, data_len, f) == data_len;
+        if (fclose(f) != 0)
+            ok = false;
+        if (!ok || rename(tmp_path, cache_path) != 0)
+            remove(tmp_path);
+    }
+    js_free(ctx, data);
+}
+
+/* Parallel preloading of a module graph: worker threads, each with its
+   own runtime, read and compile the modules reachable through static
+   imports and keep their JS_WriteObject() output. js_module_loader()
+   then only has to deserialize them. */
+
+typedef struct JSPreloadModule {
+    char *name; /* normalized module name */
+    uint8_t *data; /* bytecode, NULL if the module could not be compiled */
+    size_t data_len;
+} JSPreloadModule;
+
+typedef struct JSPreloadState {
+#if JS_HAVE_THREADS
+    js_mutex_t mutex;
+    js_cond_t cond;
+#endif
+    JSPreloadModule *tab;
+    int count;
+    int size;
+    int *hash_tab; /* indexes in 'tab', -1 for an empty slot */
+    int hash_size; /* power of two, at least twice 'count' */
+    int next; /* index of the next module to compile */
+    int busy; /* number of modules being compiled */
+} JSPreloadState;
+
+typedef struct JSPreloadWorker {
+    JSPreloadState *ps;
+    char **imports; /* normalized names imported by the last module */
+    int imports_count;
+    int imports_size;
+} JSPreloadWorker;
+
+static uint32_t js_preload_hash(const char *name)
+{
+    return js_module_cache_hash(JS_MODULE_CACHE_HASH_INIT, name, strlen(name));
+}
+
+static int js_preload_find(JSPreloadState *ps, const char *name)
+{
+    uint32_t h;
+    int idx;
+
+    if (ps->hash_size == 0)
+        return -1;
+    h = js_preload_hash(name) & (ps->hash_size - 1);
+    while ((idx = ps->hash_tab[h]) >= 0) {
+        if (!strcmp(ps->tab[idx].name, name))
+            return idx;
+        h = (h + 1) & (ps->hash_size - 1);
+    }
+    return -1;
+}
+
+/* add 'name' if not already present. Return -1 if out of memory. */
+static int js_preload_add(JSPreloadState *ps, const char *name)
+{
+    JSPreloadModule *e, *new_tab;
+    int i, *new_hash_tab, new_hash_size, new_size;
+    uint32_t h;
+
+    if (js_preload_find(ps, name) >= 0)
+        return 0;
+    if (ps->count >= ps->size) {
+        new_size = max_int(16, ps->size * 3 / 2);
+        new_tab = realloc(ps->tab, sizeof(ps->tab[0]) * new_size);
+        if (!new_tab)
+            return -1;
+        ps->tab = new_tab;
+        ps->size = new_size;
+    }
+    if (2 * (ps->count + 1) > ps->hash_size) {
+        new_hash_size = max_int(32, ps->hash_size * 2);
+        new_hash_tab = malloc(sizeof(ps->hash_tab[0]) * new_hash_size);
+        if (!new_hash_tab)
+            return -1;
+        for (i = 0; i < new_hash_size; i++)
+            new_hash_tab[i] = -1;
+        for (i = 0; i < ps->count; i++) {
+            h = js_preload_hash(ps->tab[i].name) & (new_hash_size - 1);
+            while (new_hash_tab[h] >= 0)
+                h = (h + 1) & (new_hash_size - 1);
+            new_hash_tab[h] = i;
+        }
+        free(ps->hash_tab);
+        ps->hash_tab = new_hash_tab;
+        ps->hash_size = new_hash_size;
+    }
+    e = &ps->tab[ps->count];
+    e->name = strdup(name);
+    if (!e->name)
+        return -1;
+    e->data = NULL;
+    e->data_len = 0;
+    h = js_preload_hash(name) & (ps->hash_size - 1);
+    while (ps->hash_tab[h] >= 0)
+        h = (h + 1) & (ps->hash_size - 1);
+    ps->hash_tab[h] = ps->count++;
+    return 0;
+}
+
+static void js_preload_free(JSPreloadState *ps)
+{
+    int i;
+
+    if (!ps)
+        return;
+    for (i = 0; i < ps->count; i++) {
+        free(ps->tab[i].name);
+        free(ps->tab[i].data);
+    }
+    free(ps->tab);
+    free(ps->hash_tab);
+    free(ps);
+}
+
+static int js_preload_module_init(JSContext *ctx, JSModuleDef *m)
+{
+    return 0;
+}
+
+/* record the imports of the module being resolved and stop there: the
+   imported modules are compiled separately */
+static JSModuleDef *js_preload_loader(JSContext *ctx, const char *module_name,
+                                      void *opaque)
+{
+    JSPreloadWorker *w = opaque;
+    char **new_imports;
+    int new_size;
+
+    if (!js__has_suffix(module_name, QJS_NATIVE_MODULE_SUFFIX)) {
+        if (w->imports_count >= w->imports_size) {
+            new_size = max_int(8, w->imports_size * 2);
+            new_imports = realloc(w->imports, sizeof(w->imports[0]) * new_size);
+            if (!new_imports)
+                goto oom;
+            w->imports = new_imports;
+            w->imports_size = new_size;
+        }
+        w->imports[w->imports_count] = strdup(module_name);
+        if (!w->imports[w->imports_count])
+            goto oom;
+        w->imports_count++;
+    }
+    return JS_NewCModule(ctx, module_name, js_preload_module_init);
+ oom:
+    JS_ThrowOutOfMemory(ctx);
+    return NULL;
+}
+
+/* compile a module. Return its bytecode in a malloc'ed buffer, or NULL
+   if it cannot be compiled in which case js_module_loader() reports the
+   error. */
+static uint8_t *js_preload_compile(JSContext *ctx, const char *module_name,
+                                   size_t *pdata_len)
+{
+    uint8_t *buf, *data, *data1;
+    size_t buf_len, data_len;
+    JSValue func_val;
+
+    *pdata_len = 0;
+    buf = js_load_file(ctx, &buf_len, module_name);
+    if (!buf)
+        return NULL;
+    func_val = JS_Eval(ctx, (char *)buf, buf_len, module_name,
+                       JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
+    js_free(ctx, buf);
+    if (JS_IsException(func_val))
+        goto fail;
+    data1 = NULL;
+    data_len = 0;
+    data = JS_WriteObject(ctx, &data_len, func_val, JS_WRITE_OBJ_BYTECODE);
+    if (data) {
+        data1 = malloc(data_len);
+        if (data1)
+            memcpy(data1, data, data_len);
+        js_free(ctx, data);
+    }
+    /* the static imports are collected by js_preload_loader() */
+    if (JS_ResolveModule(ctx, func_val) < 0)
+        JS_FreeValue(ctx, JS_GetException(ctx));
+    JS_FreeValue(ctx, func_val);
+    *pdata_len = data_len;
+    return data1;
+ fail:
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    return NULL;
+}
+
+static void js_preload_worker(void *opaque)
+{
+    JSPreloadWorker w_s, *w = &w_s;
+    JSPreloadState *ps = opaque;
+    JSRuntime *rt;
+    JSContext *ctx;
+    uint8_t *data;
+    size_t data_len;
+    char *name;
+    int i, idx;
+
+    memset(w, 0, sizeof(*w));
+    w->ps = ps;
+    rt = JS_NewRuntime();
+    if (!rt)
+        return;
+    ctx = JS_NewContext(rt);
+    if (!ctx) {
+        JS_FreeRuntime(rt);
+        return;
+    }
+    JS_SetModuleLoaderFunc(rt, NULL, js_preload_loader, w);
+#if JS_HAVE_THREADS
+    js_mutex_lock(&ps->mutex);
+#endif
+    for(;;) {
+        if (ps->next == ps->count) {
+            if (ps->busy == 0)
+                break;
+#if JS_HAVE_THREADS
+            js_cond_wait(&ps->cond, &ps->mutex);
+#endif
+            continue;
+        }
+        idx = ps->next++;
+        name = ps->tab[idx].name;
+        ps->busy++;
+#if JS_HAVE_THREADS
+        js_mutex_unlock(&ps->mutex);
+#endif
+        data = js_preload_compile(ctx, name, &data_len);
+#if JS_HAVE_THREADS
+        js_mutex_lock(&ps->mutex);
+#endif
+        ps->tab[idx].data = data;
+        ps->tab[idx].data_len = data_len;
+        for (i = 0; i < w->imports_count; i++) {
+            /* on failure, the module is loaded by js_module_loader() */
+            js_preload_add(ps, w->imports[i]);
+            free(w->imports[i]);
+        }
+        w->imports_count = 0;
+        ps->busy--;
+#if JS_HAVE_THREADS
+        js_cond_broadcast(&ps->cond);
+#endif
+    }
+#if JS_HAVE_THREADS
+    js_cond_broadcast(&ps->cond);
+    js_mutex_unlock(&ps->mutex);
+#endif
+    free(w->imports);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+int js_std_preload_modules(JSContext *ctx, const char *filename,
+                           int thread_count)
+{
+    JSThreadState *ts = js_get_thread_state(JS_GetRuntime(ctx));
+    JSPreloadState *ps;
+#if JS_HAVE_THREADS
+    js_thread_t *threads;
+    int i, n;
+#endif
+
+    if (!ts) {
+        JS_ThrowInternalError(ctx, "js_std_init_handlers() was not called");
+        return -1;
+    }
+    ps = calloc(1, sizeof(*ps));
+    if (!ps || js_preload_add(ps, filename)) {
+        js_preload_free(ps);
+        JS_ThrowOutOfMemory(ctx);
+        return -1;
+    }
+#if JS_HAVE_THREADS
+    js_mutex_init(&ps->mutex);
+    js_cond_init(&ps->cond);
+    n = 0;
+    threads = NULL;
+    if (thread_count > 1)
+        threads = malloc(sizeof(threads[0]) * (thread_count - 1));
+    if (threads) {
+        for (i = 0; i < thread_count - 1; i++) {
+            if (js_thread_create(&threads[n], js_preload_worker, ps, 0))
+                break;
+            n++;
+        }
+    }
+    /* the calling thread compiles too */
+    js_preload_worker(ps);
+    for (i = 0; i < n; i++)
+        js_thread_join(threads[i]);
+    free(threads);
+    js_cond_destroy(&ps->cond);
+    js_mutex_destroy(&ps->mutex);
+#else
+    js_preload_worker(ps);
+#endif
+    js_preload_free(ts->preload);
+    ts->preload = ps;
+    return 0;
+}
+
+JSValue js_std_load_preloaded_module(JSContext *ctx, const char *module_name)
+{
+    JSThreadState *ts = js_get_thread_state(JS_GetRuntime(ctx));
+    JSPreloadModule *e;
+    JSValue obj;
+    int idx;
+
+    if (!ts || !ts->preload)
+        return JS_UNDEFINED;
+    idx = js_preload_find(ts->preload, module_name);
+    if (idx < 0)
+        return JS_UNDEFINED;
+    e = &ts->preload->tab[idx];
+    if (!e->data)
+        return JS_UNDEFINED;
+    obj = JS_ReadObject(ctx, e->data, e->data_len, JS_READ_OBJ_BYTECODE);
+    /* a module is loaded only once */
+    free(e->data);
+    e->data = NULL;
+    if (JS_IsException(obj)) {
+        JS_FreeValue(ctx, JS_GetException(ctx));
+        return JS_UNDEFINED;
+    }
+    return obj;
+}
+
 JSModuleDef *js_module_loader(JSContext *ctx,
                               const char *module_name, void *opaque)
 {
@@ -800,17 +1307,26 @@ JSModuleDef *js_module_loader(JSContext *ctx,
         uint8_t *buf;
         JSValue func_val;
 
-        buf = js_load_file(ctx, &buf_len, module_name);
-        if (!buf) {
-            JS_ThrowReferenceError(ctx, "could not load module filename '%s'",
-                                   module_name);
-            return NULL;
-        }
+        func_val = js_std_load_preloaded_module(ctx, module_name);
+        if (JS_IsUndefined(func_val)) {
+            buf = js_load_file(ctx, &buf_len, module_name);
+            if (!buf) {
+                JS_ThrowReferenceError(ctx, "could not load module filename '%s'",
+                                       module_name);
+                return NULL;
+            }
 
-        /* compile the module */
-        func_val = JS_Eval(ctx, (char *)buf, buf_len, module_name,
-                           JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
-        js_free(ctx, buf);
+            if (js_module_cache_dir)
+                func_val = js_module_cache_load(ctx, module_name, buf, buf_len);
+            if (JS_IsUndefined(func_val)) {
+                /* compile the module */
+                func_val = JS_Eval(ctx, (char *)buf, buf_len, module_name,
+                                   JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
+                if (js_module_cache_dir && !JS_IsException(func_val))
+                    js_module_cache_store(ctx, module_name, buf, buf_len, func_val);
+            }
+            js_free(ctx, buf);
+        }
         if (JS_IsException(func_val))
             return NULL;
         if (js_module_set_import_meta(ctx, func_val, true, false) < 0) {
@@ -4413,6 +4929,9 @@ void js_std_free_handlers(JSRuntime *rt)
         free_rp(rt, rp);
     }
 
+    js_preload_free(ts->preload);
+    ts->preload = NULL;
+
 #ifdef USE_WORKER
     /* XXX: free port_list ? */
     js_free_message_pipe(ts->recv_pipe);
@@ -4590,11 +5109,26 @@ JSValue js_std_await(JSContext *ctx, JSValue obj)
 
 void js_std_eval_binary(JSContext *ctx, const uint8_t *buf, size_t buf_len,
                         int load_only)
+{
+    js_std_eval_binary_native(ctx, buf, buf_len, load_only, NULL, 0);
+}
+
+/* same as js_std_eval_binary() with the functions compiled ahead-of-time
+   to 'native_tab' by qjsc */
+void js_std_eval_binary_native(JSContext *ctx, const uint8_t *buf,
+                               size_t buf_len, int load_only,
+                               const JSNativeCodeEntry *native_tab,
+                               int native_count)
 {
     JSValue obj, val;
     obj = JS_ReadObject(ctx, buf, buf_len, JS_READ_OBJ_BYTECODE);
     if (JS_IsException(obj))
         goto exception;
+    if (native_tab &&
+        JS_SetNativeCode(ctx, obj, native_tab, native_count) < 0) {
+        JS_FreeValue(ctx, obj);
+        goto exception;
+    }
     if (load_only) {
         if (JS_VALUE_GET_TAG(obj) == JS_TAG_MODULE) {
             if (js_module_set_import_meta(ctx, obj, false, false) < 0)
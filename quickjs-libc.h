@@ -54,12 +54,40 @@ JS_EXTERN void js_std_free_handlers(JSRuntime *rt);
 JS_EXTERN void js_std_dump_error(JSContext *ctx);
 JS_EXTERN uint8_t *js_load_file(JSContext *ctx, size_t *pbuf_len,
                                 const char *filename);
+// Map 'filename' read-only for the lifetime of the process, e.g. to run a
+// bytecode image in place with JS_READ_OBJ_ROM_DATA. Falls back to
+// js_load_file() where mmap() is not available.
+JS_EXTERN const uint8_t *js_map_file(size_t *pbuf_len, const char *filename);
 JS_EXTERN int js_module_set_import_meta(JSContext *ctx, JSValueConst func_val,
                                         bool use_realpath, bool is_main);
 JS_EXTERN JSModuleDef *js_module_loader(JSContext *ctx,
                                         const char *module_name, void *opaque);
+// Cache the bytecode of the modules loaded by js_module_loader in 'dir',
+// an existing directory, or disable the cache if NULL. Entries are keyed by
+// the module name and path and validated against the source content and the
+// engine version. 'dir' must stay valid while the cache is in use.
+JS_EXTERN void js_std_set_module_cache_dir(const char *dir);
+// Compile the module 'filename' and the modules reachable through its static
+// imports on 'thread_count' threads, each with its own runtime, so that
+// js_module_loader only deserializes them. Modules that fail to compile are
+// left to js_module_loader, which reports the error. Needs
+// js_std_init_handlers; the bytecode is freed by js_std_free_handlers.
+JS_EXTERN int js_std_preload_modules(JSContext *ctx, const char *filename,
+                                     int thread_count);
+// Return the bytecode of the module 'module_name' compiled by
+// js_std_preload_modules, e.g. its 'filename' to run it without compiling
+// it again, or JS_UNDEFINED if it was not preloaded. Each module is only
+// returned once. The module is not resolved.
+JS_EXTERN JSValue js_std_load_preloaded_module(JSContext *ctx,
+                                               const char *module_name);
 JS_EXTERN void js_std_eval_binary(JSContext *ctx, const uint8_t *buf,
                                   size_t buf_len, int flags);
+// Same as js_std_eval_binary with the functions compiled ahead-of-time by
+// `qjsc -a`.
+JS_EXTERN void js_std_eval_binary_native(JSContext *ctx, const uint8_t *buf,
+                                         size_t buf_len, int flags,
+                                         const JSNativeCodeEntry *native_tab,
+                                         int native_count);
 JS_EXTERN void js_std_promise_rejection_tracker(JSContext *ctx,
                                                 JSValueConst promise,
                                                 JSValueConst reason,
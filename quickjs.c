@@ -60,6 +60,18 @@
 #define MALLOC_OVERHEAD  8
 #endif
 
+/* the slab allocator would hide the invalid accesses to the freed
+   objects from the sanitizers */
+#if !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+#define CONFIG_SLAB
+#endif
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(memory_sanitizer) || \
+    __has_feature(thread_sanitizer)
+#undef CONFIG_SLAB
+#endif
+#endif
+
 #if defined(__NEWLIB__)
 #define NO_TM_GMTOFF
 #endif
@@ -215,10 +227,14 @@ typedef enum JSErrorEnum {
 
 #define JS_MAX_LOCAL_VARS 65535
 #define JS_STACK_SIZE_MAX 65534
+/* internal eval flag: skip optimize_bytecode() (JSEvalOptions.opt_level < 0) */
+#define JS_EVAL_FLAG_NO_OPTIMIZE (1 << 30)
 #define JS_STRING_LEN_MAX ((1 << 30) - 1)
 // 1,024 bytes is about the cutoff point where it starts getting
 // more profitable to ref slice than to copy
 #define JS_STRING_SLICE_LEN_MAX 1024 // in bytes
+// per-runtime cache of the decimal strings of 0..JS_INT_STRING_CACHE_SIZE-1
+#define JS_INT_STRING_CACHE_SIZE 1024
 
 #define __exception __attribute__((warn_unused_result))
 
@@ -234,6 +250,20 @@ typedef enum {
     JS_GC_PHASE_REMOVE_CYCLES,
 } JSGCPhaseEnum;
 
+/* phases of an incremental collection (JS_RunGCStep()) */
+typedef enum {
+    JS_GC_STEP_NONE,
+    JS_GC_STEP_SCAN, /* add the objects to the cycle */
+    JS_GC_STEP_CLEAR, /* clear the reference count table */
+    JS_GC_STEP_COUNT, /* count the references between the objects */
+    JS_GC_STEP_MARK, /* mark the objects reachable from outside */
+} JSGCStepPhaseEnum;
+
+typedef struct JSGCStepCount {
+    JSGCObjectHeader *obj;
+    uint32_t count;
+} JSGCStepCount;
+
 typedef struct JSMallocState {
     size_t malloc_count;
     size_t malloc_size;
@@ -241,6 +271,44 @@ typedef struct JSMallocState {
     void *opaque; /* user opaque */
 } JSMallocState;
 
+/* Slab allocator for the small engine objects of fixed size (objects,
+   shapes, property arrays, variable references). Each size class has
+   a free list of slots carved from pages allocated with
+   js_malloc_rt(), so the memory accounting and limit see the pages. */
+#define JS_SLAB_ALIGN       16
+#define JS_SLAB_CLASS_COUNT 16
+#define JS_SLAB_MAX_SIZE    (JS_SLAB_ALIGN * JS_SLAB_CLASS_COUNT)
+#define JS_SLAB_PAGE_SIZE   (16 * 1024)
+
+typedef struct JSSlabPage {
+    struct JSSlabPage *next;
+    uint32_t free_count; /* only valid in js_slab_trim() */
+    /* followed by the slots, aligned on JS_SLAB_ALIGN */
+} JSSlabPage;
+
+typedef struct JSSlabSlot {
+    struct JSSlabSlot *next;
+} JSSlabSlot;
+
+typedef struct JSSlabClass {
+    JSSlabSlot *free_list;
+    JSSlabPage *pages;
+    uint32_t page_count;
+    uint32_t free_count; /* number of slots in free_list */
+} JSSlabClass;
+
+typedef struct JSArena JSArena;
+
+/* kind of the allocations for the allocation profiler */
+typedef enum {
+    JS_ALLOC_KIND_OTHER,
+    JS_ALLOC_KIND_OBJECT,
+    JS_ALLOC_KIND_STRING,
+    JS_ALLOC_KIND_ARRAY_BUFFER,
+    JS_ALLOC_KIND_BYTECODE,
+    JS_ALLOC_KIND_COUNT,
+} JSAllocKind;
+
 typedef struct JSRuntimeFinalizerState {
     struct JSRuntimeFinalizerState *next;
     JSRuntimeFinalizer *finalizer;
@@ -257,14 +325,18 @@ struct JSRuntime {
     JSMallocState malloc_state;
     const char *rt_info;
 
-    int atom_hash_size; /* power of two */
+    int atom_hash_size; /* power of two, open addressing */
     int atom_count;
     int atom_size;
     int atom_count_resize; /* resize hash table at this count */
-    uint32_t *atom_hash;
+    uint32_t *atom_hash; /* atom indexes, 0 = empty slot */
     JSAtomStruct **atom_array;
     int atom_free_index; /* 0 = none */
 
+    /* lazily filled, each entry holds one reference */
+    JSString *char_string_cache[256]; /* one character Latin-1 strings */
+    JSString *int_string_cache[JS_INT_STRING_CACHE_SIZE];
+
     JSClassID js_class_id_alloc; /* counter for user defined classes */
     int class_count;    /* size of class_array */
     JSClass *class_array;
@@ -276,8 +348,55 @@ struct JSRuntime {
     /* list of JSGCObjectHeader.link. Used during JS_FreeValueRT() */
     struct list_head gc_zero_ref_count_list;
     struct list_head tmp_obj_list; /* used during GC */
+    struct list_head gc_step_list; /* used during partial collections */
+    /* list of JSGCObjectHeader.link. Candidate roots of garbage cycles */
+    struct list_head gc_root_list;
     JSGCPhaseEnum gc_phase : 8;
+    JSGCStepPhaseEnum gc_step_phase : 8;
+    /* incremental collection: objects of the current cycle which are
+       not yet visited in its phase and the ones already visited */
+    struct list_head gc_step_todo_list;
+    struct list_head gc_step_done_list;
+    /* number of references to each object of the cycle coming from
+       the other ones (hash table with open addressing) */
+    JSGCStepCount *gc_step_counts;
+    uint32_t gc_step_count_size; /* power of two */
+    uint32_t gc_step_count_used; /* or number of cleared entries */
+    uint32_t gc_step_object_count; /* number of objects in the cycle */
+    uint32_t gc_step_work; /* visits done by the last JS_RunGCStep() */
+    struct list_head *gc_join_first[3]; /* used by gc_join_lists() */
     size_t malloc_gc_threshold;
+    /* automatic mode: budget of JS_RunGCStep() in microseconds, 0 if
+       the collections are not incremental */
+    int64_t gc_step_budget;
+    /* run a full collection above this size, or longer steps in the
+       incremental mode */
+    size_t gc_full_limit;
+    size_t gc_live_count; /* number of GC objects after the last full GC */
+    /* number of automatic collections that are full before trying the
+       candidate roots again, and its next value */
+    int gc_roots_skip;
+    int gc_roots_backoff;
+    /* adaptive threshold: growth in percent set by the user and its
+       current value */
+    int gc_heap_growth;
+    int gc_growth;
+    int64_t gc_target_pause; /* in microseconds, 0 if none */
+    int64_t gc_last_end; /* time of the end of the last collection, in ns */
+    JSGCStats gc_stats;
+    struct list_head string_slice_list; /* list of JSStringSlice.link */
+    int string_slice_count;
+#ifdef CONFIG_SLAB
+    JSSlabClass slab_classes[JS_SLAB_CLASS_COUNT];
+    size_t slab_free_size; /* size of the free slots, in bytes */
+#endif
+    JSArena *arena; /* not NULL if created with JS_NewArenaRuntime() */
+    struct JSHeapSnapshot *heap_snapshot; /* used by JS_WriteHeapSnapshot() */
+    /* allocation sampling: bytes before the next sample, INT64_MAX if
+       disabled */
+    int64_t alloc_sample_left;
+    struct JSAllocProfile *alloc_profile;
+    uint8_t alloc_kind; /* JSAllocKind of the current allocation */
 #ifdef ENABLE_DUMPS // JS_DUMP_LEAKS
     struct list_head string_list; /* list of JSString.link */
 #endif
@@ -320,6 +439,8 @@ struct JSRuntime {
     JSSharedArrayBufferFunctions sab_funcs;
 
     bool can_block; /* true if Atomics.wait can block */
+    bool lazy_compile; /* defer the code generation of inner functions */
+    bool shared_source; /* function sources point into one JSSourceBlob */
     uint32_t dump_flags : 24;
 
     /* Shape hash table */
@@ -404,12 +525,19 @@ typedef uint64_t js_dlimb_t;
 
 #define JS_LIMB_DIGITS 9
 
-/* Must match the size of short_big_int in JSValueUnion */
 #define JS_LIMB_BITS 32
-#define JS_SHORT_BIG_INT_BITS JS_LIMB_BITS
 #define JS_BIGINT_MAX_SIZE ((1024 * 1024) / JS_LIMB_BITS) /* in limbs */
+
+/* JS_SHORT_BIG_INT_BITS is the size of short_big_int in JSValueUnion */
+#if JS_SHORT_BIG_INT_BITS == 32
 #define JS_SHORT_BIG_INT_MIN INT32_MIN
 #define JS_SHORT_BIG_INT_MAX INT32_MAX
+#elif JS_SHORT_BIG_INT_BITS == 64
+#define JS_SHORT_BIG_INT_MIN INT64_MIN
+#define JS_SHORT_BIG_INT_MAX INT64_MAX
+#else
+#error unsupported JS_SHORT_BIG_INT_BITS
+#endif
 
 
 typedef struct JSBigInt {
@@ -576,7 +704,7 @@ struct JSString {
     uint32_t hash : 29;
     uint32_t kind : 1;
     uint32_t atom_type : 2; /* != 0 if atom, JS_ATOM_TYPE_x */
-    uint32_t hash_next; /* atom_index for JS_ATOM_TYPE_SYMBOL */
+    uint32_t hash_next; /* atom index if atom_type != 0, unused otherwise */
     JSWeakRefRecord *first_weak_ref;
 #ifdef ENABLE_DUMPS // JS_DUMP_LEAKS
     struct list_head link; /* string list */
@@ -586,6 +714,7 @@ struct JSString {
 typedef struct JSStringSlice {
     JSString *parent;
     uint32_t start; // in bytes, not characters
+    struct list_head link; // rt->string_slice_list
 } JSStringSlice;
 
 static inline void *strv(JSString *p)
@@ -692,6 +821,23 @@ typedef enum JSFunctionKindEnum {
     JS_FUNC_ASYNC_GENERATOR = (JS_FUNC_GENERATOR | JS_FUNC_ASYNC),
 } JSFunctionKindEnum;
 
+/* atoms of a bytecode buffer read with JS_READ_OBJ_ROM_DATA. The
+   buffer is executed in place, so its atom operands keep the
+   serialized indexes and are resolved through this table. */
+typedef struct JSBytecodeAtoms {
+    int ref_count;
+    uint32_t count;
+    JSAtom tab[];
+} JSBytecodeAtoms;
+
+/* copy of a script shared by the sources of its functions (see
+   JS_SetSharedFunctionSource()) */
+typedef struct JSSourceBlob {
+    int ref_count;
+    int len;
+    char buf[]; /* null terminated */
+} JSSourceBlob;
+
 typedef struct JSFunctionBytecode {
     JSGCObjectHeader header; /* must come first */
     uint8_t is_strict_mode : 1;
@@ -706,8 +852,13 @@ typedef struct JSFunctionBytecode {
     uint8_t super_allowed : 1;
     uint8_t arguments_allowed : 1;
     uint8_t backtrace_barrier : 1; /* stop backtrace on this function */
-    /* XXX: 5 bits available */
-    uint8_t *byte_code_buf; /* (self pointer) */
+    /* code generation deferred until the first call: the compiled
+       function is cpool[0] once generated */
+    uint8_t is_lazy : 1;
+    /* pc2line_buf and source point into the ROM data */
+    uint8_t debug_in_rom : 1;
+    /* XXX: 3 bits available */
+    uint8_t *byte_code_buf; /* (self pointer unless rom_atoms is set) */
     int byte_code_len;
     JSAtom func_name;
     JSVarDef *vardefs; /* arguments + local variables (arg_count + var_count) (self pointer) */
@@ -726,7 +877,11 @@ typedef struct JSFunctionBytecode {
     int source_len;
     int pc2line_len;
     uint8_t *pc2line_buf;
-    char *source;
+    char *source; /* not null terminated if debug_in_rom or source_blob */
+    JSSourceBlob *source_blob; /* != NULL if source points into it */
+    struct JSFunctionDef *lazy_fd; /* pending code generation if is_lazy */
+    JSBytecodeAtoms *rom_atoms; /* != NULL if byte_code_buf is ROM data */
+    JSNativeCodeFunc *native_code; /* != NULL if compiled ahead-of-time */
 } JSFunctionBytecode;
 
 typedef struct JSBoundFunction {
@@ -1105,6 +1260,12 @@ static JSAtom __JS_NewAtomInit(JSRuntime *rt, const char *str, int len,
                                int atom_type);
 static void JS_FreeAtomStruct(JSRuntime *rt, JSAtomStruct *p);
 static void free_function_bytecode(JSRuntime *rt, JSFunctionBytecode *b);
+static void js_free_function_source(JSRuntime *rt, char *source,
+                                    JSSourceBlob *sb);
+static JSFunctionBytecode *js_lazy_compile_bytecode(JSContext *ctx,
+                                                    JSFunctionBytecode *b);
+static JSFunctionBytecode *js_lazy_compile_function(JSContext *ctx,
+                                                    JSObject *p);
 static JSValue js_call_c_function(JSContext *ctx, JSValueConst func_obj,
                                   JSValueConst this_obj,
                                   int argc, JSValueConst *argv, int flags);
@@ -1207,6 +1368,7 @@ static int JS_ToUint8ClampFree(JSContext *ctx, int32_t *pres, JSValue val);
 static JSValue JS_ToPropertyKeyInternal(JSContext *ctx, JSValueConst val,
                                         int flags);
 static JSValue js_new_string8_len(JSContext *ctx, const char *buf, int len);
+static JSValue js_new_string_uint32(JSContext *ctx, uint32_t n);
 static JSValue js_compile_regexp(JSContext *ctx, JSValueConst pattern,
                                  JSValueConst flags);
 static JSValue js_regexp_constructor_internal(JSContext *ctx, JSValueConst ctor,
@@ -1357,7 +1519,15 @@ static JSAtom js_symbol_to_atom(JSContext *ctx, JSValueConst val);
 static void add_gc_object(JSRuntime *rt, JSGCObjectHeader *h,
                           JSGCObjectTypeEnum type);
 static void remove_gc_object(JSGCObjectHeader *h);
+static inline void gc_add_root(JSRuntime *rt, JSGCObjectHeader *p);
+static inline void gc_relink_object(JSRuntime *rt, JSGCObjectHeader *p);
+static void gc_join_lists(JSRuntime *rt);
+static void gc_split_lists(JSRuntime *rt);
+static size_t gc_collect_roots(JSRuntime *rt);
+static void gc_step_abort(JSRuntime *rt);
 static void js_async_function_free0(JSRuntime *rt, JSAsyncFunctionData *s);
+static int find_line_num(JSContext *ctx, JSFunctionBytecode *b,
+                         uint32_t pc_value, int *col);
 static JSValue js_instantiate_prototype(JSContext *ctx, JSObject *p, JSAtom atom, void *opaque);
 static JSValue js_module_ns_autoinit(JSContext *ctx, JSObject *p, JSAtom atom,
                                  void *opaque);
@@ -1466,14 +1636,68 @@ JSValue JS_DupValueRT(JSRuntime *rt, JSValueConst v)
     return js_dup(v);
 }
 
+/* the free slots of the slab pages are used before the heap grows */
+static inline size_t js_gc_heap_size(JSRuntime *rt)
+{
+#ifdef CONFIG_SLAB
+    return rt->malloc_state.malloc_size - rt->slab_free_size;
+#else
+    return rt->malloc_state.malloc_size;
+#endif
+}
+
+/* adapt the growth of the GC threshold to the last collection */
+static void js_gc_adapt(JSRuntime *rt, size_t before, int64_t start,
+                        bool full)
+{
+    JSGCStats *st = &rt->gc_stats;
+    size_t after = js_gc_heap_size(rt);
+    int64_t end = js__hrtime_ns();
+    int64_t pause = end - start;
+    int64_t interval = start - rt->gc_last_end;
+    int g = rt->gc_growth, lo;
+
+    st->gc_count++;
+    st->full_gc_count += full;
+    st->last_time_us = pause / 1000;
+    st->total_time_us += st->last_time_us;
+    st->last_freed = before > after ? before - after : 0;
+    if (rt->gc_last_end != 0 && interval > 0 && before > st->heap_size)
+        st->alloc_rate = (before - st->heap_size) * 1e9 / interval;
+    if (!full && rt->gc_target_pause > 0 &&
+        pause > rt->gc_target_pause * 1000) {
+        /* the partial collections visit about what was allocated
+           since the last one: collect more often */
+        g = g / 2;
+    } else if (st->last_freed < before / 10 ||
+               (rt->gc_last_end != 0 && pause > interval / 10)) {
+        g = g * 2;
+    } else if (st->last_freed > before / 2) {
+        g = g * 3 / 4;
+    }
+    lo = rt->gc_heap_growth;
+    if (rt->gc_target_pause > 0)
+        lo = max_int(lo / 8, 1);
+    rt->gc_growth = max_int(min_int(g, rt->gc_heap_growth * 8), lo);
+    st->heap_growth = rt->gc_growth;
+    st->heap_size = after; /* JS_GetGCStats() returns the current size */
+    rt->gc_last_end = end;
+}
+
+static size_t js_gc_grow(JSRuntime *rt, size_t size, int percent)
+{
+    return size + (uint64_t)size * percent / 100;
+}
+
 static void js_trigger_gc(JSRuntime *rt, size_t size)
 {
     bool force_gc;
+    size_t before;
+    int64_t start;
 #ifdef FORCE_GC_AT_MALLOC
     force_gc = true;
 #else
-    force_gc = ((rt->malloc_state.malloc_size + size) >
-                rt->malloc_gc_threshold);
+    force_gc = ((js_gc_heap_size(rt) + size) > rt->malloc_gc_threshold);
 #endif
     if (force_gc) {
 #ifdef ENABLE_DUMPS // JS_DUMP_GC
@@ -1481,9 +1705,57 @@ static void js_trigger_gc(JSRuntime *rt, size_t size)
             printf("GC: size=%zd\n", rt->malloc_state.malloc_size);
         }
 #endif
-        JS_RunGC(rt);
-        rt->malloc_gc_threshold = rt->malloc_state.malloc_size +
-            (rt->malloc_state.malloc_size >> 1);
+        before = js_gc_heap_size(rt);
+        start = js__hrtime_ns();
+        if (rt->gc_step_budget > 0) {
+            int64_t budget = rt->gc_step_budget;
+            size_t size;
+            bool done;
+            /* the program allocates faster than the cycles complete:
+               run longer steps */
+            if (before >= rt->gc_full_limit)
+                budget *= 4;
+            done = JS_RunGCStep(rt, budget);
+            js_gc_adapt(rt, before, start, false);
+            size = js_gc_heap_size(rt);
+            if (done) {
+                /* start the next cycle when the heap has grown */
+                rt->malloc_gc_threshold = js_gc_grow(rt, size,
+                                                     rt->gc_heap_growth);
+                rt->gc_full_limit = js_gc_grow(rt, size,
+                                               rt->gc_heap_growth * 4);
+            } else {
+                /* allocate a few bytes per visited object before the
+                   next step, so that the heap grows by about
+                   'gc_heap_growth' percent during a cycle */
+                rt->malloc_gc_threshold = size + (size_t)rt->gc_step_work *
+                    rt->gc_heap_growth / 4;
+            }
+        } else if (before >= rt->gc_full_limit || rt->gc_roots_skip > 0) {
+            if (rt->gc_roots_skip > 0)
+                rt->gc_roots_skip--;
+            JS_RunGC(rt);
+            js_gc_adapt(rt, before, start, true);
+            rt->malloc_gc_threshold = js_gc_grow(rt, js_gc_heap_size(rt),
+                                                 rt->gc_growth);
+            /* the candidate roots miss the cycles going through a
+               realm */
+            rt->gc_full_limit = js_gc_grow(rt, js_gc_heap_size(rt),
+                                           rt->gc_growth * 2);
+        } else {
+            /* when the candidate roots mostly reach live objects, a
+               full collection is cheaper: do not try them for a while */
+            if (gc_collect_roots(rt) > rt->gc_live_count / 2) {
+                rt->gc_roots_backoff = min_int(rt->gc_roots_backoff * 2 + 1, 7);
+                rt->gc_roots_skip = rt->gc_roots_backoff;
+            } else {
+                rt->gc_roots_backoff = 0;
+            }
+            js_gc_adapt(rt, before, start, false);
+            rt->malloc_gc_threshold = js_gc_grow(rt, js_gc_heap_size(rt),
+                                                 rt->gc_growth);
+        }
+        rt->gc_stats.gc_threshold = rt->malloc_gc_threshold;
     }
 }
 
@@ -1492,6 +1764,16 @@ static size_t js_malloc_usable_size_unknown(const void *ptr)
     return 0;
 }
 
+static void js_alloc_sample(JSRuntime *rt, size_t size);
+static void js_free_alloc_profile(JSRuntime *rt);
+
+static inline void js_alloc_sample_check(JSRuntime *rt, size_t size)
+{
+    rt->alloc_sample_left -= size;
+    if (unlikely(rt->alloc_sample_left < 0))
+        js_alloc_sample(rt, size);
+}
+
 void *js_calloc_rt(JSRuntime *rt, size_t count, size_t size)
 {
     void *ptr;
@@ -1515,6 +1797,7 @@ void *js_calloc_rt(JSRuntime *rt, size_t count, size_t size)
 
     s->malloc_count++;
     s->malloc_size += rt->mf.js_malloc_usable_size(ptr) + MALLOC_OVERHEAD;
+    js_alloc_sample_check(rt, count * size);
     return ptr;
 }
 
@@ -1537,6 +1820,7 @@ void *js_malloc_rt(JSRuntime *rt, size_t size)
 
     s->malloc_count++;
     s->malloc_size += rt->mf.js_malloc_usable_size(ptr) + MALLOC_OVERHEAD;
+    js_alloc_sample_check(rt, size);
     return ptr;
 }
 
@@ -1578,6 +1862,8 @@ void *js_realloc_rt(JSRuntime *rt, void *ptr, size_t size)
         return NULL;
 
     s->malloc_size += rt->mf.js_malloc_usable_size(ptr) - old_size;
+    if (size > old_size)
+        js_alloc_sample_check(rt, size - old_size);
     return ptr;
 }
 
@@ -1672,6 +1958,255 @@ size_t js_malloc_usable_size(JSContext *ctx, const void *ptr)
     return js_malloc_usable_size_rt(ctx->rt, ptr);
 }
 
+#ifdef CONFIG_SLAB
+
+#define JS_SLAB_PAGE_HEADER_SIZE \
+    ((sizeof(JSSlabPage) + JS_SLAB_ALIGN - 1) & ~(JS_SLAB_ALIGN - 1))
+
+static inline int js_slab_class(size_t size)
+{
+    return (size - 1) / JS_SLAB_ALIGN;
+}
+
+static inline uint32_t js_slab_slot_count(int c)
+{
+    return (JS_SLAB_PAGE_SIZE - JS_SLAB_PAGE_HEADER_SIZE) /
+        ((c + 1) * JS_SLAB_ALIGN);
+}
+
+static no_inline int js_slab_new_page(JSRuntime *rt, JSSlabClass *cl, int c)
+{
+    JSSlabPage *pg;
+    JSSlabSlot *slot;
+    uint8_t *ptr;
+    size_t slot_size;
+    uint32_t i, n;
+
+    pg = js_malloc_rt(rt, JS_SLAB_PAGE_SIZE);
+    if (!pg)
+        return -1;
+    pg->next = cl->pages;
+    cl->pages = pg;
+    cl->page_count++;
+    /* the slots are handed out in address order */
+    slot_size = (c + 1) * JS_SLAB_ALIGN;
+    n = js_slab_slot_count(c);
+    ptr = (uint8_t *)pg + JS_SLAB_PAGE_HEADER_SIZE;
+    for(i = 0; i < n; i++) {
+        slot = (JSSlabSlot *)(ptr + i * slot_size);
+        if (i == n - 1)
+            slot->next = cl->free_list;
+        else
+            slot->next = (JSSlabSlot *)(ptr + (i + 1) * slot_size);
+    }
+    cl->free_list = (JSSlabSlot *)ptr;
+    cl->free_count += n;
+    rt->slab_free_size += n * slot_size;
+    return 0;
+}
+
+/* 'size' must be given again to js_slab_free_rt() */
+static void *js_slab_alloc_rt(JSRuntime *rt, size_t size)
+{
+    JSSlabClass *cl;
+    JSSlabSlot *slot;
+    int c;
+
+    assert(size != 0);
+    if (size > JS_SLAB_MAX_SIZE)
+        return js_malloc_rt(rt, size);
+    c = js_slab_class(size);
+    cl = &rt->slab_classes[c];
+    if (unlikely(!cl->free_list)) {
+        if (js_slab_new_page(rt, cl, c))
+            return NULL;
+    }
+    slot = cl->free_list;
+    cl->free_list = slot->next;
+    cl->free_count--;
+    rt->slab_free_size -= (c + 1) * JS_SLAB_ALIGN;
+    js_alloc_sample_check(rt, size);
+    return slot;
+}
+
+static void js_slab_free_rt(JSRuntime *rt, void *ptr, size_t size)
+{
+    JSSlabClass *cl;
+    JSSlabSlot *slot;
+    int c;
+
+    if (!ptr)
+        return;
+    if (size > JS_SLAB_MAX_SIZE) {
+        js_free_rt(rt, ptr);
+        return;
+    }
+    c = js_slab_class(size);
+    cl = &rt->slab_classes[c];
+    slot = ptr;
+    slot->next = cl->free_list;
+    cl->free_list = slot;
+    cl->free_count++;
+    rt->slab_free_size += (c + 1) * JS_SLAB_ALIGN;
+}
+
+static int js_slab_page_cmp(const void *a, const void *b, void *opaque)
+{
+    uintptr_t pa = (uintptr_t)*(JSSlabPage * const *)a;
+    uintptr_t pb = (uintptr_t)*(JSSlabPage * const *)b;
+    return (pa > pb) - (pa < pb);
+}
+
+/* return the page containing 'ptr'. 'tab' is sorted by address */
+static JSSlabPage *js_slab_find_page(JSSlabPage **tab, uint32_t n,
+                                     const void *ptr)
+{
+    uint32_t lo, hi, mid;
+
+    lo = 0;
+    hi = n - 1;
+    while (lo < hi) {
+        mid = lo + (hi - lo + 1) / 2;
+        if ((uintptr_t)tab[mid] <= (uintptr_t)ptr)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return tab[lo];
+}
+
+/* free the pages of the class 'c' whose slots are all free */
+static void js_slab_trim_class(JSRuntime *rt, int c)
+{
+    JSSlabClass *cl = &rt->slab_classes[c];
+    JSSlabPage **tab, *pg, **ppg;
+    JSSlabSlot *slot, **pslot;
+    uint32_t i, n, slot_count;
+
+    n = cl->page_count;
+    slot_count = js_slab_slot_count(c);
+    tab = js_malloc_rt(rt, sizeof(tab[0]) * n);
+    if (!tab)
+        return;
+    i = 0;
+    for(pg = cl->pages; pg != NULL; pg = pg->next) {
+        pg->free_count = 0;
+        tab[i++] = pg;
+    }
+    assert(i == n);
+    rqsort(tab, n, sizeof(tab[0]), js_slab_page_cmp, NULL);
+    for(slot = cl->free_list; slot != NULL; slot = slot->next)
+        js_slab_find_page(tab, n, slot)->free_count++;
+
+    /* remove the slots of the free pages from the free list */
+    pslot = &cl->free_list;
+    while ((slot = *pslot) != NULL) {
+        if (js_slab_find_page(tab, n, slot)->free_count == slot_count)
+            *pslot = slot->next;
+        else
+            pslot = &slot->next;
+    }
+    js_free_rt(rt, tab);
+
+    ppg = &cl->pages;
+    while ((pg = *ppg) != NULL) {
+        if (pg->free_count == slot_count) {
+            *ppg = pg->next;
+            cl->page_count--;
+            cl->free_count -= slot_count;
+            rt->slab_free_size -= slot_count * (c + 1) * JS_SLAB_ALIGN;
+            js_free_rt(rt, pg);
+        } else {
+            ppg = &pg->next;
+        }
+    }
+}
+
+/* release the free pages when the free slots of a class fill at least
+   'min_pages' pages */
+static void js_slab_trim(JSRuntime *rt, uint32_t min_pages)
+{
+    int c;
+
+    for(c = 0; c < JS_SLAB_CLASS_COUNT; c++) {
+        if (rt->slab_classes[c].free_count >= min_pages * js_slab_slot_count(c))
+            js_slab_trim_class(rt, c);
+    }
+}
+
+#else
+
+static inline void *js_slab_alloc_rt(JSRuntime *rt, size_t size)
+{
+    return js_malloc_rt(rt, size);
+}
+
+static inline void js_slab_free_rt(JSRuntime *rt, void *ptr, size_t size)
+{
+    js_free_rt(rt, ptr);
+}
+
+static inline void js_slab_trim(JSRuntime *rt, uint32_t min_pages)
+{
+}
+
+#endif /* CONFIG_SLAB */
+
+/* Throw out of memory in case of error */
+static void *js_slab_alloc(JSContext *ctx, size_t size)
+{
+    void *ptr;
+    ptr = js_slab_alloc_rt(ctx->rt, size);
+    if (unlikely(!ptr)) {
+        JS_ThrowOutOfMemory(ctx);
+        return NULL;
+    }
+    return ptr;
+}
+
+static void js_slab_free(JSContext *ctx, void *ptr, size_t size)
+{
+    js_slab_free_rt(ctx->rt, ptr, size);
+}
+
+/* return true if js_slab_realloc() allocates a new block. Otherwise it
+   resizes the block in place or with js_realloc(), and a failure
+   leaves a block that can still be freed with either size. */
+static bool js_slab_realloc_moves(size_t old_size, size_t new_size)
+{
+#ifdef CONFIG_SLAB
+    if (old_size > JS_SLAB_MAX_SIZE && new_size > JS_SLAB_MAX_SIZE)
+        return false;
+    if (old_size <= JS_SLAB_MAX_SIZE && new_size <= JS_SLAB_MAX_SIZE &&
+        js_slab_class(old_size) == js_slab_class(new_size))
+        return false;
+    return true;
+#else
+    return false;
+#endif
+}
+
+/* Throw out of memory in case of error */
+static void *js_slab_realloc(JSContext *ctx, void *ptr, size_t old_size,
+                             size_t new_size)
+{
+    void *new_ptr;
+
+    if (js_slab_realloc_moves(old_size, new_size)) {
+        new_ptr = js_slab_alloc(ctx, new_size);
+        if (!new_ptr)
+            return NULL;
+        memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+        js_slab_free(ctx, ptr, old_size);
+        return new_ptr;
+    }
+#ifdef CONFIG_SLAB
+    if (old_size <= JS_SLAB_MAX_SIZE)
+        return ptr;
+#endif
+    return js_realloc(ctx, ptr, new_size);
+}
+
 /* Throw out of memory exception in case of error */
 char *js_strndup(JSContext *ctx, const char *s, size_t n)
 {
@@ -1857,11 +2392,20 @@ JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
     ms.malloc_size += rt->mf.js_malloc_usable_size(rt) + MALLOC_OVERHEAD;
     rt->malloc_state = ms;
     rt->malloc_gc_threshold = 256 * 1024;
+    rt->alloc_sample_left = INT64_MAX;
+    rt->gc_heap_growth = 50;
+    rt->gc_growth = 50;
 
     init_list_head(&rt->context_list);
     init_list_head(&rt->gc_obj_list);
     init_list_head(&rt->gc_zero_ref_count_list);
+    init_list_head(&rt->gc_root_list);
+    init_list_head(&rt->gc_step_list);
+    init_list_head(&rt->gc_step_todo_list);
+    init_list_head(&rt->gc_step_done_list);
     rt->gc_phase = JS_GC_PHASE_NONE;
+    rt->gc_step_phase = JS_GC_STEP_NONE;
+    init_list_head(&rt->string_slice_list);
 
 #ifdef ENABLE_DUMPS // JS_DUMP_LEAKS
     init_list_head(&rt->string_list);
@@ -1960,6 +2504,244 @@ JSRuntime *JS_NewRuntime(void)
     return JS_NewRuntime2(&def_malloc_funcs, NULL);
 }
 
+/* Arena allocator: the blocks are carved from large chunks and
+   recycled with one free list per size class. The chunks are only
+   released when the runtime is freed. The size classes are multiples
+   of 16 bytes up to 256 bytes, then 4 classes per power of two. */
+#define JS_ARENA_CHUNK_SIZE  (1024 * 1024)
+#define JS_ARENA_LARGE_SIZE  (256 * 1024) /* larger blocks use malloc() */
+#define JS_ARENA_CLASS_COUNT (16 + 4 * 10)
+
+typedef struct JSArenaHeader {
+    size_t size; /* usable size */
+    size_t size_class; /* JS_ARENA_CLASS_COUNT for a large block */
+} JSArenaHeader;
+
+typedef struct JSArenaLarge {
+    struct list_head link;
+    JSArenaHeader h;
+} JSArenaLarge;
+
+typedef struct JSArenaChunk {
+    struct JSArenaChunk *next;
+    /* followed by the blocks */
+} JSArenaChunk;
+
+/* the blocks are aligned on JS_ARENA_ALIGN as with malloc() and their
+   JSArenaHeader is just before them, after some padding if needed */
+#define JS_ARENA_ALIGN 16
+#define js_arena_align(n) \
+    (((n) + JS_ARENA_ALIGN - 1) & ~(size_t)(JS_ARENA_ALIGN - 1))
+#define JS_ARENA_HEADER_SIZE js_arena_align(sizeof(JSArenaHeader))
+#define JS_ARENA_LARGE_PAD \
+    (js_arena_align(sizeof(JSArenaLarge)) - sizeof(JSArenaLarge))
+
+struct JSArena {
+    uint8_t *ptr; /* free space of the current chunk */
+    uint8_t *end;
+    JSArenaChunk *chunks;
+    struct list_head large_list; /* list of JSArenaLarge.link */
+    void *free_list[JS_ARENA_CLASS_COUNT];
+    bool closing; /* true while the runtime is released */
+};
+
+static int js_arena_size_class(size_t size)
+{
+    int g;
+
+    if (size <= 256)
+        return (max_int(size, 1) + 15) / 16 - 1;
+    g = 31 - clz32(size - 1) - 8;
+    return 16 + g * 4 + ((size - 1 - (256 << g)) >> (6 + g));
+}
+
+static size_t js_arena_class_size(int c)
+{
+    int g;
+
+    if (c < 16)
+        return (c + 1) * 16;
+    g = (c - 16) / 4;
+    return (256 << g) + ((c - 16) % 4 + 1) * (64 << g);
+}
+
+static void js_arena_new_chunk(JSArena *a)
+{
+    JSArenaChunk *ch;
+    JSArenaHeader *h;
+    size_t n;
+    int c;
+
+    ch = malloc(JS_ARENA_CHUNK_SIZE);
+    if (!ch)
+        return;
+    /* keep the end of the current chunk in the free lists */
+    for(;;) {
+        n = a->end - a->ptr;
+        if (n < JS_ARENA_HEADER_SIZE + 16)
+            break;
+        c = js_arena_size_class(n - JS_ARENA_HEADER_SIZE);
+        if (js_arena_class_size(c) > n - JS_ARENA_HEADER_SIZE)
+            c--;
+        h = (JSArenaHeader *)(a->ptr + JS_ARENA_HEADER_SIZE) - 1;
+        h->size = js_arena_class_size(c);
+        h->size_class = c;
+        a->ptr += JS_ARENA_HEADER_SIZE + h->size;
+        *(void **)(h + 1) = a->free_list[c];
+        a->free_list[c] = h + 1;
+    }
+    ch->next = a->chunks;
+    a->chunks = ch;
+    a->ptr = (uint8_t *)ch + js_arena_align(sizeof(*ch));
+    a->end = (uint8_t *)ch + JS_ARENA_CHUNK_SIZE;
+}
+
+static void *js_arena_malloc(void *opaque, size_t size)
+{
+    JSArena *a = opaque;
+    JSArenaHeader *h;
+    void *ptr;
+    size_t n;
+    int c;
+
+    if (size > JS_ARENA_LARGE_SIZE) {
+        JSArenaLarge *l;
+        ptr = malloc(js_arena_align(sizeof(*l)) + size);
+        if (!ptr)
+            return NULL;
+        l = (JSArenaLarge *)((uint8_t *)ptr + JS_ARENA_LARGE_PAD);
+        list_add_tail(&l->link, &a->large_list);
+        l->h.size = size;
+        l->h.size_class = JS_ARENA_CLASS_COUNT;
+        return &l->h + 1;
+    }
+    c = js_arena_size_class(size);
+    ptr = a->free_list[c];
+    if (ptr) {
+        a->free_list[c] = *(void **)ptr;
+        return ptr;
+    }
+    n = JS_ARENA_HEADER_SIZE + js_arena_class_size(c);
+    if ((size_t)(a->end - a->ptr) < n) {
+        js_arena_new_chunk(a);
+        if ((size_t)(a->end - a->ptr) < n)
+            return NULL;
+    }
+    h = (JSArenaHeader *)(a->ptr + JS_ARENA_HEADER_SIZE) - 1;
+    h->size = n - JS_ARENA_HEADER_SIZE;
+    h->size_class = c;
+    a->ptr += n;
+    return h + 1;
+}
+
+static void *js_arena_calloc(void *opaque, size_t count, size_t size)
+{
+    void *ptr;
+
+    if (size != 0 && count > SIZE_MAX / size)
+        return NULL;
+    ptr = js_arena_malloc(opaque, count * size);
+    if (ptr)
+        memset(ptr, 0, count * size);
+    return ptr;
+}
+
+static void js_arena_free(void *opaque, void *ptr)
+{
+    JSArena *a = opaque;
+    JSArenaHeader *h;
+
+    if (!ptr || a->closing)
+        return;
+    h = (JSArenaHeader *)ptr - 1;
+    if (h->size_class == JS_ARENA_CLASS_COUNT) {
+        JSArenaLarge *l = container_of(h, JSArenaLarge, h);
+        list_del(&l->link);
+        free((uint8_t *)l - JS_ARENA_LARGE_PAD);
+    } else {
+        *(void **)ptr = a->free_list[h->size_class];
+        a->free_list[h->size_class] = ptr;
+    }
+}
+
+static size_t js_arena_usable_size(const void *ptr)
+{
+    if (!ptr)
+        return 0;
+    return ((const JSArenaHeader *)ptr - 1)->size;
+}
+
+static void *js_arena_realloc(void *opaque, void *ptr, size_t size)
+{
+    JSArenaHeader *h;
+    void *new_ptr;
+
+    if (!ptr)
+        return js_arena_malloc(opaque, size);
+    if (size == 0) {
+        js_arena_free(opaque, ptr);
+        return NULL;
+    }
+    h = (JSArenaHeader *)ptr - 1;
+    /* keep the block if the size class does not change */
+    if (size <= h->size) {
+        if (h->size_class == JS_ARENA_CLASS_COUNT) {
+            if (size > JS_ARENA_LARGE_SIZE)
+                return ptr;
+        } else if (js_arena_size_class(size) == h->size_class) {
+            return ptr;
+        }
+    }
+    new_ptr = js_arena_malloc(opaque, size);
+    if (!new_ptr)
+        return NULL;
+    memcpy(new_ptr, ptr, size < h->size ? size : h->size);
+    js_arena_free(opaque, ptr);
+    return new_ptr;
+}
+
+static void js_free_arena(JSArena *a)
+{
+    JSArenaChunk *ch, *ch_next;
+    struct list_head *el, *el1;
+
+    for(ch = a->chunks; ch != NULL; ch = ch_next) {
+        ch_next = ch->next;
+        free(ch);
+    }
+    list_for_each_safe(el, el1, &a->large_list) {
+        free((uint8_t *)list_entry(el, JSArenaLarge, link) -
+             JS_ARENA_LARGE_PAD);
+    }
+    free(a);
+}
+
+static const JSMallocFunctions arena_malloc_funcs = {
+    js_arena_calloc,
+    js_arena_malloc,
+    js_arena_free,
+    js_arena_realloc,
+    js_arena_usable_size,
+};
+
+JSRuntime *JS_NewArenaRuntime(void)
+{
+    JSRuntime *rt;
+    JSArena *a;
+
+    a = calloc(1, sizeof(*a));
+    if (!a)
+        return NULL;
+    init_list_head(&a->large_list);
+    rt = JS_NewRuntime2(&arena_malloc_funcs, a);
+    if (!rt) {
+        js_free_arena(a);
+        return NULL;
+    }
+    rt->arena = a;
+    return rt;
+}
+
 void JS_SetMemoryLimit(JSRuntime *rt, size_t limit)
 {
     rt->malloc_state.malloc_limit = limit;
@@ -2006,6 +2788,16 @@ void JS_SetCanBlock(JSRuntime *rt, bool can_block)
     rt->can_block = can_block;
 }
 
+void JS_SetLazyCompilation(JSRuntime *rt, bool enable)
+{
+    rt->lazy_compile = enable;
+}
+
+void JS_SetSharedFunctionSource(JSRuntime *rt, bool enable)
+{
+    rt->shared_source = enable;
+}
+
 void JS_SetSharedArrayBufferFunctions(JSRuntime *rt,
                                       const JSSharedArrayBufferFunctions *sf)
 {
@@ -2090,7 +2882,9 @@ static inline JSAtomStruct *atom_set_free(uint32_t v)
 static JSString *js_alloc_string_rt(JSRuntime *rt, int max_len, int is_wide_char)
 {
     JSString *str;
+    rt->alloc_kind = JS_ALLOC_KIND_STRING;
     str = js_malloc_rt(rt, sizeof(JSString) + (max_len << is_wide_char) + 1 - is_wide_char);
+    rt->alloc_kind = JS_ALLOC_KIND_OTHER;
     if (unlikely(!str))
         return NULL;
     str->header.ref_count = 1;
@@ -2136,6 +2930,8 @@ static inline void js_free_string0(JSRuntime *rt, JSString *str)
 #endif
         if (str->kind == JS_STRING_KIND_SLICE) {
             JSStringSlice *slice = (void *)&str[1];
+            list_del(&slice->link);
+            rt->string_slice_count--;
             js_free_string(rt, slice->parent); // safe, recurses only 1 level
         }
         js_free_rt(rt, str);
@@ -2148,12 +2944,66 @@ void JS_SetRuntimeInfo(JSRuntime *rt, const char *s)
         rt->rt_info = s;
 }
 
+/* release an arena runtime without freeing the objects one by one:
+   only the finalizers which may own resources outside the runtime are
+   called */
+static void js_free_arena_runtime(JSRuntime *rt)
+{
+    struct list_head *lists[] = {
+        &rt->gc_obj_list, &rt->gc_root_list, &rt->gc_zero_ref_count_list,
+        &rt->gc_step_todo_list, &rt->gc_step_done_list,
+    };
+    struct list_head *el;
+    JSGCObjectHeader *gp;
+    JSObject *p;
+    JSClassFinalizer *finalizer;
+    int i;
+
+    rt->in_free = true;
+    rt->arena->closing = true;
+    /* the finalizers may release references: bit 0 of 'mark' prevents
+       the objects from moving to the root list while iterating */
+    for(i = 0; i < countof(lists); i++) {
+        list_for_each(el, lists[i]) {
+            gp = list_entry(el, JSGCObjectHeader, link);
+            gp->mark |= 1;
+        }
+    }
+    for(i = 0; i < countof(lists); i++) {
+        list_for_each(el, lists[i]) {
+            gp = list_entry(el, JSGCObjectHeader, link);
+            if (gp->gc_obj_type != JS_GC_OBJ_TYPE_JS_OBJECT)
+                continue;
+            p = (JSObject *)gp;
+            if (p->class_id < JS_CLASS_INIT_COUNT &&
+                p->class_id != JS_CLASS_ARRAY_BUFFER &&
+                p->class_id != JS_CLASS_SHARED_ARRAY_BUFFER &&
+                p->class_id != JS_CLASS_C_CLOSURE)
+                continue;
+            finalizer = rt->class_array[p->class_id].finalizer;
+            if (finalizer)
+                (*finalizer)(rt, JS_MKPTR(JS_TAG_OBJECT, p));
+        }
+    }
+    while (rt->finalizers) {
+        JSRuntimeFinalizerState *fs = rt->finalizers;
+        rt->finalizers = fs->next;
+        fs->finalizer(rt, fs->arg);
+    }
+    js_free_arena(rt->arena);
+}
+
 void JS_FreeRuntime(JSRuntime *rt)
 {
     struct list_head *el, *el1;
     int i;
 
+    if (rt->arena) {
+        js_free_arena_runtime(rt);
+        return;
+    }
     rt->in_free = true;
+    js_free_alloc_profile(rt);
     JS_FreeValueRT(rt, rt->current_exception);
 
     list_for_each_safe(el, el1, &rt->job_list) {
@@ -2207,6 +3057,7 @@ void JS_FreeRuntime(JSRuntime *rt)
 #endif
 
     assert(list_empty(&rt->gc_obj_list));
+    assert(list_empty(&rt->gc_root_list));
 
     /* free the classes */
     for(i = 0; i < rt->class_count; i++) {
@@ -2217,6 +3068,16 @@ void JS_FreeRuntime(JSRuntime *rt)
     }
     js_free_rt(rt, rt->class_array);
 
+    /* free the string caches */
+    for(i = 0; i < countof(rt->char_string_cache); i++) {
+        if (rt->char_string_cache[i])
+            js_free_string(rt, rt->char_string_cache[i]);
+    }
+    for(i = 0; i < countof(rt->int_string_cache); i++) {
+        if (rt->int_string_cache[i])
+            js_free_string(rt, rt->int_string_cache[i]);
+    }
+
 #ifdef ENABLE_DUMPS // JS_DUMP_ATOM_LEAKS
     /* only the atoms defined in JS_InitAtoms() should be left */
     if (check_dump_flag(rt, JS_DUMP_ATOM_LEAKS)) {
@@ -2325,6 +3186,9 @@ void JS_FreeRuntime(JSRuntime *rt)
         js_free_rt(rt, fs);
     }
 
+    /* the pages still holding slots are leaked objects */
+    js_slab_trim(rt, 1);
+
 #ifdef ENABLE_DUMPS // JS_DUMP_LEAKS
     if (check_dump_flag(rt, JS_DUMP_LEAKS)) {
         JSMallocState *s = &rt->malloc_state;
@@ -2344,7 +3208,8 @@ void JS_FreeRuntime(JSRuntime *rt)
     }
 }
 
-JSContext *JS_NewContextRaw(JSRuntime *rt)
+/* a context without intrinsic objects */
+static JSContext *js_new_context(JSRuntime *rt)
 {
     JSContext *ctx;
     int i;
@@ -2375,7 +3240,16 @@ JSContext *JS_NewContextRaw(JSRuntime *rt)
     ctx->error_prepare_stack = JS_UNDEFINED;
     ctx->error_stack_trace_limit = js_int32(10);
     init_list_head(&ctx->loaded_modules);
+    return ctx;
+}
+
+JSContext *JS_NewContextRaw(JSRuntime *rt)
+{
+    JSContext *ctx;
 
+    ctx = js_new_context(rt);
+    if (!ctx)
+        return NULL;
     JS_AddIntrinsicBasicObjects(ctx);
     return ctx;
 }
@@ -2534,10 +3408,12 @@ void JS_FreeContext(JSContext *ctx)
         JSGCObjectHeader *p;
         printf("JSObjects: {\n");
         JS_DumpObjectHeader(ctx->rt);
+        gc_join_lists(rt);
         list_for_each(el, &rt->gc_obj_list) {
             p = list_entry(el, JSGCObjectHeader, link);
             JS_DumpGCObject(rt, p);
         }
+        gc_split_lists(rt);
         printf("}\n");
     }
 #endif
@@ -2628,7 +3504,7 @@ static inline bool is_strict_mode(JSContext *ctx)
 #define JS_ATOM_MAX     ((1U << 30) - 1)
 
 /* return the max count from the hash size */
-#define JS_ATOM_COUNT_RESIZE(n) ((n) * 2)
+#define JS_ATOM_COUNT_RESIZE(n) ((n) / 2)
 
 static inline bool __JS_AtomIsConst(JSAtom v)
 {
@@ -2640,6 +3516,17 @@ static inline bool __JS_AtomIsTaggedInt(JSAtom v)
     return (v & JS_ATOM_TAG_INT) != 0;
 }
 
+/* return the atom operand at 'pc' */
+static inline JSAtom bc_get_atom_operand(const JSFunctionBytecode *b,
+                                         const uint8_t *pc)
+{
+    JSAtom atom = get_u32(pc);
+    if (unlikely(b->rom_atoms != NULL) && atom >= JS_ATOM_END &&
+        !__JS_AtomIsTaggedInt(atom))
+        atom = b->rom_atoms->tab[atom - JS_ATOM_END];
+    return atom;
+}
+
 static inline JSAtom __JS_AtomFromUInt32(uint32_t v)
 {
     return v | JS_ATOM_TAG_INT;
@@ -2690,24 +3577,75 @@ static inline bool is_num_string(uint32_t *pval, JSString *p)
     }
 }
 
-/* XXX: could use faster version ? */
-static inline uint32_t hash_string8(const uint8_t *str, size_t len, uint32_t h)
+/* Word-at-a-time string hash in the style of wyhash. The 8-bit and the
+   16-bit variants return the same value for strings made of the same
+   code units, so a Latin-1 string hashes identically whichever way it is
+   stored. The result is never zero, which lets non-atom strings cache
+   their hash in JSString.hash (see js_string_hash()). */
+#define HASH_K0 UINT64_C(0xa0761d6478bd642f)
+#define HASH_K1 UINT64_C(0xe7037ed1a0b428db)
+#define HASH_K2 UINT64_C(0x8ebc6af09c88c6e3)
+
+static inline uint64_t hash_mum(uint64_t a, uint64_t b)
+{
+    uint64_t hi, lo;
+    lo = mul_u64(&hi, a, b);
+    return lo ^ hi;
+}
+
+static inline uint32_t hash_final(uint64_t h, size_t len)
 {
+    uint32_t h1;
+
+    h = hash_mum(h ^ HASH_K0, (uint64_t)len ^ HASH_K1);
+    h1 = (uint32_t)(h ^ (h >> 32)) & JS_ATOM_HASH_MASK;
+    return h1 ? h1 : 1;
+}
+
+static inline uint32_t hash_string8(const uint8_t *str, size_t len, uint32_t h0)
+{
+    uint64_t h, w;
     size_t i;
+    int shift;
 
-    for(i = 0; i < len; i++)
-        h = h * 263 + str[i];
-    return h;
+    h = h0;
+    for(i = 0; i + 8 <= len; i += 8) {
+        w = get_u64(str + i);
+        if (is_be())
+            w = bswap64(w);
+        h = hash_mum(h ^ HASH_K0, w ^ HASH_K1);
+    }
+    if (i < len) {
+        w = 0;
+        for(shift = 0; i < len; i++, shift += 8)
+            w |= (uint64_t)str[i] << shift;
+        h = hash_mum(h ^ HASH_K0, w ^ HASH_K1);
+    }
+    return hash_final(h, len);
 }
 
 static inline uint32_t hash_string16(const uint16_t *str,
-                                     size_t len, uint32_t h)
+                                     size_t len, uint32_t h0)
 {
-    size_t i;
+    uint64_t h, w, wh;
+    size_t i, j;
+    int shift;
 
-    for(i = 0; i < len; i++)
-        h = h * 263 + str[i];
-    return h;
+    h = h0;
+    for(i = 0; i < len; i = j) {
+        /* the low bytes are hashed as in hash_string8(), the high bytes
+           only contribute when they are not zero */
+        w = 0;
+        wh = 0;
+        for(j = i, shift = 0; j < len && shift < 64; j++, shift += 8) {
+            w |= (uint64_t)(str[j] & 0xff) << shift;
+            wh |= (uint64_t)(str[j] >> 8) << shift;
+        }
+        h = hash_mum(h ^ HASH_K0, w ^ HASH_K1);
+        if (wh != 0)
+            h = hash_mum(h ^ HASH_K2, wh ^ HASH_K1);
+    }
+    return hash_final(h, len);
 }
 
 static uint32_t hash_string(JSString *str, uint32_t h)
@@ -2719,6 +3657,25 @@ static uint32_t hash_string(JSString *str, uint32_t h)
     return h;
 }
 
+/* Return the hash of 'p' as an atom of type 'atom_type'. The hash of a
+   string atom is reused and the hash of a non-atom string is cached in
+   p->hash, so repeated lookups with the same string value do not rehash
+   it. */
+static uint32_t js_string_hash(JSString *p, int atom_type)
+{
+    uint32_t h;
+
+    if (atom_type != JS_ATOM_TYPE_STRING)
+        return hash_string(p, atom_type);
+    if (p->atom_type == JS_ATOM_TYPE_STRING ||
+        (p->atom_type == 0 && p->hash != 0))
+        return p->hash;
+    h = hash_string(p, atom_type);
+    if (p->atom_type == 0)
+        p->hash = h;
+    return h;
+}
+
 static __maybe_unused void JS_DumpString(JSRuntime *rt, JSString *p)
 {
     int i, c, sep;
@@ -2761,13 +3718,10 @@ static __maybe_unused void JS_DumpAtoms(JSRuntime *rt)
     for(i = 0; i < rt->atom_hash_size; i++) {
         h = rt->atom_hash[i];
         if (h) {
-            printf("  %d:", i);
-            while (h) {
-                p = rt->atom_array[h];
-                printf(" ");
-                JS_DumpString(rt, p);
-                h = p->hash_next;
-            }
+            p = rt->atom_array[h];
+            printf("  %d: %d (+%d) ", i, h,
+                   (i - p->hash) & (rt->atom_hash_size - 1));
+            JS_DumpString(rt, p);
             printf("\n");
         }
     }
@@ -2788,7 +3742,7 @@ static __maybe_unused void JS_DumpAtoms(JSRuntime *rt)
 static int JS_ResizeAtomHash(JSRuntime *rt, int new_hash_size)
 {
     JSAtomStruct *p;
-    uint32_t new_hash_mask, h, i, hash_next1, j, *new_hash;
+    uint32_t new_hash_mask, h, i, j, *new_hash;
 
     assert((new_hash_size & (new_hash_size - 1)) == 0); /* power of two */
     new_hash_mask = new_hash_size - 1;
@@ -2797,14 +3751,13 @@ static int JS_ResizeAtomHash(JSRuntime *rt, int new_hash_size)
         return -1;
     for(i = 0; i < rt->atom_hash_size; i++) {
         h = rt->atom_hash[i];
-        while (h != 0) {
+        if (h != 0) {
+            /* add in new hash table with linear probing */
             p = rt->atom_array[h];
-            hash_next1 = p->hash_next;
-            /* add in new hash table */
             j = p->hash & new_hash_mask;
-            p->hash_next = new_hash[j];
+            while (new_hash[j] != 0)
+                j = (j + 1) & new_hash_mask;
             new_hash[j] = h;
-            h = hash_next1;
         }
     }
     js_free_rt(rt, rt->atom_hash);
@@ -2825,7 +3778,7 @@ static int JS_InitAtoms(JSRuntime *rt)
     rt->atom_count = 0;
     rt->atom_size = 0;
     rt->atom_free_index = 0;
-    if (JS_ResizeAtomHash(rt, 256))     /* there are at least 195 predefined atoms */
+    if (JS_ResizeAtomHash(rt, 512))     /* there are at least 195 predefined atoms */
         return -1;
 
     p = js_atom_init;
@@ -2899,19 +3852,7 @@ static JSAtomKindEnum JS_AtomGetKind(JSContext *ctx, JSAtom v)
 
 static JSAtom js_get_atom_index(JSRuntime *rt, JSAtomStruct *p)
 {
-    uint32_t i = p->hash_next;  /* atom_index */
-    if (p->atom_type != JS_ATOM_TYPE_SYMBOL) {
-        JSAtomStruct *p1;
-
-        i = rt->atom_hash[p->hash & (rt->atom_hash_size - 1)];
-        p1 = rt->atom_array[i];
-        while (p1 != p) {
-            assert(i != 0);
-            i = p1->hash_next;
-            p1 = rt->atom_array[i];
-        }
-    }
-    return i;
+    return p->hash_next;  /* atom_index */
 }
 
 /* string case (internal). Return JS_ATOM_NULL if error. 'str' is
@@ -2932,13 +3873,21 @@ static JSAtom __JS_NewAtom(JSRuntime *rt, JSString *str, int atom_type)
                 str->header.ref_count--;
             return i;
         }
+        /* grow the table before probing so that it always keeps free
+           slots: atom_count also counts the unhashed symbols */
+        if (unlikely(rt->atom_count >= rt->atom_count_resize)) {
+            if (JS_ResizeAtomHash(rt, rt->atom_hash_size * 2) &&
+                rt->atom_count >= rt->atom_hash_size - 1)
+                goto fail;
+        }
         /* try and locate an already registered atom */
         len = str->len;
-        h = hash_string(str, atom_type);
-        h &= JS_ATOM_HASH_MASK;
+        h = js_string_hash(str, atom_type);
         h1 = h & (rt->atom_hash_size - 1);
-        i = rt->atom_hash[h1];
-        while (i != 0) {
+        for(;;) {
+            i = rt->atom_hash[h1];
+            if (i == 0)
+                break;
             p = rt->atom_array[i];
             if (p->hash == h &&
                 p->atom_type == atom_type &&
@@ -2948,7 +3897,7 @@ static JSAtom __JS_NewAtom(JSRuntime *rt, JSString *str, int atom_type)
                     p->header.ref_count++;
                 goto done;
             }
-            i = p->hash_next;
+            h1 = (h1 + 1) & (rt->atom_hash_size - 1);
         }
     } else {
         h1 = 0; /* avoid warning */
@@ -3008,7 +3957,7 @@ static JSAtom __JS_NewAtom(JSRuntime *rt, JSString *str, int atom_type)
     }
 
     if (str) {
-        if (str->atom_type == 0) {
+        if (str->atom_type == 0 && str->kind == JS_STRING_KIND_NORMAL) {
             p = str;
             p->atom_type = atom_type;
         } else {
@@ -3024,8 +3973,10 @@ static JSAtom __JS_NewAtom(JSRuntime *rt, JSString *str, int atom_type)
 #ifdef ENABLE_DUMPS // JS_DUMP_LEAKS
             list_add_tail(&p->link, &rt->string_list);
 #endif
-            memcpy(str8(p), str8(str), (str->len << str->is_wide_char) +
-                   1 - str->is_wide_char);
+            /* slices are not null terminated */
+            memcpy(str8(p), str8(str), str->len << str->is_wide_char);
+            if (!str->is_wide_char)
+                str8(p)[str->len] = '\0';
             js_free_string(rt, str);
         }
     } else {
@@ -3054,10 +4005,8 @@ static JSAtom __JS_NewAtom(JSRuntime *rt, JSString *str, int atom_type)
     rt->atom_count++;
 
     if (atom_type != JS_ATOM_TYPE_SYMBOL) {
-        p->hash_next = rt->atom_hash[h1];
+        /* h1 is the empty slot that ended the probe sequence */
         rt->atom_hash[h1] = i;
-        if (unlikely(rt->atom_count >= rt->atom_count_resize))
-            JS_ResizeAtomHash(rt, rt->atom_hash_size * 2);
     }
 
     //    JS_DumpAtoms(rt);
@@ -3085,6 +4034,8 @@ static JSAtom __JS_NewAtomInit(JSRuntime *rt, const char *str, int len,
     return __JS_NewAtom(rt, p, atom_type);
 }
 
+/* Look up an existing atom without allocating a temporary JSString.
+   Return JS_ATOM_NULL if not found. */
 // XXX: `str` must be raw 8-bit contents. No UTF-8 encoded strings
 static JSAtom __JS_FindAtom(JSRuntime *rt, const char *str, size_t len,
                             int atom_type)
@@ -3092,14 +4043,15 @@ static JSAtom __JS_FindAtom(JSRuntime *rt, const char *str, size_t len,
     uint32_t h, h1, i;
     JSAtomStruct *p;
 
-    h = hash_string8((const uint8_t *)str, len, JS_ATOM_TYPE_STRING);
-    h &= JS_ATOM_HASH_MASK;
+    h = hash_string8((const uint8_t *)str, len, atom_type);
     h1 = h & (rt->atom_hash_size - 1);
-    i = rt->atom_hash[h1];
-    while (i != 0) {
+    for(;;) {
+        i = rt->atom_hash[h1];
+        if (i == 0)
+            break;
         p = rt->atom_array[i];
         if (p->hash == h &&
-            p->atom_type == JS_ATOM_TYPE_STRING &&
+            p->atom_type == atom_type &&
             p->len == len &&
             p->is_wide_char == 0 &&
             memcmp(str8(p), str, len) == 0) {
@@ -3107,7 +4059,7 @@ static JSAtom __JS_FindAtom(JSRuntime *rt, const char *str, size_t len,
                 p->header.ref_count++;
             return i;
         }
-        i = p->hash_next;
+        h1 = (h1 + 1) & (rt->atom_hash_size - 1);
     }
     return JS_ATOM_NULL;
 }
@@ -3116,26 +4068,25 @@ static void JS_FreeAtomStruct(JSRuntime *rt, JSAtomStruct *p)
 {
     uint32_t i = p->hash_next;  /* atom_index */
     if (p->atom_type != JS_ATOM_TYPE_SYMBOL) {
-        JSAtomStruct *p0, *p1;
-        uint32_t h0;
-
-        h0 = p->hash & (rt->atom_hash_size - 1);
-        i = rt->atom_hash[h0];
-        p1 = rt->atom_array[i];
-        if (p1 == p) {
-            rt->atom_hash[h0] = p1->hash_next;
-        } else {
-            for(;;) {
-                assert(i != 0);
-                p0 = p1;
-                i = p1->hash_next;
-                p1 = rt->atom_array[i];
-                if (p1 == p) {
-                    p0->hash_next = p1->hash_next;
-                    break;
-                }
+        uint32_t mask, j, k, h1;
+
+        mask = rt->atom_hash_size - 1;
+        j = p->hash & mask;
+        while (rt->atom_hash[j] != i) {
+            assert(rt->atom_hash[j] != 0);
+            j = (j + 1) & mask;
+        }
+        /* backward shift deletion: move up the following entries of the
+           cluster that may live at j without breaking their probe
+           sequence, then clear the last hole */
+        for(k = (j + 1) & mask; rt->atom_hash[k] != 0; k = (k + 1) & mask) {
+            h1 = rt->atom_array[rt->atom_hash[k]]->hash & mask;
+            if (((k - h1) & mask) >= ((k - j) & mask)) {
+                rt->atom_hash[j] = rt->atom_hash[k];
+                j = k;
             }
         }
+        rt->atom_hash[j] = 0;
     }
     /* insert in free atom list */
     rt->atom_array[i] = atom_set_free(rt->atom_free_index);
@@ -3181,15 +4132,23 @@ static JSAtom JS_NewAtomStr(JSContext *ctx, JSString *p)
 JSAtom JS_NewAtomLen(JSContext *ctx, const char *str, size_t len)
 {
     JSValue val;
+    size_t i;
 
-    if (len == 0 || !is_digit(*str)) {
-        // TODO(chqrlie): this does not work if `str` has UTF-8 encoded contents
-        // bug example: `({ "\u00c3\u00a9": 1 }).\u00e9` evaluates to `1`.
-        JSAtom atom = __JS_FindAtom(ctx->rt, str, len, JS_ATOM_TYPE_STRING);
-        if (atom)
-            return atom;
+    for(i = 0; i < len; i++) {
+        if ((uint8_t)str[i] >= 0x80)
+            break;
+    }
+    if (i == len) {
+        /* pure ASCII: the raw bytes are the 8-bit string contents */
+        if (len == 0 || !is_digit(*str)) {
+            JSAtom atom = __JS_FindAtom(ctx->rt, str, len, JS_ATOM_TYPE_STRING);
+            if (atom)
+                return atom;
+        }
+        val = js_new_string8_len(ctx, str, len);
+    } else {
+        val = JS_NewStringLen(ctx, str, len);
     }
-    val = JS_NewStringLen(ctx, str, len);
     if (JS_IsException(val))
         return JS_ATOM_NULL;
     return JS_NewAtomStr(ctx, JS_VALUE_GET_STRING(val));
@@ -3302,11 +4261,8 @@ static const char *JS_AtomGetStr(JSContext *ctx, char *buf, int buf_size, JSAtom
 
 static JSValue __JS_AtomToValue(JSContext *ctx, JSAtom atom, bool force_string)
 {
-    char buf[ATOM_GET_STR_BUF_SIZE];
-
     if (__JS_AtomIsTaggedInt(atom)) {
-        size_t len = u32toa(buf, __JS_AtomToUInt32(atom));
-        return js_new_string8_len(ctx, buf, len);
+        return js_new_string_uint32(ctx, __JS_AtomToUInt32(atom));
     } else {
         JSRuntime *rt = ctx->rt;
         JSAtomStruct *p;
@@ -3706,11 +4662,31 @@ static inline JSValue js_empty_string(JSRuntime *rt)
     return js_dup(JS_MKPTR(JS_TAG_STRING, p));
 }
 
+/* return the cached one character string for the Latin-1 character 'c' */
+static JSValue js_new_string_char8(JSContext *ctx, uint8_t c)
+{
+    JSRuntime *rt = ctx->rt;
+    JSString *str;
+
+    str = rt->char_string_cache[c];
+    if (unlikely(!str)) {
+        str = js_alloc_string(ctx, 1, 0);
+        if (!str)
+            return JS_EXCEPTION;
+        str8(str)[0] = c;
+        str8(str)[1] = '\0';
+        rt->char_string_cache[c] = str;
+    }
+    return js_dup(JS_MKPTR(JS_TAG_STRING, str));
+}
+
 // XXX: `buf` contains raw 8-bit data, no UTF-8 decoding is performed
 // XXX: no special case for len == 0
 static JSValue js_new_string8_len(JSContext *ctx, const char *buf, int len)
 {
     JSString *str;
+    if (len == 1)
+        return js_new_string_char8(ctx, buf[0]);
     str = js_alloc_string(ctx, len, 0);
     if (!str)
         return JS_EXCEPTION;
@@ -3736,11 +4712,38 @@ static JSValue js_new_string16_len(JSContext *ctx, const uint16_t *buf, int len)
     return JS_MKPTR(JS_TAG_STRING, str);
 }
 
+/* decimal representation of 'n', cached for small values */
+static JSValue js_new_string_uint32(JSContext *ctx, uint32_t n)
+{
+    JSRuntime *rt = ctx->rt;
+    JSValue val;
+    char buf[16];
+    size_t len;
+
+    if (n < JS_INT_STRING_CACHE_SIZE && rt->int_string_cache[n])
+        return js_dup(JS_MKPTR(JS_TAG_STRING, rt->int_string_cache[n]));
+    len = u32toa(buf, n);
+    val = js_new_string8_len(ctx, buf, len);
+    if (n < JS_INT_STRING_CACHE_SIZE && !JS_IsException(val))
+        rt->int_string_cache[n] = JS_VALUE_GET_STRING(js_dup(val));
+    return val;
+}
+
+static JSValue js_new_string_int32(JSContext *ctx, int32_t n)
+{
+    char buf[16];
+    size_t len;
+
+    if (n >= 0)
+        return js_new_string_uint32(ctx, n);
+    len = i32toa(buf, n);
+    return js_new_string8_len(ctx, buf, len);
+}
+
 static JSValue js_new_string_char(JSContext *ctx, uint16_t c)
 {
     if (c < 0x100) {
-        char ch8 = c;
-        return js_new_string8_len(ctx, &ch8, 1);
+        return js_new_string_char8(ctx, c);
     } else {
         uint16_t ch16 = c;
         return js_new_string16_len(ctx, &ch16, 1);
@@ -3778,6 +4781,8 @@ static JSValue js_sub_string(JSContext *ctx, JSString *p, int start, int end)
         slice->parent = p;
         slice->start = start << p->is_wide_char; // chars -> bytes
         p->header.ref_count++;
+        list_add_tail(&slice->link, &ctx->rt->string_slice_list);
+        ctx->rt->string_slice_count++;
         return JS_MKPTR(JS_TAG_STRING, q);
     }
     if (p->is_wide_char) {
@@ -4539,8 +5544,10 @@ static JSValue JS_ConcatString(JSContext *ctx, JSValue op1, JSValue op2)
         goto ret_op1;
     }
     if (p1->header.ref_count == 1 && p1->is_wide_char == p2->is_wide_char
+    &&  p1->atom_type == 0 && p1->kind == JS_STRING_KIND_NORMAL
     &&  js_malloc_usable_size(ctx, p1) >= sizeof(*p1) + ((p1->len + p2->len) << p2->is_wide_char) + 1 - p1->is_wide_char) {
         /* Concatenate in place in available space at the end of p1 */
+        p1->hash = 0; /* invalidate the cached hash */
         if (p1->is_wide_char) {
             memcpy(str16(p1) + p1->len, str16(p2), p2->len << 1);
             p1->len += p2->len;
@@ -4681,7 +5688,9 @@ static no_inline JSShape *js_new_shape2(JSContext *ctx, JSObject *proto,
         resize_shape_hash(rt, rt->shape_hash_bits + 1);
     }
 
-    sh_alloc = js_malloc(ctx, get_shape_size(hash_size, prop_size));
+    rt->alloc_kind = JS_ALLOC_KIND_OBJECT;
+    sh_alloc = js_slab_alloc(ctx, get_shape_size(hash_size, prop_size));
+    rt->alloc_kind = JS_ALLOC_KIND_OTHER;
     if (!sh_alloc)
         return NULL;
     sh = get_shape_from_alloc(sh_alloc, hash_size);
@@ -4723,7 +5732,7 @@ static JSShape *js_clone_shape(JSContext *ctx, JSShape *sh1)
 
     hash_size = sh1->prop_hash_mask + 1;
     size = get_shape_size(hash_size, sh1->prop_size);
-    sh_alloc = js_malloc(ctx, size);
+    sh_alloc = js_slab_alloc(ctx, size);
     if (!sh_alloc)
         return NULL;
     sh_alloc1 = get_alloc_from_shape(sh1);
@@ -4764,13 +5773,16 @@ static void js_free_shape0(JSRuntime *rt, JSShape *sh)
         pr++;
     }
     remove_gc_object(&sh->header);
-    js_free_rt(rt, get_alloc_from_shape(sh));
+    js_slab_free_rt(rt, get_alloc_from_shape(sh),
+                    get_shape_size(sh->prop_hash_mask + 1, sh->prop_size));
 }
 
 static void js_free_shape(JSRuntime *rt, JSShape *sh)
 {
     if (unlikely(--sh->header.ref_count <= 0)) {
         js_free_shape0(rt, sh);
+    } else {
+        gc_add_root(rt, &sh->header);
     }
 }
 
@@ -4787,19 +5799,31 @@ static no_inline int resize_properties(JSContext *ctx, JSShape **psh,
     JSShape *sh;
     uint32_t new_size, new_hash_size, new_hash_mask, i;
     JSShapeProperty *pr;
+    JSProperty *new_prop;
     void *sh_alloc;
     intptr_t h;
 
     sh = *psh;
     new_size = max_int(count, sh->prop_size * 3 / 2);
     /* Reallocate prop array first to avoid crash or size inconsistency
-       in case of memory allocation failure */
+       in case of memory allocation failure. When it moves to another
+       slab slot, it is only replaced at the end. */
+    new_prop = NULL;
     if (p) {
-        JSProperty *new_prop;
-        new_prop = js_realloc(ctx, p->prop, sizeof(new_prop[0]) * new_size);
-        if (unlikely(!new_prop))
-            return -1;
-        p->prop = new_prop;
+        if (js_slab_realloc_moves(sizeof(new_prop[0]) * sh->prop_size,
+                                  sizeof(new_prop[0]) * new_size)) {
+            new_prop = js_slab_alloc(ctx, sizeof(new_prop[0]) * new_size);
+            if (unlikely(!new_prop))
+                return -1;
+        } else {
+            JSProperty *prop;
+            prop = js_slab_realloc(ctx, p->prop,
+                                   sizeof(prop[0]) * sh->prop_size,
+                                   sizeof(prop[0]) * new_size);
+            if (unlikely(!prop))
+                return -1;
+            p->prop = prop;
+        }
     }
     new_hash_size = sh->prop_hash_mask + 1;
     while (new_hash_size < new_size)
@@ -4808,15 +5832,15 @@ static no_inline int resize_properties(JSContext *ctx, JSShape **psh,
         JSShape *old_sh;
         /* resize the hash table and the properties */
         old_sh = sh;
-        sh_alloc = js_malloc(ctx, get_shape_size(new_hash_size, new_size));
+        sh_alloc = js_slab_alloc(ctx, get_shape_size(new_hash_size, new_size));
         if (!sh_alloc)
-            return -1;
+            goto fail;
         sh = get_shape_from_alloc(sh_alloc, new_hash_size);
         list_del(&old_sh->header.link);
         /* copy all the fields and the properties */
         memcpy(sh, old_sh,
                sizeof(JSShape) + sizeof(sh->prop[0]) * old_sh->prop_count);
-        list_add_tail(&sh->header.link, &ctx->rt->gc_obj_list);
+        gc_relink_object(ctx->rt, &sh->header);
         new_hash_mask = new_hash_size - 1;
         sh->prop_hash_mask = new_hash_mask;
         memset(prop_hash_end(sh) - new_hash_size, 0,
@@ -4828,23 +5852,34 @@ static no_inline int resize_properties(JSContext *ctx, JSShape **psh,
                 prop_hash_end(sh)[-h - 1] = i + 1;
             }
         }
-        js_free(ctx, get_alloc_from_shape(old_sh));
+        js_slab_free(ctx, get_alloc_from_shape(old_sh),
+                     get_shape_size(old_sh->prop_hash_mask + 1,
+                                    old_sh->prop_size));
     } else {
         /* only resize the properties */
         list_del(&sh->header.link);
-        sh_alloc = js_realloc(ctx, get_alloc_from_shape(sh),
-                              get_shape_size(new_hash_size, new_size));
+        sh_alloc = js_slab_realloc(ctx, get_alloc_from_shape(sh),
+                                   get_shape_size(new_hash_size, sh->prop_size),
+                                   get_shape_size(new_hash_size, new_size));
         if (unlikely(!sh_alloc)) {
             /* insert again in the GC list */
-            list_add_tail(&sh->header.link, &ctx->rt->gc_obj_list);
-            return -1;
+            gc_relink_object(ctx->rt, &sh->header);
+            goto fail;
         }
         sh = get_shape_from_alloc(sh_alloc, new_hash_size);
-        list_add_tail(&sh->header.link, &ctx->rt->gc_obj_list);
+        gc_relink_object(ctx->rt, &sh->header);
+    }
+    if (new_prop) {
+        memcpy(new_prop, p->prop, sizeof(new_prop[0]) * sh->prop_size);
+        js_slab_free(ctx, p->prop, sizeof(new_prop[0]) * sh->prop_size);
+        p->prop = new_prop;
     }
     *psh = sh;
     sh->prop_size = new_size;
     return 0;
+ fail:
+    js_slab_free(ctx, new_prop, sizeof(new_prop[0]) * new_size);
+    return -1;
 }
 
 /* remove the deleted properties. */
@@ -4869,15 +5904,26 @@ static int compact_properties(JSContext *ctx, JSObject *p)
         new_hash_size = new_hash_size / 2;
     new_hash_mask = new_hash_size - 1;
 
+    /* the reduced object properties are allocated first when they move
+       to another slab slot, so that nothing fails after the update */
+    new_prop = NULL;
+    if (js_slab_realloc_moves(sizeof(new_prop[0]) * sh->prop_size,
+                              sizeof(new_prop[0]) * new_size)) {
+        new_prop = js_slab_alloc(ctx, sizeof(new_prop[0]) * new_size);
+        if (!new_prop)
+            return -1;
+    }
     /* resize the hash table and the properties */
     old_sh = sh;
-    sh_alloc = js_malloc(ctx, get_shape_size(new_hash_size, new_size));
-    if (!sh_alloc)
+    sh_alloc = js_slab_alloc(ctx, get_shape_size(new_hash_size, new_size));
+    if (!sh_alloc) {
+        js_slab_free(ctx, new_prop, sizeof(new_prop[0]) * new_size);
         return -1;
+    }
     sh = get_shape_from_alloc(sh_alloc, new_hash_size);
     list_del(&old_sh->header.link);
     memcpy(sh, old_sh, sizeof(JSShape));
-    list_add_tail(&sh->header.link, &ctx->rt->gc_obj_list);
+    gc_relink_object(ctx->rt, &sh->header);
 
     memset(prop_hash_end(sh) - new_hash_size, 0,
            sizeof(prop_hash_end(sh)[0]) * new_hash_size);
@@ -4906,12 +5952,21 @@ static int compact_properties(JSContext *ctx, JSObject *p)
     sh->prop_count = j;
 
     p->shape = sh;
-    js_free(ctx, get_alloc_from_shape(old_sh));
 
     /* reduce the size of the object properties */
-    new_prop = js_realloc(ctx, p->prop, sizeof(new_prop[0]) * new_size);
-    if (new_prop)
+    if (new_prop) {
+        memcpy(new_prop, prop, sizeof(prop[0]) * j);
+        js_slab_free(ctx, prop, sizeof(prop[0]) * old_sh->prop_size);
         p->prop = new_prop;
+    } else {
+        new_prop = js_slab_realloc(ctx, prop,
+                                   sizeof(prop[0]) * old_sh->prop_size,
+                                   sizeof(prop[0]) * new_size);
+        if (new_prop)
+            p->prop = new_prop;
+    }
+    js_slab_free(ctx, get_alloc_from_shape(old_sh),
+                 get_shape_size(old_sh->prop_hash_mask + 1, old_sh->prop_size));
     return 0;
 }
 
@@ -5044,6 +6099,7 @@ static __maybe_unused void JS_DumpShapes(JSRuntime *rt)
         }
     }
     /* dump non-hashed shapes */
+    gc_join_lists(rt);
     list_for_each(el, &rt->gc_obj_list) {
         gp = list_entry(el, JSGCObjectHeader, link);
         if (gp->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT) {
@@ -5053,6 +6109,7 @@ static __maybe_unused void JS_DumpShapes(JSRuntime *rt)
             }
         }
     }
+    gc_split_lists(rt);
     printf("}\n");
 }
 
@@ -5061,7 +6118,8 @@ static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID clas
     JSObject *p;
 
     js_trigger_gc(ctx->rt, sizeof(JSObject));
-    p = js_malloc(ctx, sizeof(JSObject));
+    ctx->rt->alloc_kind = JS_ALLOC_KIND_OBJECT;
+    p = js_slab_alloc(ctx, sizeof(JSObject));
     if (unlikely(!p))
         goto fail;
     p->class_id = class_id;
@@ -5076,13 +6134,15 @@ static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID clas
     p->first_weak_ref = NULL;
     p->u.opaque = NULL;
     p->shape = sh;
-    p->prop = js_malloc(ctx, sizeof(JSProperty) * sh->prop_size);
+    p->prop = js_slab_alloc(ctx, sizeof(JSProperty) * sh->prop_size);
     if (unlikely(!p->prop)) {
-        js_free(ctx, p);
+        js_slab_free(ctx, p, sizeof(JSObject));
     fail:
+        ctx->rt->alloc_kind = JS_ALLOC_KIND_OTHER;
         js_free_shape(ctx->rt, sh);
         return JS_EXCEPTION;
     }
+    ctx->rt->alloc_kind = JS_ALLOC_KIND_OTHER;
 
     switch(class_id) {
     case JS_CLASS_OBJECT:
@@ -5779,7 +6839,9 @@ static void free_var_ref(JSRuntime *rt, JSVarRef *var_ref)
             } else {
                 list_del(&var_ref->header.link); /* still on the stack */
             }
-            js_free_rt(rt, var_ref);
+            js_slab_free_rt(rt, var_ref, sizeof(JSVarRef));
+        } else if (var_ref->is_detached) {
+            gc_add_root(rt, &var_ref->header);
         }
     }
 }
@@ -5946,7 +7008,7 @@ static void free_object(JSRuntime *rt, JSObject *p)
         free_property(rt, &p->prop[i], pr->flags);
         pr++;
     }
-    js_free_rt(rt, p->prop);
+    js_slab_free_rt(rt, p->prop, sizeof(JSProperty) * sh->prop_size);
     /* as an optimization we destroy the shape immediately without
        putting it in gc_zero_ref_count_list */
     js_free_shape(rt, sh);
@@ -5973,7 +7035,7 @@ static void free_object(JSRuntime *rt, JSObject *p)
     if (rt->gc_phase == JS_GC_PHASE_REMOVE_CYCLES && p->header.ref_count != 0) {
         list_add_tail(&p->header.link, &rt->gc_zero_ref_count_list);
     } else {
-        js_free_rt(rt, p);
+        js_slab_free_rt(rt, p, sizeof(JSObject));
     }
 }
 
@@ -6013,6 +7075,10 @@ static void js_free_value_rt(JSRuntime *rt, JSValue v)
 {
     uint32_t tag = JS_VALUE_GET_TAG(v);
 
+    /* the arena runtimes are released at once */
+    if (unlikely(rt->arena && rt->arena->closing))
+        return;
+
 #ifdef ENABLE_DUMPS // JS_DUMP_FREE
     if (check_dump_flag(rt, JS_DUMP_FREE)) {
         /* Prevent invalid object access during GC */
@@ -6043,6 +7109,12 @@ static void js_free_value_rt(JSRuntime *rt, JSValue v)
                 if (rt->gc_phase == JS_GC_PHASE_NONE) {
                     free_zero_refcount(rt);
                 }
+            } else if (!(p->mark & 1)) {
+                /* only referenced by the freed cycles (possible when
+                   JS_RunGCStep() collects a part of the heap): free
+                   it with them */
+                list_del(&p->link);
+                list_add_tail(&p->link, &rt->tmp_obj_list);
             }
         }
         break;
@@ -6073,6 +7145,9 @@ void JS_FreeValueRT(JSRuntime *rt, JSValue v)
         JSRefCountHeader *p = (JSRefCountHeader *)JS_VALUE_GET_PTR(v);
         if (--p->ref_count <= 0) {
             js_free_value_rt(rt, v);
+        } else if (JS_VALUE_GET_TAG(v) == JS_TAG_OBJECT ||
+                   JS_VALUE_GET_TAG(v) == JS_TAG_FUNCTION_BYTECODE) {
+            gc_add_root(rt, (JSGCObjectHeader *)p);
         }
     }
 }
@@ -6097,6 +7172,27 @@ static void remove_gc_object(JSGCObjectHeader *h)
     list_del(&h->link);
 }
 
+/* called when the reference count of 'p' is decremented to a non zero
+   value: it may now be part of a garbage cycle */
+static inline void gc_add_root(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    /* bit 0 is set when 'p' is in the set being freed */
+    if (!(p->mark & (1 | 8))) {
+        p->mark |= 8;
+        list_del(&p->link);
+        list_add_tail(&p->link, &rt->gc_root_list);
+    }
+}
+
+/* insert again 'p' in its GC list after it was moved in memory */
+static inline void gc_relink_object(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    if (p->mark & 8)
+        list_add_tail(&p->link, &rt->gc_root_list);
+    else
+        list_add_tail(&p->link, &rt->gc_obj_list);
+}
+
 void JS_MarkValue(JSRuntime *rt, JSValueConst val, JS_MarkFunc *mark_func)
 {
     if (JS_VALUE_HAS_REF_COUNT(val)) {
@@ -6248,7 +7344,7 @@ static void gc_decref(JSRuntime *rt)
        tmp_obj_list */
     list_for_each_safe(el, el1, &rt->gc_obj_list) {
         p = list_entry(el, JSGCObjectHeader, link);
-        assert(p->mark == 0);
+        assert(!(p->mark & 1));
         mark_children(rt, p, gc_decref_child);
         p->mark = 1;
         if (p->ref_count == 0) {
@@ -6281,11 +7377,13 @@ static void gc_scan(JSRuntime *rt)
     JSGCObjectHeader *p;
 
     /* keep the objects with a refcount > 0 and their children. */
+    rt->gc_live_count = 0;
     list_for_each(el, &rt->gc_obj_list) {
         p = list_entry(el, JSGCObjectHeader, link);
         assert(p->ref_count > 0);
         p->mark = 0; /* reset the mark for the next GC call */
         mark_children(rt, p, gc_scan_incref_child);
+        rt->gc_live_count++;
     }
 
     /* restore the refcount of the objects to be deleted. */
@@ -6340,14 +7438,154 @@ static void gc_free_cycles(JSRuntime *rt)
         p = list_entry(el, JSGCObjectHeader, link);
         assert(p->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT ||
                p->gc_obj_type == JS_GC_OBJ_TYPE_FUNCTION_BYTECODE);
-        js_free_rt(rt, p);
+        if (p->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT)
+            js_slab_free_rt(rt, p, sizeof(JSObject));
+        else
+            js_free_rt(rt, p);
     }
 
     init_list_head(&rt->gc_zero_ref_count_list);
 }
 
+static int js_string_slice_cmp(const void *a, const void *b, void *opaque)
+{
+    JSString *p1 = ((JSStringSlice *)&(*(JSString **)a)[1])->parent;
+    JSString *p2 = ((JSStringSlice *)&(*(JSString **)b)[1])->parent;
+    return (p1 > p2) - (p1 < p2);
+}
+
+/* A slice keeps its whole parent string alive. When a parent is only
+   referenced by slices that cover less than half of it, give each slice
+   its own copy of the characters so that the parent can be freed. The
+   slice strings themselves are kept since values point to them. */
+static void gc_compact_string_slices(JSRuntime *rt)
+{
+    struct list_head *el;
+    JSStringSlice *slice;
+    JSString **tab, *p, *parent;
+    int i, j, n, k;
+    size_t size;
+
+    n = rt->string_slice_count;
+    if (n == 0)
+        return;
+    tab = js_malloc_rt(rt, sizeof(tab[0]) * n);
+    if (!tab)
+        return;
+    i = 0;
+    list_for_each(el, &rt->string_slice_list) {
+        slice = list_entry(el, JSStringSlice, link);
+        tab[i++] = (JSString *)slice - 1;
+    }
+    assert(i == n);
+    rqsort(tab, n, sizeof(tab[0]), js_string_slice_cmp, NULL);
+
+    for(i = 0; i < n; i = j) {
+        parent = ((JSStringSlice *)&tab[i][1])->parent;
+        size = 0;
+        for(j = i; j < n; j++) {
+            p = tab[j];
+            slice = (void *)&p[1];
+            if (slice->parent != parent)
+                break;
+            size += p->len << p->is_wide_char;
+        }
+        if (parent->header.ref_count != j - i || parent->atom_type ||
+            size * 2 >= (parent->len << parent->is_wide_char))
+            continue;
+        for(k = i; k < j; k++) {
+            JSString *q;
+            p = tab[k];
+            slice = (void *)&p[1];
+            q = js_alloc_string_rt(rt, p->len, p->is_wide_char);
+            if (!q)
+                continue;
+            memcpy(str8(q), str8(p), p->len << p->is_wide_char);
+            if (!q->is_wide_char)
+                str8(q)[q->len] = '\0';
+            slice->parent = q;
+            slice->start = 0;
+            js_free_string(rt, parent);
+        }
+    }
+    js_free_rt(rt, tab);
+}
+
+static void gc_get_lists(JSRuntime *rt, struct list_head **tab)
+{
+    tab[0] = &rt->gc_root_list;
+    tab[1] = &rt->gc_step_todo_list;
+    tab[2] = &rt->gc_step_done_list;
+}
+
+/* temporarily append the candidate roots and the objects of the
+   incremental cycle to gc_obj_list so that all the GC objects can be
+   iterated. The lists must not be modified before gc_split_lists() is
+   called. */
+static void gc_join_lists(JSRuntime *rt)
+{
+    struct list_head *tab[countof(rt->gc_join_first)];
+    struct list_head *first, *last, *tail;
+    int i;
+
+    gc_get_lists(rt, tab);
+    for(i = 0; i < countof(tab); i++) {
+        if (list_empty(tab[i])) {
+            rt->gc_join_first[i] = NULL;
+            continue;
+        }
+        first = tab[i]->next;
+        last = tab[i]->prev;
+        tail = rt->gc_obj_list.prev;
+        tail->next = first;
+        first->prev = tail;
+        last->next = &rt->gc_obj_list;
+        rt->gc_obj_list.prev = last;
+        rt->gc_join_first[i] = first;
+    }
+}
+
+static void gc_split_lists(JSRuntime *rt)
+{
+    struct list_head *tab[countof(rt->gc_join_first)];
+    struct list_head *first, *last, *tail;
+    int i;
+
+    gc_get_lists(rt, tab);
+    for(i = countof(tab) - 1; i >= 0; i--) {
+        first = rt->gc_join_first[i];
+        if (!first)
+            continue;
+        tail = first->prev;
+        last = rt->gc_obj_list.prev;
+        tail->next = &rt->gc_obj_list;
+        rt->gc_obj_list.prev = tail;
+        first->prev = tab[i];
+        tab[i]->next = first;
+        last->next = tab[i];
+        tab[i]->prev = last;
+    }
+}
+
+/* move the candidate roots back to gc_obj_list */
+static void gc_flush_roots(JSRuntime *rt)
+{
+    struct list_head *el, *el1;
+    JSGCObjectHeader *p;
+
+    list_for_each_safe(el, el1, &rt->gc_root_list) {
+        p = list_entry(el, JSGCObjectHeader, link);
+        p->mark &= ~8;
+        list_del(&p->link);
+        list_add_tail(&p->link, &rt->gc_obj_list);
+    }
+}
+
 void JS_RunGC(JSRuntime *rt)
 {
+    gc_step_abort(rt);
+    gc_flush_roots(rt);
+
     /* decrement the reference of the children of each object. mark =
        1 after this pass. */
     gc_decref(rt);
@@ -6357,6 +7595,385 @@ void JS_RunGC(JSRuntime *rt)
 
     /* free the GC objects in a cycle */
     gc_free_cycles(rt);
+
+    /* copy out small slices of large strings that nothing else holds */
+    if (!rt->in_free)
+        gc_compact_string_slices(rt);
+
+    /* give back the slab pages emptied by the collection */
+    js_slab_trim(rt, 2);
+}
+
+/* Partial collections run the trial deletion of JS_RunGC() on a set of
+   objects kept in gc_step_list with bit 0 of 'mark' set. The
+   references coming from outside the set are counted as external, so
+   only the cycles fully contained in the set are freed. A partial
+   collection is atomic, hence it is correct whatever the set is: the
+   set only decides which cycles can be found. */
+
+static void gc_step_decref_child(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    if (p->mark & 1) {
+        assert(p->ref_count > 0);
+        p->ref_count--;
+    }
+}
+
+static void gc_step_incref_child(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    if (p->mark & 1) {
+        p->ref_count++;
+        if (p->ref_count == 1) {
+            /* ref_count was 0: remove from tmp_obj_list and add at the
+               end of the set being scanned */
+            list_del(&p->link);
+            list_add_tail(&p->link, &rt->gc_step_list);
+        }
+    }
+}
+
+static void gc_step_incref_child2(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    if (p->mark & 1)
+        p->ref_count++;
+}
+
+/* the references internal to the set have been removed. Free the
+   cycles and move the survivors to gc_obj_list. Return the number of
+   survivors. */
+static size_t gc_collect_set(JSRuntime *rt)
+{
+    struct list_head *el, *el1;
+    JSGCObjectHeader *p;
+    size_t n;
+
+    init_list_head(&rt->tmp_obj_list);
+    list_for_each_safe(el, el1, &rt->gc_step_list) {
+        p = list_entry(el, JSGCObjectHeader, link);
+        if (p->ref_count == 0) {
+            list_del(&p->link);
+            list_add_tail(&p->link, &rt->tmp_obj_list);
+        }
+    }
+
+    /* keep the objects with a refcount > 0 and their children */
+    list_for_each(el, &rt->gc_step_list) {
+        p = list_entry(el, JSGCObjectHeader, link);
+        mark_children(rt, p, gc_step_incref_child);
+    }
+    list_for_each(el, &rt->tmp_obj_list) {
+        p = list_entry(el, JSGCObjectHeader, link);
+        mark_children(rt, p, gc_step_incref_child2);
+    }
+
+    n = 0;
+    list_for_each_safe(el, el1, &rt->gc_step_list) {
+        p = list_entry(el, JSGCObjectHeader, link);
+        p->mark = 0;
+        list_del(&p->link);
+        list_add_tail(&p->link, &rt->gc_obj_list);
+        n++;
+    }
+
+    gc_free_cycles(rt);
+    return n;
+}
+
+/* Candidate roots (Bacon-Rajan): a garbage cycle has lost its last
+   external reference when the reference count of one of its objects
+   was decremented to a non zero value. Such objects are moved to
+   gc_root_list with bit 3 of 'mark' set, and gc_collect_roots() only
+   looks for cycles among the objects reachable from them. */
+static void gc_root_decref_child(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    if (!(p->mark & 1)) {
+        /* a realm references most of the heap: its references are
+           counted as external, JS_RunGC() frees the cycles through
+           it */
+        if (p->gc_obj_type == JS_GC_OBJ_TYPE_JS_CONTEXT)
+            return;
+        p->mark = 1;
+        list_del(&p->link);
+        list_add_tail(&p->link, &rt->gc_step_list);
+    }
+    assert(p->ref_count > 0);
+    p->ref_count--;
+}
+
+/* return the number of visited objects which are not garbage */
+static size_t gc_collect_roots(JSRuntime *rt)
+{
+    struct list_head *el, *el1;
+    JSGCObjectHeader *p;
+
+    init_list_head(&rt->gc_step_list);
+    list_for_each_safe(el, el1, &rt->gc_root_list) {
+        p = list_entry(el, JSGCObjectHeader, link);
+        p->mark = 1;
+        list_del(&p->link);
+        list_add_tail(&p->link, &rt->gc_step_list);
+    }
+    /* the objects reachable from the roots are added to the set while
+       it is iterated */
+    list_for_each(el, &rt->gc_step_list) {
+        p = list_entry(el, JSGCObjectHeader, link);
+        mark_children(rt, p, gc_root_decref_child);
+    }
+    return gc_collect_set(rt);
+}
+
+/* Incremental collection: a cycle runs the trial deletion on the
+   whole heap in short steps between which the program runs.
+   - JS_GC_STEP_SCAN sets bit 1 of 'mark' of the GC objects. The
+     objects allocated later are not part of the cycle.
+   - JS_GC_STEP_COUNT counts in gc_step_counts the references coming
+     from the objects of the cycle. 'ref_count' is not modified.
+   - JS_GC_STEP_MARK clears bit 1 of the objects having more references
+     than counted, i.e. referenced from outside the cycle, and of the
+     objects reachable from them.
+   The program modifies the references between the steps, so the
+   remaining objects are only candidates: the last step frees the
+   cycles among them with an atomic partial collection. Its pause is
+   proportional to the number of candidates, which are the garbage and
+   the objects whose references changed during the cycle. An object
+   leaving the lists of the cycle (because it is freed, becomes a
+   candidate root or is reallocated) is kept by the cycle. The count
+   table takes 32 to 64 bytes per object of the cycle. */
+#define JS_GC_STEP_SLICE_SIZE 256
+
+/* move the elements of 'src' to the end of 'dst' */
+static void gc_move_list(struct list_head *dst, struct list_head *src)
+{
+    if (list_empty(src))
+        return;
+    src->next->prev = dst->prev;
+    dst->prev->next = src->next;
+    src->prev->next = dst;
+    dst->prev = src->prev;
+    init_list_head(src);
+}
+
+static JSGCStepCount *gc_step_find_count(JSRuntime *rt, JSGCObjectHeader *p,
+                                         bool add)
+{
+    JSGCStepCount *e;
+    uint32_t h, mask;
+
+    mask = rt->gc_step_count_size - 1;
+    h = ((uint64_t)(uintptr_t)p * 0x9e3779b97f4a7c15) >> 32;
+    for(;;) {
+        e = &rt->gc_step_counts[h & mask];
+        if (e->obj == p)
+            return e;
+        if (!e->obj)
+            break;
+        h++;
+    }
+    /* when the table is full, the next objects have no count and are
+       kept */
+    if (!add || rt->gc_step_count_used >= rt->gc_step_count_size / 4 * 3)
+        return NULL;
+    rt->gc_step_count_used++;
+    e->obj = p;
+    return e;
+}
+
+static void gc_step_count_child(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    JSGCStepCount *e;
+
+    if (p->mark & 2) {
+        e = gc_step_find_count(rt, p, true);
+        if (e)
+            e->count++;
+    }
+}
+
+static void gc_step_mark_child(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    if (p->mark & 2) {
+        /* visited before the remaining candidates */
+        p->mark &= ~2;
+        list_del(&p->link);
+        list_add(&p->link, &rt->gc_step_todo_list);
+    }
+}
+
+static void gc_step_start(JSRuntime *rt)
+{
+    gc_move_list(&rt->gc_step_todo_list, &rt->gc_obj_list);
+    gc_move_list(&rt->gc_step_todo_list, &rt->gc_root_list);
+    rt->gc_step_object_count = 0;
+    rt->gc_step_phase = JS_GC_STEP_SCAN;
+}
+
+/* end the current cycle without freeing anything */
+static void gc_step_abort(JSRuntime *rt)
+{
+    if (rt->gc_step_phase == JS_GC_STEP_NONE)
+        return;
+    gc_move_list(&rt->gc_obj_list, &rt->gc_step_todo_list);
+    gc_move_list(&rt->gc_obj_list, &rt->gc_step_done_list);
+    js_free_rt(rt, rt->gc_step_counts);
+    rt->gc_step_counts = NULL;
+    rt->gc_step_phase = JS_GC_STEP_NONE;
+}
+
+static int gc_step_alloc_counts(JSRuntime *rt)
+{
+    uint32_t size;
+
+    size = 256;
+    while (size < rt->gc_step_object_count * 2)
+        size *= 2;
+    rt->gc_step_counts = js_malloc_rt(rt, sizeof(rt->gc_step_counts[0]) * size);
+    if (!rt->gc_step_counts)
+        return -1;
+    rt->gc_step_count_size = size;
+    rt->gc_step_count_used = 0;
+    return 0;
+}
+
+/* free the cycles among the remaining candidates */
+static void gc_step_finish(JSRuntime *rt)
+{
+    struct list_head *el;
+    JSGCObjectHeader *p;
+
+    js_free_rt(rt, rt->gc_step_counts);
+    rt->gc_step_counts = NULL;
+    rt->gc_step_phase = JS_GC_STEP_NONE;
+
+    init_list_head(&rt->gc_step_list);
+    gc_move_list(&rt->gc_step_list, &rt->gc_step_done_list);
+    list_for_each(el, &rt->gc_step_list) {
+        p = list_entry(el, JSGCObjectHeader, link);
+        p->mark = 1;
+    }
+    list_for_each(el, &rt->gc_step_list) {
+        p = list_entry(el, JSGCObjectHeader, link);
+        mark_children(rt, p, gc_step_decref_child);
+    }
+    gc_collect_set(rt);
+}
+
+/* visit one object, or clear a part of the count table. Return true
+   when the cycle is complete. */
+static bool gc_step_visit(JSRuntime *rt)
+{
+    struct list_head *el;
+    JSGCObjectHeader *p;
+    JSGCStepCount *e;
+    uint32_t n;
+
+    el = rt->gc_step_todo_list.next;
+    switch(rt->gc_step_phase) {
+    case JS_GC_STEP_SCAN:
+        if (el == &rt->gc_step_todo_list) {
+            if (gc_step_alloc_counts(rt)) {
+                gc_step_abort(rt);
+                return true;
+            }
+            rt->gc_step_phase = JS_GC_STEP_CLEAR;
+            break;
+        }
+        p = list_entry(el, JSGCObjectHeader, link);
+        p->mark = 2; /* also removes it from the candidate roots */
+        list_del(&p->link);
+        list_add_tail(&p->link, &rt->gc_step_done_list);
+        rt->gc_step_object_count++;
+        break;
+    case JS_GC_STEP_CLEAR:
+        n = min_uint32(rt->gc_step_count_size - rt->gc_step_count_used, 64);
+        memset(&rt->gc_step_counts[rt->gc_step_count_used], 0,
+               sizeof(rt->gc_step_counts[0]) * n);
+        rt->gc_step_count_used += n;
+        if (rt->gc_step_count_used == rt->gc_step_count_size) {
+            rt->gc_step_count_used = 0;
+            gc_move_list(&rt->gc_step_todo_list, &rt->gc_step_done_list);
+            rt->gc_step_phase = JS_GC_STEP_COUNT;
+        }
+        break;
+    case JS_GC_STEP_COUNT:
+        if (el == &rt->gc_step_todo_list) {
+            gc_move_list(&rt->gc_step_todo_list, &rt->gc_step_done_list);
+            rt->gc_step_phase = JS_GC_STEP_MARK;
+            break;
+        }
+        p = list_entry(el, JSGCObjectHeader, link);
+        mark_children(rt, p, gc_step_count_child);
+        list_del(&p->link);
+        list_add_tail(&p->link, &rt->gc_step_done_list);
+        break;
+    case JS_GC_STEP_MARK:
+        if (el == &rt->gc_step_todo_list) {
+            gc_step_finish(rt);
+            return true;
+        }
+        p = list_entry(el, JSGCObjectHeader, link);
+        list_del(&p->link);
+        if (p->mark & 2) {
+            e = gc_step_find_count(rt, p, false);
+            if (p->ref_count <= (e ? e->count : 0)) {
+                list_add_tail(&p->link, &rt->gc_step_done_list);
+                break;
+            }
+            p->mark &= ~2;
+        }
+        mark_children(rt, p, gc_step_mark_child);
+        gc_relink_object(rt, p);
+        break;
+    default:
+        abort();
+    }
+    return false;
+}
+
+bool JS_RunGCStep(JSRuntime *rt, int64_t budget_us)
+{
+    uint64_t deadline;
+    int n;
+
+    /* the objects are being freed */
+    if (rt->gc_phase != JS_GC_PHASE_NONE)
+        return false;
+    deadline = js__hrtime_ns() + max_int64(budget_us, 0) * 1000;
+    if (rt->gc_step_phase == JS_GC_STEP_NONE)
+        gc_step_start(rt);
+    rt->gc_step_work = 0;
+    for(;;) {
+        for(n = 0; n < JS_GC_STEP_SLICE_SIZE; n++) {
+            if (gc_step_visit(rt))
+                return true;
+        }
+        rt->gc_step_work += n;
+        if (js__hrtime_ns() >= deadline)
+            return false;
+    }
+}
+
+void JS_SetGCStepBudget(JSRuntime *rt, int64_t budget_us)
+{
+    rt->gc_step_budget = max_int64(budget_us, 0);
+}
+
+void JS_SetGCHeapGrowth(JSRuntime *rt, int percent)
+{
+    rt->gc_heap_growth = max_int(percent, 1);
+    rt->gc_growth = rt->gc_heap_growth;
+}
+
+void JS_SetGCTargetPause(JSRuntime *rt, int64_t pause_us)
+{
+    rt->gc_target_pause = max_int64(pause_us, 0);
+}
+
+void JS_GetGCStats(JSRuntime *rt, JSGCStats *s)
+{
+    *s = rt->gc_stats;
+    s->heap_size = js_gc_heap_size(rt);
+    s->gc_threshold = rt->malloc_gc_threshold;
+    s->heap_growth = rt->gc_growth;
 }
 
 /* Return false if not an object or if the object has already been
@@ -6415,12 +8032,17 @@ static void compute_bytecode_size(JSFunctionBytecode *b, JSMemoryUsage_helper *h
     if (b->closure_var) {
         js_func_size += b->closure_var_count * sizeof(*b->closure_var);
     }
-    if (b->byte_code_buf) {
+    if (b->byte_code_buf && !b->rom_atoms) {
         hp->js_func_code_size += b->byte_code_len;
     }
     memory_used_count++;
-    js_func_size += b->source_len + 1;
-    if (b->pc2line_len) {
+    if (b->source_blob) {
+        /* shared by the functions of the script */
+        js_func_size += (b->source_blob->len + 1) / b->source_blob->ref_count;
+    } else if (!b->debug_in_rom) {
+        js_func_size += b->source_len + 1;
+    }
+    if (b->pc2line_len && !b->debug_in_rom) {
         memory_used_count++;
         hp->js_func_pc2line_count += 1;
         hp->js_func_pc2line_size += b->pc2line_len;
@@ -6504,6 +8126,7 @@ void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s)
         }
     }
 
+    gc_join_lists(rt);
     list_for_each(el, &rt->gc_obj_list) {
         JSGCObjectHeader *gp = list_entry(el, JSGCObjectHeader, link);
         JSObject *p;
@@ -6691,6 +8314,7 @@ void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s)
             break;
         }
     }
+    gc_split_lists(rt);
     s->obj_size += s->obj_count * sizeof(JSObject);
 
     /* hashed shapes */
@@ -6719,6 +8343,18 @@ void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s)
     }
     s->str_count = round(mem.str_count);
     s->str_size = round(mem.str_size);
+    /* bytes of parent strings kept alive by slices but not covered by them */
+    s->str_slice_count = rt->string_slice_count;
+    list_for_each(el, &rt->string_slice_list) {
+        JSStringSlice *slice = list_entry(el, JSStringSlice, link);
+        JSString *str = (JSString *)slice - 1;
+        JSString *parent = slice->parent;
+        int64_t size = (sizeof(*parent) + (parent->len << parent->is_wide_char) +
+                        1 - parent->is_wide_char) / parent->header.ref_count;
+        size -= str->len << str->is_wide_char;
+        if (size > 0)
+            s->str_slice_retained_size += size;
+    }
     s->js_func_count = mem.js_func_count;
     s->js_func_size = round(mem.js_func_size);
     s->js_func_code_size = mem.js_func_code_size;
@@ -6769,6 +8405,7 @@ void JS_DumpMemoryUsage(FILE *fp, const JSMemoryUsage *s, JSRuntime *rt)
             int obj_classes[JS_CLASS_INIT_COUNT + 1] = { 0 };
             int class_id;
             struct list_head *el;
+            gc_join_lists(rt);
             list_for_each(el, &rt->gc_obj_list) {
                 JSGCObjectHeader *gp = list_entry(el, JSGCObjectHeader, link);
                 JSObject *p;
@@ -6777,6 +8414,7 @@ void JS_DumpMemoryUsage(FILE *fp, const JSMemoryUsage *s, JSRuntime *rt)
                     obj_classes[min_uint32(p->class_id, JS_CLASS_INIT_COUNT)]++;
                 }
             }
+            gc_split_lists(rt);
             fprintf(fp, "\n" "JSObject classes\n");
             if (obj_classes[0])
                 fprintf(fp, "  %5d  %2.0d %s\n", obj_classes[0], 0, "none");
@@ -6854,6 +8492,1012 @@ void JS_DumpMemoryUsage(FILE *fp, const JSMemoryUsage *s, JSRuntime *rt)
         fprintf(fp, "%-20s %8"PRId64" %8"PRId64"\n",
                 "binary objects", s->binary_object_count, s->binary_object_size);
     }
+    if (s->str_slice_count) {
+        fprintf(fp, "%-20s %8"PRId64" %8"PRId64"  (retained by slices)\n",
+                "string slices", s->str_slice_count, s->str_slice_retained_size);
+    }
+}
+
+/* return the name of the function object 'p' without running any code,
+   JS_ATOM_NULL if unknown. The class constructors get their name from
+   a property. */
+static JSAtom js_get_func_name_atom(JSRuntime *rt, JSObject *p)
+{
+    JSProperty *pr;
+    JSShapeProperty *prs;
+    JSString *str;
+    JSAtom atom;
+
+    if (js_class_has_bytecode(p->class_id)) {
+        atom = p->u.func.function_bytecode->func_name;
+        if (atom != JS_ATOM_NULL && atom != JS_ATOM_empty_string)
+            return atom;
+    }
+    prs = find_own_property(&pr, p, JS_ATOM_name);
+    if (!prs || (prs->flags & JS_PROP_TMASK) ||
+        JS_VALUE_GET_TAG(pr->u.value) != JS_TAG_STRING)
+        return JS_ATOM_NULL;
+    /* only the atom strings can be used */
+    str = JS_VALUE_GET_STRING(pr->u.value);
+    atom = str->hash_next;
+    if (str->atom_type != JS_ATOM_TYPE_STRING || atom >= rt->atom_size ||
+        rt->atom_array[atom] != str)
+        return JS_ATOM_NULL;
+    return atom;
+}
+
+/* write 'p' as a JSON string, truncated to max_len characters */
+static void js_write_json_string(FILE *f, JSString *p, uint32_t max_len)
+{
+    uint32_t i, len, c;
+
+    fputc('"', f);
+    len = min_uint32(p->len, max_len);
+    for(i = 0; i < len; i++) {
+        c = p->is_wide_char ? str16(p)[i] : str8(p)[i];
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c >= 0x20 && c < 0x7f)
+            fputc(c, f);
+        else
+            fprintf(f, "\\u%04x", c);
+    }
+    fputc('"', f);
+}
+
+/* Heap snapshot in the Chrome DevTools .heapsnapshot format. The nodes
+   are the GC objects and the strings, symbols and bigints referenced
+   by them. A synthetic root node references the objects which have
+   references from outside the heap (C code, stack). */
+
+#define JS_HEAP_NODE_FIELD_COUNT 7
+
+enum {
+    JS_HEAP_NODE_HIDDEN,
+    JS_HEAP_NODE_ARRAY,
+    JS_HEAP_NODE_STRING,
+    JS_HEAP_NODE_OBJECT,
+    JS_HEAP_NODE_CODE,
+    JS_HEAP_NODE_CLOSURE,
+    JS_HEAP_NODE_REGEXP,
+    JS_HEAP_NODE_NUMBER,
+    JS_HEAP_NODE_NATIVE,
+    JS_HEAP_NODE_SYNTHETIC,
+    JS_HEAP_NODE_CONCATENATED_STRING,
+    JS_HEAP_NODE_SLICED_STRING,
+    JS_HEAP_NODE_SYMBOL,
+    JS_HEAP_NODE_BIGINT,
+    JS_HEAP_NODE_OBJECT_SHAPE,
+};
+
+enum {
+    JS_HEAP_EDGE_CONTEXT,
+    JS_HEAP_EDGE_ELEMENT,
+    JS_HEAP_EDGE_PROPERTY,
+    JS_HEAP_EDGE_INTERNAL,
+    JS_HEAP_EDGE_HIDDEN,
+    JS_HEAP_EDGE_SHORTCUT,
+    JS_HEAP_EDGE_WEAK,
+};
+
+/* names of the string table shared by the nodes and edges */
+enum {
+    JS_HEAP_NAME_EMPTY,
+    JS_HEAP_NAME_GC_ROOTS,
+    JS_HEAP_NAME_INTERNAL,
+    JS_HEAP_NAME_SHAPE_EDGE,
+    JS_HEAP_NAME_PROTO,
+    JS_HEAP_NAME_PARENT,
+    JS_HEAP_NAME_REALM,
+    JS_HEAP_NAME_VALUE,
+    JS_HEAP_NAME_SHAPE,
+    JS_HEAP_NAME_VAR_REF,
+    JS_HEAP_NAME_ASYNC_FUNCTION,
+    JS_HEAP_NAME_CONTEXT,
+    JS_HEAP_NAME_BIGINT,
+    JS_HEAP_NAME_COUNT,
+};
+
+static const char * const js_heap_snapshot_names[JS_HEAP_NAME_COUNT] = {
+    "", "(GC roots)", "(internal)", "shape", "__proto__", "parent",
+    "realm", "value", "(shape)", "(closure variable)",
+    "(async function)", "(context)", "bigint",
+};
+
+/* kind of the pointer of a node */
+enum {
+    JS_HEAP_PTR_ROOT,
+    JS_HEAP_PTR_GC_OBJECT,
+    JS_HEAP_PTR_STRING,
+    JS_HEAP_PTR_SYMBOL,
+    JS_HEAP_PTR_BIGINT,
+};
+
+typedef struct JSHeapSnapshotNode {
+    void *ptr;
+    uint8_t kind; /* JS_HEAP_PTR_x */
+    uint8_t type; /* JS_HEAP_NODE_x */
+    uint32_t name; /* index in the string table */
+    size_t self_size;
+    uint32_t first_edge;
+    uint32_t edge_count;
+    uint32_t in_count; /* number of edges to this node */
+} JSHeapSnapshotNode;
+
+typedef struct JSHeapSnapshotEdge {
+    uint8_t type; /* JS_HEAP_EDGE_x */
+    uint32_t name_or_index;
+    uint32_t to; /* node index */
+} JSHeapSnapshotEdge;
+
+typedef struct JSHeapSnapshotName {
+    const char *cstr;
+    JSString *str; /* used if cstr is NULL */
+} JSHeapSnapshotName;
+
+typedef struct JSHeapSnapshot {
+    JSRuntime *rt;
+    JSHeapSnapshotNode *nodes;
+    uint32_t node_count, node_size;
+    JSHeapSnapshotEdge *edges;
+    uint32_t edge_count, edge_size;
+    JSHeapSnapshotName *names;
+    uint32_t name_count, name_size;
+    uint32_t *atom_names; /* name index + 1 of each atom, 0 if none */
+    uint32_t *hash; /* node index + 1, open addressing */
+    uint32_t hash_size; /* power of two */
+    /* label of the edges added by js_heap_snapshot_mark() */
+    uint8_t mark_type;
+    uint32_t mark_name;
+    bool oom;
+} JSHeapSnapshot;
+
+static bool js_heap_snapshot_grow(JSHeapSnapshot *hs, void **parray,
+                                  uint32_t *psize, size_t elem_size,
+                                  uint32_t count)
+{
+    uint32_t new_size;
+    void *new_array;
+
+    if (count < *psize)
+        return true;
+    if (hs->oom)
+        return false;
+    new_size = max_int(*psize * 3 / 2, 64);
+    new_array = js_realloc_rt(hs->rt, *parray, (size_t)new_size * elem_size);
+    if (!new_array) {
+        hs->oom = true;
+        return false;
+    }
+    *parray = new_array;
+    *psize = new_size;
+    return true;
+}
+
+static uint32_t js_heap_snapshot_cname(JSHeapSnapshot *hs, const char *cstr)
+{
+    JSHeapSnapshotName *n;
+
+    if (!js_heap_snapshot_grow(hs, (void **)&hs->names, &hs->name_size,
+                               sizeof(*hs->names), hs->name_count))
+        return 0;
+    n = &hs->names[hs->name_count];
+    n->cstr = cstr;
+    n->str = NULL;
+    return hs->name_count++;
+}
+
+static uint32_t js_heap_snapshot_sname(JSHeapSnapshot *hs, JSString *str)
+{
+    uint32_t idx = js_heap_snapshot_cname(hs, NULL);
+    if (!hs->oom)
+        hs->names[idx].str = str;
+    return idx;
+}
+
+static uint32_t js_heap_snapshot_aname(JSHeapSnapshot *hs, JSAtom atom)
+{
+    JSRuntime *rt = hs->rt;
+
+    if (atom == JS_ATOM_NULL || __JS_AtomIsTaggedInt(atom) ||
+        atom >= rt->atom_size)
+        return 0; /* "" */
+    if (!hs->atom_names[atom])
+        hs->atom_names[atom] = js_heap_snapshot_sname(hs, rt->atom_array[atom]) + 1;
+    return hs->atom_names[atom] - 1;
+}
+
+static uint32_t js_heap_snapshot_func_name(JSHeapSnapshot *hs, JSObject *p)
+{
+    return js_heap_snapshot_aname(hs, js_get_func_name_atom(hs->rt, p));
+}
+
+static uint32_t js_heap_snapshot_hash_ptr(JSHeapSnapshot *hs, void *ptr)
+{
+    uintptr_t h = (uintptr_t)ptr >> 3;
+    h ^= h >> 17;
+    return (uint32_t)(h * 0x9E3779B1) & (hs->hash_size - 1);
+}
+
+static bool js_heap_snapshot_resize_hash(JSHeapSnapshot *hs)
+{
+    uint32_t *new_hash, *old_hash = hs->hash;
+    uint32_t i, h, old_size = hs->hash_size;
+
+    new_hash = js_mallocz_rt(hs->rt, sizeof(*new_hash) * old_size * 2);
+    if (!new_hash) {
+        hs->oom = true;
+        return false;
+    }
+    hs->hash = new_hash;
+    hs->hash_size = old_size * 2;
+    for(i = 0; i < old_size; i++) {
+        if (old_hash[i]) {
+            h = js_heap_snapshot_hash_ptr(hs, hs->nodes[old_hash[i] - 1].ptr);
+            while (new_hash[h])
+                h = (h + 1) & (hs->hash_size - 1);
+            new_hash[h] = old_hash[i];
+        }
+    }
+    js_free_rt(hs->rt, old_hash);
+    return true;
+}
+
+static size_t js_heap_snapshot_string_size(JSString *p)
+{
+    if (p->kind == JS_STRING_KIND_SLICE)
+        return sizeof(*p) + sizeof(JSStringSlice);
+    return sizeof(*p) + (p->len << p->is_wide_char) + 1 - p->is_wide_char;
+}
+
+static void js_heap_snapshot_init_node(JSHeapSnapshot *hs,
+                                       JSHeapSnapshotNode *n)
+{
+    JSRuntime *rt = hs->rt;
+
+    switch(n->kind) {
+    case JS_HEAP_PTR_ROOT:
+        n->type = JS_HEAP_NODE_SYNTHETIC;
+        n->name = JS_HEAP_NAME_GC_ROOTS;
+        break;
+    case JS_HEAP_PTR_GC_OBJECT:
+        {
+            JSGCObjectHeader *gp = n->ptr;
+            switch(gp->gc_obj_type) {
+            case JS_GC_OBJ_TYPE_JS_OBJECT:
+                {
+                    JSObject *p = (JSObject *)gp;
+                    n->self_size = sizeof(*p);
+                    if (p->prop)
+                        n->self_size += p->shape->prop_size * sizeof(*p->prop);
+                    switch(p->class_id) {
+                    case JS_CLASS_ARRAY:
+                    case JS_CLASS_ARGUMENTS:
+                        n->type = JS_HEAP_NODE_ARRAY;
+                        if (p->fast_array)
+                            n->self_size += p->u.array.count * sizeof(JSValue);
+                        break;
+                    case JS_CLASS_BYTECODE_FUNCTION:
+                        n->type = JS_HEAP_NODE_CLOSURE;
+                        n->name = js_heap_snapshot_func_name(hs, p);
+                        return;
+                    case JS_CLASS_C_FUNCTION:
+                    case JS_CLASS_C_FUNCTION_DATA:
+                    case JS_CLASS_C_CLOSURE:
+                    case JS_CLASS_BOUND_FUNCTION:
+                        n->type = JS_HEAP_NODE_CLOSURE;
+                        break;
+                    case JS_CLASS_REGEXP:
+                        n->type = JS_HEAP_NODE_REGEXP;
+                        break;
+                    case JS_CLASS_ARRAY_BUFFER:
+                    case JS_CLASS_SHARED_ARRAY_BUFFER:
+                        n->type = JS_HEAP_NODE_OBJECT;
+                        if (p->u.array_buffer)
+                            n->self_size += p->u.array_buffer->byte_length;
+                        break;
+                    case JS_CLASS_OBJECT:
+                        n->type = JS_HEAP_NODE_OBJECT;
+                        /* use the constructor name as DevTools does */
+                        if (p->shape->proto) {
+                            JSProperty *pr;
+                            JSShapeProperty *prs;
+                            JSObject *f;
+                            prs = find_own_property(&pr, p->shape->proto,
+                                                    JS_ATOM_constructor);
+                            if (prs && !(prs->flags & JS_PROP_TMASK) &&
+                                JS_VALUE_GET_TAG(pr->u.value) == JS_TAG_OBJECT) {
+                                f = JS_VALUE_GET_OBJ(pr->u.value);
+                                if (f->class_id == JS_CLASS_BYTECODE_FUNCTION) {
+                                    n->name = js_heap_snapshot_func_name(hs, f);
+                                    if (n->name != JS_HEAP_NAME_EMPTY)
+                                        return;
+                                }
+                            }
+                        }
+                        break;
+                    default:
+                        n->type = JS_HEAP_NODE_OBJECT;
+                        break;
+                    }
+                    n->name = js_heap_snapshot_aname(hs, rt->class_array[p->class_id].class_name);
+                }
+                break;
+            case JS_GC_OBJ_TYPE_FUNCTION_BYTECODE:
+                {
+                    JSFunctionBytecode *b = (JSFunctionBytecode *)gp;
+                    n->type = JS_HEAP_NODE_CODE;
+                    n->name = js_heap_snapshot_aname(hs, b->func_name);
+                    n->self_size = sizeof(*b) +
+                        (b->rom_atoms ? 0 : b->byte_code_len) +
+                        b->cpool_count * sizeof(*b->cpool) +
+                        b->closure_var_count * sizeof(*b->closure_var) +
+                        (b->debug_in_rom ? 0 : b->source_len + b->pc2line_len);
+                    if (b->vardefs)
+                        n->self_size += (b->arg_count + b->var_count) * sizeof(*b->vardefs);
+                }
+                break;
+            case JS_GC_OBJ_TYPE_SHAPE:
+                {
+                    JSShape *sh = (JSShape *)gp;
+                    n->type = JS_HEAP_NODE_OBJECT_SHAPE;
+                    n->name = JS_HEAP_NAME_SHAPE;
+                    n->self_size = get_shape_size(sh->prop_hash_mask + 1,
+                                                  sh->prop_size);
+                }
+                break;
+            case JS_GC_OBJ_TYPE_VAR_REF:
+                n->type = JS_HEAP_NODE_HIDDEN;
+                n->name = JS_HEAP_NAME_VAR_REF;
+                n->self_size = sizeof(JSVarRef);
+                break;
+            case JS_GC_OBJ_TYPE_ASYNC_FUNCTION:
+                n->type = JS_HEAP_NODE_HIDDEN;
+                n->name = JS_HEAP_NAME_ASYNC_FUNCTION;
+                n->self_size = sizeof(JSAsyncFunctionData);
+                break;
+            case JS_GC_OBJ_TYPE_JS_CONTEXT:
+                n->type = JS_HEAP_NODE_NATIVE;
+                n->name = JS_HEAP_NAME_CONTEXT;
+                n->self_size = sizeof(JSContext) +
+                    sizeof(JSValue) * rt->class_count;
+                break;
+            default:
+                abort();
+            }
+        }
+        break;
+    case JS_HEAP_PTR_STRING:
+        {
+            JSString *p = n->ptr;
+            n->type = (p->kind == JS_STRING_KIND_SLICE) ?
+                JS_HEAP_NODE_SLICED_STRING : JS_HEAP_NODE_STRING;
+            n->name = js_heap_snapshot_sname(hs, p);
+            n->self_size = js_heap_snapshot_string_size(p);
+        }
+        break;
+    case JS_HEAP_PTR_SYMBOL:
+        {
+            JSAtomStruct *p = n->ptr;
+            n->type = JS_HEAP_NODE_SYMBOL;
+            n->name = js_heap_snapshot_sname(hs, p);
+            n->self_size = js_heap_snapshot_string_size(p);
+        }
+        break;
+    case JS_HEAP_PTR_BIGINT:
+        {
+            JSBigInt *p = n->ptr;
+            n->type = JS_HEAP_NODE_BIGINT;
+            n->name = JS_HEAP_NAME_BIGINT;
+            n->self_size = sizeof(*p) + p->len * sizeof(js_limb_t);
+        }
+        break;
+    default:
+        abort();
+    }
+}
+
+/* return the node index of 'ptr', adding it if needed. Return -1 if
+   out of memory. */
+static int64_t js_heap_snapshot_node(JSHeapSnapshot *hs, void *ptr, int kind)
+{
+    JSHeapSnapshotNode *n;
+    uint32_t h;
+
+    if (hs->oom)
+        return -1;
+    h = js_heap_snapshot_hash_ptr(hs, ptr);
+    while (hs->hash[h]) {
+        if (hs->nodes[hs->hash[h] - 1].ptr == ptr)
+            return hs->hash[h] - 1;
+        h = (h + 1) & (hs->hash_size - 1);
+    }
+    if (!js_heap_snapshot_grow(hs, (void **)&hs->nodes, &hs->node_size,
+                               sizeof(*hs->nodes), hs->node_count))
+        return -1;
+    n = &hs->nodes[hs->node_count];
+    memset(n, 0, sizeof(*n));
+    n->ptr = ptr;
+    n->kind = kind;
+    hs->hash[h] = ++hs->node_count;
+    js_heap_snapshot_init_node(hs, &hs->nodes[hs->node_count - 1]);
+    if (hs->node_count * 2 > hs->hash_size)
+        js_heap_snapshot_resize_hash(hs);
+    return hs->node_count - 1;
+}
+
+static void js_heap_snapshot_edge(JSHeapSnapshot *hs, int type,
+                                  uint32_t name_or_index, void *ptr, int kind)
+{
+    JSHeapSnapshotEdge *e;
+    int64_t idx;
+
+    idx = js_heap_snapshot_node(hs, ptr, kind);
+    if (idx < 0)
+        return;
+    if (!js_heap_snapshot_grow(hs, (void **)&hs->edges, &hs->edge_size,
+                               sizeof(*hs->edges), hs->edge_count))
+        return;
+    e = &hs->edges[hs->edge_count++];
+    e->type = type;
+    e->name_or_index = name_or_index;
+    e->to = idx;
+    hs->nodes[idx].in_count++;
+}
+
+static void js_heap_snapshot_value(JSHeapSnapshot *hs, int type,
+                                   uint32_t name_or_index, JSValueConst val)
+{
+    if (!JS_VALUE_HAS_REF_COUNT(val))
+        return;
+    switch(JS_VALUE_GET_TAG(val)) {
+    case JS_TAG_OBJECT:
+    case JS_TAG_FUNCTION_BYTECODE:
+        js_heap_snapshot_edge(hs, type, name_or_index,
+                              JS_VALUE_GET_PTR(val), JS_HEAP_PTR_GC_OBJECT);
+        break;
+    case JS_TAG_STRING:
+        js_heap_snapshot_edge(hs, type, name_or_index,
+                              JS_VALUE_GET_PTR(val), JS_HEAP_PTR_STRING);
+        break;
+    case JS_TAG_SYMBOL:
+        js_heap_snapshot_edge(hs, type, name_or_index,
+                              JS_VALUE_GET_PTR(val), JS_HEAP_PTR_SYMBOL);
+        break;
+    case JS_TAG_BIG_INT:
+        js_heap_snapshot_edge(hs, type, name_or_index,
+                              JS_VALUE_GET_PTR(val), JS_HEAP_PTR_BIGINT);
+        break;
+    default:
+        break;
+    }
+}
+
+/* JS_MarkFunc adding an edge with the current label */
+static void js_heap_snapshot_mark(JSRuntime *rt, JSGCObjectHeader *gp)
+{
+    JSHeapSnapshot *hs = rt->heap_snapshot;
+    js_heap_snapshot_edge(hs, hs->mark_type, hs->mark_name, gp,
+                          JS_HEAP_PTR_GC_OBJECT);
+}
+
+/* add the edges of a node. They must match mark_children() so that the
+   number of internal references of the GC objects is known. */
+static void js_heap_snapshot_edges(JSHeapSnapshot *hs, JSHeapSnapshotNode *n)
+{
+    JSRuntime *rt = hs->rt;
+    JSGCObjectHeader *gp;
+    int i;
+
+    hs->mark_type = JS_HEAP_EDGE_INTERNAL;
+    hs->mark_name = JS_HEAP_NAME_INTERNAL;
+    if (n->kind == JS_HEAP_PTR_STRING) {
+        JSString *p = n->ptr;
+        if (p->kind == JS_STRING_KIND_SLICE) {
+            JSStringSlice *slice = (void *)&p[1];
+            js_heap_snapshot_edge(hs, JS_HEAP_EDGE_INTERNAL,
+                                  JS_HEAP_NAME_PARENT,
+                                  slice->parent, JS_HEAP_PTR_STRING);
+        }
+        return;
+    }
+    if (n->kind != JS_HEAP_PTR_GC_OBJECT)
+        return;
+    gp = n->ptr;
+    switch(gp->gc_obj_type) {
+    case JS_GC_OBJ_TYPE_JS_OBJECT:
+        {
+            JSObject *p = (JSObject *)gp;
+            JSShape *sh = p->shape;
+            JSShapeProperty *prs;
+            uint32_t name;
+            int type;
+
+            js_heap_snapshot_edge(hs, JS_HEAP_EDGE_INTERNAL,
+                                  JS_HEAP_NAME_SHAPE_EDGE,
+                                  sh, JS_HEAP_PTR_GC_OBJECT);
+            prs = get_shape_prop(sh);
+            for(i = 0; i < sh->prop_count; i++, prs++) {
+                JSProperty *pr = &p->prop[i];
+                if (prs->atom == JS_ATOM_NULL)
+                    continue;
+                if (__JS_AtomIsTaggedInt(prs->atom)) {
+                    type = JS_HEAP_EDGE_ELEMENT;
+                    name = __JS_AtomToUInt32(prs->atom);
+                } else {
+                    type = JS_HEAP_EDGE_PROPERTY;
+                    name = js_heap_snapshot_aname(hs, prs->atom);
+                }
+                switch(prs->flags & JS_PROP_TMASK) {
+                case JS_PROP_GETSET:
+                    if (pr->u.getset.getter)
+                        js_heap_snapshot_edge(hs, type, name, pr->u.getset.getter,
+                                              JS_HEAP_PTR_GC_OBJECT);
+                    if (pr->u.getset.setter)
+                        js_heap_snapshot_edge(hs, type, name, pr->u.getset.setter,
+                                              JS_HEAP_PTR_GC_OBJECT);
+                    break;
+                case JS_PROP_VARREF:
+                    if (pr->u.var_ref->is_detached)
+                        js_heap_snapshot_edge(hs, type, name, pr->u.var_ref,
+                                              JS_HEAP_PTR_GC_OBJECT);
+                    break;
+                case JS_PROP_AUTOINIT:
+                    js_autoinit_mark(rt, pr, js_heap_snapshot_mark);
+                    break;
+                case JS_PROP_NORMAL:
+                    js_heap_snapshot_value(hs, type, name, pr->u.value);
+                    break;
+                }
+            }
+            if (unlikely(p->first_weak_ref))
+                mark_weak_map_value(rt, p->first_weak_ref, js_heap_snapshot_mark);
+            if ((p->class_id == JS_CLASS_ARRAY ||
+                 p->class_id == JS_CLASS_ARGUMENTS) && p->fast_array) {
+                for(i = 0; i < p->u.array.count; i++) {
+                    js_heap_snapshot_value(hs, JS_HEAP_EDGE_ELEMENT, i,
+                                           p->u.array.u.values[i]);
+                }
+            } else if (p->class_id != JS_CLASS_OBJECT) {
+                JSClassGCMark *gc_mark;
+                gc_mark = rt->class_array[p->class_id].gc_mark;
+                if (gc_mark)
+                    gc_mark(rt, JS_MKPTR(JS_TAG_OBJECT, p), js_heap_snapshot_mark);
+            }
+        }
+        break;
+    case JS_GC_OBJ_TYPE_FUNCTION_BYTECODE:
+        {
+            JSFunctionBytecode *b = (JSFunctionBytecode *)gp;
+            for(i = 0; i < b->cpool_count; i++) {
+                /* the strings are not counted by mark_children() */
+                js_heap_snapshot_value(hs, JS_HEAP_EDGE_ELEMENT, i, b->cpool[i]);
+            }
+            if (b->realm)
+                js_heap_snapshot_edge(hs, JS_HEAP_EDGE_INTERNAL,
+                                      JS_HEAP_NAME_REALM,
+                                      b->realm, JS_HEAP_PTR_GC_OBJECT);
+        }
+        break;
+    case JS_GC_OBJ_TYPE_VAR_REF:
+        {
+            JSVarRef *var_ref = (JSVarRef *)gp;
+            if (var_ref->is_detached)
+                js_heap_snapshot_value(hs, JS_HEAP_EDGE_INTERNAL,
+                                       JS_HEAP_NAME_VALUE,
+                                       *var_ref->pvalue);
+        }
+        break;
+    case JS_GC_OBJ_TYPE_SHAPE:
+        {
+            JSShape *sh = (JSShape *)gp;
+            if (sh->proto)
+                js_heap_snapshot_edge(hs, JS_HEAP_EDGE_PROPERTY,
+                                      JS_HEAP_NAME_PROTO,
+                                      sh->proto, JS_HEAP_PTR_GC_OBJECT);
+        }
+        break;
+    default:
+        mark_children(rt, gp, js_heap_snapshot_mark);
+        break;
+    }
+}
+
+static void js_heap_snapshot_write_name(FILE *f, JSHeapSnapshotName *n)
+{
+    const char *s;
+
+    if (!n->cstr) {
+        /* long strings are truncated */
+        js_write_json_string(f, n->str, 1024);
+        return;
+    }
+    fputc('"', f);
+    for(s = n->cstr; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static void js_heap_snapshot_write(JSHeapSnapshot *hs, FILE *f)
+{
+    JSHeapSnapshotNode *n;
+    JSHeapSnapshotEdge *e;
+    uint32_t i, j;
+    bool first = true;
+
+    fputs("{\"snapshot\":{\"meta\":{"
+          "\"node_fields\":[\"type\",\"name\",\"id\",\"self_size\","
+          "\"edge_count\",\"trace_node_id\",\"detachedness\"],"
+          "\"node_types\":[[\"hidden\",\"array\",\"string\",\"object\","
+          "\"code\",\"closure\",\"regexp\",\"number\",\"native\","
+          "\"synthetic\",\"concatenated string\",\"sliced string\","
+          "\"symbol\",\"bigint\",\"object shape\"],\"string\",\"number\","
+          "\"number\",\"number\",\"number\",\"number\"],"
+          "\"edge_fields\":[\"type\",\"name_or_index\",\"to_node\"],"
+          "\"edge_types\":[[\"context\",\"element\",\"property\","
+          "\"internal\",\"hidden\",\"shortcut\",\"weak\"],"
+          "\"string_or_number\",\"node\"],"
+          "\"trace_function_info_fields\":[\"function_id\",\"name\","
+          "\"script_name\",\"script_id\",\"line\",\"column\"],"
+          "\"trace_node_fields\":[\"id\",\"function_info_index\",\"count\","
+          "\"size\",\"children\"],"
+          "\"sample_fields\":[\"timestamp_us\",\"last_assigned_id\"],"
+          "\"location_fields\":[\"object_index\",\"script_id\",\"line\","
+          "\"column\"]},", f);
+    fprintf(f, "\"node_count\":%u,\"edge_count\":%u,"
+            "\"trace_function_count\":0},\n\"nodes\":[",
+            hs->node_count, hs->edge_count);
+    for(i = 0; i < hs->node_count; i++) {
+        n = &hs->nodes[i];
+        fprintf(f, "%s%u,%u,%u,%zu,%u,0,0", i ? ",\n" : "", n->type,
+                n->name, 2 * i + 1, n->self_size, n->edge_count);
+    }
+    fputs("],\n\"edges\":[", f);
+    for(i = 0; i < hs->node_count; i++) {
+        n = &hs->nodes[i];
+        for(j = 0; j < n->edge_count; j++) {
+            e = &hs->edges[n->first_edge + j];
+            fprintf(f, "%s%u,%u,%u", first ? "" : ",\n",
+                    e->type, e->name_or_index, e->to * JS_HEAP_NODE_FIELD_COUNT);
+            first = false;
+        }
+    }
+    fputs("],\n\"trace_function_infos\":[],\"trace_tree\":[],"
+          "\"samples\":[],\"locations\":[],\n\"strings\":[", f);
+    for(i = 0; i < hs->name_count; i++) {
+        if (i)
+            fputs(",\n", f);
+        js_heap_snapshot_write_name(f, &hs->names[i]);
+    }
+    fputs("]}\n", f);
+}
+
+int JS_WriteHeapSnapshot(JSRuntime *rt, FILE *f)
+{
+    JSHeapSnapshot hs_s, *hs = &hs_s;
+    struct list_head *el;
+    JSHeapSnapshotNode *n;
+    uint32_t i, root_edges;
+    int ret;
+
+    memset(hs, 0, sizeof(*hs));
+    hs->rt = rt;
+    hs->hash_size = 1024;
+    hs->hash = js_mallocz_rt(rt, sizeof(*hs->hash) * hs->hash_size);
+    hs->atom_names = js_mallocz_rt(rt, sizeof(*hs->atom_names) * rt->atom_size);
+    if (!hs->hash || !hs->atom_names) {
+        hs->oom = true;
+        goto done;
+    }
+    for(i = 0; i < JS_HEAP_NAME_COUNT; i++)
+        js_heap_snapshot_cname(hs, js_heap_snapshot_names[i]);
+    js_heap_snapshot_node(hs, NULL, JS_HEAP_PTR_ROOT);
+
+    rt->heap_snapshot = hs;
+    gc_join_lists(rt);
+    list_for_each(el, &rt->gc_obj_list) {
+        js_heap_snapshot_node(hs, list_entry(el, JSGCObjectHeader, link),
+                              JS_HEAP_PTR_GC_OBJECT);
+    }
+    /* the edges of a node are consecutive. New nodes may be found while
+       adding them. */
+    for(i = 1; i < hs->node_count && !hs->oom; i++) {
+        hs->nodes[i].first_edge = hs->edge_count;
+        js_heap_snapshot_edges(hs, &hs->nodes[i]);
+        hs->nodes[i].edge_count = hs->edge_count - hs->nodes[i].first_edge;
+    }
+    gc_split_lists(rt);
+    rt->heap_snapshot = NULL;
+
+    /* the GC objects with more references than edges are referenced
+       from outside the heap */
+    hs->nodes[0].first_edge = hs->edge_count;
+    root_edges = 0;
+    for(i = 1; i < hs->node_count && !hs->oom; i++) {
+        n = &hs->nodes[i];
+        if (n->kind == JS_HEAP_PTR_GC_OBJECT &&
+            ((JSGCObjectHeader *)n->ptr)->ref_count > n->in_count) {
+            js_heap_snapshot_edge(hs, JS_HEAP_EDGE_ELEMENT, root_edges++,
+                                  n->ptr, JS_HEAP_PTR_GC_OBJECT);
+        }
+    }
+    hs->nodes[0].edge_count = hs->edge_count - hs->nodes[0].first_edge;
+ done:
+    ret = -1;
+    if (!hs->oom) {
+        js_heap_snapshot_write(hs, f);
+        ret = ferror(f) ? -1 : 0;
+    }
+    js_free_rt(rt, hs->nodes);
+    js_free_rt(rt, hs->edges);
+    js_free_rt(rt, hs->names);
+    js_free_rt(rt, hs->atom_names);
+    js_free_rt(rt, hs->hash);
+    return ret;
+}
+
+/* Sampling allocation profiler: about every 'interval' allocated bytes,
+   the JS stack and the kind of the allocation are recorded in a call
+   tree. A sample stands for 'interval' bytes, or its size if larger. */
+
+typedef struct JSAllocProfileNode {
+    JSAtom func_name;
+    JSAtom filename;
+    int line_num; /* line of the allocation or of the call */
+    int col_num;
+    int kind; /* JS_ALLOC_KIND_x for the leaves, -1 otherwise */
+    uint32_t parent;
+    uint32_t first_child; /* 0 if none */
+    uint32_t next_sibling; /* 0 if none */
+    uint64_t self_size;
+} JSAllocProfileNode;
+
+typedef struct JSAllocProfileSample {
+    uint32_t node;
+    uint64_t size;
+} JSAllocProfileSample;
+
+typedef struct JSAllocProfile {
+    bool active;
+    size_t interval;
+    int max_depth;
+    uint32_t random_state;
+    JSAllocProfileNode *nodes; /* nodes[0] is the root */
+    uint32_t node_count, node_size;
+    JSAllocProfileSample *samples;
+    uint32_t sample_count, sample_size;
+} JSAllocProfile;
+
+static const char * const js_alloc_kind_names[JS_ALLOC_KIND_COUNT] = {
+    "(native)", "(object)", "(string)", "(array buffer)", "(bytecode)",
+};
+
+/* next sample after a random number of bytes in [interval/2, 3*interval/2[
+   so that periodic allocation patterns are not missed */
+static int64_t js_alloc_profile_next(JSAllocProfile *ap)
+{
+    uint32_t x = ap->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    ap->random_state = x;
+    return ap->interval / 2 + (uint64_t)x * ap->interval / UINT32_MAX;
+}
+
+/* return the child of 'parent' with the given frame, creating it if
+   needed. Return 0 if out of memory. */
+static uint32_t js_alloc_profile_child(JSRuntime *rt, JSAllocProfile *ap,
+                                       uint32_t parent, JSAtom func_name,
+                                       JSAtom filename, int line_num,
+                                       int col_num, int kind)
+{
+    JSAllocProfileNode *n, *new_nodes;
+    uint32_t i, new_size;
+
+    for(i = ap->nodes[parent].first_child; i != 0; i = n->next_sibling) {
+        n = &ap->nodes[i];
+        if (n->func_name == func_name && n->filename == filename &&
+            n->line_num == line_num && n->col_num == col_num &&
+            n->kind == kind)
+            return i;
+    }
+    if (ap->node_count >= ap->node_size) {
+        new_size = ap->node_size * 3 / 2;
+        new_nodes = js_realloc_rt(rt, ap->nodes, sizeof(*ap->nodes) * new_size);
+        if (!new_nodes)
+            return 0;
+        ap->nodes = new_nodes;
+        ap->node_size = new_size;
+    }
+    i = ap->node_count++;
+    n = &ap->nodes[i];
+    n->func_name = JS_DupAtomRT(rt, func_name);
+    n->filename = JS_DupAtomRT(rt, filename);
+    n->line_num = line_num;
+    n->col_num = col_num;
+    n->kind = kind;
+    n->parent = parent;
+    n->first_child = 0;
+    n->next_sibling = ap->nodes[parent].first_child;
+    n->self_size = 0;
+    ap->nodes[parent].first_child = i;
+    return i;
+}
+
+static void js_alloc_sample(JSRuntime *rt, size_t size)
+{
+    JSAllocProfile *ap = rt->alloc_profile;
+    JSStackFrame *sf, *frames[64];
+    JSAllocProfileSample *new_samples;
+    JSFunctionBytecode *b;
+    JSObject *p;
+    uint32_t node, new_size;
+    int i, n, line_num, col_num;
+    JSAtom func_name, filename;
+
+    /* no sampling of the allocations done here */
+    rt->alloc_sample_left = INT64_MAX;
+    if (!ap || !ap->active)
+        return;
+
+    n = 0;
+    for(sf = rt->current_stack_frame; sf != NULL && n < ap->max_depth;
+        sf = sf->prev_frame) {
+        if (JS_VALUE_GET_TAG(sf->cur_func) == JS_TAG_OBJECT)
+            frames[n++] = sf;
+    }
+    /* from the outermost frame */
+    node = 0;
+    for(i = n - 1; i >= 0; i--) {
+        sf = frames[i];
+        p = JS_VALUE_GET_OBJ(sf->cur_func);
+        func_name = js_get_func_name_atom(rt, p);
+        filename = JS_ATOM_NULL;
+        line_num = -1;
+        col_num = -1;
+        if (js_class_has_bytecode(p->class_id)) {
+            b = p->u.func.function_bytecode;
+            filename = b->filename;
+            if (sf->cur_pc) {
+                line_num = find_line_num(b->realm, b,
+                                         sf->cur_pc - b->byte_code_buf - 1,
+                                         &col_num);
+            } else {
+                line_num = b->line_num;
+                col_num = b->col_num;
+            }
+        }
+        node = js_alloc_profile_child(rt, ap, node, func_name, filename,
+                                      line_num, col_num, -1);
+        if (!node)
+            goto done;
+    }
+    node = js_alloc_profile_child(rt, ap, node, JS_ATOM_NULL, JS_ATOM_NULL,
+                                  -1, -1, rt->alloc_kind);
+    if (!node)
+        goto done;
+    if (ap->sample_count >= ap->sample_size) {
+        new_size = max_int(ap->sample_size * 3 / 2, 64);
+        new_samples = js_realloc_rt(rt, ap->samples,
+                                    sizeof(*ap->samples) * new_size);
+        if (!new_samples)
+            goto done;
+        ap->samples = new_samples;
+        ap->sample_size = new_size;
+    }
+    ap->samples[ap->sample_count].node = node;
+    ap->samples[ap->sample_count].size = max_int64(size, ap->interval);
+    ap->sample_count++;
+    ap->nodes[node].self_size += max_int64(size, ap->interval);
+ done:
+    rt->alloc_sample_left = js_alloc_profile_next(ap);
+}
+
+static void js_free_alloc_profile(JSRuntime *rt)
+{
+    JSAllocProfile *ap = rt->alloc_profile;
+    uint32_t i;
+
+    if (!ap)
+        return;
+    for(i = 0; i < ap->node_count; i++) {
+        JS_FreeAtomRT(rt, ap->nodes[i].func_name);
+        JS_FreeAtomRT(rt, ap->nodes[i].filename);
+    }
+    js_free_rt(rt, ap->nodes);
+    js_free_rt(rt, ap->samples);
+    js_free_rt(rt, ap);
+    rt->alloc_profile = NULL;
+    rt->alloc_sample_left = INT64_MAX;
+}
+
+int JS_StartAllocationSampling(JSRuntime *rt, size_t interval, int max_depth)
+{
+    JSAllocProfile *ap;
+
+    js_free_alloc_profile(rt);
+    ap = js_mallocz_rt(rt, sizeof(*ap));
+    if (!ap)
+        return -1;
+    ap->node_size = 64;
+    ap->nodes = js_mallocz_rt(rt, sizeof(*ap->nodes) * ap->node_size);
+    if (!ap->nodes) {
+        js_free_rt(rt, ap);
+        return -1;
+    }
+    ap->node_count = 1;
+    ap->nodes[0].kind = -1;
+    ap->active = true;
+    ap->interval = max_int64(interval, 1);
+    ap->max_depth = min_int(max_int(max_depth, 0), 64);
+    ap->random_state = 0x9E3779B9;
+    rt->alloc_profile = ap;
+    rt->alloc_sample_left = js_alloc_profile_next(ap);
+    return 0;
+}
+
+void JS_StopAllocationSampling(JSRuntime *rt)
+{
+    if (rt->alloc_profile)
+        rt->alloc_profile->active = false;
+    rt->alloc_sample_left = INT64_MAX;
+}
+
+static void js_alloc_profile_write_node(JSRuntime *rt, JSAllocProfile *ap,
+                                        FILE *f, uint32_t i, int level)
+{
+    JSAllocProfileNode *n = &ap->nodes[i];
+    uint32_t j;
+
+    fprintf(f, "%*s{\"callFrame\":{\"functionName\":", level, "");
+    if (i == 0)
+        fputs("\"(root)\"", f);
+    else if (n->kind >= 0)
+        fprintf(f, "\"%s\"", js_alloc_kind_names[n->kind]);
+    else if (n->func_name != JS_ATOM_NULL && !__JS_AtomIsTaggedInt(n->func_name))
+        js_write_json_string(f, rt->atom_array[n->func_name], 256);
+    else
+        fputs("\"(anonymous)\"", f);
+    fputs(",\"scriptId\":\"0\",\"url\":", f);
+    if (n->filename != JS_ATOM_NULL && !__JS_AtomIsTaggedInt(n->filename))
+        js_write_json_string(f, rt->atom_array[n->filename], 1024);
+    else
+        fputs("\"\"", f);
+    /* the line and column numbers are 0 based */
+    fprintf(f, ",\"lineNumber\":%d,\"columnNumber\":%d},"
+            "\"selfSize\":%" PRIu64 ",\"id\":%u,\"children\":[",
+            n->line_num < 0 ? -1 : n->line_num - 1,
+            n->col_num < 0 ? -1 : n->col_num - 1,
+            n->self_size, i + 1);
+    for(j = n->first_child; j != 0; j = ap->nodes[j].next_sibling) {
+        fputs("\n", f);
+        js_alloc_profile_write_node(rt, ap, f, j, level + 1);
+        if (ap->nodes[j].next_sibling)
+            fputc(',', f);
+    }
+    fputs("]}", f);
+}
+
+int JS_WriteAllocationProfile(JSRuntime *rt, FILE *f)
+{
+    JSAllocProfile *ap = rt->alloc_profile;
+    uint32_t i;
+
+    if (!ap)
+        return -1;
+    fputs("{\"head\":\n", f);
+    js_alloc_profile_write_node(rt, ap, f, 0, 0);
+    fputs(",\n\"samples\":[", f);
+    for(i = 0; i < ap->sample_count; i++) {
+        fprintf(f, "%s{\"size\":%" PRIu64 ",\"nodeId\":%u,\"ordinal\":%u}",
+                i ? ",\n" : "", ap->samples[i].size,
+                ap->samples[i].node + 1, i + 1);
+    }
+    fputs("]}\n", f);
+    return ferror(f) ? -1 : 0;
 }
 
 JSValue JS_GetGlobalObject(JSContext *ctx)
@@ -8823,8 +11467,9 @@ static JSProperty *add_property(JSContext *ctx,
             /*  the property array may need to be resized */
             if (new_sh->prop_size != sh->prop_size) {
                 JSProperty *new_prop;
-                new_prop = js_realloc(ctx, p->prop, sizeof(p->prop[0]) *
-                                      new_sh->prop_size);
+                new_prop = js_slab_realloc(ctx, p->prop,
+                                           sizeof(p->prop[0]) * sh->prop_size,
+                                           sizeof(p->prop[0]) * new_sh->prop_size);
                 if (!new_prop)
                     return NULL;
                 p->prop = new_prop;
@@ -11189,6 +13834,273 @@ static js_limb_t js_mp_shr(js_limb_t *tab_r, const js_limb_t *tab, int n,
     return l & (((js_limb_t)1 << shift) - 1);
 }
 
+/* tab[0..n-1] += c. Return the carry */
+static js_limb_t js_mp_add_ui(js_limb_t *tab, js_limb_t c, int n)
+{
+    int i;
+
+    for(i = 0; i < n && c != 0; i++) {
+        tab[i] += c;
+        c = (tab[i] < c);
+    }
+    return c;
+}
+
+/* tab[0..n-1] -= c. Return the borrow */
+static js_limb_t js_mp_sub_ui(js_limb_t *tab, js_limb_t c, int n)
+{
+    int i;
+    js_limb_t a;
+
+    for(i = 0; i < n && c != 0; i++) {
+        a = tab[i];
+        tab[i] = a - c;
+        c = (a < c);
+    }
+    return c;
+}
+
+/* return -1, 0 or 1 */
+static int js_mp_cmp(const js_limb_t *taba, const js_limb_t *tabb, int n)
+{
+    int i;
+
+    for(i = n - 1; i >= 0; i--) {
+        if (taba[i] != tabb[i])
+            return taba[i] < tabb[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+/* tabr[0..na-1] = |taba[0..na-1] - tabb[0..nb-1]| with nb <= na.
+   Return 1 if taba < tabb. */
+static int js_mp_sub_abs(js_limb_t *tabr, const js_limb_t *taba, int na,
+                         const js_limb_t *tabb, int nb)
+{
+    int i;
+    js_limb_t c;
+
+    for(i = na - 1; i >= nb; i--) {
+        if (taba[i] != 0)
+            goto a_ge_b;
+    }
+    if (js_mp_cmp(taba, tabb, nb) < 0) {
+        js_mp_sub(tabr, tabb, taba, nb, 0);
+        for(i = nb; i < na; i++)
+            tabr[i] = 0;
+        return 1;
+    }
+ a_ge_b:
+    c = js_mp_sub(tabr, taba, tabb, nb, 0);
+    for(i = nb; i < na; i++) {
+        tabr[i] = taba[i] - c;
+        c = (taba[i] < c);
+    }
+    return 0;
+}
+
+/* Karatsuba multiplication is used when both operands have at least
+   this number of limbs */
+#define JS_MP_MUL_KARATSUBA_THRESHOLD 32
+
+/* number of temporary limbs needed by js_mp_mul_karatsuba() */
+#define JS_MP_MUL_KARATSUBA_TMP_SIZE(n) (6 * (n) + 256)
+
+/* result[0..2*n-1] = op1[0..n-1] * op2[0..n-1]. The middle term is
+   computed from |op1_lo - op1_hi| * |op2_lo - op2_hi| so that no carry
+   limb is needed. 'tmp' must contain at least
+   JS_MP_MUL_KARATSUBA_TMP_SIZE(n) limbs. */
+static void js_mp_mul_karatsuba(js_limb_t *result, const js_limb_t *op1,
+                                const js_limb_t *op2, int n, js_limb_t *tmp)
+{
+    js_limb_t *d1, *d2, *t, *m, c;
+    int l, h, neg;
+
+    if (n < JS_MP_MUL_KARATSUBA_THRESHOLD) {
+        js_mp_mul_basecase(result, op1, n, op2, n);
+        return;
+    }
+    l = (n + 1) / 2;
+    h = n - l;
+    d1 = tmp;
+    d2 = d1 + l;
+    t = d2 + l;
+    m = t + 2 * l;
+    tmp = m + 2 * l + 1;
+    neg = js_mp_sub_abs(d1, op1, l, op1 + l, h) ^
+        js_mp_sub_abs(d2, op2, l, op2 + l, h);
+    js_mp_mul_karatsuba(result, op1, op2, l, tmp);
+    js_mp_mul_karatsuba(result + 2 * l, op1 + l, op2 + l, h, tmp);
+    js_mp_mul_karatsuba(t, d1, d2, l, tmp);
+
+    /* m = lo * lo + hi * hi -/+ t = op1_lo * op2_hi + op1_hi * op2_lo */
+    memcpy(m, result, 2 * l * sizeof(m[0]));
+    c = js_mp_add(m, m, result + 2 * l, 2 * h, 0);
+    m[2 * l] = js_mp_add_ui(m + 2 * h, c, 2 * (l - h));
+    if (neg)
+        m[2 * l] += js_mp_add(m, m, t, 2 * l, 0);
+    else
+        m[2 * l] -= js_mp_sub(m, m, t, 2 * l, 0);
+    c = js_mp_add(result + l, result + l, m, 2 * l + 1, 0);
+    js_mp_add_ui(result + 3 * l + 1, c, 2 * n - 3 * l - 1);
+}
+
+/* result[0..n1+n2-1] = op1[0..n1-1] * op2[0..n2-1]. Return -1 if
+   memory error. */
+static int js_mp_mul(JSContext *ctx, js_limb_t *result,
+                     const js_limb_t *op1, int n1,
+                     const js_limb_t *op2, int n2)
+{
+    js_limb_t *t, *tmp, c;
+    int i, len, ret;
+
+    if (n1 < n2) {
+        const js_limb_t *tmp_op;
+        int tmp_n;
+        tmp_op = op1;
+        op1 = op2;
+        op2 = tmp_op;
+        tmp_n = n1;
+        n1 = n2;
+        n2 = tmp_n;
+    }
+    if (n2 < JS_MP_MUL_KARATSUBA_THRESHOLD) {
+        js_mp_mul_basecase(result, op1, n1, op2, n2);
+        return 0;
+    }
+    t = js_malloc(ctx, (2 * n2 + JS_MP_MUL_KARATSUBA_TMP_SIZE(n2)) *
+                  sizeof(t[0]));
+    if (!t)
+        return -1;
+    tmp = t + 2 * n2;
+    ret = 0;
+    /* the largest operand is sliced in blocks of n2 limbs */
+    js_mp_mul_karatsuba(result, op1, op2, n2, tmp);
+    for(i = n2; i < n1; i += len) {
+        len = min_int(n1 - i, n2);
+        if (len == n2) {
+            js_mp_mul_karatsuba(t, op1 + i, op2, n2, tmp);
+        } else if (js_mp_mul(ctx, t, op2, n2, op1 + i, len)) {
+            ret = -1;
+            break;
+        }
+        memcpy(result + i + n2, t + n2, len * sizeof(t[0]));
+        c = js_mp_add(result + i, result + i, t, n2, 0);
+        js_mp_add_ui(result + i + n2, c, len);
+    }
+    js_free(ctx, t);
+    return ret;
+}
+
+/* recursive division is used when the divisor and the quotient have
+   at least this number of limbs */
+#define JS_MP_DIV_RECURSIVE_THRESHOLD 48
+
+/* taba[0..na-1] -= tabt[0..nt-1]. While the result is negative, add
+   tabb[0..nb-1] and decrement the quotient tabq[0..nq-1] + *pqh *
+   B^nq */
+static void js_mp_div_adjust(js_limb_t *taba, int na,
+                             const js_limb_t *tabt, int nt,
+                             const js_limb_t *tabb, int nb,
+                             js_limb_t *tabq, int nq, js_limb_t *pqh)
+{
+    js_limb_t c;
+
+    c = js_mp_sub(taba, taba, tabt, nt, 0);
+    c = js_mp_sub_ui(taba + nt, c, na - nt);
+    while (c != 0) {
+        *pqh -= js_mp_sub_ui(tabq, 1, nq);
+        c -= js_mp_add_ui(taba + nb, js_mp_add(taba, taba, tabb, nb, 0),
+                          na - nb);
+    }
+}
+
+/* Recursive division (Burnikel-Ziegler): divides taba[0..n+m-1] by
+   tabb[0..n-1] with 1 <= m <= n, tabb[n - 1] >= 1 << (JS_LIMB_BITS -
+   1) and taba < 2 * tabb * B^m. tabq[0..m-1] contains the low limbs
+   of the quotient and its high limb (0 or 1) is returned. 'taba'
+   contains the remainder in its low n limbs and the other limbs are
+   set to zero. tabq[m] is not modified. Return -1 if memory error. */
+static int js_mp_divnorm_rec(JSContext *ctx, js_limb_t *tabq, js_limb_t *taba,
+                             const js_limb_t *tabb, int n, int m)
+{
+    js_limb_t *t, q_saved, qh0, qh1;
+    int k, ret;
+
+    if (m < JS_MP_DIV_RECURSIVE_THRESHOLD) {
+        q_saved = tabq[m];
+        js_mp_divnorm(tabq, taba, n + m, tabb, n);
+        qh1 = tabq[m];
+        tabq[m] = q_saved;
+        return qh1;
+    }
+    k = m / 2;
+    t = js_malloc(ctx, (m + 1) * sizeof(t[0]));
+    if (!t)
+        return -1;
+
+    /* high part of the quotient using the high limbs of 'b' */
+    ret = js_mp_divnorm_rec(ctx, tabq + k, taba + 2 * k, tabb + k,
+                            n - k, m - k);
+    if (ret < 0)
+        goto fail;
+    qh1 = ret;
+    if (js_mp_mul(ctx, t, tabq + k, m - k, tabb, k))
+        goto fail;
+    t[m] = 0;
+    if (qh1)
+        t[m] = js_mp_add(t + m - k, t + m - k, tabb, k, 0);
+    js_mp_div_adjust(taba + k, n + m - k, t, m + 1, tabb, n,
+                     tabq + k, m - k, &qh1);
+
+    /* low part of the quotient */
+    ret = js_mp_divnorm_rec(ctx, tabq, taba + k, tabb + k, n - k, k);
+    if (ret < 0)
+        goto fail;
+    qh0 = ret;
+    if (js_mp_mul(ctx, t, tabq, k, tabb, k))
+        goto fail;
+    t[2 * k] = 0;
+    if (qh0)
+        t[2 * k] = js_mp_add(t + k, t + k, tabb, k, 0);
+    js_mp_div_adjust(taba, n + k, t, 2 * k + 1, tabb, n, tabq, k, &qh0);
+    js_free(ctx, t);
+    return qh1 + js_mp_add_ui(tabq + k, qh0, m - k);
+ fail:
+    js_free(ctx, t);
+    return -1;
+}
+
+/* same as js_mp_divnorm() but uses the recursive division for large
+   operands. Return -1 if memory error. */
+static int js_mp_divnorm_large(JSContext *ctx, js_limb_t *tabq,
+                               js_limb_t *taba, int na,
+                               const js_limb_t *tabb, int nb)
+{
+    int n, len, ret;
+
+    n = na - nb;
+    if (nb < JS_MP_DIV_RECURSIVE_THRESHOLD ||
+        n < JS_MP_DIV_RECURSIVE_THRESHOLD) {
+        js_mp_divnorm(tabq, taba, na, tabb, nb);
+        return 0;
+    }
+    /* first iteration: the quotient is only 0 or 1 */
+    tabq[n] = (js_mp_cmp(taba + n, tabb, nb) >= 0);
+    if (tabq[n])
+        js_mp_sub(taba + n, taba + n, tabb, nb, 0);
+    /* the quotient is computed by blocks of at most nb limbs */
+    while (n > 0) {
+        len = min_int(n, nb);
+        n -= len;
+        ret = js_mp_divnorm_rec(ctx, tabq + n, taba + n, tabb, nb, len);
+        if (ret < 0)
+            return -1;
+        assert(ret == 0);
+    }
+    return 0;
+}
+
 static JSBigInt *js_bigint_new(JSContext *ctx, int len)
 {
     JSBigInt *r;
@@ -11231,7 +14143,65 @@ static JSBigInt *js_bigint_set_si64(JSBigIntBuf *buf, int64_t a)
 /* val must be a short big int */
 static JSBigInt *js_bigint_set_short(JSBigIntBuf *buf, JSValueConst val)
 {
-    return js_bigint_set_si(buf, JS_VALUE_GET_SHORT_BIG_INT(val));
+    return js_bigint_set_si64(buf, JS_VALUE_GET_SHORT_BIG_INT(val));
+}
+
+/* short big int arithmetic: *pr = a op b. Return true if the result
+   does not fit in a short big int. */
+static inline bool js_short_big_int_add(int64_t *pr, int64_t a, int64_t b)
+{
+    int64_t r;
+    r = (uint64_t)a + (uint64_t)b;
+    *pr = r;
+#if JS_SHORT_BIG_INT_BITS == 64
+    return ((a ^ r) & (b ^ r)) < 0;
+#else
+    return r < JS_SHORT_BIG_INT_MIN || r > JS_SHORT_BIG_INT_MAX;
+#endif
+}
+
+static inline bool js_short_big_int_sub(int64_t *pr, int64_t a, int64_t b)
+{
+    int64_t r;
+    r = (uint64_t)a - (uint64_t)b;
+    *pr = r;
+#if JS_SHORT_BIG_INT_BITS == 64
+    return ((a ^ b) & (a ^ r)) < 0;
+#else
+    return r < JS_SHORT_BIG_INT_MIN || r > JS_SHORT_BIG_INT_MAX;
+#endif
+}
+
+static inline bool js_short_big_int_mul(int64_t *pr, int64_t a, int64_t b)
+{
+#if JS_SHORT_BIG_INT_BITS == 64
+    uint64_t hi, lo, a1, b1;
+    a1 = a < 0 ? -(uint64_t)a : a;
+    b1 = b < 0 ? -(uint64_t)b : b;
+    lo = mul_u64(&hi, a1, b1);
+    if ((a ^ b) < 0) {
+        *pr = -lo;
+        return hi != 0 || lo > (uint64_t)INT64_MAX + 1;
+    } else {
+        *pr = lo;
+        return hi != 0 || lo > INT64_MAX;
+    }
+#else
+    int64_t r;
+    r = a * b;
+    *pr = r;
+    return r < JS_SHORT_BIG_INT_MIN || r > JS_SHORT_BIG_INT_MAX;
+#endif
+}
+
+/* 0 <= b < 64 */
+static inline bool js_short_big_int_shl(int64_t *pr, int64_t a, int b)
+{
+    int64_t r;
+    r = (uint64_t)a << b;
+    *pr = r;
+    return (r >> b) != a ||
+        r < JS_SHORT_BIG_INT_MIN || r > JS_SHORT_BIG_INT_MAX;
 }
 
 static __maybe_unused void js_bigint_dump1(JSContext *ctx, const char *str,
@@ -11292,24 +14262,6 @@ static JSBigInt *js_bigint_new_ui64(JSContext *ctx, uint64_t a)
     }
 }
 
-static JSBigInt *js_bigint_new_di(JSContext *ctx, js_sdlimb_t a)
-{
-    JSBigInt *r;
-    if (a == (js_slimb_t)a) {
-        r = js_bigint_new(ctx, 1);
-        if (!r)
-            return NULL;
-        r->tab[0] = a;
-    } else {
-        r = js_bigint_new(ctx, 2);
-        if (!r)
-            return NULL;
-        r->tab[0] = a;
-        r->tab[1] = a >> JS_LIMB_BITS;
-    }
-    return r;
-}
-
 /* Remove redundant high order limbs. Warning: 'a' may be
    reallocated. Can never fail.
 */
@@ -11444,7 +14396,10 @@ static JSBigInt *js_bigint_mul(JSContext *ctx, const JSBigInt *a,
     r = js_bigint_new(ctx, a->len + b->len);
     if (!r)
         return NULL;
-    js_mp_mul_basecase(r->tab, a->tab, a->len, b->tab, b->len);
+    if (js_mp_mul(ctx, r->tab, a->tab, a->len, b->tab, b->len)) {
+        js_free(ctx, r);
+        return NULL;
+    }
     /* correct the result if negative operands (no overflow is
        possible) */
     if (js_bigint_sign(a))
@@ -11534,7 +14489,12 @@ static JSBigInt *js_bigint_divrem(JSContext *ctx, const JSBigInt *a,
 
     //    js_bigint_dump1(ctx, "a", r->tab, na);
     //    js_bigint_dump1(ctx, "b", tabb, nb);
-    js_mp_divnorm(q->tab, r->tab, na, tabb, nb);
+    if (js_mp_divnorm_large(ctx, q->tab, r->tab, na, tabb, nb)) {
+        js_free(ctx, q);
+        js_free(ctx, r);
+        js_free(ctx, tabb);
+        return NULL;
+    }
     js_free(ctx, tabb);
 
     if (is_rem) {
@@ -12004,6 +14964,141 @@ static const js_limb_t js_pow_dec[JS_LIMB_DIGITS + 1] = {
     1000000000U,
 };
 
+/* radix conversions use a divide and conquer algorithm above this
+   number of limbs */
+#define JS_MP_RADIX_RECURSIVE_THRESHOLD 32
+
+#define JS_MP_POW_TABLE_SIZE 32
+
+/* base^(2^i) for 0 <= i < count */
+typedef struct {
+    int count;
+    js_limb_t base;
+    int len[JS_MP_POW_TABLE_SIZE];
+    js_limb_t *tab[JS_MP_POW_TABLE_SIZE];
+} JSMPPowTable;
+
+static void js_mp_pow_table_init(JSMPPowTable *s, js_limb_t base)
+{
+    s->count = 1;
+    s->base = base;
+    s->len[0] = 1;
+    s->tab[0] = &s->base;
+}
+
+static void js_mp_pow_table_free(JSContext *ctx, JSMPPowTable *s)
+{
+    int i;
+    for(i = 1; i < s->count; i++)
+        js_free(ctx, s->tab[i]);
+}
+
+/* compute base^(2^i) if needed. Return -1 if memory error */
+static int js_mp_pow_table_get(JSContext *ctx, JSMPPowTable *s, int i)
+{
+    js_limb_t *r, *a;
+    int len;
+
+    assert(i < JS_MP_POW_TABLE_SIZE);
+    while (s->count <= i) {
+        a = s->tab[s->count - 1];
+        len = s->len[s->count - 1];
+        r = js_malloc(ctx, 2 * len * sizeof(r[0]));
+        if (!r)
+            return -1;
+        if (js_mp_mul(ctx, r, a, len, a, len)) {
+            js_free(ctx, r);
+            return -1;
+        }
+        len *= 2;
+        while (len > 1 && r[len - 1] == 0)
+            len--;
+        s->tab[s->count] = r;
+        s->len[s->count] = len;
+        s->count++;
+    }
+    return 0;
+}
+
+/* tabr[] = value of the base 10^JS_LIMB_DIGITS digits tabd[0..n-1]
+   (least significant first). 'tabr' must have at least n limbs. Return
+   the number of limbs or -1 if memory error. */
+static int js_mp_from_dec(JSContext *ctx, js_limb_t *tabr,
+                          const js_limb_t *tabd, int n, JSMPPowTable *pows)
+{
+    js_limb_t *t, h;
+    int i, l, len, len_lo, len_hi;
+
+    if (n < JS_MP_RADIX_RECURSIVE_THRESHOLD) {
+        tabr[0] = tabd[n - 1];
+        len = 1;
+        for(i = n - 2; i >= 0; i--) {
+            h = js_mp_mul1(tabr, tabr, len, js_pow_dec[JS_LIMB_DIGITS],
+                           tabd[i]);
+            if (h != 0)
+                tabr[len++] = h;
+        }
+        return len;
+    }
+    /* hi * (10^JS_LIMB_DIGITS)^l + lo with l the largest power of two
+       below n */
+    i = 31 - clz32(n - 1);
+    l = 1 << i;
+    if (js_mp_pow_table_get(ctx, pows, i))
+        return -1;
+    t = js_malloc(ctx, n * sizeof(t[0]));
+    if (!t)
+        return -1;
+    len_hi = js_mp_from_dec(ctx, t, tabd + l, n - l, pows);
+    if (len_hi < 0)
+        goto fail;
+    if (js_mp_mul(ctx, tabr, t, len_hi, pows->tab[i], pows->len[i]))
+        goto fail;
+    len = len_hi + pows->len[i];
+    len_lo = js_mp_from_dec(ctx, t, tabd, l, pows);
+    if (len_lo < 0)
+        goto fail;
+    h = js_mp_add(tabr, tabr, t, len_lo, 0);
+    js_mp_add_ui(tabr + len_lo, h, len - len_lo);
+    while (len > 1 && tabr[len - 1] == 0)
+        len--;
+    js_free(ctx, t);
+    return len;
+ fail:
+    js_free(ctx, t);
+    return -1;
+}
+
+/* tabr[] = value of the decimal digits p[0..n_digits-1]. Return the
+   number of limbs or -1 if memory error. */
+static int js_mp_from_dec_str(JSContext *ctx, js_limb_t *tabr,
+                              const char *p, int n_digits)
+{
+    JSMPPowTable pows;
+    js_limb_t *tabd, v;
+    int i, j, n, len;
+
+    n = (n_digits + JS_LIMB_DIGITS - 1) / JS_LIMB_DIGITS;
+    tabd = js_malloc(ctx, 2 * n * sizeof(tabd[0]));
+    if (!tabd)
+        return -1;
+    for(i = 0; i < n; i++) {
+        v = 0;
+        for(j = max_int(0, n_digits - (i + 1) * JS_LIMB_DIGITS);
+            j < n_digits - i * JS_LIMB_DIGITS; j++) {
+            v = v * 10 + js_to_digit(p[j]);
+        }
+        tabd[i] = v;
+    }
+    js_mp_pow_table_init(&pows, js_pow_dec[JS_LIMB_DIGITS]);
+    len = js_mp_from_dec(ctx, tabd + n, tabd, n, &pows);
+    js_mp_pow_table_free(ctx, &pows);
+    if (len > 0)
+        memcpy(tabr, tabd + n, len * sizeof(tabr[0]));
+    js_free(ctx, tabd);
+    return len;
+}
+
 /* syntax: [-]digits in base radix. Return NULL if memory error. radix
    = 10, 2, 8 or 16. */
 static JSBigInt *js_bigint_from_string(JSContext *ctx,
@@ -12042,7 +15137,18 @@ static JSBigInt *js_bigint_from_string(JSContext *ctx,
     r = js_bigint_new(ctx, n_limbs);
     if (!r)
         return NULL;
-    if (radix == 10) {
+    if (radix == 10 &&
+        n_digits >= JS_LIMB_DIGITS * JS_MP_RADIX_RECURSIVE_THRESHOLD) {
+        len = js_mp_from_dec_str(ctx, r->tab, p, n_digits);
+        if (len < 0) {
+            js_free(ctx, r);
+            return NULL;
+        }
+        /* add one extra limb to have the correct sign*/
+        if ((r->tab[len - 1] >> (JS_LIMB_BITS - 1)) != 0)
+            r->tab[len++] = 0;
+        r->len = len;
+    } else if (radix == 10) {
         int digits_per_limb = JS_LIMB_DIGITS;
         len = 1;
         r->tab[0] = 0;
@@ -12173,6 +15279,86 @@ static const js_limb_t js_radix_base_table[JS_RADIX_MAX - 1] = {
  0x5c13d840, 0x6d91b519, 0x81bf1000,
 };
 
+/* write the digits of tab[0..len-1] ending at 'q'. If 'n_digits' is
+   not zero, leading zeros are added to have exactly 'n_digits'
+   digits. 'tab' is modified. Return the position of the first digit
+   or NULL if memory error. */
+static char *js_mp_to_a(JSContext *ctx, char *q, js_limb_t *tab, int len,
+                        int radix, int n_digits, JSMPPowTable *pows)
+{
+    char *q_end = q;
+    int digits_per_limb;
+
+    digits_per_limb = js_digits_per_limb_table[radix - 2];
+    while (len > 1 && tab[len - 1] == 0)
+        len--;
+    if (len < JS_MP_RADIX_RECURSIVE_THRESHOLD) {
+        js_limb_t v;
+        for(;;) {
+            /* remove leading zero limbs */
+            while (len > 1 && tab[len - 1] == 0)
+                len--;
+            if (len == 1 && tab[0] < pows->base) {
+                v = tab[0];
+                if (v != 0) {
+                    q = js_u64toa(q, v, radix);
+                }
+                break;
+            } else {
+                v = js_mp_div1(tab, tab, len, pows->base, 0);
+                q = js_limb_to_a(q, v, radix, digits_per_limb);
+            }
+        }
+    } else {
+        js_limb_t *a, *b, *tabq;
+        int i, na, nb, shift;
+
+        /* divide by the largest base^(2^i) having at most half the
+           limbs of 'tab' */
+        i = 0;
+        for(;;) {
+            if (js_mp_pow_table_get(ctx, pows, i + 1))
+                return NULL;
+            if (pows->len[i + 1] > (len + 1) / 2)
+                break;
+            i++;
+        }
+        nb = pows->len[i];
+        na = len + 1;
+        b = js_malloc(ctx, (nb + na + na - nb + 1) * sizeof(b[0]));
+        if (!b)
+            return NULL;
+        a = b + nb;
+        tabq = a + na;
+        shift = js_limb_clz(pows->tab[i][nb - 1]);
+        if (shift != 0) {
+            js_mp_shl(b, pows->tab[i], nb, shift);
+            a[len] = js_mp_shl(a, tab, len, shift);
+        } else {
+            memcpy(b, pows->tab[i], nb * sizeof(b[0]));
+            memcpy(a, tab, len * sizeof(a[0]));
+            a[len] = 0;
+        }
+        if (js_mp_divnorm_large(ctx, tabq, a, na, b, nb)) {
+            js_free(ctx, b);
+            return NULL;
+        }
+        if (shift != 0)
+            js_mp_shr(a, a, nb, shift, 0);
+        q = js_mp_to_a(ctx, q, a, nb, radix, digits_per_limb << i, pows);
+        if (q) {
+            q = js_mp_to_a(ctx, q, tabq, na - nb + 1, radix,
+                           n_digits ? n_digits - (q_end - q) : 0, pows);
+        }
+        js_free(ctx, b);
+        if (!q)
+            return NULL;
+    }
+    while (q_end - q < n_digits)
+        *--q = '0';
+    return q;
+}
+
 static JSValue js_bigint_to_string1(JSContext *ctx, JSValueConst val, int radix)
 {
     if (JS_VALUE_GET_TAG(val) == JS_TAG_SHORT_BIG_INT) {
@@ -12223,24 +15409,14 @@ static JSValue js_bigint_to_string1(JSContext *ctx, JSValueConst val, int radix)
         *--q = '\0';
         buf_end = q;
         if (!is_binary_radix) {
-            int len;
-            js_limb_t radix_base, v;
-            radix_base = js_radix_base_table[radix - 2];
-            len = r->len;
-            for(;;) {
-                /* remove leading zero limbs */
-                while (len > 1 && r->tab[len - 1] == 0)
-                    len--;
-                if (len == 1 && r->tab[0] < radix_base) {
-                    v = r->tab[0];
-                    if (v != 0) {
-                        q = js_u64toa(q, v, radix);
-                    }
-                    break;
-                } else {
-                    v = js_mp_div1(r->tab, r->tab, len, radix_base, 0);
-                    q = js_limb_to_a(q, v, radix, js_digits_per_limb_table[radix - 2]);
-                }
+            JSMPPowTable pows;
+            js_mp_pow_table_init(&pows, js_radix_base_table[radix - 2]);
+            q = js_mp_to_a(ctx, q, r->tab, r->len, radix, 0, &pows);
+            js_mp_pow_table_free(ctx, &pows);
+            if (!q) {
+                js_free(ctx, buf);
+                js_free(ctx, tmp);
+                return JS_EXCEPTION;
             }
         } else {
             int i, shift;
@@ -12278,6 +15454,13 @@ static JSValue JS_CompactBigInt(JSContext *ctx, JSBigInt *p)
         res = __JS_NewShortBigInt(ctx, (js_slimb_t)p->tab[0]);
         js_free(ctx, p);
         return res;
+#if JS_SHORT_BIG_INT_BITS == 64
+    } else if (p->len == 2) {
+        res = __JS_NewShortBigInt(ctx, (int64_t)(((uint64_t)p->tab[1] << 32) |
+                                                 p->tab[0]));
+        js_free(ctx, p);
+        return res;
+#endif
     } else {
         return JS_MKPTR(JS_TAG_BIG_INT, p);
     }
@@ -13114,6 +16297,11 @@ static JSValue js_dtoa2(JSContext *ctx,
     int len, len_max;
     JSValue res;
     JSDTOATempMem dtoa_mem;
+
+    /* small integers, including -0, use the cached strings */
+    if (radix == 10 && flags == JS_DTOA_FORMAT_FREE &&
+        d >= 0 && d < JS_INT_STRING_CACHE_SIZE && d == (uint32_t)d)
+        return js_new_string_uint32(ctx, (uint32_t)d);
     len_max = js_dtoa_max_len(d, radix, n_digits, flags);
 
     /* longer buffer may be used if radix != 10 */
@@ -13136,16 +16324,13 @@ static JSValue JS_ToStringInternal(JSContext *ctx, JSValueConst val,
                                    int flags)
 {
     uint32_t tag;
-    char buf[32];
-    size_t len;
 
     tag = JS_VALUE_GET_NORM_TAG(val);
     switch(tag) {
     case JS_TAG_STRING:
         return js_dup(val);
     case JS_TAG_INT:
-        len = i32toa(buf, JS_VALUE_GET_INT(val));
-        return js_new_string8_len(ctx, buf, len);
+        return js_new_string_int32(ctx, JS_VALUE_GET_INT(val));
     case JS_TAG_BOOL:
         return JS_AtomToString(ctx, JS_VALUE_GET_BOOL(val) ?
                           JS_ATOM_true : JS_ATOM_false);
@@ -13921,46 +17106,34 @@ static no_inline __exception int js_binary_arith_slow(JSContext *ctx, JSValue *s
     }
     /* fast path for short big int operations */
     if (tag1 == JS_TAG_SHORT_BIG_INT && tag2 == JS_TAG_SHORT_BIG_INT) {
-        js_slimb_t v1, v2;
-        js_sdlimb_t v;
+        int64_t v1, v2, v;
         v1 = JS_VALUE_GET_SHORT_BIG_INT(op1);
         v2 = JS_VALUE_GET_SHORT_BIG_INT(op2);
         switch(op) {
         case OP_sub:
-            v = (js_sdlimb_t)v1 - (js_sdlimb_t)v2;
+            if (unlikely(js_short_big_int_sub(&v, v1, v2)))
+                goto slow_big_int;
             break;
         case OP_mul:
-            v = (js_sdlimb_t)v1 * (js_sdlimb_t)v2;
+            if (unlikely(js_short_big_int_mul(&v, v1, v2)))
+                goto slow_big_int;
             break;
         case OP_div:
-            if (v2 == 0 ||
-                ((js_limb_t)v1 == (js_limb_t)1 << (JS_LIMB_BITS - 1) &&
-                 v2 == -1)) {
+            if (v2 == 0 || (v1 == JS_SHORT_BIG_INT_MIN && v2 == -1))
                 goto slow_big_int;
-            }
-            sp[-2] = __JS_NewShortBigInt(ctx, v1 / v2);
-            return 0;
+            v = v1 / v2;
+            break;
         case OP_mod:
-            if (v2 == 0 ||
-                ((js_limb_t)v1 == (js_limb_t)1 << (JS_LIMB_BITS - 1) &&
-                 v2 == -1)) {
+            if (v2 == 0 || (v1 == JS_SHORT_BIG_INT_MIN && v2 == -1))
                 goto slow_big_int;
-            }
-            sp[-2] = __JS_NewShortBigInt(ctx, v1 % v2);
-            return 0;
+            v = v1 % v2;
+            break;
         case OP_pow:
             goto slow_big_int;
         default:
             abort();
         }
-        if (likely(v >= JS_SHORT_BIG_INT_MIN && v <= JS_SHORT_BIG_INT_MAX)) {
-            sp[-2] = __JS_NewShortBigInt(ctx, v);
-        } else {
-            JSBigInt *r = js_bigint_new_di(ctx, v);
-            if (!r)
-                goto exception;
-            sp[-2] = JS_MKPTR(JS_TAG_BIG_INT, r);
-        }
+        sp[-2] = __JS_NewShortBigInt(ctx, v);
         return 0;
     }
     op1 = JS_ToNumericFree(ctx, op1);
@@ -14115,15 +17288,16 @@ static no_inline __exception int js_add_slow(JSContext *ctx, JSValue *sp)
     }
     /* fast path for short bigint */
     if (tag1 == JS_TAG_SHORT_BIG_INT && tag2 == JS_TAG_SHORT_BIG_INT) {
-        js_slimb_t v1, v2;
-        js_sdlimb_t v;
+        int64_t v1, v2, v;
         v1 = JS_VALUE_GET_SHORT_BIG_INT(op1);
         v2 = JS_VALUE_GET_SHORT_BIG_INT(op2);
-        v = (js_sdlimb_t)v1 + (js_sdlimb_t)v2;
-        if (likely(v >= JS_SHORT_BIG_INT_MIN && v <= JS_SHORT_BIG_INT_MAX)) {
+        if (likely(!js_short_big_int_add(&v, v1, v2))) {
             sp[-2] = __JS_NewShortBigInt(ctx, v);
         } else {
-            JSBigInt *r = js_bigint_new_di(ctx, v);
+            JSBigIntBuf buf1, buf2;
+            JSBigInt *r;
+            r = js_bigint_add(ctx, js_bigint_set_si64(&buf1, v1),
+                              js_bigint_set_si64(&buf2, v2), 0);
             if (!r)
                 goto exception;
             sp[-2] = JS_MKPTR(JS_TAG_BIG_INT, r);
@@ -14227,8 +17401,7 @@ static no_inline __exception int js_binary_logic_slow(JSContext *ctx,
     tag2 = JS_VALUE_GET_NORM_TAG(op2);
 
     if (tag1 == JS_TAG_SHORT_BIG_INT && tag2 == JS_TAG_SHORT_BIG_INT) {
-        js_slimb_t v1, v2, v;
-        js_sdlimb_t vd;
+        int64_t v1, v2, v;
         v1 = JS_VALUE_GET_SHORT_BIG_INT(op1);
         v2 = JS_VALUE_GET_SHORT_BIG_INT(op2);
         /* bigint fast path */
@@ -14243,10 +17416,10 @@ static no_inline __exception int js_binary_logic_slow(JSContext *ctx,
             v = v1 ^ v2;
             break;
         case OP_sar:
-            if (v2 > (JS_LIMB_BITS - 1)) {
+            if (v2 > (JS_SHORT_BIG_INT_BITS - 1)) {
                 goto slow_big_int;
             } else if (v2 < 0) {
-                if (v2 < -(JS_LIMB_BITS - 1))
+                if (v2 < -(JS_SHORT_BIG_INT_BITS - 1))
                     goto slow_big_int;
                 v2 = -v2;
                 goto bigint_shl;
@@ -14255,26 +17428,17 @@ static no_inline __exception int js_binary_logic_slow(JSContext *ctx,
             v = v1 >> v2;
             break;
         case OP_shl:
-            if (v2 > (JS_LIMB_BITS - 1)) {
+            if (v2 > (JS_SHORT_BIG_INT_BITS - 1)) {
                 goto slow_big_int;
             } else if (v2 < 0) {
-                if (v2 < -(JS_LIMB_BITS - 1))
+                if (v2 < -(JS_SHORT_BIG_INT_BITS - 1))
                     goto slow_big_int;
                 v2 = -v2;
                 goto bigint_sar;
             }
         bigint_shl:
-            vd = (js_dlimb_t)v1 << v2;
-            if (likely(vd >= JS_SHORT_BIG_INT_MIN &&
-                       vd <= JS_SHORT_BIG_INT_MAX)) {
-                v = vd;
-            } else {
-                JSBigInt *r = js_bigint_new_di(ctx, vd);
-                if (!r)
-                    goto exception;
-                sp[-2] = JS_MKPTR(JS_TAG_BIG_INT, r);
-                return 0;
-            }
+            if (unlikely(js_short_big_int_shl(&v, v1, v2)))
+                goto slow_big_int;
             break;
         default:
             abort();
@@ -14410,7 +17574,7 @@ static int js_compare_bigint(JSContext *ctx, OPCodeEnum op,
     if ((tag1 == JS_TAG_SHORT_BIG_INT || tag1 == JS_TAG_INT) &&
         (tag2 == JS_TAG_SHORT_BIG_INT || tag2 == JS_TAG_INT)) {
         /* fast path */
-        js_slimb_t v1, v2;
+        int64_t v1, v2;
         if (tag1 == JS_TAG_INT)
             v1 = JS_VALUE_GET_INT(op1);
         else
@@ -15926,7 +19090,7 @@ static JSVarRef *get_var_ref(JSContext *ctx, JSStackFrame *sf,
         }
     }
     /* create a new one */
-    var_ref = js_malloc(ctx, sizeof(JSVarRef));
+    var_ref = js_slab_alloc(ctx, sizeof(JSVarRef));
     if (!var_ref)
         return NULL;
     var_ref->header.ref_count = 1;
@@ -16012,6 +19176,12 @@ static JSValue js_closure(JSContext *ctx, JSValue bfunc,
     JSAtom name_atom;
 
     b = JS_VALUE_GET_PTR(bfunc);
+    if (b->is_lazy && b->cpool_count) {
+        /* the code was already generated */
+        bfunc = js_dup(b->cpool[0]);
+        JS_FreeValue(ctx, JS_MKPTR(JS_TAG_FUNCTION_BYTECODE, b));
+        b = JS_VALUE_GET_PTR(bfunc);
+    }
     func_obj = JS_NewObjectClass(ctx, func_kind_to_class_id[b->func_kind]);
     if (JS_IsException(func_obj)) {
         JS_FreeValue(ctx, bfunc);
@@ -16469,6 +19639,11 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                          argv, flags);
     }
     b = p->u.func.function_bytecode;
+    if (unlikely(b->is_lazy)) {
+        b = js_lazy_compile_function(caller_ctx, p);
+        if (!b)
+            return JS_EXCEPTION;
+    }
 
     if (unlikely(argc < b->arg_count || (flags & JS_CALL_FLAG_COPY_ARGV))) {
         arg_allocated_size = b->arg_count;
@@ -16514,6 +19689,18 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
     rt->current_stack_frame = sf;
     ctx = b->realm; /* set the current realm */
 
+    if (b->native_code) {
+        /* ahead-of-time compiled function */
+        ret_val = b->native_code(ctx, this_obj, arg_buf, var_buf);
+        if (unlikely(JS_IsException(ret_val)) &&
+            (needs_backtrace(rt->current_exception) ||
+             JS_IsUndefined(ctx->error_back_trace))) {
+            build_backtrace(ctx, rt->current_exception, JS_UNDEFINED,
+                            NULL, 0, 0, 0);
+        }
+        goto done;
+    }
+
 #ifdef ENABLE_DUMPS // JS_DUMP_BYTECODE_STEP
     if (check_dump_flag(ctx->rt, JS_DUMP_BYTECODE_STEP))
         print_func_name(b);
@@ -16580,7 +19767,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             }
             BREAK;
         CASE(OP_push_atom_value):
-            *sp++ = JS_AtomToValue(ctx, get_u32(pc));
+            *sp++ = JS_AtomToValue(ctx, bc_get_atom_operand(b, pc));
             pc += 4;
             BREAK;
         CASE(OP_undefined):
@@ -17006,7 +20193,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 JSAtom atom;
                 int type;
-                atom = get_u32(pc);
+                atom = bc_get_atom_operand(b, pc);
                 type = pc[4];
                 pc += 5;
                 if (type == JS_THROW_VAR_RO)
@@ -17126,7 +20313,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 int ret;
                 JSAtom atom;
-                atom = get_u32(pc);
+                atom = bc_get_atom_operand(b, pc);
                 pc += 4;
 
                 ret = JS_CheckGlobalVar(ctx, atom);
@@ -17141,7 +20328,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 JSValue val;
                 JSAtom atom;
-                atom = get_u32(pc);
+                atom = bc_get_atom_operand(b, pc);
                 pc += 4;
                 sf->cur_pc = pc;
 
@@ -17157,7 +20344,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 int ret;
                 JSAtom atom;
-                atom = get_u32(pc);
+                atom = bc_get_atom_operand(b, pc);
                 pc += 4;
                 sf->cur_pc = pc;
 
@@ -17172,7 +20359,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 int ret;
                 JSAtom atom;
-                atom = get_u32(pc);
+                atom = bc_get_atom_operand(b, pc);
                 pc += 4;
                 sf->cur_pc = pc;
 
@@ -17192,7 +20379,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 JSAtom atom;
                 int flags;
-                atom = get_u32(pc);
+                atom = bc_get_atom_operand(b, pc);
                 flags = pc[4];
                 pc += 5;
                 if (JS_CheckDefineGlobalVar(ctx, atom, flags))
@@ -17203,7 +20390,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 JSAtom atom;
                 int flags;
-                atom = get_u32(pc);
+                atom = bc_get_atom_operand(b, pc);
                 flags = pc[4];
                 pc += 5;
                 if (JS_DefineGlobalVar(ctx, atom, flags))
@@ -17214,7 +20401,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 JSAtom atom;
                 int flags;
-                atom = get_u32(pc);
+                atom = bc_get_atom_operand(b, pc);
                 flags = pc[4];
                 pc += 5;
                 if (JS_DefineGlobalFunction(ctx, atom, sp[-1], flags))
@@ -17462,7 +20649,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 JSProperty *pr;
                 JSAtom atom;
                 int idx;
-                atom = get_u32(pc);
+                atom = bc_get_atom_operand(b, pc);
                 idx = get_u16(pc + 4);
                 pc += 6;
                 *sp++ = JS_NewObjectProto(ctx, JS_NULL);
@@ -17489,7 +20676,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
         CASE(OP_make_var_ref):
             {
                 JSAtom atom;
-                atom = get_u32(pc);
+                atom = bc_get_atom_operand(b, pc);
                 pc += 4;
 
                 if (JS_GetGlobalVarRef(ctx, atom, sp))
@@ -17775,7 +20962,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 JSValue val;
                 JSAtom atom;
-                atom = get_u32(pc);
+                atom = bc_get_atom_operand(b, pc);
                 pc += 4;
                 sf->cur_pc = pc;
                 val = JS_GetPropertyInternal(ctx, sp[-1], atom, sp[-1], false);
@@ -17790,7 +20977,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 JSValue val;
                 JSAtom atom;
-                atom = get_u32(pc);
+                atom = bc_get_atom_operand(b, pc);
                 pc += 4;
                 sf->cur_pc = pc;
                 val = JS_GetPropertyInternal(ctx, sp[-1], atom, sp[-1], false);
@@ -17804,7 +20991,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 int ret;
                 JSAtom atom;
-                atom = get_u32(pc);
+                atom = bc_get_atom_operand(b, pc);
                 pc += 4;
                 sf->cur_pc = pc;
                 ret = JS_SetPropertyInternal2(ctx,
@@ -17823,7 +21010,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 JSAtom atom;
                 JSValue val;
 
-                atom = get_u32(pc);
+                atom = bc_get_atom_operand(b, pc);
                 pc += 4;
                 val = JS_NewSymbolFromAtom(ctx, atom, JS_ATOM_TYPE_PRIVATE);
                 if (JS_IsException(val))
@@ -17874,7 +21061,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 int ret;
                 JSAtom atom;
-                atom = get_u32(pc);
+                atom = bc_get_atom_operand(b, pc);
                 pc += 4;
 
                 ret = JS_DefinePropertyValue(ctx, sp[-2], atom, sp[-1],
@@ -17889,7 +21076,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 int ret;
                 JSAtom atom;
-                atom = get_u32(pc);
+                atom = bc_get_atom_operand(b, pc);
                 pc += 4;
 
                 ret = JS_DefineObjectName(ctx, sp[-1], atom, JS_PROP_CONFIGURABLE);
@@ -17940,7 +21127,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                         goto exception;
                     opcode += OP_define_method - OP_define_method_computed;
                 } else {
-                    atom = get_u32(pc);
+                    atom = bc_get_atom_operand(b, pc);
                     pc += 4;
                 }
                 op_flags = *pc++;
@@ -17986,7 +21173,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 int class_flags;
                 JSAtom atom;
 
-                atom = get_u32(pc);
+                atom = bc_get_atom_operand(b, pc);
                 class_flags = pc[4];
                 pc += 5;
                 if (js_op_define_class(ctx, sp, atom, class_flags,
@@ -18668,7 +21855,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 JSAtom atom;
                 int ret;
 
-                atom = get_u32(pc);
+                atom = bc_get_atom_operand(b, pc);
                 pc += 4;
 
                 sf->cur_pc = pc;
@@ -18739,7 +21926,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 int32_t diff;
                 JSValue obj, val;
                 int ret, is_with;
-                atom = get_u32(pc);
+                atom = bc_get_atom_operand(b, pc);
                 diff = get_u32(pc + 4);
                 is_with = pc[8];
                 pc += 9;
@@ -19120,6 +22307,11 @@ static __exception int async_func_init(JSContext *ctx, JSAsyncFunctionState *s,
     init_list_head(&sf->var_ref_list);
     p = JS_VALUE_GET_OBJ(func_obj);
     b = p->u.func.function_bytecode;
+    if (unlikely(b->is_lazy)) {
+        b = js_lazy_compile_function(ctx, p);
+        if (!b)
+            return -1;
+    }
     sf->is_strict_mode = b->is_strict_mode;
     sf->cur_pc = b->byte_code_buf;
     arg_buf_len = max_int(b->arg_count, argc);
@@ -19395,6 +22587,8 @@ static void js_async_function_free(JSRuntime *rt, JSAsyncFunctionData *s)
 {
     if (--s->header.ref_count == 0) {
         js_async_function_free0(rt, s);
+    } else {
+        gc_add_root(rt, &s->header);
     }
 }
 
@@ -20233,6 +23427,7 @@ typedef struct JSFunctionDef {
     bool need_home_object : 1;
     bool use_short_opcodes : 1; /* true if short opcodes are used in byte_code */
     bool has_await : 1; /* true if await is used (used in module eval) */
+    bool optimize : 1; /* true if optimize_bytecode() is run */
 
     JSFunctionKindEnum func_kind : 8;
     JSParseFunctionEnum func_type : 7;
@@ -20309,6 +23504,7 @@ typedef struct JSFunctionDef {
 
     char *source;  /* raw source, utf-8 encoded */
     int source_len;
+    JSSourceBlob *source_blob; /* != NULL if source points into it */
 
     JSModuleDef *module; /* != NULL when parsing a module */
 } JSFunctionDef;
@@ -20358,6 +23554,7 @@ typedef struct JSParseState {
     JSFunctionDef *cur_func;
     bool is_module; /* parsing a module */
     bool allow_html_comments;
+    JSSourceBlob *source_blob; /* shared copy of the input if rt->shared_source */
 } JSParseState;
 
 typedef struct JSOpCode {
@@ -20513,6 +23710,114 @@ int JS_PRINTF_FORMAT_ATTR(2, 3) js_parse_error(JSParseState *s, JS_PRINTF_FORMAT
     return -1;
 }
 
+/* Word at a time scanning of the source text: while at least 8 bytes
+   remain before 'end', they are tested at once with SWAR bit tricks.
+   Each scan_*() function returns a pointer to the first byte which
+   may need the per character code. It can stop early, so the caller
+   still runs its scalar loop, but it never skips a byte of interest. */
+
+#define SCAN_ONES 0x0101010101010101ULL
+#define SCAN_HIGH 0x8080808080808080ULL
+
+/* bit 7 of each byte is set iff the byte of 'v' is 'c' */
+static inline uint64_t scan_eq(uint64_t v, int c)
+{
+    const uint64_t low7 = SCAN_ONES * 0x7f;
+
+    v ^= SCAN_ONES * c;
+    return ~(((v & low7) + low7) | v | low7);
+}
+
+/* 7 bit bytes only: bit 7 of each byte is set iff the byte of 'v' is
+   lower than 'c' (1 <= c <= 0x80) */
+static inline uint64_t scan_lt(uint64_t v, int c)
+{
+    return ~(v + SCAN_ONES * (0x80 - c)) & SCAN_HIGH;
+}
+
+/* skip spaces and tabs */
+static const uint8_t *scan_spaces(const uint8_t *p, const uint8_t *end)
+{
+    uint64_t v;
+
+    while (end - p >= 8) {
+        v = get_u64(p);
+        if ((scan_eq(v, ' ') | scan_eq(v, '\t')) != SCAN_HIGH)
+            break;
+        p += 8;
+    }
+    while (*p == ' ' || *p == '\t')
+        p++;
+    return p;
+}
+
+/* skip the ASCII characters of a comment up to a line terminator, or
+   up to a '*' if 'is_block' */
+static const uint8_t *scan_comment(const uint8_t *p, const uint8_t *end,
+                                   bool is_block)
+{
+    uint64_t v, m;
+
+    while (end - p >= 8) {
+        v = get_u64(p);
+        m = (v & SCAN_HIGH) | scan_eq(v, '\n') | scan_eq(v, '\r');
+        if (is_block)
+            m |= scan_eq(v, '*');
+        if (m)
+            break;
+        p += 8;
+    }
+    return p;
+}
+
+/* skip the ASCII identifier characters ([A-Za-z0-9_$]) */
+static const uint8_t *scan_ident(const uint8_t *p, const uint8_t *end)
+{
+    uint64_t v, u, m;
+    int c;
+
+    while (end - p >= 8) {
+        v = get_u64(p);
+        if (v & SCAN_HIGH)
+            break;
+        u = v | (SCAN_ONES * 0x20); /* lower case */
+        m = ~scan_lt(u, 'a') & scan_lt(u, 'z' + 1);
+        m |= ~scan_lt(v, '0') & scan_lt(v, '9' + 1);
+        m |= scan_eq(v, '_') | scan_eq(v, '$');
+        if (m != SCAN_HIGH)
+            break;
+        p += 8;
+    }
+    for(;;) {
+        c = *p;
+        if (c >= 128 ||
+            !((lre_id_continue_table_ascii[c >> 5] >> (c & 31)) & 1))
+            break;
+        p++;
+    }
+    return p;
+}
+
+/* skip the printable ASCII characters of a string literal other than
+   'sep', '\\' and, in templates, '$' */
+static const uint8_t *scan_string(const uint8_t *p, const uint8_t *end,
+                                  int sep)
+{
+    uint64_t v, m;
+
+    while (end - p >= 8) {
+        v = get_u64(p);
+        m = (v & SCAN_HIGH) | scan_lt(v & ~SCAN_HIGH, 0x20) |
+            scan_eq(v, sep) | scan_eq(v, '\\');
+        if (sep == '`')
+            m |= scan_eq(v, '$');
+        if (m)
+            break;
+        p += 8;
+    }
+    return p;
+}
+
 #ifndef QJS_DISABLE_PARSER
 
 static __exception int next_token(JSParseState *s);
@@ -20580,6 +23885,12 @@ static __exception int js_parse_template_part(JSParseState *s,
     if (string_buffer_init(s->ctx, b, 32))
         goto fail;
     for(;;) {
+        p_next = scan_string(p, s->buf_end, '`');
+        if (p_next > p) {
+            if (string_buffer_write8(b, p, p_next - p))
+                goto fail;
+            p = p_next;
+        }
         if (p >= s->buf_end)
             goto unexpected_eof;
         c = *p++;
@@ -20650,6 +23961,12 @@ static __exception int js_parse_string(JSParseState *s, int sep,
     if (string_buffer_init(s->ctx, b, 32))
         goto fail;
     for(;;) {
+        p_next = scan_string(p, s->buf_end, sep);
+        if (p_next > p) {
+            if (string_buffer_write8(b, p, p_next - p))
+                goto fail;
+            p = p_next;
+        }
         if (p >= s->buf_end)
             goto invalid_char;
         c = *p;
@@ -20957,7 +24274,7 @@ static JSAtom parse_ident(JSParseState *s, const uint8_t **pp,
 {
     const uint8_t *p, *p_next;
     char ident_buf[128], *buf;
-    size_t ident_size, ident_pos;
+    size_t ident_size, ident_pos, len;
     JSAtom atom = JS_ATOM_NULL;
 
     p = *pp;
@@ -20972,6 +24289,15 @@ static JSAtom parse_ident(JSParseState *s, const uint8_t **pp,
         } else {
             ident_pos += utf8_encode((uint8_t*)buf + ident_pos, c);
         }
+        /* copy the following ASCII characters at once */
+        len = scan_ident(p, s->buf_end) - p;
+        while (unlikely(ident_pos + len >= ident_size - UTF8_CHAR_LEN_MAX)) {
+            if (ident_realloc(s->ctx, &buf, &ident_size, ident_buf))
+                goto done;
+        }
+        memcpy(buf + ident_pos, p, len);
+        ident_pos += len;
+        p += len;
         c = *p;
         p_next = p + 1;
         if (c == '\\' && *p_next == 'u') {
@@ -21057,13 +24383,15 @@ static __exception int next_token(JSParseState *s)
     case '\v':
     case ' ':
     case '\t':
-        s->mark = ++p;
+        p = scan_spaces(p + 1, s->buf_end);
+        s->mark = p;
         goto redo;
     case '/':
         if (p[1] == '*') {
             /* comment */
             p += 2;
             for(;;) {
+                p = scan_comment(p, s->buf_end, true);
                 if (*p == '\0' && p >= s->buf_end) {
                     js_parse_error(s, "unexpected end of comment");
                     goto fail;
@@ -21097,6 +24425,7 @@ static __exception int next_token(JSParseState *s)
             p += 2;
         skip_line_comment:
             for(;;) {
+                p = scan_comment(p, s->buf_end, false);
                 if (*p == '\0' && p >= s->buf_end)
                     break;
                 if (*p == '\r' || *p == '\n')
@@ -21499,6 +24828,7 @@ static int json_parse_string(JSParseState *s, const uint8_t **pp)
 
         // Fast path: batch consecutive ASCII characters
         const uint8_t *p_start = p;
+        p = scan_string(p, s->buf_end, '"');
         while (p < s->buf_end && *p != '"' && *p != '\\' && *p >= 0x20 && *p < 0x80) {
             p++;
         }
@@ -21576,6 +24906,7 @@ static int json_parse_number(JSParseState *s, const uint8_t **pp)
 {
     const uint8_t *p = *pp;
     const uint8_t *p_start = p;
+    JSATODTempMem atod_mem;
 
     if (*p == '+' || *p == '-')
         p++;
@@ -21606,7 +24937,8 @@ static int json_parse_number(JSParseState *s, const uint8_t **pp)
             p++;
     }
     s->token.val = TOK_NUMBER;
-    s->token.u.num.val = js_float64(strtod((const char *)p_start, NULL));
+    s->token.u.num.val = js_float64(js_atod((const char *)p_start, NULL, 10, 0,
+                                             &atod_mem));
     *pp = p;
     return 0;
 }
@@ -21616,27 +24948,24 @@ static JSAtom json_parse_ident(JSParseState *s, const uint8_t **pp, int c)
 {
     const uint8_t *p;
     char ident_buf[128], *buf;
-    size_t ident_size, ident_pos;
+    size_t ident_size, ident_pos, len;
     JSAtom atom;
 
     p = *pp;
     buf = ident_buf;
     ident_size = sizeof(ident_buf);
     ident_pos = 0;
-    for(;;) {
-        buf[ident_pos++] = c;
-        c = *p;
-        if (c >= 128 ||
-            !((lre_id_continue_table_ascii[c >> 5] >> (c & 31)) & 1))
-            break;
-        p++;
-        if (unlikely(ident_pos >= ident_size - UTF8_CHAR_LEN_MAX)) {
-            if (ident_realloc(s->ctx, &buf, &ident_size, ident_buf)) {
-                atom = JS_ATOM_NULL;
-                goto done;
-            }
+    len = scan_ident(p, s->buf_end) - p;
+    while (unlikely(len + 1 > ident_size)) {
+        if (ident_realloc(s->ctx, &buf, &ident_size, ident_buf)) {
+            atom = JS_ATOM_NULL;
+            goto done;
         }
     }
+    buf[ident_pos++] = c;
+    memcpy(buf + ident_pos, p, len);
+    ident_pos += len;
+    p += len;
     /* buf contains pure ASCII */
     atom = JS_NewAtomLen(s->ctx, buf, ident_pos);
  done:
@@ -21699,7 +25028,7 @@ static __exception int json_next_token(JSParseState *s)
         goto def_token;
     case ' ':
     case '\t':
-        p++;
+        p = scan_spaces(p + 1, s->buf_end);
         s->mark = p;
         goto redo;
     case '/':
@@ -21780,12 +25109,59 @@ static __exception int json_next_token(JSParseState *s)
     return -1;
 }
 
+/* Read the token after '{' or ','. A property name made of printable
+   ASCII characters without escapes is atomized straight from the input
+   buffer and returned in '*pname', the current token is then the one
+   following it. Otherwise '*pname' is JS_ATOM_NULL and the current token
+   is set by json_next_token(). */
+static __exception int json_next_prop_name(JSParseState *s, JSAtom *pname)
+{
+    const uint8_t *p, *q;
+    JSAtom atom;
+
+    *pname = JS_ATOM_NULL;
+    p = s->buf_ptr;
+    for(;;) {
+        if (*p == ' ' || *p == '\t') {
+            p++;
+            s->mark = p;
+        } else if (*p == '\n' || (*p == '\r' && p[1] == '\n')) {
+            p += (*p == '\r');
+            s->line_num++;
+            s->eol = p++;
+            s->mark = p;
+        } else {
+            break;
+        }
+    }
+    s->buf_ptr = p;
+    if (*p != '\"')
+        return json_next_token(s);
+    for(q = p + 1; q < s->buf_end; q++) {
+        if (*q < 0x20 || *q >= 0x80 || *q == '\"' || *q == '\\')
+            break;
+    }
+    if (q >= s->buf_end || *q != '\"')
+        return json_next_token(s);
+    atom = JS_NewAtomLen(s->ctx, (const char *)p + 1, q - p - 1);
+    if (atom == JS_ATOM_NULL)
+        return -1;
+    s->buf_ptr = q + 1;
+    if (json_next_token(s)) {
+        JS_FreeAtom(s->ctx, atom);
+        return -1;
+    }
+    *pname = atom;
+    return 0;
+}
+
 #ifndef QJS_DISABLE_PARSER
 
 /* only used for ':' and '=>', 'let' or 'function' look-ahead. *pp is
    only set if TOK_IMPORT is returned */
 /* XXX: handle all unicode cases */
-static int simple_next_token(const uint8_t **pp, bool no_line_terminator)
+static int simple_next_token(const uint8_t **pp, const uint8_t *buf_end,
+                             bool no_line_terminator)
 {
     const uint8_t *p;
     uint32_t c;
@@ -21808,12 +25184,16 @@ static int simple_next_token(const uint8_t **pp, bool no_line_terminator)
             if (*p == '/') {
                 if (no_line_terminator)
                     return '\n';
+                p = scan_comment(p, buf_end, false);
                 while (*p && *p != '\r' && *p != '\n')
                     p++;
                 continue;
             }
             if (*p == '*') {
-                while (*++p) {
+                for (p++; *p; p++) {
+                    p = scan_comment(p, buf_end, true);
+                    if (!*p)
+                        break;
                     if ((*p == '\r' || *p == '\n') && no_line_terminator)
                         return '\n';
                     if (*p == '*' && p[1] == '/') {
@@ -21867,7 +25247,7 @@ static int simple_next_token(const uint8_t **pp, bool no_line_terminator)
 static int peek_token(JSParseState *s, bool no_line_terminator)
 {
     const uint8_t *p = s->buf_ptr;
-    return simple_next_token(&p, no_line_terminator);
+    return simple_next_token(&p, s->buf_end, no_line_terminator);
 }
 
 static void skip_shebang(const uint8_t **pp, const uint8_t *buf_end)
@@ -23456,6 +26836,45 @@ static __exception int js_parse_class_default_ctor(JSParseState *s,
     return 0;
 }
 
+/* store the source code of 'fd', which is the 'len' bytes at 'ptr' in
+   the parsed input */
+static int js_save_function_source(JSParseState *s, JSFunctionDef *fd,
+                                   const uint8_t *ptr, size_t len)
+{
+    JSContext *ctx = s->ctx;
+    JSSourceBlob *sb;
+    size_t input_len;
+
+    js_free_function_source(ctx->rt, fd->source, fd->source_blob);
+    fd->source = NULL;
+    fd->source_blob = NULL;
+    fd->source_len = len;
+    if (!ctx->rt->shared_source) {
+        fd->source = js_strndup(ctx, (const char *)ptr, len);
+        return fd->source ? 0 : -1;
+    }
+    sb = s->source_blob;
+    if (!sb) {
+        /* copied once per script: the input is not owned by the parser */
+        input_len = s->buf_end - s->buf_start;
+        if (input_len > INT32_MAX) {
+            JS_ThrowOutOfMemory(ctx);
+            return -1;
+        }
+        sb = js_malloc(ctx, sizeof(*sb) + input_len + 1);
+        if (!sb)
+            return -1;
+        sb->ref_count = 1; /* reference of the parser */
+        sb->len = input_len;
+        memcpy(sb->buf, s->buf_start, input_len);
+        sb->buf[input_len] = '\0';
+        s->source_blob = sb;
+    }
+    sb->ref_count++;
+    fd->source_blob = sb;
+    fd->source = sb->buf + (ptr - s->buf_start);
+    return 0;
+}
 
 static __exception int js_parse_class(JSParseState *s, bool is_class_expr,
                                       JSParseExportEnum export_flag)
@@ -23868,10 +27287,8 @@ static __exception int js_parse_class(JSParseState *s, bool is_class_expr,
     put_u32(fd->byte_code.buf + ctor_cpool_offset, ctor_fd->parent_cpool_idx);
 
     /* store the class source code in the constructor. */
-    js_free(ctx, ctor_fd->source);
-    ctor_fd->source_len = s->buf_ptr - class_start_ptr;
-    ctor_fd->source = js_strndup(ctx, (const char *)class_start_ptr, ctor_fd->source_len);
-    if (!ctor_fd->source)
+    if (js_save_function_source(s, ctor_fd, class_start_ptr,
+                                s->buf_ptr - class_start_ptr))
         goto fail;
 
     /* consume the '}' */
@@ -28572,7 +31989,7 @@ static int js_resolve_module(JSContext *ctx, JSModuleDef *m)
 static JSVarRef *js_create_module_var(JSContext *ctx, bool is_lexical)
 {
     JSVarRef *var_ref;
-    var_ref = js_malloc(ctx, sizeof(JSVarRef));
+    var_ref = js_slab_alloc(ctx, sizeof(JSVarRef));
     if (!var_ref)
         return NULL;
     var_ref->header.ref_count = 1;
@@ -29996,6 +33413,7 @@ static JSFunctionDef *js_new_function_def(JSContext *ctx,
     if (parent) {
         list_add_tail(&fd->link, &parent->child_list);
         fd->is_strict_mode = parent->is_strict_mode;
+        fd->optimize = parent->optimize;
         fd->parent_scope_level = parent->scope_level;
     }
 
@@ -30073,6 +33491,17 @@ static void free_bytecode_atoms(JSRuntime *rt,
     }
 }
 
+static void free_bytecode_rom_atoms(JSRuntime *rt, JSBytecodeAtoms *ba)
+{
+    uint32_t i;
+
+    if (--ba->ref_count > 0)
+        return;
+    for(i = 0; i < ba->count; i++)
+        JS_FreeAtomRT(rt, ba->tab[i]);
+    js_free_rt(rt, ba);
+}
+
 #ifndef QJS_DISABLE_PARSER
 
 static void js_free_function_def(JSContext *ctx, JSFunctionDef *fd)
@@ -30128,7 +33557,7 @@ static void js_free_function_def(JSContext *ctx, JSFunctionDef *fd)
     JS_FreeAtom(ctx, fd->filename);
     dbuf_free(&fd->pc2line);
 
-    js_free(ctx, fd->source);
+    js_free_function_source(ctx->rt, fd->source, fd->source_blob);
 
     if (fd->parent) {
         /* remove in parent list */
@@ -30140,22 +33569,28 @@ static void js_free_function_def(JSContext *ctx, JSFunctionDef *fd)
 #endif // QJS_DISABLE_PARSER
 
 #ifdef ENABLE_DUMPS // JS_DUMP_BYTECODE_*
-static const char *skip_lines(const char *p, int n) {
-    while (p && n-- > 0 && *p) {
-        while (*p && *p++ != '\n')
+/* the sources are not always null terminated: they can be slices of a
+   shared copy of the script */
+static const char *skip_lines(const char *p, const char *end, int n) {
+    while (n-- > 0 && p < end) {
+        while (p < end && *p++ != '\n')
             continue;
     }
     return p;
 }
 
-static void print_lines(const char *source, int line, int line1) {
-    const char *s = source;
-    const char *p = skip_lines(s, line);
-    if (p && *p) {
+static void print_lines(const char *source, int source_len,
+                        int line, int line1) {
+    const char *s, *p, *end;
+    if (!source)
+        return;
+    end = source + source_len;
+    p = skip_lines(source, end, line);
+    if (p < end) {
         while (line++ < line1) {
-            p = skip_lines(s = p, 1);
+            p = skip_lines(s = p, end, 1);
             printf(";; %.*s", (int)(p - s), s);
-            if (!*p) {
+            if (p >= end) {
                 if (p[-1] != '\n')
                     printf("\n");
                 break;
@@ -30170,7 +33605,7 @@ static void dump_byte_code(JSContext *ctx, int pass,
                            const JSVarDef *vars, int var_count,
                            const JSClosureVar *closure_var, int closure_var_count,
                            const JSValue *cpool, uint32_t cpool_count,
-                           const char *source, int line_num,
+                           const char *source, int source_len, int line_num,
                            const LabelSlot *label_slots, JSFunctionBytecode *b,
                            int start_pos)
 {
@@ -30226,7 +33661,7 @@ static void dump_byte_code(JSContext *ctx, int pass,
     in_source = 0;
     if (source) {
         /* Always print first line: needed if single line */
-        print_lines(source, 0, 1);
+        print_lines(source, source_len, 0, 1);
         in_source = 1;
     }
     line1 = line = 1;
@@ -30244,7 +33679,7 @@ static void dump_byte_code(JSContext *ctx, int pass,
                 if (!in_source)
                     printf("\n");
                 in_source = 1;
-                print_lines(source, line, line1);
+                print_lines(source, source_len, line, line1);
                 line = line1;
                 //bits[pos] |= 2;
             }
@@ -30355,22 +33790,26 @@ static void dump_byte_code(JSContext *ctx, int pass,
             break;
         case OP_FMT_atom:
             printf(" ");
-            print_atom(ctx, get_u32(tab + pos));
+            print_atom(ctx, b ? bc_get_atom_operand(b, tab + pos) :
+                       get_u32(tab + pos));
             break;
         case OP_FMT_atom_u8:
             printf(" ");
-            print_atom(ctx, get_u32(tab + pos));
+            print_atom(ctx, b ? bc_get_atom_operand(b, tab + pos) :
+                       get_u32(tab + pos));
             printf(",%d", get_u8(tab + pos + 4));
             break;
         case OP_FMT_atom_u16:
             printf(" ");
-            print_atom(ctx, get_u32(tab + pos));
+            print_atom(ctx, b ? bc_get_atom_operand(b, tab + pos) :
+                       get_u32(tab + pos));
             printf(",%d", get_u16(tab + pos + 4));
             break;
         case OP_FMT_atom_label_u8:
         case OP_FMT_atom_label_u16:
             printf(" ");
-            print_atom(ctx, get_u32(tab + pos));
+            print_atom(ctx, b ? bc_get_atom_operand(b, tab + pos) :
+                       get_u32(tab + pos));
             addr = get_u32(tab + pos + 4);
             if (pass == 1)
                 printf(",%u:%u", addr, label_slots[addr].pos);
@@ -30437,7 +33876,7 @@ static void dump_byte_code(JSContext *ctx, int pass,
     if (source) {
         if (!in_source)
             printf("\n");
-        print_lines(source, line, INT32_MAX);
+        print_lines(source, source_len, line, INT32_MAX);
     }
     js_free(ctx, bits);
 }
@@ -30459,13 +33898,15 @@ static __maybe_unused void dump_single_byte_code(JSContext *ctx,
                    args, b->arg_count, vars, b->var_count,
                    b->closure_var, b->closure_var_count,
                    b->cpool, b->cpool_count,
-                   NULL, b->line_num,
+                   NULL, 0, b->line_num,
                    NULL, b, start_pos);
 }
 
+/* ROM sources are not null terminated */
 static __maybe_unused void print_func_name(JSFunctionBytecode *b)
 {
-    print_lines(b->source, 0, 1);
+    if (!b->debug_in_rom)
+        print_lines(b->source, b->source_len, 0, 1);
 }
 
 static __maybe_unused void dump_pc2line(JSContext *ctx,
@@ -30586,7 +34027,9 @@ static __maybe_unused void js_dump_function_bytecode(JSContext *ctx, JSFunctionB
                    b->vardefs ? b->vardefs + b->arg_count : NULL, b->var_count,
                    b->closure_var, b->closure_var_count,
                    b->cpool, b->cpool_count,
-                   b->source, b->line_num, NULL, b, 0);
+                   b->debug_in_rom ? NULL : b->source, b->source_len,
+                   b->line_num,
+                   NULL, b, 0);
 #ifdef ENABLE_DUMPS // JS_DUMP_BYTECODE_PC2LINE
     if (check_dump_flag(ctx->rt, JS_DUMP_BYTECODE_PC2LINE))
         dump_pc2line(ctx, b->pc2line_buf, b->pc2line_len, b->line_num, b->col_num);
@@ -32685,6 +36128,533 @@ static void put_short_code(DynBuf *bc_out, int op, int idx)
     dbuf_put_u16(bc_out, idx);
 }
 
+/* Constant folding, constant/copy propagation and dead store
+   elimination on the phase 2 bytecode. Only straight-line code is
+   analyzed: a label ends the region in which a local variable is
+   known to hold the value stored by its single assignment. Jumps and
+   labels are never removed so that 'jump_size' and the label
+   reference counts computed in phase 2 stay valid. */
+
+#define OPT_MAX_ROUNDS 4
+#define OPT_HIST_SIZE  8
+
+enum {
+    OPT_VAR_KEEP,
+    OPT_VAR_SUBST, /* the reads are replaced by the stored instruction */
+    OPT_VAR_DEAD,  /* never read: the stores and TDZ resets are removed */
+};
+
+typedef struct OptVarInfo {
+    int read_count;
+    int write_count;
+    int uninit_count;
+    int check_write_count; /* writes depending on the TDZ state */
+    int write_pos; /* position of the last write */
+    int write_block;
+    int src_pos; /* position of the instruction before the write or -1 */
+    int first_read_pos;
+    int last_read_block;
+    int uninit_pos;
+    bool disabled : 1;
+    uint8_t action : 2;
+} OptVarInfo;
+
+typedef struct OptState {
+    JSContext *ctx;
+    JSFunctionDef *s;
+    DynBuf out;
+    int hist[OPT_HIST_SIZE]; /* positions of the last emitted instructions */
+    int hist_len;
+    int change_count;
+} OptState;
+
+static bool opt_is_special_var(JSFunctionDef *s, int idx)
+{
+    return (idx == s->var_object_idx || idx == s->arg_var_object_idx ||
+            idx == s->arguments_var_idx || idx == s->arguments_arg_idx ||
+            idx == s->func_var_idx || idx == s->this_var_idx ||
+            idx == s->new_target_var_idx ||
+            idx == s->this_active_func_var_idx ||
+            idx == s->home_object_var_idx);
+}
+
+static bool opt_is_const(JSFunctionDef *s, const uint8_t *p)
+{
+    JSValue val;
+
+    switch(p[0]) {
+    case OP_push_i32:
+    case OP_push_bigint_i32:
+    case OP_push_atom_value:
+    case OP_push_empty_string:
+    case OP_undefined:
+    case OP_null:
+    case OP_push_true:
+    case OP_push_false:
+        return true;
+    case OP_push_const:
+        val = s->cpool[get_u32(p + 1)];
+        return JS_IsNumber(val) || JS_IsString(val) || JS_IsBigInt(val);
+    default:
+        return false;
+    }
+}
+
+/* instructions pushing one value without side effect */
+static bool opt_is_pure_push(JSFunctionDef *s, const uint8_t *p)
+{
+    switch(p[0]) {
+    case OP_get_loc:
+    case OP_get_arg:
+    case OP_get_var_ref:
+    case OP_dup:
+        return true;
+    default:
+        return opt_is_const(s, p);
+    }
+}
+
+/* return true if the reads of the variable stored at 'write_pos' can
+   be replaced by the instruction 'p' which pushed the stored value */
+static bool opt_is_subst_source(JSFunctionDef *s, OptVarInfo *vars,
+                                OptVarInfo *args, int var_idx,
+                                const uint8_t *p, int write_pos)
+{
+    OptVarInfo *vi;
+    int idx;
+
+    if (opt_is_const(s, p))
+        return true;
+    switch(p[0]) {
+    case OP_get_loc:
+    case OP_get_loc_check:
+        idx = get_u16(p + 1);
+        vi = &vars[idx];
+        return (idx != var_idx && !vi->disabled &&
+                !opt_is_special_var(s, idx) && !s->vars[idx].is_captured &&
+                vi->write_count == 1 && vi->write_pos < write_pos &&
+                (vi->uninit_count == 0 ||
+                 (vi->uninit_count == 1 && vi->uninit_pos < vi->write_pos)));
+    case OP_get_arg:
+        idx = get_u16(p + 1);
+        vi = &args[idx];
+        /* mapped arguments alias the parameters */
+        if (s->arguments_var_idx >= 0 && !s->is_strict_mode &&
+            s->has_simple_parameter_list)
+            return false;
+        return (!vi->disabled && !s->args[idx].is_captured &&
+                vi->write_count == 0);
+    default:
+        return false;
+    }
+}
+
+static void opt_scan(JSFunctionDef *s, OptVarInfo *vars, OptVarInfo *args)
+{
+    const uint8_t *bc_buf = s->byte_code.buf;
+    int bc_len = s->byte_code.size;
+    int pos, len, op, idx, block, prev_pos;
+    OptVarInfo *vi;
+
+    block = 0;
+    prev_pos = -1;
+    for (pos = 0; pos < bc_len; pos += len) {
+        op = bc_buf[pos];
+        len = opcode_info[op].size;
+        switch(op) {
+        case OP_source_loc:
+            continue;
+        case OP_label:
+            block++;
+            prev_pos = -1;
+            continue;
+        case OP_get_loc:
+        case OP_get_loc_check:
+            vi = &vars[get_u16(bc_buf + pos + 1)];
+            if (vi->read_count++ == 0)
+                vi->first_read_pos = pos;
+            vi->last_read_block = block;
+            break;
+        case OP_put_loc:
+        case OP_set_loc:
+        case OP_put_loc_check:
+        case OP_put_loc_check_init:
+            vi = &vars[get_u16(bc_buf + pos + 1)];
+            vi->write_count++;
+            if (op == OP_put_loc_check || op == OP_put_loc_check_init)
+                vi->check_write_count++;
+            vi->write_pos = pos;
+            vi->write_block = block;
+            vi->src_pos = prev_pos;
+            break;
+        case OP_set_loc_uninitialized:
+            vi = &vars[get_u16(bc_buf + pos + 1)];
+            vi->uninit_count++;
+            vi->uninit_pos = pos;
+            break;
+        case OP_get_arg:
+            break;
+        case OP_put_arg:
+        case OP_set_arg:
+            args[get_u16(bc_buf + pos + 1)].write_count++;
+            break;
+        case OP_make_loc_ref:
+            vars[get_u16(bc_buf + pos + 5)].disabled = true;
+            break;
+        case OP_make_arg_ref:
+            args[get_u16(bc_buf + pos + 5)].disabled = true;
+            break;
+        default:
+            /* close_loc and any other access by index */
+            if (opcode_info[op].fmt == OP_FMT_loc)
+                vars[get_u16(bc_buf + pos + 1)].disabled = true;
+            else if (opcode_info[op].fmt == OP_FMT_arg)
+                args[get_u16(bc_buf + pos + 1)].disabled = true;
+            break;
+        }
+        prev_pos = pos;
+    }
+
+    for (idx = 0; idx < s->var_count; idx++) {
+        vi = &vars[idx];
+        vi->action = OPT_VAR_KEEP;
+        if (vi->disabled || s->vars[idx].is_captured ||
+            opt_is_special_var(s, idx))
+            continue;
+        if (vi->read_count == 0) {
+            if (vi->check_write_count == 0 &&
+                (vi->write_count != 0 || vi->uninit_count != 0))
+                vi->action = OPT_VAR_DEAD;
+        } else if (vi->write_count == 1 && vi->src_pos >= 0 &&
+                   vi->first_read_pos > vi->write_pos &&
+                   vi->last_read_block == vi->write_block &&
+                   (vi->uninit_count == 0 ||
+                    (vi->uninit_count == 1 && vi->uninit_pos < vi->write_pos)) &&
+                   opt_is_subst_source(s, vars, args, idx,
+                                       bc_buf + vi->src_pos, vi->write_pos)) {
+            vi->action = OPT_VAR_SUBST;
+        }
+    }
+}
+
+/* remove the emitted code from 'pos'. Return true if a source_loc was
+   removed and copy the last one to 'sl_buf'. */
+static bool opt_truncate(OptState *os, int pos, uint8_t *sl_buf)
+{
+    DynBuf *bc = &os->out;
+    int p, op;
+    bool has_sl;
+
+    has_sl = false;
+    for (p = pos; p < bc->size; p += opcode_info[op].size) {
+        op = bc->buf[p];
+        if (op == OP_source_loc) {
+            memcpy(sl_buf, bc->buf + p, opcode_info[op].size);
+            has_sl = true;
+        }
+    }
+    free_bytecode_atoms(os->ctx->rt, bc->buf + pos, bc->size - pos, false);
+    bc->size = pos;
+    while (os->hist_len > 0 && os->hist[os->hist_len - 1] >= pos)
+        os->hist_len--;
+    return has_sl;
+}
+
+static void opt_put(OptState *os, const uint8_t *p)
+{
+    int op = p[0];
+
+    switch(opcode_info[op].fmt) {
+    case OP_FMT_atom:
+    case OP_FMT_atom_u8:
+    case OP_FMT_atom_u16:
+    case OP_FMT_atom_label_u8:
+    case OP_FMT_atom_label_u16:
+        JS_DupAtom(os->ctx, get_u32(p + 1));
+        break;
+    default:
+        break;
+    }
+    if (os->hist_len == OPT_HIST_SIZE) {
+        memmove(os->hist, os->hist + 1, sizeof(os->hist[0]) * (OPT_HIST_SIZE - 1));
+        os->hist_len--;
+    }
+    os->hist[os->hist_len++] = os->out.size;
+    dbuf_put(&os->out, p, opcode_info[op].size);
+}
+
+/* replace the last 'n' emitted instructions by 'op' (OP_nop for none) */
+static void opt_replace(OptState *os, int n, int op, int32_t val)
+{
+    uint8_t sl_buf[9], buf[5];
+    bool has_sl;
+
+    has_sl = opt_truncate(os, os->hist[os->hist_len - n], sl_buf);
+    if (op != OP_nop) {
+        buf[0] = op;
+        if (op == OP_push_i32)
+            put_u32(buf + 1, val);
+        opt_put(os, buf);
+    }
+    /* keep the line number of the following instructions */
+    if (has_sl)
+        dbuf_put(&os->out, sl_buf, sizeof(sl_buf));
+    os->change_count++;
+}
+
+static bool opt_fold_binary(int op, int32_t a, int32_t b, int *pop,
+                            int32_t *pval)
+{
+    int64_t r;
+    int res_op = OP_push_i32;
+
+    switch(op) {
+    case OP_add:
+        r = (int64_t)a + b;
+        break;
+    case OP_sub:
+        r = (int64_t)a - b;
+        break;
+    case OP_mul:
+        r = (int64_t)a * b;
+        if (r == 0 && (a < 0 || b < 0))
+            return false; /* -0 */
+        break;
+    case OP_div:
+        if (b == 0 || (a == 0 && b < 0) || (a == INT32_MIN && b == -1) ||
+            a % b != 0)
+            return false;
+        r = a / b;
+        break;
+    case OP_mod:
+        if (b == 0 || b == -1)
+            return false;
+        r = a % b;
+        if (r == 0 && a < 0)
+            return false; /* -0 */
+        break;
+    case OP_and:
+        r = a & b;
+        break;
+    case OP_or:
+        r = a | b;
+        break;
+    case OP_xor:
+        r = a ^ b;
+        break;
+    case OP_shl:
+        r = (int32_t)((uint32_t)a << (b & 0x1f));
+        break;
+    case OP_sar:
+        r = a >> (b & 0x1f);
+        break;
+    case OP_shr:
+        r = (uint32_t)a >> (b & 0x1f);
+        break;
+    case OP_lt:
+        r = a < b;
+        goto bool_res;
+    case OP_lte:
+        r = a <= b;
+        goto bool_res;
+    case OP_gt:
+        r = a > b;
+        goto bool_res;
+    case OP_gte:
+        r = a >= b;
+        goto bool_res;
+    case OP_eq:
+    case OP_strict_eq:
+        r = a == b;
+        goto bool_res;
+    case OP_neq:
+    case OP_strict_neq:
+        r = a != b;
+    bool_res:
+        res_op = r ? OP_push_true : OP_push_false;
+        break;
+    default:
+        return false;
+    }
+    if (r != (int32_t)r)
+        return false;
+    *pop = res_op;
+    *pval = r;
+    return true;
+}
+
+/* emit 'p' after trying to fold it with the previous instructions */
+static void opt_emit(OptState *os, const uint8_t *p)
+{
+    JSFunctionDef *s = os->s;
+    int op = p[0], n = os->hist_len, res_op;
+    const uint8_t *p1, *p2;
+    int32_t a, b, val;
+
+    p1 = p2 = NULL;
+    if (n >= 1)
+        p2 = os->out.buf + os->hist[n - 1];
+    if (n >= 2)
+        p1 = os->out.buf + os->hist[n - 2];
+
+    switch(op) {
+    case OP_drop:
+        if (p2 && opt_is_pure_push(s, p2)) {
+            opt_replace(os, 1, OP_nop, 0);
+            return;
+        }
+        break;
+    case OP_to_propkey:
+        if (p2 && (p2[0] == OP_push_i32 || p2[0] == OP_push_atom_value ||
+                   (p2[0] == OP_push_const &&
+                    opt_is_const(s, p2) &&
+                    !JS_IsBigInt(s->cpool[get_u32(p2 + 1)])))) {
+            os->change_count++;
+            return;
+        }
+        break;
+    case OP_neg:
+    case OP_plus:
+    case OP_not:
+    case OP_lnot:
+        if (!p2)
+            break;
+        if (p2[0] == OP_push_i32) {
+            a = get_u32(p2 + 1);
+            if (op == OP_neg) {
+                if (a == 0 || a == INT32_MIN)
+                    break; /* -0 or not an int32 */
+                opt_replace(os, 1, OP_push_i32, -a);
+            } else if (op == OP_plus) {
+                os->change_count++;
+            } else if (op == OP_not) {
+                opt_replace(os, 1, OP_push_i32, ~a);
+            } else {
+                opt_replace(os, 1, a ? OP_push_false : OP_push_true, 0);
+            }
+            return;
+        }
+        if (op == OP_lnot &&
+            (p2[0] == OP_push_true || p2[0] == OP_push_false)) {
+            opt_replace(os, 1, p2[0] == OP_push_true ?
+                        OP_push_false : OP_push_true, 0);
+            return;
+        }
+        break;
+    default:
+        if (p1 && p1[0] == OP_push_i32 && p2[0] == OP_push_i32) {
+            a = get_u32(p1 + 1);
+            b = get_u32(p2 + 1);
+            if (opt_fold_binary(op, a, b, &res_op, &val)) {
+                opt_replace(os, 2, res_op, val);
+                return;
+            }
+        }
+        break;
+    }
+    opt_put(os, p);
+}
+
+static int optimize_bytecode_round(JSContext *ctx, JSFunctionDef *s,
+                                   OptVarInfo *vars, OptVarInfo *args)
+{
+    const uint8_t *bc_buf = s->byte_code.buf;
+    int bc_len = s->byte_code.size;
+    int pos, len, op, label;
+    OptVarInfo *vi;
+    OptState os_s, *os = &os_s;
+    uint8_t drop_op = OP_drop;
+
+    memset(vars, 0, sizeof(vars[0]) * s->var_count);
+    memset(args, 0, sizeof(args[0]) * s->arg_count);
+    opt_scan(s, vars, args);
+
+    os->ctx = ctx;
+    os->s = s;
+    os->hist_len = 0;
+    os->change_count = 0;
+    js_dbuf_init(ctx, &os->out);
+    /* the output is at most 5/3 of the input so that no reallocation
+       is needed once the label positions are modified */
+    if (dbuf_realloc(&os->out, bc_len * 2 + 16)) {
+        dbuf_free(&os->out);
+        JS_ThrowOutOfMemory(ctx);
+        return -1;
+    }
+
+    for (pos = 0; pos < bc_len; pos += len) {
+        op = bc_buf[pos];
+        len = opcode_info[op].size;
+        switch(op) {
+        case OP_source_loc:
+            dbuf_put(&os->out, bc_buf + pos, len);
+            continue;
+        case OP_label:
+            label = get_u32(bc_buf + pos + 1);
+            dbuf_put(&os->out, bc_buf + pos, len);
+            s->label_slots[label].pos2 = os->out.size;
+            os->hist_len = 0;
+            continue;
+        case OP_get_loc:
+        case OP_get_loc_check:
+            vi = &vars[get_u16(bc_buf + pos + 1)];
+            if (vi->action == OPT_VAR_SUBST) {
+                os->change_count++;
+                opt_emit(os, bc_buf + vi->src_pos);
+                continue;
+            }
+            break;
+        case OP_put_loc:
+        case OP_set_loc:
+        case OP_set_loc_uninitialized:
+            vi = &vars[get_u16(bc_buf + pos + 1)];
+            if (vi->action == OPT_VAR_DEAD) {
+                os->change_count++;
+                if (op == OP_put_loc)
+                    opt_emit(os, &drop_op);
+                continue;
+            }
+            break;
+        default:
+            break;
+        }
+        opt_emit(os, bc_buf + pos);
+    }
+    assert(!dbuf_error(&os->out));
+
+    if (os->change_count == 0) {
+        free_bytecode_atoms(ctx->rt, os->out.buf, os->out.size, false);
+        dbuf_free(&os->out);
+        return 0;
+    }
+    free_bytecode_atoms(ctx->rt, s->byte_code.buf, s->byte_code.size, false);
+    dbuf_free(&s->byte_code);
+    s->byte_code = os->out;
+    return 1;
+}
+
+static __exception int optimize_bytecode(JSContext *ctx, JSFunctionDef *s)
+{
+    OptVarInfo *vars, *args;
+    int i, ret;
+
+    /* direct eval can access any local variable */
+    if (s->has_eval_call)
+        return 0;
+    vars = js_malloc(ctx, sizeof(vars[0]) * (s->var_count + s->arg_count + 1));
+    if (!vars)
+        return -1;
+    args = vars + s->var_count;
+    ret = 0;
+    for (i = 0; i < OPT_MAX_ROUNDS; i++) {
+        ret = optimize_bytecode_round(ctx, s, vars, args);
+        if (ret <= 0)
+            break;
+    }
+    js_free(ctx, vars);
+    return ret < 0 ? -1 : 0;
+}
+
 /* peephole optimizations and resolve goto/labels */
 static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
 {
@@ -33887,14 +37857,12 @@ static int add_module_variables(JSContext *ctx, JSFunctionDef *fd)
 /* create a function object from a function definition. The function
    definition is freed. All the child functions are also created. It
    must be done this way to resolve all the variables. */
-static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
+/* first compilation pass of 'fd' and of its inner functions: the
+   variables are resolved, hence the closure variables are known */
+static __exception int js_resolve_function(JSContext *ctx, JSFunctionDef *fd)
 {
-    JSValue func_obj;
-    JSFunctionBytecode *b;
-    struct list_head *el, *el1;
-    int stack_size, scope, idx;
-    int function_size, byte_code_offset, cpool_offset;
-    int closure_var_offset, vardefs_offset;
+    struct list_head *el;
+    int scope, idx;
 
     /* recompute scope linkage */
     for (scope = 0; scope < fd->scope_count; scope++) {
@@ -33926,30 +37894,20 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
        are used to compile the eval and they must be ordered by scope,
        so it is necessary to create the closure variables before any
        other variable lookup is done. */
-#ifndef QJS_DISABLE_PARSER
     if (fd->has_eval_call)
         add_eval_variables(ctx, fd);
-#endif // QJS_DISABLE_PARSER
 
     /* add the module global variables in the closure */
     if (fd->module) {
         if (add_module_variables(ctx, fd))
-            goto fail;
+            return -1;
     }
 
-    /* first create all the child functions */
-    list_for_each_safe(el, el1, &fd->child_list) {
-        JSFunctionDef *fd1;
-        int cpool_idx;
-
-        fd1 = list_entry(el, JSFunctionDef, link);
-        cpool_idx = fd1->parent_cpool_idx;
-        func_obj = js_create_function(ctx, fd1);
-        if (JS_IsException(func_obj))
-            goto fail;
-        /* save it in the constant pool */
-        assert(cpool_idx >= 0);
-        fd->cpool[cpool_idx] = func_obj;
+    /* the child functions add their closure variables to the parents */
+    list_for_each(el, &fd->child_list) {
+        JSFunctionDef *fd1 = list_entry(el, JSFunctionDef, link);
+        if (js_resolve_function(ctx, fd1))
+            return -1;
     }
 
 #ifdef ENABLE_DUMPS // JS_DUMP_BYTECODE_PASS1
@@ -33958,14 +37916,15 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
         dump_byte_code(ctx, 1, fd->byte_code.buf, fd->byte_code.size,
                        fd->args, fd->arg_count, fd->vars, fd->var_count,
                        fd->closure_var, fd->closure_var_count,
-                       fd->cpool, fd->cpool_count, fd->source, fd->line_num,
+                       fd->cpool, fd->cpool_count, fd->source, fd->source_len,
+                       fd->line_num,
                        fd->label_slots, NULL, 0);
         printf("\n");
     }
 #endif
 
     if (resolve_variables(ctx, fd))
-        goto fail;
+        return -1;
 
 #ifdef ENABLE_DUMPS // JS_DUMP_BYTECODE_PASS2
     if (check_dump_flag(ctx->rt, JS_DUMP_BYTECODE_PASS2)) {
@@ -33973,11 +37932,156 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
         dump_byte_code(ctx, 2, fd->byte_code.buf, fd->byte_code.size,
                        fd->args, fd->arg_count, fd->vars, fd->var_count,
                        fd->closure_var, fd->closure_var_count,
-                       fd->cpool, fd->cpool_count, fd->source, fd->line_num,
+                       fd->cpool, fd->cpool_count, fd->source, fd->source_len,
+                       fd->line_num,
                        fd->label_slots, NULL, 0);
         printf("\n");
     }
 #endif
+    return 0;
+}
+
+/* minimum size of the resolved code of a function for its code
+   generation to be deferred */
+#define JS_LAZY_FUNCTION_MIN_SIZE 256
+
+static bool js_can_defer_function(JSContext *ctx, JSFunctionDef *fd)
+{
+    return ctx->rt->lazy_compile &&
+        fd->byte_code.size >= JS_LAZY_FUNCTION_MIN_SIZE;
+}
+
+/* release the unused parts of the buffers of 'fd' and of its inner
+   functions while they wait for their code generation */
+static void js_shrink_function_def(JSContext *ctx, JSFunctionDef *fd)
+{
+    JSRuntime *rt = ctx->rt;
+    struct list_head *el;
+    void *ptr;
+
+    if (fd->byte_code.size < fd->byte_code.allocated_size) {
+        ptr = js_realloc_rt(rt, fd->byte_code.buf, fd->byte_code.size);
+        if (ptr) {
+            fd->byte_code.buf = ptr;
+            fd->byte_code.allocated_size = fd->byte_code.size;
+        }
+    }
+    if (fd->label_count > 0 && fd->label_count < fd->label_size) {
+        ptr = js_realloc_rt(rt, fd->label_slots,
+                            fd->label_count * sizeof(fd->label_slots[0]));
+        if (ptr) {
+            fd->label_slots = ptr;
+            fd->label_size = fd->label_count;
+        }
+    }
+    if (fd->closure_var_count > 0 &&
+        fd->closure_var_count < fd->closure_var_size) {
+        ptr = js_realloc_rt(rt, fd->closure_var,
+                            fd->closure_var_count * sizeof(fd->closure_var[0]));
+        if (ptr) {
+            fd->closure_var = ptr;
+            fd->closure_var_size = fd->closure_var_count;
+        }
+    }
+    list_for_each(el, &fd->child_list) {
+        js_shrink_function_def(ctx, list_entry(el, JSFunctionDef, link));
+    }
+}
+
+/* create a placeholder for 'fd' whose code is generated by
+   js_lazy_compile_bytecode(). It has all the information needed to
+   create closures. 'fd' is freed with the placeholder if it is never
+   called. */
+static JSValue js_create_lazy_function(JSContext *ctx, JSFunctionDef *fd)
+{
+    JSFunctionBytecode *b;
+    int i;
+
+    ctx->rt->alloc_kind = JS_ALLOC_KIND_BYTECODE;
+    b = js_mallocz(ctx, sizeof(*b) + sizeof(*b->cpool) +
+                   fd->closure_var_count * sizeof(*b->closure_var));
+    ctx->rt->alloc_kind = JS_ALLOC_KIND_OTHER;
+    if (!b)
+        return JS_EXCEPTION;
+    b->header.ref_count = 1;
+    b->is_lazy = true;
+    b->lazy_fd = fd;
+    b->cpool = (void *)(b + 1);
+    b->func_name = JS_DupAtom(ctx, fd->func_name);
+    b->arg_count = fd->arg_count;
+    b->defined_arg_count = fd->defined_arg_count;
+    b->closure_var_count = fd->closure_var_count;
+    if (b->closure_var_count) {
+        b->closure_var = (void *)(b->cpool + 1);
+        for(i = 0; i < b->closure_var_count; i++) {
+            b->closure_var[i] = fd->closure_var[i];
+            JS_DupAtom(ctx, b->closure_var[i].var_name);
+        }
+    }
+    b->filename = JS_DupAtom(ctx, fd->filename);
+    b->line_num = fd->line_num;
+    b->col_num = fd->col_num;
+    /* the source is given back to 'fd' when the code is generated */
+    b->source = fd->source;
+    b->source_len = fd->source_len;
+    b->source_blob = fd->source_blob;
+    fd->source = NULL;
+    fd->source_blob = NULL;
+
+    b->has_prototype = fd->has_prototype;
+    b->has_simple_parameter_list = fd->has_simple_parameter_list;
+    b->is_strict_mode = fd->is_strict_mode;
+    b->is_derived_class_constructor = fd->is_derived_class_constructor;
+    b->func_kind = fd->func_kind;
+    b->need_home_object = (fd->home_object_var_idx >= 0 ||
+                           fd->need_home_object);
+    b->new_target_allowed = fd->new_target_allowed;
+    b->super_call_allowed = fd->super_call_allowed;
+    b->super_allowed = fd->super_allowed;
+    b->arguments_allowed = fd->arguments_allowed;
+    b->backtrace_barrier = fd->backtrace_barrier;
+    b->realm = JS_DupContext(ctx);
+
+    /* 'fd' no longer depends on its parent */
+    list_del(&fd->link);
+    fd->parent = NULL;
+    js_shrink_function_def(ctx, fd);
+
+    add_gc_object(ctx->rt, &b->header, JS_GC_OBJ_TYPE_FUNCTION_BYTECODE);
+    return JS_MKPTR(JS_TAG_FUNCTION_BYTECODE, b);
+}
+
+/* second compilation pass of 'fd' after js_resolve_function(). The
+   inner functions are either generated too or deferred. */
+static JSValue js_create_function_bytecode(JSContext *ctx, JSFunctionDef *fd)
+{
+    JSValue func_obj;
+    JSFunctionBytecode *b;
+    struct list_head *el, *el1;
+    int stack_size;
+    int function_size, byte_code_offset, cpool_offset;
+    int closure_var_offset, vardefs_offset;
+
+    /* first create all the child functions */
+    list_for_each_safe(el, el1, &fd->child_list) {
+        JSFunctionDef *fd1;
+        int cpool_idx;
+
+        fd1 = list_entry(el, JSFunctionDef, link);
+        cpool_idx = fd1->parent_cpool_idx;
+        if (js_can_defer_function(ctx, fd1))
+            func_obj = js_create_lazy_function(ctx, fd1);
+        else
+            func_obj = js_create_function_bytecode(ctx, fd1);
+        if (JS_IsException(func_obj))
+            goto fail;
+        /* save it in the constant pool */
+        assert(cpool_idx >= 0);
+        fd->cpool[cpool_idx] = func_obj;
+    }
+
+    if (fd->optimize && optimize_bytecode(ctx, fd))
+        goto fail;
 
     if (resolve_labels(ctx, fd))
         goto fail;
@@ -33995,7 +38099,9 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
     byte_code_offset = function_size;
     function_size += fd->byte_code.size;
 
+    ctx->rt->alloc_kind = JS_ALLOC_KIND_BYTECODE;
     b = js_mallocz(ctx, function_size);
+    ctx->rt->alloc_kind = JS_ALLOC_KIND_OTHER;
     if (!b)
         goto fail;
     b->header.ref_count = 1;
@@ -34043,6 +38149,7 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
     b->pc2line_len = fd->pc2line.size;
     b->source = fd->source;
     b->source_len = fd->source_len;
+    b->source_blob = fd->source_blob;
 
     if (fd->scopes != fd->def_scope_array)
         js_free(ctx, fd->scopes);
@@ -34088,13 +38195,90 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
     return JS_EXCEPTION;
 }
 
+static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
+{
+    if (js_resolve_function(ctx, fd)) {
+        js_free_function_def(ctx, fd);
+        return JS_EXCEPTION;
+    }
+    return js_create_function_bytecode(ctx, fd);
+}
+
 #endif // QJS_DISABLE_PARSER
 
+/* return the bytecode of the lazy function 'b', generating it if
+   necessary. Return NULL if exception. */
+static JSFunctionBytecode *js_lazy_compile_bytecode(JSContext *ctx,
+                                                    JSFunctionBytecode *b)
+{
+#ifndef QJS_DISABLE_PARSER
+    JSFunctionDef *fd;
+    JSValue func_obj;
+
+    fd = b->lazy_fd;
+    if (fd) {
+        b->lazy_fd = NULL;
+        fd->source = b->source;
+        fd->source_len = b->source_len;
+        fd->source_blob = b->source_blob;
+        b->source = NULL;
+        b->source_len = 0;
+        b->source_blob = NULL;
+        /* 'fd' is freed in case of error */
+        func_obj = js_create_function_bytecode(b->realm, fd);
+        if (JS_IsException(func_obj))
+            return NULL;
+        b->cpool[0] = func_obj;
+        b->cpool_count = 1;
+    }
+#endif
+    if (!b->cpool_count) {
+        JS_ThrowInternalError(ctx, "function code generation failed");
+        return NULL;
+    }
+    return JS_VALUE_GET_PTR(b->cpool[0]);
+}
+
+/* replace the lazy bytecode of the function object 'p' by the
+   generated one. Return NULL if exception. */
+static no_inline JSFunctionBytecode *js_lazy_compile_function(JSContext *ctx,
+                                                              JSObject *p)
+{
+    JSFunctionBytecode *b, *b1;
+
+    b = p->u.func.function_bytecode;
+    b1 = js_lazy_compile_bytecode(ctx, b);
+    if (!b1)
+        return NULL;
+    p->u.func.function_bytecode = b1;
+    js_dup(JS_MKPTR(JS_TAG_FUNCTION_BYTECODE, b1));
+    JS_FreeValue(ctx, JS_MKPTR(JS_TAG_FUNCTION_BYTECODE, b));
+    return b1;
+}
+
+static void js_free_function_source(JSRuntime *rt, char *source,
+                                    JSSourceBlob *sb)
+{
+    if (sb) {
+        if (--sb->ref_count == 0)
+            js_free_rt(rt, sb);
+    } else {
+        js_free_rt(rt, source);
+    }
+}
+
 static void free_function_bytecode(JSRuntime *rt, JSFunctionBytecode *b)
 {
     int i;
 
-    if (b->byte_code_buf)
+#ifndef QJS_DISABLE_PARSER
+    if (b->lazy_fd)
+        js_free_function_def(b->realm, b->lazy_fd);
+#endif
+
+    if (b->rom_atoms)
+        free_bytecode_rom_atoms(rt, b->rom_atoms);
+    else if (b->byte_code_buf)
         free_bytecode_atoms(rt, b->byte_code_buf, b->byte_code_len, true);
 
     if (b->vardefs) {
@@ -34114,8 +38298,10 @@ static void free_function_bytecode(JSRuntime *rt, JSFunctionBytecode *b)
 
     JS_FreeAtomRT(rt, b->func_name);
     JS_FreeAtomRT(rt, b->filename);
-    js_free_rt(rt, b->pc2line_buf);
-    js_free_rt(rt, b->source);
+    if (!b->debug_in_rom) {
+        js_free_rt(rt, b->pc2line_buf);
+        js_free_function_source(rt, b->source, b->source_blob);
+    }
 
     remove_gc_object(&b->header);
     if (rt->gc_phase == JS_GC_PHASE_REMOVE_CYCLES && b->header.ref_count != 0) {
@@ -34713,9 +38899,7 @@ static __exception int js_parse_function_decl2(JSParseState *s,
             /* save the function source code */
             /* the end of the function source code is after the last
                 token of the function source stored into s->last_ptr */
-            fd->source_len = s->last_ptr - ptr;
-            fd->source = js_strndup(ctx, (const char *)ptr, fd->source_len);
-            if (!fd->source)
+            if (js_save_function_source(s, fd, ptr, s->last_ptr - ptr))
                 goto fail;
 
             goto done;
@@ -34740,9 +38924,7 @@ static __exception int js_parse_function_decl2(JSParseState *s,
     }
 
     /* save the function source code */
-    fd->source_len = s->buf_ptr - ptr;
-    fd->source = js_strndup(ctx, (const char *)ptr, fd->source_len);
-    if (!fd->source)
+    if (js_save_function_source(s, fd, ptr, s->buf_ptr - ptr))
         goto fail;
 
     if (next_token(s)) {
@@ -35050,6 +39232,7 @@ static JSValue __JS_EvalInternal(JSContext *ctx, JSValueConst this_obj,
     fd->eval_type = eval_type;
     fd->has_this_binding = (eval_type != JS_EVAL_TYPE_DIRECT);
     fd->backtrace_barrier = ((flags & JS_EVAL_FLAG_BACKTRACE_BARRIER) != 0);
+    fd->optimize = !(flags & JS_EVAL_FLAG_NO_OPTIMIZE);
     if (eval_type == JS_EVAL_TYPE_DIRECT) {
         fd->new_target_allowed = b->new_target_allowed;
         fd->super_call_allowed = b->super_call_allowed;
@@ -35079,6 +39262,9 @@ static JSValue __JS_EvalInternal(JSContext *ctx, JSValueConst this_obj,
     fd->body_scope = fd->scope_level;
 
     err = js_parse_program(s);
+    /* the functions keep their own references to the shared source */
+    if (s->source_blob)
+        js_free_function_source(ctx->rt, NULL, s->source_blob);
     if (err) {
     fail:
         free_token(s, &s->token);
@@ -35172,13 +39358,16 @@ JSValue JS_EvalThis2(JSContext *ctx, JSValueConst this_obj,
     int line = 1;
     int eval_flags = 0;
     if (options) {
-        if (options->version != JS_EVAL_OPTIONS_VERSION)
+        if (options->version < 1 ||
+            options->version > JS_EVAL_OPTIONS_VERSION)
             return JS_ThrowInternalError(ctx, "bad JSEvalOptions version");
         if (options->filename)
             filename = options->filename;
         if (options->line_num != 0)
             line = options->line_num;
-        eval_flags = options->eval_flags;
+        eval_flags = options->eval_flags & ~JS_EVAL_FLAG_NO_OPTIMIZE;
+        if (options->version >= 2 && options->opt_level < 0)
+            eval_flags |= JS_EVAL_FLAG_NO_OPTIMIZE;
     }
     JSValue ret;
 
@@ -35591,7 +39780,7 @@ static int JS_WriteFunctionBytecode(BCWriterState *s,
         case OP_FMT_atom_u16:
         case OP_FMT_atom_label_u8:
         case OP_FMT_atom_label_u16:
-            atom = get_u32(bc_buf + pos + 1);
+            atom = bc_get_atom_operand(b, bc_buf + pos + 1);
             if (bc_atom_to_idx(s, &val, atom))
                 goto fail;
             put_u32(bc_buf + pos + 1, val);
@@ -35679,6 +39868,11 @@ static int JS_WriteFunctionTag(BCWriterState *s, JSValueConst obj)
     uint32_t flags;
     int idx, i;
 
+    if (b->is_lazy) {
+        b = js_lazy_compile_bytecode(s->ctx, b);
+        if (!b)
+            return -1;
+    }
     bc_put_u8(s, BC_TAG_FUNCTION_BYTECODE);
     flags = idx = 0;
     bc_set_flags(&flags, &idx, b->has_prototype, 1);
@@ -36226,6 +40420,8 @@ typedef struct BCReaderState {
     bool allow_sab;
     bool allow_bytecode;
     bool allow_reference;
+    bool is_rom_data; /* bytecode executed in place */
+    JSBytecodeAtoms *rom_atoms; /* shared by the ROM functions */
     /* object references */
     JSObject **objects;
     int objects_count;
@@ -36388,6 +40584,21 @@ static int bc_get_buf(BCReaderState *s, void *buf, uint32_t buf_len)
     return 0;
 }
 
+/* return a pointer to the next 'buf_len' bytes of the ROM data and
+   skip them. Return NULL if error. */
+static uint8_t *bc_get_rom_buf(BCReaderState *s, uint32_t buf_len)
+{
+    uint8_t *buf;
+
+    if (unlikely(s->buf_end - s->ptr < buf_len)) {
+        bc_read_error_end(s);
+        return NULL;
+    }
+    buf = (uint8_t *)s->ptr;
+    s->ptr += buf_len;
+    return buf;
+}
+
 static int bc_idx_to_atom(BCReaderState *s, JSAtom *patom, uint32_t idx)
 {
     JSAtom atom;
@@ -36423,6 +40634,38 @@ static int bc_get_atom(BCReaderState *s, JSAtom *patom)
     }
 }
 
+static int bc_check_atom_idx(BCReaderState *s, uint32_t idx)
+{
+    if (!__JS_AtomIsTaggedInt(idx) && idx >= s->first_atom &&
+        idx - s->first_atom >= s->idx_to_atom_count) {
+        JS_ThrowSyntaxError(s->ctx, "invalid atom index (pos=%u)",
+                            (unsigned int)(s->ptr - s->buf_start));
+        return s->error_state = -1;
+    }
+    return 0;
+}
+
+static JSBytecodeAtoms *bc_get_rom_atoms(BCReaderState *s)
+{
+    JSBytecodeAtoms *ba;
+    uint32_t i;
+
+    if (!s->rom_atoms) {
+        ba = js_malloc(s->ctx, sizeof(*ba) +
+                       s->idx_to_atom_count * sizeof(ba->tab[0]));
+        if (!ba) {
+            s->error_state = -1;
+            return NULL;
+        }
+        ba->ref_count = 1;
+        ba->count = s->idx_to_atom_count;
+        for(i = 0; i < ba->count; i++)
+            ba->tab[i] = JS_DupAtom(s->ctx, s->idx_to_atom[i]);
+        s->rom_atoms = ba;
+    }
+    return s->rom_atoms;
+}
+
 static JSString *JS_ReadString(BCReaderState *s)
 {
     uint32_t len;
@@ -36487,13 +40730,26 @@ static int JS_ReadFunctionBytecode(BCReaderState *s, JSFunctionBytecode *b,
     JSAtom atom;
     uint32_t idx;
 
-    bc_buf = (uint8_t*)b + byte_code_offset;
-    if (bc_get_buf(s, bc_buf, bc_len))
-        return -1;
-    b->byte_code_buf = bc_buf;
+    if (s->is_rom_data) {
+        /* the atom operands are resolved at execution time */
+        if (unlikely(s->buf_end - s->ptr < bc_len))
+            return bc_read_error_end(s);
+        b->rom_atoms = bc_get_rom_atoms(s);
+        if (!b->rom_atoms)
+            return -1;
+        b->rom_atoms->ref_count++;
+        bc_buf = (uint8_t *)s->ptr;
+        s->ptr += bc_len;
+        b->byte_code_buf = bc_buf;
+    } else {
+        bc_buf = (uint8_t*)b + byte_code_offset;
+        if (bc_get_buf(s, bc_buf, bc_len))
+            return -1;
+        b->byte_code_buf = bc_buf;
 
-    if (is_be())
-        bc_byte_swap(bc_buf, bc_len);
+        if (is_be())
+            bc_byte_swap(bc_buf, bc_len);
+    }
 
     pos = 0;
     while (pos < bc_len) {
@@ -36506,6 +40762,11 @@ static int JS_ReadFunctionBytecode(BCReaderState *s, JSFunctionBytecode *b,
         case OP_FMT_atom_label_u8:
         case OP_FMT_atom_label_u16:
             idx = get_u32(bc_buf + pos + 1);
+            if (s->is_rom_data) {
+                if (bc_check_atom_idx(s, idx))
+                    return -1;
+                break;
+            }
             if (bc_idx_to_atom(s, &atom, idx)) {
                 /* Note: the atoms will be freed up to this position */
                 b->byte_code_len = pos;
@@ -36658,9 +40919,12 @@ static JSValue JS_ReadFunctionTag(BCReaderState *s)
     closure_var_offset = function_size;
     function_size += bc.closure_var_count * sizeof(*bc.closure_var);
     byte_code_offset = function_size;
-    function_size += bc.byte_code_len;
+    if (!s->is_rom_data)
+        function_size += bc.byte_code_len;
 
+    ctx->rt->alloc_kind = JS_ALLOC_KIND_BYTECODE;
     b = js_mallocz(ctx, function_size);
+    ctx->rt->alloc_kind = JS_ALLOC_KIND_OTHER;
     if (!b)
         goto fail;
 
@@ -36802,13 +41066,21 @@ static JSValue JS_ReadFunctionTag(BCReaderState *s)
 #endif
     if (bc_get_leb128_int(s, &b->pc2line_len))
         goto fail;
+    /* with ROM data, the debug information is used in place */
+    b->debug_in_rom = s->is_rom_data;
     if (b->pc2line_len) {
         bc_read_trace(s, "positions: %d bytes\n", b->pc2line_len);
-        b->pc2line_buf = js_mallocz(ctx, b->pc2line_len);
+        if (b->debug_in_rom) {
+            b->pc2line_buf = bc_get_rom_buf(s, b->pc2line_len);
+        } else {
+            b->pc2line_buf = js_mallocz(ctx, b->pc2line_len);
+            if (!b->pc2line_buf)
+                goto fail;
+            if (bc_get_buf(s, b->pc2line_buf, b->pc2line_len))
+                goto fail;
+        }
         if (!b->pc2line_buf)
             goto fail;
-        if (bc_get_buf(s, b->pc2line_buf, b->pc2line_len))
-            goto fail;
     }
     if (bc_get_leb128_int(s, &b->source_len))
         goto fail;
@@ -36816,12 +41088,18 @@ static JSValue JS_ReadFunctionTag(BCReaderState *s)
         bc_read_trace(s, "source: %d bytes\n", b->source_len);
         if (s->ptr_last)
             s->ptr_last += b->source_len;  // omit source code hex dump
-        /* b->source is a UTF-8 encoded null terminated C string */
-        b->source = js_mallocz(ctx, b->source_len + 1);
+        if (b->debug_in_rom) {
+            b->source = (char *)bc_get_rom_buf(s, b->source_len);
+        } else {
+            /* b->source is a UTF-8 encoded null terminated C string */
+            b->source = js_mallocz(ctx, b->source_len + 1);
+            if (!b->source)
+                goto fail;
+            if (bc_get_buf(s, b->source, b->source_len))
+                goto fail;
+        }
         if (!b->source)
             goto fail;
-        if (bc_get_buf(s, b->source, b->source_len))
-            goto fail;
     }
     bc_read_trace(s, "}\n");
 
@@ -37457,6 +41735,8 @@ static void bc_reader_free(BCReaderState *s)
         }
         js_free(s->ctx, s->idx_to_atom);
     }
+    if (s->rom_atoms)
+        free_bytecode_rom_atoms(s->ctx->rt, s->rom_atoms);
     js_free(s->ctx, s->objects);
 }
 
@@ -37477,6 +41757,9 @@ JSValue JS_ReadObject2(JSContext *ctx, const uint8_t *buf, size_t buf_len,
     s->allow_bytecode = ((flags & JS_READ_OBJ_BYTECODE) != 0);
     s->allow_sab = ((flags & JS_READ_OBJ_SAB) != 0);
     s->allow_reference = ((flags & JS_READ_OBJ_REFERENCE) != 0);
+    /* the bytecode must be byte swapped on big endian hosts */
+    s->is_rom_data = ((flags & JS_READ_OBJ_ROM_DATA) != 0 &&
+                      s->allow_bytecode && !is_be());
     if (s->allow_bytecode)
         s->first_atom = JS_ATOM_END;
     else
@@ -37502,6 +41785,1962 @@ JSValue JS_ReadObject(JSContext *ctx, const uint8_t *buf, size_t buf_len,
     return JS_ReadObject2(ctx, buf, buf_len, flags, NULL);
 }
 
+/*******************************************************************/
+/* ahead-of-time compilation to C */
+
+/* The generated C functions keep the operand stack and the local
+   variables which are not captured by a closure in C variables. The
+   simple opcodes are translated inline, the other ones are executed by
+   JS_NativeCodeExecOp() which accesses the frame of the function
+   through rt->current_stack_frame. */
+
+/* backward jumps poll the interrupt handler every NC_POLL_INTERVAL
+   iterations */
+#define NC_POLL_INTERVAL 16
+
+/* execute the opcode 'op' of the instruction at 'pos' in the current
+   bytecode function with the stack top 'sp'. The operands are replaced
+   by the results. In case of exception, the operand slots contain
+   values which must still be freed. */
+int JS_NativeCodeExecOp(JSContext *ctx, uint32_t pos, int op, JSValue *sp)
+{
+    JSRuntime *rt = ctx->rt;
+    JSStackFrame *sf = rt->current_stack_frame;
+    JSObject *p = JS_VALUE_GET_OBJ(sf->cur_func);
+    JSFunctionBytecode *b = p->u.func.function_bytecode;
+    JSVarRef **var_refs = p->u.func.var_refs;
+    const uint8_t *pc = b->byte_code_buf + pos + 1;
+    JSValue val, *call_argv;
+    JSAtom atom;
+    int call_argc, idx, ret, i;
+
+    sf->cur_pc = (uint8_t *)pc;
+    switch(op) {
+    case OP_push_const:
+        sp[0] = js_dup(b->cpool[get_u32(pc)]);
+        break;
+    case OP_push_const8:
+        sp[0] = js_dup(b->cpool[*pc]);
+        break;
+    case OP_fclosure:
+    case OP_fclosure8:
+        idx = (op == OP_fclosure) ? get_u32(pc) : *pc;
+        sp[0] = js_closure(ctx, js_dup(b->cpool[idx]), var_refs, sf);
+        if (unlikely(JS_IsException(sp[0])))
+            goto exception;
+        break;
+    case OP_push_atom_value:
+        sp[0] = JS_AtomToValue(ctx, bc_get_atom_operand(b, pc));
+        break;
+    case OP_push_empty_string:
+        sp[0] = js_empty_string(rt);
+        break;
+    case OP_push_bigint_i32:
+        sp[0] = __JS_NewShortBigInt(ctx, (int)get_u32(pc));
+        break;
+    case OP_object:
+        sp[0] = JS_NewObject(ctx);
+        if (unlikely(JS_IsException(sp[0])))
+            goto exception;
+        break;
+    case OP_array_from:
+        call_argc = get_u16(pc);
+        call_argv = sp - call_argc;
+        val = JS_NewArrayFrom(ctx, call_argc, call_argv);
+        for(i = 0; i < call_argc; i++)
+            call_argv[i] = JS_UNDEFINED;
+        if (unlikely(JS_IsException(val)))
+            goto exception;
+        call_argv[0] = val;
+        break;
+    case OP_call0:
+    case OP_call1:
+    case OP_call2:
+    case OP_call3:
+    case OP_call:
+        if (op == OP_call)
+            call_argc = get_u16(pc);
+        else
+            call_argc = op - OP_call0;
+        call_argv = sp - call_argc;
+        val = JS_CallInternal(ctx, call_argv[-1], JS_UNDEFINED, JS_UNDEFINED,
+                              call_argc, vc(call_argv), 0);
+        if (unlikely(JS_IsException(val)))
+            goto exception;
+        for(i = -1; i < call_argc; i++)
+            JS_FreeValue(ctx, call_argv[i]);
+        call_argv[-1] = val;
+        break;
+    case OP_call_method:
+        call_argc = get_u16(pc);
+        call_argv = sp - call_argc;
+        val = JS_CallInternal(ctx, call_argv[-1], call_argv[-2], JS_UNDEFINED,
+                              call_argc, vc(call_argv), 0);
+        if (unlikely(JS_IsException(val)))
+            goto exception;
+        for(i = -2; i < call_argc; i++)
+            JS_FreeValue(ctx, call_argv[i]);
+        call_argv[-2] = val;
+        break;
+    case OP_call_constructor:
+        call_argc = get_u16(pc);
+        call_argv = sp - call_argc;
+        val = JS_CallConstructorInternal(ctx, call_argv[-2], call_argv[-1],
+                                         call_argc, vc(call_argv), 0);
+        if (unlikely(JS_IsException(val)))
+            goto exception;
+        for(i = -2; i < call_argc; i++)
+            JS_FreeValue(ctx, call_argv[i]);
+        call_argv[-2] = val;
+        break;
+    case OP_apply:
+        val = js_function_apply(ctx, sp[-3], 2, vc(&sp[-2]), get_u16(pc));
+        if (unlikely(JS_IsException(val)))
+            goto exception;
+        JS_FreeValue(ctx, sp[-3]);
+        JS_FreeValue(ctx, sp[-2]);
+        JS_FreeValue(ctx, sp[-1]);
+        sp[-3] = val;
+        break;
+    case OP_get_field:
+    case OP_get_field2:
+        atom = bc_get_atom_operand(b, pc);
+        val = JS_GetPropertyInternal(ctx, sp[-1], atom, sp[-1], false);
+        if (unlikely(JS_IsException(val)))
+            goto exception;
+        if (op == OP_get_field2) {
+            sp[0] = val;
+        } else {
+            JS_FreeValue(ctx, sp[-1]);
+            sp[-1] = val;
+        }
+        break;
+    case OP_get_length:
+        val = JS_GetProperty(ctx, sp[-1], JS_ATOM_length);
+        if (unlikely(JS_IsException(val)))
+            goto exception;
+        JS_FreeValue(ctx, sp[-1]);
+        sp[-1] = val;
+        break;
+    case OP_put_field:
+        atom = bc_get_atom_operand(b, pc);
+        ret = JS_SetPropertyInternal2(ctx, sp[-2], atom, sp[-1], sp[-2],
+                                      JS_PROP_THROW_STRICT);
+        JS_FreeValue(ctx, sp[-2]);
+        sp[-2] = JS_UNDEFINED;
+        sp[-1] = JS_UNDEFINED;
+        if (unlikely(ret < 0))
+            goto exception;
+        break;
+    case OP_get_array_el:
+        val = JS_GetPropertyValue(ctx, sp[-2], sp[-1]);
+        sp[-1] = JS_UNDEFINED;
+        JS_FreeValue(ctx, sp[-2]);
+        sp[-2] = val;
+        if (unlikely(JS_IsException(val)))
+            goto exception;
+        break;
+    case OP_get_array_el2:
+        val = JS_GetPropertyValue(ctx, sp[-2], sp[-1]);
+        sp[-1] = val;
+        if (unlikely(JS_IsException(val)))
+            goto exception;
+        break;
+    case OP_put_array_el:
+        ret = JS_SetPropertyValue(ctx, sp[-3], sp[-2], sp[-1],
+                                  JS_PROP_THROW_STRICT);
+        JS_FreeValue(ctx, sp[-3]);
+        sp[-3] = JS_UNDEFINED;
+        sp[-2] = JS_UNDEFINED;
+        sp[-1] = JS_UNDEFINED;
+        if (unlikely(ret < 0))
+            goto exception;
+        break;
+    case OP_define_field:
+        atom = bc_get_atom_operand(b, pc);
+        ret = JS_DefinePropertyValue(ctx, sp[-2], atom, sp[-1],
+                                     JS_PROP_C_W_E | JS_PROP_THROW);
+        sp[-1] = JS_UNDEFINED;
+        if (unlikely(ret < 0))
+            goto exception;
+        break;
+    case OP_define_array_el:
+        ret = JS_DefinePropertyValueValue(ctx, sp[-3], js_dup(sp[-2]), sp[-1],
+                                          JS_PROP_C_W_E | JS_PROP_THROW);
+        sp[-1] = JS_UNDEFINED;
+        if (unlikely(ret < 0))
+            goto exception;
+        break;
+    case OP_set_name:
+        atom = bc_get_atom_operand(b, pc);
+        if (JS_DefineObjectName(ctx, sp[-1], atom, JS_PROP_CONFIGURABLE) < 0)
+            goto exception;
+        break;
+    case OP_get_var_undef:
+    case OP_get_var:
+        atom = bc_get_atom_operand(b, pc);
+        val = JS_GetGlobalVar(ctx, atom, op - OP_get_var_undef);
+        if (unlikely(JS_IsException(val)))
+            goto exception;
+        sp[0] = val;
+        break;
+    case OP_put_var:
+    case OP_put_var_init:
+        atom = bc_get_atom_operand(b, pc);
+        ret = JS_SetGlobalVar(ctx, atom, sp[-1], op - OP_put_var);
+        sp[-1] = JS_UNDEFINED;
+        if (unlikely(ret < 0))
+            goto exception;
+        break;
+    case OP_get_var_ref0:
+    case OP_get_var_ref1:
+    case OP_get_var_ref2:
+    case OP_get_var_ref3:
+    case OP_get_var_ref:
+    case OP_get_var_ref_check:
+        if (op >= OP_get_var_ref0 && op <= OP_get_var_ref3)
+            idx = op - OP_get_var_ref0;
+        else
+            idx = get_u16(pc);
+        val = *var_refs[idx]->pvalue;
+        if (op == OP_get_var_ref_check && unlikely(JS_IsUninitialized(val))) {
+            JS_ThrowReferenceErrorUninitialized2(ctx, b, idx, true);
+            goto exception;
+        }
+        sp[0] = js_dup(val);
+        break;
+    case OP_put_var_ref0:
+    case OP_put_var_ref1:
+    case OP_put_var_ref2:
+    case OP_put_var_ref3:
+    case OP_put_var_ref:
+    case OP_put_var_ref_check:
+    case OP_put_var_ref_check_init:
+        if (op >= OP_put_var_ref0 && op <= OP_put_var_ref3)
+            idx = op - OP_put_var_ref0;
+        else
+            idx = get_u16(pc);
+        if ((op == OP_put_var_ref_check &&
+             JS_IsUninitialized(*var_refs[idx]->pvalue)) ||
+            (op == OP_put_var_ref_check_init &&
+             !JS_IsUninitialized(*var_refs[idx]->pvalue))) {
+            JS_ThrowReferenceErrorUninitialized2(ctx, b, idx, true);
+            goto exception;
+        }
+        set_value(ctx, var_refs[idx]->pvalue, sp[-1]);
+        sp[-1] = JS_UNDEFINED;
+        break;
+    case OP_set_var_ref0:
+    case OP_set_var_ref1:
+    case OP_set_var_ref2:
+    case OP_set_var_ref3:
+    case OP_set_var_ref:
+        if (op == OP_set_var_ref)
+            idx = get_u16(pc);
+        else
+            idx = op - OP_set_var_ref0;
+        set_value(ctx, var_refs[idx]->pvalue, js_dup(sp[-1]));
+        break;
+    case OP_get_loc_check:
+    case OP_put_loc_check:
+        /* only called when the variable is uninitialized */
+        JS_ThrowReferenceErrorUninitialized2(ctx, b, get_u16(pc), false);
+        goto exception;
+    case OP_put_loc_check_init:
+        /* only called when the variable is already initialized */
+        JS_ThrowReferenceError(ctx, "'this' can be initialized only once");
+        goto exception;
+    case OP_close_loc:
+        close_lexical_var(ctx, sf, get_u16(pc));
+        break;
+    case OP_goto:
+        /* called every NC_POLL_INTERVAL backward jumps */
+        ctx->interrupt_counter -= NC_POLL_INTERVAL - 1;
+        if (js_poll_interrupts(ctx))
+            goto exception;
+        break;
+    case OP_add:
+        if (js_add_slow(ctx, sp))
+            goto exception;
+        break;
+    case OP_sub:
+    case OP_mul:
+    case OP_div:
+    case OP_mod:
+    case OP_pow:
+        if (js_binary_arith_slow(ctx, sp, op))
+            goto exception;
+        break;
+    case OP_shl:
+    case OP_sar:
+    case OP_and:
+    case OP_or:
+    case OP_xor:
+        if (js_binary_logic_slow(ctx, sp, op))
+            goto exception;
+        break;
+    case OP_shr:
+        if (js_shr_slow(ctx, sp))
+            goto exception;
+        break;
+    case OP_neg:
+    case OP_plus:
+    case OP_inc:
+    case OP_dec:
+        if (js_unary_arith_slow(ctx, sp, op))
+            goto exception;
+        break;
+    case OP_post_inc:
+    case OP_post_dec:
+        if (js_post_inc_slow(ctx, sp, op))
+            goto exception;
+        break;
+    case OP_not:
+        if (js_not_slow(ctx, sp))
+            goto exception;
+        break;
+    case OP_lt:
+    case OP_lte:
+    case OP_gt:
+    case OP_gte:
+        if (js_relational_slow(ctx, sp, op))
+            goto exception;
+        break;
+    case OP_eq:
+    case OP_neq:
+        if (js_eq_slow(ctx, sp, op == OP_neq))
+            goto exception;
+        break;
+    case OP_strict_eq:
+    case OP_strict_neq:
+        if (js_strict_eq_slow(ctx, sp, op == OP_strict_neq))
+            goto exception;
+        break;
+    case OP_in:
+        if (js_operator_in(ctx, sp))
+            goto exception;
+        break;
+    case OP_instanceof:
+        if (js_operator_instanceof(ctx, sp))
+            goto exception;
+        break;
+    case OP_delete:
+        if (js_operator_delete(ctx, sp))
+            goto exception;
+        break;
+    case OP_typeof:
+        atom = js_operator_typeof(ctx, sp[-1]);
+        JS_FreeValue(ctx, sp[-1]);
+        sp[-1] = JS_AtomToString(ctx, atom);
+        break;
+    case OP_typeof_is_undefined:
+    case OP_typeof_is_function:
+        atom = js_operator_typeof(ctx, sp[-1]);
+        JS_FreeValue(ctx, sp[-1]);
+        sp[-1] = js_bool(atom == (op == OP_typeof_is_undefined ?
+                                  JS_ATOM_undefined : JS_ATOM_function));
+        break;
+    case OP_to_propkey2:
+        if (unlikely(JS_IsUndefined(sp[-2]) || JS_IsNull(sp[-2]))) {
+            JS_ThrowTypeError(ctx, "value has no property");
+            goto exception;
+        }
+        /* fall through */
+    case OP_to_propkey:
+        switch (JS_VALUE_GET_TAG(sp[-1])) {
+        case JS_TAG_INT:
+        case JS_TAG_STRING:
+        case JS_TAG_SYMBOL:
+            break;
+        default:
+            val = JS_ToPropertyKey(ctx, sp[-1]);
+            if (JS_IsException(val))
+                goto exception;
+            JS_FreeValue(ctx, sp[-1]);
+            sp[-1] = val;
+            break;
+        }
+        break;
+    case OP_throw:
+        JS_Throw(ctx, sp[-1]);
+        sp[-1] = JS_UNDEFINED;
+        goto exception;
+    case OP_throw_error:
+        atom = bc_get_atom_operand(b, pc);
+        switch(pc[4]) {
+        case JS_THROW_VAR_RO:
+            JS_ThrowTypeErrorReadOnly(ctx, JS_PROP_THROW, atom);
+            break;
+        case JS_THROW_VAR_REDECL:
+            JS_ThrowSyntaxErrorVarRedeclaration(ctx, atom);
+            break;
+        case JS_THROW_VAR_UNINITIALIZED:
+            JS_ThrowReferenceErrorUninitialized(ctx, atom);
+            break;
+        case JS_THROW_ERROR_DELETE_SUPER:
+            JS_ThrowReferenceError(ctx, "unsupported reference to 'super'");
+            break;
+        case JS_THROW_ERROR_ITERATOR_THROW:
+            JS_ThrowTypeError(ctx, "iterator does not have a throw method");
+            break;
+        default:
+            JS_ThrowInternalError(ctx, "invalid throw var type %d", pc[4]);
+            break;
+        }
+        goto exception;
+    default:
+        JS_ThrowInternalError(ctx, "invalid native code opcode: pc=%u opcode=0x%02x",
+                              pos, op);
+        goto exception;
+    }
+    return 0;
+ exception:
+    return -1;
+}
+
+#ifndef QJS_DISABLE_PARSER
+
+/* return true if JS_NativeCodeExecOp() can execute 'op' */
+static bool nc_has_fallback(int op)
+{
+    switch(op) {
+    case OP_push_const:
+    case OP_push_const8:
+    case OP_fclosure:
+    case OP_fclosure8:
+    case OP_push_atom_value:
+    case OP_push_empty_string:
+    case OP_push_bigint_i32:
+    case OP_object:
+    case OP_array_from:
+    case OP_call0:
+    case OP_call1:
+    case OP_call2:
+    case OP_call3:
+    case OP_call:
+    case OP_call_method:
+    case OP_call_constructor:
+    case OP_apply:
+    case OP_get_field:
+    case OP_get_field2:
+    case OP_get_length:
+    case OP_put_field:
+    case OP_get_array_el:
+    case OP_get_array_el2:
+    case OP_put_array_el:
+    case OP_define_field:
+    case OP_define_array_el:
+    case OP_set_name:
+    case OP_get_var_undef:
+    case OP_get_var:
+    case OP_put_var:
+    case OP_put_var_init:
+    case OP_get_var_ref0:
+    case OP_get_var_ref1:
+    case OP_get_var_ref2:
+    case OP_get_var_ref3:
+    case OP_get_var_ref:
+    case OP_get_var_ref_check:
+    case OP_put_var_ref0:
+    case OP_put_var_ref1:
+    case OP_put_var_ref2:
+    case OP_put_var_ref3:
+    case OP_put_var_ref:
+    case OP_put_var_ref_check:
+    case OP_put_var_ref_check_init:
+    case OP_set_var_ref0:
+    case OP_set_var_ref1:
+    case OP_set_var_ref2:
+    case OP_set_var_ref3:
+    case OP_set_var_ref:
+    case OP_close_loc:
+    case OP_div:
+    case OP_mod:
+    case OP_pow:
+    case OP_shr:
+    case OP_neg:
+    case OP_plus:
+    case OP_not:
+    case OP_in:
+    case OP_instanceof:
+    case OP_delete:
+    case OP_typeof:
+    case OP_typeof_is_undefined:
+    case OP_typeof_is_function:
+    case OP_to_propkey:
+    case OP_to_propkey2:
+    case OP_throw:
+    case OP_throw_error:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* return true if the C code of 'op' is generated inline */
+static bool nc_is_inline(JSFunctionBytecode *b, int op)
+{
+    switch(op) {
+    case OP_push_this:
+        /* no conversion of 'this' */
+        return b->is_strict_mode;
+    case OP_push_i32:
+    case OP_push_i8:
+    case OP_push_i16:
+    case OP_push_minus1:
+    case OP_push_0:
+    case OP_push_1:
+    case OP_push_2:
+    case OP_push_3:
+    case OP_push_4:
+    case OP_push_5:
+    case OP_push_6:
+    case OP_push_7:
+    case OP_undefined:
+    case OP_null:
+    case OP_push_false:
+    case OP_push_true:
+    case OP_get_loc:
+    case OP_put_loc:
+    case OP_set_loc:
+    case OP_get_loc8:
+    case OP_put_loc8:
+    case OP_set_loc8:
+    case OP_get_loc0:
+    case OP_get_loc1:
+    case OP_get_loc2:
+    case OP_get_loc3:
+    case OP_put_loc0:
+    case OP_put_loc1:
+    case OP_put_loc2:
+    case OP_put_loc3:
+    case OP_set_loc0:
+    case OP_set_loc1:
+    case OP_set_loc2:
+    case OP_set_loc3:
+    case OP_get_loc0_loc1:
+    case OP_get_arg:
+    case OP_put_arg:
+    case OP_set_arg:
+    case OP_get_arg0:
+    case OP_get_arg1:
+    case OP_get_arg2:
+    case OP_get_arg3:
+    case OP_put_arg0:
+    case OP_put_arg1:
+    case OP_put_arg2:
+    case OP_put_arg3:
+    case OP_set_arg0:
+    case OP_set_arg1:
+    case OP_set_arg2:
+    case OP_set_arg3:
+    case OP_set_loc_uninitialized:
+    case OP_get_loc_check:
+    case OP_put_loc_check:
+    case OP_put_loc_check_init:
+    case OP_inc_loc:
+    case OP_dec_loc:
+    case OP_add_loc:
+    case OP_drop:
+    case OP_nip:
+    case OP_nip1:
+    case OP_dup:
+    case OP_dup1:
+    case OP_dup2:
+    case OP_dup3:
+    case OP_insert2:
+    case OP_insert3:
+    case OP_insert4:
+    case OP_perm3:
+    case OP_perm4:
+    case OP_perm5:
+    case OP_swap:
+    case OP_swap2:
+    case OP_rot3l:
+    case OP_rot3r:
+    case OP_rot4l:
+    case OP_rot5l:
+    case OP_nop:
+    case OP_goto:
+    case OP_goto8:
+    case OP_goto16:
+    case OP_if_true:
+    case OP_if_false:
+    case OP_if_true8:
+    case OP_if_false8:
+    case OP_return:
+    case OP_return_undef:
+    case OP_tail_call:
+    case OP_tail_call_method:
+    case OP_lnot:
+    case OP_is_undefined_or_null:
+    case OP_is_undefined:
+    case OP_is_null:
+    case OP_add:
+    case OP_sub:
+    case OP_mul:
+    case OP_lt:
+    case OP_lte:
+    case OP_gt:
+    case OP_gte:
+    case OP_eq:
+    case OP_neq:
+    case OP_strict_eq:
+    case OP_strict_neq:
+    case OP_and:
+    case OP_or:
+    case OP_xor:
+    case OP_shl:
+    case OP_sar:
+    case OP_inc:
+    case OP_dec:
+    case OP_post_inc:
+    case OP_post_dec:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static int nc_get_jump_target(const uint8_t *bc, int pos, const JSOpCode *oi)
+{
+    switch(oi->fmt) {
+    case OP_FMT_label8:
+        return pos + 1 + (int8_t)bc[pos + 1];
+    case OP_FMT_label16:
+        return pos + 1 + (int16_t)get_u16(bc + pos + 1);
+    default:
+        return pos + 1 + (int32_t)get_u32(bc + pos + 1);
+    }
+}
+
+static int nc_push_pos(int16_t *depth, int *stack, int *psp, int pos, int d)
+{
+    if (depth[pos] < 0) {
+        depth[pos] = d;
+        stack[(*psp)++] = pos;
+        return 0;
+    }
+    return (depth[pos] == d) ? 0 : -1;
+}
+
+/* compute the stack depth before each instruction of 'b' (-1 if not
+   reachable) and mark the jump targets. Return -1 if 'b' cannot be
+   translated to C, -2 if memory error. */
+static int nc_compute_depth(JSContext *ctx, JSFunctionBytecode *b,
+                            int16_t *depth, uint8_t *is_label)
+{
+    const uint8_t *bc = b->byte_code_buf;
+    int len = b->byte_code_len;
+    int *stack, sp, pos, op, d, n_pop, target, ret;
+    const JSOpCode *oi;
+
+    if (b->func_kind != JS_FUNC_NORMAL || b->stack_size > INT16_MAX)
+        return -1;
+    stack = js_malloc(ctx, sizeof(stack[0]) * (len + 1));
+    if (!stack)
+        return -2;
+    for(pos = 0; pos < len; pos++)
+        depth[pos] = -1;
+    memset(is_label, 0, len);
+    ret = -1;
+    sp = 0;
+    if (nc_push_pos(depth, stack, &sp, 0, 0))
+        goto done;
+    while (sp > 0) {
+        pos = stack[--sp];
+        for(;;) {
+            d = depth[pos];
+            op = bc[pos];
+            oi = &short_opcode_info(op);
+            if (pos + oi->size > len)
+                goto done;
+            if (!nc_is_inline(b, op) && !nc_has_fallback(op))
+                goto done;
+            n_pop = oi->n_pop;
+            if (oi->fmt == OP_FMT_npop)
+                n_pop += get_u16(bc + pos + 1);
+            else if (oi->fmt == OP_FMT_npopx)
+                n_pop += op - OP_call0;
+            if (d < n_pop)
+                goto done;
+            d += oi->n_push - n_pop;
+            /* tail calls push their result before returning */
+            if (d > b->stack_size ||
+                ((op == OP_tail_call || op == OP_tail_call_method) &&
+                 d + 1 > b->stack_size))
+                goto done;
+            switch(op) {
+            case OP_return:
+            case OP_return_undef:
+            case OP_tail_call:
+            case OP_tail_call_method:
+            case OP_throw:
+            case OP_throw_error:
+                goto next;
+            case OP_goto:
+            case OP_goto8:
+            case OP_goto16:
+            case OP_if_true:
+            case OP_if_false:
+            case OP_if_true8:
+            case OP_if_false8:
+                target = nc_get_jump_target(bc, pos, oi);
+                if (target < 0 || target >= len)
+                    goto done;
+                is_label[target] = 1;
+                if (nc_push_pos(depth, stack, &sp, target, d))
+                    goto done;
+                if (op == OP_goto || op == OP_goto8 || op == OP_goto16)
+                    goto next;
+                break;
+            default:
+                break;
+            }
+            pos += oi->size;
+            if (pos >= len)
+                goto done;
+            if (depth[pos] >= 0) {
+                if (depth[pos] != d)
+                    goto done;
+                break;
+            }
+            depth[pos] = d;
+        }
+    next: ;
+    }
+    ret = 0;
+ done:
+    js_free(ctx, stack);
+    return ret;
+}
+
+typedef struct NCState {
+    JSContext *ctx;
+    DynBuf dbuf; /* generated C code */
+    DynBuf tab; /* entries of the function table */
+    const char *c_name;
+    int func_count;
+    /* current function */
+    JSFunctionBytecode *b;
+    char loc_buf[32];
+    bool use_tmp;
+    bool use_tmp_array;
+    bool use_r64;
+    bool use_poll;
+    bool use_exception;
+    bool use_done;
+} NCState;
+
+/* C expression of the local variable 'idx' */
+static const char *nc_loc(NCState *s, int idx)
+{
+    JSFunctionBytecode *b = s->b;
+
+    if (b->vardefs && !b->vardefs[b->arg_count + idx].is_captured)
+        snprintf(s->loc_buf, sizeof(s->loc_buf), "v%d", idx);
+    else
+        snprintf(s->loc_buf, sizeof(s->loc_buf), "var_buf[%d]", idx);
+    return s->loc_buf;
+}
+
+/* execute 'op' with JS_NativeCodeExecOp(). 'd' is the stack depth. */
+static void nc_emit_exec(NCState *s, int pos, int op, int d)
+{
+    s->use_exception = true;
+    dbuf_printf(&s->dbuf,
+                "    if (JS_NativeCodeExecOp(ctx, %d, %d, s + %d)) {\n"
+                "        n = %d;\n"
+                "        goto exception;\n"
+                "    }\n", pos, op, d, d);
+}
+
+/* same as nc_emit_exec() when the inline fast path 'cond' fails */
+static void nc_emit_fast(NCState *s, int pos, int op, int d,
+                         const char *cond, const char *res)
+{
+    s->use_exception = true;
+    dbuf_printf(&s->dbuf,
+                "    if (%s) {\n"
+                "        %s;\n"
+                "    } else if (JS_NativeCodeExecOp(ctx, %d, %d, s + %d)) {\n"
+                "        n = %d;\n"
+                "        goto exception;\n"
+                "    }\n", cond, res, pos, op, d, d);
+}
+
+static void nc_emit_set(NCState *s, const char *lval, const char *val)
+{
+    dbuf_printf(&s->dbuf,
+                "    t = %s;\n"
+                "    %s = %s;\n"
+                "    nc_free(ctx, t);\n", lval, lval, val);
+}
+
+static void nc_emit_poll(NCState *s, int pos, int d)
+{
+    s->use_poll = true;
+    s->use_exception = true;
+    dbuf_printf(&s->dbuf,
+                "    if (--poll == 0) {\n"
+                "        poll = %d;\n"
+                "        if (JS_NativeCodeExecOp(ctx, %d, %d, s + %d)) {\n"
+                "            n = %d;\n"
+                "            goto exception;\n"
+                "        }\n"
+                "    }\n", NC_POLL_INTERVAL, pos, OP_goto, d, d);
+}
+
+/* return 'val' after freeing the 'd' first stack slots */
+static void nc_emit_return(NCState *s, int d, const char *val)
+{
+    int i;
+    s->use_done = true;
+    dbuf_printf(&s->dbuf, "    ret = %s;\n", val);
+    for(i = 0; i < d; i++)
+        dbuf_printf(&s->dbuf, "    nc_free(ctx, s[%d]);\n", i);
+    dbuf_printf(&s->dbuf, "    goto done;\n");
+}
+
+static void nc_emit_insn(NCState *s, const uint8_t *bc, int pos, int d)
+{
+    DynBuf *db = &s->dbuf;
+    int op = bc[pos], idx, target, i, n_pop;
+    const JSOpCode *oi = &short_opcode_info(op);
+    char lval[32], cond[256], res[256];
+    const char *cop;
+
+    if (nc_has_fallback(op)) {
+        nc_emit_exec(s, pos, op, d);
+        return;
+    }
+    switch(op) {
+    case OP_push_i32:
+        dbuf_printf(db, "    s[%d] = JS_NewInt32(ctx, %d);\n", d,
+                    (int32_t)get_u32(bc + pos + 1));
+        break;
+    case OP_push_i8:
+        dbuf_printf(db, "    s[%d] = JS_NewInt32(ctx, %d);\n", d,
+                    (int8_t)bc[pos + 1]);
+        break;
+    case OP_push_i16:
+        dbuf_printf(db, "    s[%d] = JS_NewInt32(ctx, %d);\n", d,
+                    (int16_t)get_u16(bc + pos + 1));
+        break;
+    case OP_push_minus1:
+    case OP_push_0:
+    case OP_push_1:
+    case OP_push_2:
+    case OP_push_3:
+    case OP_push_4:
+    case OP_push_5:
+    case OP_push_6:
+    case OP_push_7:
+        dbuf_printf(db, "    s[%d] = JS_NewInt32(ctx, %d);\n", d,
+                    op - OP_push_0);
+        break;
+    case OP_undefined:
+        dbuf_printf(db, "    s[%d] = JS_UNDEFINED;\n", d);
+        break;
+    case OP_null:
+        dbuf_printf(db, "    s[%d] = JS_NULL;\n", d);
+        break;
+    case OP_push_false:
+        dbuf_printf(db, "    s[%d] = JS_FALSE;\n", d);
+        break;
+    case OP_push_true:
+        dbuf_printf(db, "    s[%d] = JS_TRUE;\n", d);
+        break;
+    case OP_push_this:
+        dbuf_printf(db, "    s[%d] = JS_DupValue(ctx, this_val);\n", d);
+        break;
+    case OP_get_loc:
+    case OP_get_loc8:
+    case OP_get_loc0:
+    case OP_get_loc1:
+    case OP_get_loc2:
+    case OP_get_loc3:
+        if (op == OP_get_loc)
+            idx = get_u16(bc + pos + 1);
+        else if (op == OP_get_loc8)
+            idx = bc[pos + 1];
+        else
+            idx = op - OP_get_loc0;
+        dbuf_printf(db, "    s[%d] = nc_dup(ctx, %s);\n", d,
+                    nc_loc(s, idx));
+        break;
+    case OP_get_loc0_loc1:
+        dbuf_printf(db, "    s[%d] = nc_dup(ctx, %s);\n", d,
+                    nc_loc(s, 0));
+        dbuf_printf(db, "    s[%d] = nc_dup(ctx, %s);\n", d + 1,
+                    nc_loc(s, 1));
+        break;
+    case OP_put_loc:
+    case OP_put_loc8:
+    case OP_put_loc0:
+    case OP_put_loc1:
+    case OP_put_loc2:
+    case OP_put_loc3:
+    case OP_set_loc:
+    case OP_set_loc8:
+    case OP_set_loc0:
+    case OP_set_loc1:
+    case OP_set_loc2:
+    case OP_set_loc3:
+    case OP_put_loc_check:
+    case OP_put_loc_check_init:
+        if (op == OP_put_loc || op == OP_set_loc ||
+            op == OP_put_loc_check || op == OP_put_loc_check_init)
+            idx = get_u16(bc + pos + 1);
+        else if (op == OP_put_loc8 || op == OP_set_loc8)
+            idx = bc[pos + 1];
+        else if (op >= OP_put_loc0 && op <= OP_put_loc3)
+            idx = op - OP_put_loc0;
+        else
+            idx = op - OP_set_loc0;
+        js__pstrcpy(lval, sizeof(lval), nc_loc(s, idx));
+        if (op == OP_put_loc_check || op == OP_put_loc_check_init) {
+            dbuf_printf(db, "    if (%sJS_IsUninitialized(%s)) {\n",
+                        op == OP_put_loc_check ? "" : "!", lval);
+            dbuf_printf(db, "        JS_NativeCodeExecOp(ctx, %d, %d, s + %d);\n"
+                        "        n = %d;\n"
+                        "        goto exception;\n"
+                        "    }\n", pos, op, d, d);
+            s->use_exception = true;
+        }
+        s->use_tmp = true;
+        snprintf(res, sizeof(res), "s[%d]", d - 1);
+        if ((op >= OP_set_loc0 && op <= OP_set_loc3) ||
+            op == OP_set_loc || op == OP_set_loc8)
+            snprintf(res, sizeof(res), "nc_dup(ctx, s[%d])", d - 1);
+        nc_emit_set(s, lval, res);
+        break;
+    case OP_set_loc_uninitialized:
+        s->use_tmp = true;
+        nc_emit_set(s, nc_loc(s, get_u16(bc + pos + 1)), "JS_UNINITIALIZED");
+        break;
+    case OP_get_loc_check:
+        idx = get_u16(bc + pos + 1);
+        s->use_exception = true;
+        dbuf_printf(db, "    if (JS_IsUninitialized(%s)) {\n"
+                    "        JS_NativeCodeExecOp(ctx, %d, %d, s + %d);\n"
+                    "        n = %d;\n"
+                    "        goto exception;\n"
+                    "    }\n", nc_loc(s, idx), pos, op, d, d);
+        dbuf_printf(db, "    s[%d] = nc_dup(ctx, %s);\n", d,
+                    nc_loc(s, idx));
+        break;
+    case OP_get_arg:
+    case OP_get_arg0:
+    case OP_get_arg1:
+    case OP_get_arg2:
+    case OP_get_arg3:
+        idx = (op == OP_get_arg) ? get_u16(bc + pos + 1) : op - OP_get_arg0;
+        dbuf_printf(db, "    s[%d] = nc_dup(ctx, arg_buf[%d]);\n",
+                    d, idx);
+        break;
+    case OP_put_arg:
+    case OP_put_arg0:
+    case OP_put_arg1:
+    case OP_put_arg2:
+    case OP_put_arg3:
+    case OP_set_arg:
+    case OP_set_arg0:
+    case OP_set_arg1:
+    case OP_set_arg2:
+    case OP_set_arg3:
+        if (op == OP_put_arg || op == OP_set_arg)
+            idx = get_u16(bc + pos + 1);
+        else if (op >= OP_put_arg0 && op <= OP_put_arg3)
+            idx = op - OP_put_arg0;
+        else
+            idx = op - OP_set_arg0;
+        snprintf(lval, sizeof(lval), "arg_buf[%d]", idx);
+        if (op == OP_set_arg || (op >= OP_set_arg0 && op <= OP_set_arg3))
+            snprintf(res, sizeof(res), "nc_dup(ctx, s[%d])", d - 1);
+        else
+            snprintf(res, sizeof(res), "s[%d]", d - 1);
+        s->use_tmp = true;
+        nc_emit_set(s, lval, res);
+        break;
+    case OP_inc_loc:
+    case OP_dec_loc:
+    case OP_add_loc:
+        js__pstrcpy(lval, sizeof(lval), nc_loc(s, bc[pos + 1]));
+        s->use_tmp = true;
+        s->use_tmp_array = true;
+        s->use_r64 = true;
+        s->use_exception = true;
+        if (op == OP_add_loc) {
+            dbuf_printf(db, "    if (JS_VALUE_IS_BOTH_INT(%s, s[%d]) &&\n"
+                        "        (r64 = (int64_t)JS_VALUE_GET_INT(%s) + JS_VALUE_GET_INT(s[%d]),\n"
+                        "         r64 == (int32_t)r64)) {\n"
+                        "        %s = JS_NewInt32(ctx, (int32_t)r64);\n"
+                        "    } else {\n"
+                        "        tmp[0] = nc_dup(ctx, %s);\n"
+                        "        tmp[1] = s[%d];\n"
+                        "        if (JS_NativeCodeExecOp(ctx, %d, %d, tmp + 2)) {\n"
+                        "            n = %d;\n"
+                        "            goto exception;\n"
+                        "        }\n",
+                        lval, d - 1, lval, d - 1, lval, lval, d - 1,
+                        pos, OP_add, d - 1);
+        } else {
+            dbuf_printf(db, "    if (JS_VALUE_GET_TAG(%s) == JS_TAG_INT &&\n"
+                        "        JS_VALUE_GET_INT(%s) != %s) {\n"
+                        "        %s = JS_NewInt32(ctx, JS_VALUE_GET_INT(%s) %c 1);\n"
+                        "    } else {\n"
+                        "        tmp[0] = nc_dup(ctx, %s);\n"
+                        "        if (JS_NativeCodeExecOp(ctx, %d, %d, tmp + 1)) {\n"
+                        "            n = %d;\n"
+                        "            goto exception;\n"
+                        "        }\n",
+                        lval, lval, op == OP_inc_loc ? "INT32_MAX" : "INT32_MIN",
+                        lval, lval, op == OP_inc_loc ? '+' : '-', lval,
+                        pos, op == OP_inc_loc ? OP_inc : OP_dec, d);
+        }
+        dbuf_printf(db, "        t = %s;\n"
+                    "        %s = tmp[0];\n"
+                    "        nc_free(ctx, t);\n"
+                    "    }\n", lval, lval);
+        break;
+    case OP_drop:
+        dbuf_printf(db, "    nc_free(ctx, s[%d]);\n", d - 1);
+        break;
+    case OP_nip:
+        dbuf_printf(db, "    nc_free(ctx, s[%d]);\n"
+                    "    s[%d] = s[%d];\n", d - 2, d - 2, d - 1);
+        break;
+    case OP_nip1:
+        dbuf_printf(db, "    nc_free(ctx, s[%d]);\n"
+                    "    s[%d] = s[%d];\n"
+                    "    s[%d] = s[%d];\n", d - 3, d - 3, d - 2, d - 2, d - 1);
+        break;
+    case OP_dup:
+        dbuf_printf(db, "    s[%d] = nc_dup(ctx, s[%d]);\n", d, d - 1);
+        break;
+    case OP_dup1:
+        dbuf_printf(db, "    s[%d] = s[%d];\n"
+                    "    s[%d] = nc_dup(ctx, s[%d]);\n",
+                    d, d - 1, d - 1, d - 2);
+        break;
+    case OP_dup2:
+    case OP_dup3:
+        n_pop = oi->n_pop;
+        for(i = 0; i < n_pop; i++)
+            dbuf_printf(db, "    s[%d] = nc_dup(ctx, s[%d]);\n",
+                        d + i, d - n_pop + i);
+        break;
+    case OP_insert2:
+    case OP_insert3:
+    case OP_insert4:
+        n_pop = oi->n_pop;
+        dbuf_printf(db, "    s[%d] = s[%d];\n", d, d - 1);
+        for(i = 1; i < n_pop; i++)
+            dbuf_printf(db, "    s[%d] = s[%d];\n", d - i, d - i - 1);
+        dbuf_printf(db, "    s[%d] = nc_dup(ctx, s[%d]);\n", d - n_pop, d);
+        break;
+    case OP_perm3:
+    case OP_perm4:
+    case OP_perm5:
+        /* move the element below the top to the bottom */
+        n_pop = oi->n_pop;
+        s->use_tmp = true;
+        dbuf_printf(db, "    t = s[%d];\n", d - 2);
+        for(i = 2; i < n_pop; i++)
+            dbuf_printf(db, "    s[%d] = s[%d];\n", d - i, d - i - 1);
+        dbuf_printf(db, "    s[%d] = t;\n", d - n_pop);
+        break;
+    case OP_rot3l:
+    case OP_rot4l:
+    case OP_rot5l:
+        n_pop = oi->n_pop;
+        s->use_tmp = true;
+        dbuf_printf(db, "    t = s[%d];\n", d - n_pop);
+        for(i = n_pop; i > 1; i--)
+            dbuf_printf(db, "    s[%d] = s[%d];\n", d - i, d - i + 1);
+        dbuf_printf(db, "    s[%d] = t;\n", d - 1);
+        break;
+    case OP_rot3r:
+        s->use_tmp = true;
+        dbuf_printf(db, "    t = s[%d];\n"
+                    "    s[%d] = s[%d];\n"
+                    "    s[%d] = s[%d];\n"
+                    "    s[%d] = t;\n",
+                    d - 1, d - 1, d - 2, d - 2, d - 3, d - 3);
+        break;
+    case OP_swap:
+        s->use_tmp = true;
+        dbuf_printf(db, "    t = s[%d];\n"
+                    "    s[%d] = s[%d];\n"
+                    "    s[%d] = t;\n", d - 2, d - 2, d - 1, d - 1);
+        break;
+    case OP_swap2:
+        s->use_tmp = true;
+        for(i = 0; i < 2; i++) {
+            dbuf_printf(db, "    t = s[%d];\n"
+                        "    s[%d] = s[%d];\n"
+                        "    s[%d] = t;\n",
+                        d - 4 + i, d - 4 + i, d - 2 + i, d - 2 + i);
+        }
+        break;
+    case OP_nop:
+        break;
+    case OP_goto:
+    case OP_goto8:
+    case OP_goto16:
+        target = nc_get_jump_target(bc, pos, oi);
+        if (target <= pos)
+            nc_emit_poll(s, pos, d);
+        dbuf_printf(db, "    goto L%d;\n", target);
+        break;
+    case OP_if_true:
+    case OP_if_false:
+    case OP_if_true8:
+    case OP_if_false8:
+        target = nc_get_jump_target(bc, pos, oi);
+        s->use_tmp = true;
+        dbuf_printf(db, "    t = s[%d];\n"
+                    "    if (JS_VALUE_GET_TAG(t) == JS_TAG_BOOL) {\n"
+                    "        r = JS_VALUE_GET_BOOL(t);\n"
+                    "    } else {\n"
+                    "        r = JS_ToBool(ctx, t);\n"
+                    "        nc_free(ctx, t);\n"
+                    "    }\n", d - 1);
+        if (target <= pos)
+            nc_emit_poll(s, pos, d - 1);
+        dbuf_printf(db, "    if (%sr)\n"
+                    "        goto L%d;\n",
+                    (op == OP_if_false || op == OP_if_false8) ? "!" : "",
+                    target);
+        break;
+    case OP_return:
+        snprintf(res, sizeof(res), "s[%d]", d - 1);
+        nc_emit_return(s, d - 1, res);
+        break;
+    case OP_return_undef:
+        nc_emit_return(s, d, "JS_UNDEFINED");
+        break;
+    case OP_tail_call:
+    case OP_tail_call_method:
+        n_pop = oi->n_pop + get_u16(bc + pos + 1);
+        nc_emit_exec(s, pos, op == OP_tail_call ? OP_call : OP_call_method, d);
+        snprintf(res, sizeof(res), "s[%d]", d - n_pop);
+        nc_emit_return(s, d - n_pop, res);
+        break;
+    case OP_lnot:
+        dbuf_printf(db, "    r = JS_ToBool(ctx, s[%d]);\n"
+                    "    nc_free(ctx, s[%d]);\n"
+                    "    s[%d] = JS_NewBool(ctx, !r);\n", d - 1, d - 1, d - 1);
+        break;
+    case OP_is_undefined_or_null:
+    case OP_is_undefined:
+    case OP_is_null:
+        if (op == OP_is_undefined_or_null)
+            snprintf(cond, sizeof(cond), "JS_IsUndefined(s[%d]) || JS_IsNull(s[%d])",
+                     d - 1, d - 1);
+        else
+            snprintf(cond, sizeof(cond), "%s(s[%d])",
+                     op == OP_is_null ? "JS_IsNull" : "JS_IsUndefined", d - 1);
+        dbuf_printf(db, "    r = %s;\n"
+                    "    nc_free(ctx, s[%d]);\n"
+                    "    s[%d] = JS_NewBool(ctx, r);\n", cond, d - 1, d - 1);
+        break;
+    case OP_add:
+    case OP_sub:
+    case OP_mul:
+        cop = (op == OP_add) ? "+" : (op == OP_sub) ? "-" : "*";
+        s->use_r64 = true;
+        /* a zero product may be -0 */
+        snprintf(cond, sizeof(cond),
+                 "JS_VALUE_IS_BOTH_INT(s[%d], s[%d]) &&\n"
+                 "        (r64 = (int64_t)JS_VALUE_GET_INT(s[%d]) %s JS_VALUE_GET_INT(s[%d]),\n"
+                 "         r64 == (int32_t)r64%s)",
+                 d - 2, d - 1, d - 2, cop, d - 1,
+                 op == OP_mul ? " && r64 != 0" : "");
+        snprintf(res, sizeof(res), "s[%d] = JS_NewInt32(ctx, (int32_t)r64)",
+                 d - 2);
+        nc_emit_fast(s, pos, op, d, cond, res);
+        break;
+    case OP_lt:
+    case OP_lte:
+    case OP_gt:
+    case OP_gte:
+    case OP_eq:
+    case OP_neq:
+    case OP_strict_eq:
+    case OP_strict_neq:
+    case OP_and:
+    case OP_or:
+    case OP_xor:
+    case OP_shl:
+    case OP_sar:
+        switch(op) {
+        case OP_lt: cop = "<"; break;
+        case OP_lte: cop = "<="; break;
+        case OP_gt: cop = ">"; break;
+        case OP_gte: cop = ">="; break;
+        case OP_eq: case OP_strict_eq: cop = "=="; break;
+        case OP_neq: case OP_strict_neq: cop = "!="; break;
+        case OP_and: cop = "&"; break;
+        case OP_or: cop = "|"; break;
+        case OP_xor: cop = "^"; break;
+        default: cop = NULL; break;
+        }
+        snprintf(cond, sizeof(cond), "JS_VALUE_IS_BOTH_INT(s[%d], s[%d])",
+                 d - 2, d - 1);
+        if (op == OP_shl) {
+            snprintf(res, sizeof(res),
+                     "s[%d] = JS_NewInt32(ctx, (int32_t)((uint32_t)JS_VALUE_GET_INT(s[%d]) << (JS_VALUE_GET_INT(s[%d]) & 31)))",
+                     d - 2, d - 2, d - 1);
+        } else if (op == OP_sar) {
+            snprintf(res, sizeof(res),
+                     "s[%d] = JS_NewInt32(ctx, JS_VALUE_GET_INT(s[%d]) >> (JS_VALUE_GET_INT(s[%d]) & 31))",
+                     d - 2, d - 2, d - 1);
+        } else {
+            snprintf(res, sizeof(res),
+                     "s[%d] = JS_New%s(ctx, JS_VALUE_GET_INT(s[%d]) %s JS_VALUE_GET_INT(s[%d]))",
+                     d - 2, (op == OP_and || op == OP_or || op == OP_xor) ?
+                     "Int32" : "Bool", d - 2, cop, d - 1);
+        }
+        nc_emit_fast(s, pos, op, d, cond, res);
+        break;
+    case OP_inc:
+    case OP_dec:
+        snprintf(cond, sizeof(cond),
+                 "JS_VALUE_GET_TAG(s[%d]) == JS_TAG_INT &&\n"
+                 "        JS_VALUE_GET_INT(s[%d]) != %s",
+                 d - 1, d - 1, op == OP_inc ? "INT32_MAX" : "INT32_MIN");
+        snprintf(res, sizeof(res), "s[%d] = JS_NewInt32(ctx, JS_VALUE_GET_INT(s[%d]) %c 1)",
+                 d - 1, d - 1, op == OP_inc ? '+' : '-');
+        nc_emit_fast(s, pos, op, d, cond, res);
+        break;
+    case OP_post_inc:
+    case OP_post_dec:
+        snprintf(cond, sizeof(cond),
+                 "JS_VALUE_GET_TAG(s[%d]) == JS_TAG_INT &&\n"
+                 "        JS_VALUE_GET_INT(s[%d]) != %s",
+                 d - 1, d - 1, op == OP_post_inc ? "INT32_MAX" : "INT32_MIN");
+        snprintf(res, sizeof(res), "s[%d] = JS_NewInt32(ctx, JS_VALUE_GET_INT(s[%d]) %c 1)",
+                 d, d - 1, op == OP_post_inc ? '+' : '-');
+        nc_emit_fast(s, pos, op, d, cond, res);
+        break;
+    default:
+        abort();
+    }
+}
+
+/* write the C function of 'b'. Return 0 if OK, 1 if 'b' is not
+   translated, -1 if memory error. */
+static int nc_write_function(NCState *s, JSFunctionBytecode *b, int func_idx)
+{
+    JSContext *ctx = s->ctx;
+    DynBuf body, *db;
+    int16_t *depth;
+    uint8_t *is_label;
+    int pos, ret, i;
+
+    depth = js_malloc(ctx, b->byte_code_len * (sizeof(*depth) + 1));
+    if (!depth)
+        return -1;
+    is_label = (uint8_t *)(depth + b->byte_code_len);
+    ret = nc_compute_depth(ctx, b, depth, is_label);
+    if (ret < 0) {
+        js_free(ctx, depth);
+        return (ret == -2) ? -1 : 1;
+    }
+
+    /* the body is generated first to know the needed variables */
+    db = &s->dbuf;
+    body = *db;
+    js_dbuf_init(ctx, &s->dbuf);
+    s->b = b;
+    s->use_tmp = false;
+    s->use_r64 = false;
+    s->use_poll = false;
+    s->use_tmp_array = false;
+    s->use_exception = false;
+    s->use_done = false;
+    for(pos = 0; pos < b->byte_code_len;
+        pos += short_opcode_info(b->byte_code_buf[pos]).size) {
+        if (depth[pos] < 0)
+            continue;
+        if (is_label[pos])
+            dbuf_printf(&s->dbuf, " L%d:\n", pos);
+        nc_emit_insn(s, b->byte_code_buf, pos, depth[pos]);
+    }
+    js_free(ctx, depth);
+    if (dbuf_error(&s->dbuf)) {
+        dbuf_free(&s->dbuf);
+        s->dbuf = body;
+        return -1;
+    }
+    /* swap the buffers */
+    {
+        DynBuf tmp = s->dbuf;
+        s->dbuf = body;
+        body = tmp;
+    }
+
+    db = &s->dbuf;
+    dbuf_printf(db, "static JSValue %s_native_%d(JSContext *ctx, JSValueConst this_val,\n"
+                "    JSValue *arg_buf, JSValue *var_buf)\n"
+                "{\n"
+                "    JSValue s[%d], ret;\n",
+                s->c_name, func_idx, max_int(b->stack_size, 1));
+    for(i = 0; i < b->var_count; i++) {
+        if (b->vardefs && !b->vardefs[b->arg_count + i].is_captured)
+            dbuf_printf(db, "    JSValue v%d = JS_UNDEFINED;\n", i);
+    }
+    if (s->use_tmp)
+        dbuf_printf(db, "    JSValue t;\n");
+    if (s->use_tmp_array)
+        dbuf_printf(db, "    JSValue tmp[2];\n");
+    if (s->use_r64)
+        dbuf_printf(db, "    int64_t r64;\n");
+    if (s->use_poll)
+        dbuf_printf(db, "    int poll = %d;\n", NC_POLL_INTERVAL);
+    dbuf_printf(db, "    int r, n;\n\n");
+    dbuf_put(db, body.buf, body.size);
+    dbuf_free(&body);
+    if (s->use_exception) {
+        dbuf_printf(db, " exception:\n"
+                    "    while (n > 0)\n"
+                    "        nc_free(ctx, s[--n]);\n"
+                    "    ret = JS_EXCEPTION;\n");
+    }
+    if (s->use_done)
+        dbuf_printf(db, " done:\n");
+    for(i = 0; i < b->var_count; i++) {
+        if (b->vardefs && !b->vardefs[b->arg_count + i].is_captured)
+            dbuf_printf(db, "    nc_free(ctx, v%d);\n", i);
+    }
+    dbuf_printf(db, "    (void)s;\n"
+                "    (void)r;\n"
+                "    (void)n;\n"
+                "    return ret;\n"
+                "}\n\n");
+    return 0;
+}
+
+static int nc_write_rec(NCState *s, JSValueConst obj)
+{
+    JSFunctionBytecode *b = JS_VALUE_GET_PTR(obj);
+    int func_idx, ret, i;
+
+    if (b->is_lazy) {
+        b = js_lazy_compile_bytecode(s->ctx, b);
+        if (!b)
+            return -1;
+    }
+    func_idx = s->func_count++;
+    ret = nc_write_function(s, b, func_idx);
+    if (ret < 0)
+        return -1;
+    if (ret == 0)
+        dbuf_printf(&s->tab, "    { %s_native_%d, %d },\n",
+                    s->c_name, func_idx, b->byte_code_len);
+    else
+        dbuf_printf(&s->tab, "    { NULL, %d },\n", b->byte_code_len);
+    for(i = 0; i < b->cpool_count; i++) {
+        if (JS_VALUE_GET_TAG(b->cpool[i]) == JS_TAG_FUNCTION_BYTECODE) {
+            if (nc_write_rec(s, b->cpool[i]))
+                return -1;
+        }
+    }
+    return 0;
+}
+
+#endif // QJS_DISABLE_PARSER
+
+/* return the function bytecode of the compiled script or module 'obj' */
+static JSValueConst nc_get_bytecode(JSContext *ctx, JSValueConst obj)
+{
+    if (JS_VALUE_GET_TAG(obj) == JS_TAG_MODULE) {
+        JSModuleDef *m = JS_VALUE_GET_PTR(obj);
+        obj = m->func_obj;
+    }
+    if (JS_VALUE_GET_TAG(obj) != JS_TAG_FUNCTION_BYTECODE) {
+        JS_ThrowTypeError(ctx, "bytecode function expected");
+        return JS_EXCEPTION;
+    }
+    return obj;
+}
+
+char *JS_WriteNativeCode(JSContext *ctx, size_t *psize, JSValueConst obj,
+                         const char *c_name)
+{
+#ifndef QJS_DISABLE_PARSER
+    NCState ss, *s = &ss;
+
+    *psize = 0;
+    obj = nc_get_bytecode(ctx, obj);
+    if (JS_IsException(obj))
+        return NULL;
+    memset(s, 0, sizeof(*s));
+    s->ctx = ctx;
+    s->c_name = c_name;
+    js_dbuf_init(ctx, &s->dbuf);
+    js_dbuf_init(ctx, &s->tab);
+    /* inline the reference counting of the values without reference
+       count */
+    dbuf_printf(&s->dbuf,
+                "#ifndef JS_NATIVE_CODE_HELPERS\n"
+                "#define JS_NATIVE_CODE_HELPERS\n"
+                "static inline JSValue nc_dup(JSContext *ctx, JSValue v)\n"
+                "{\n"
+                "    return JS_VALUE_HAS_REF_COUNT(v) ? JS_DupValue(ctx, v) : v;\n"
+                "}\n\n"
+                "static inline void nc_free(JSContext *ctx, JSValue v)\n"
+                "{\n"
+                "    if (JS_VALUE_HAS_REF_COUNT(v))\n"
+                "        JS_FreeValue(ctx, v);\n"
+                "}\n"
+                "#endif\n\n");
+    if (nc_write_rec(s, obj))
+        goto fail;
+    dbuf_printf(&s->dbuf, "const uint32_t %s_native_count = %d;\n\n"
+                "const JSNativeCodeEntry %s_native[%d] = {\n",
+                c_name, s->func_count, c_name, s->func_count);
+    dbuf_put(&s->dbuf, s->tab.buf, s->tab.size);
+    dbuf_printf(&s->dbuf, "};\n\n");
+    dbuf_putc(&s->dbuf, '\0');
+    if (dbuf_error(&s->dbuf) || dbuf_error(&s->tab))
+        goto fail;
+    dbuf_free(&s->tab);
+    *psize = s->dbuf.size - 1;
+    return (char *)s->dbuf.buf;
+ fail:
+    dbuf_free(&s->dbuf);
+    dbuf_free(&s->tab);
+    if (!JS_HasException(ctx))
+        JS_ThrowOutOfMemory(ctx);
+    return NULL;
+#else
+    JS_ThrowInternalError(ctx, "native code generation is disabled");
+    return NULL;
+#endif
+}
+
+static int nc_set_rec(JSContext *ctx, JSValueConst obj,
+                      const JSNativeCodeEntry *tab, int count, int *pidx,
+                      bool check)
+{
+    JSFunctionBytecode *b = JS_VALUE_GET_PTR(obj);
+    int idx, i;
+
+    if (b->is_lazy) {
+        b = js_lazy_compile_bytecode(ctx, b);
+        if (!b)
+            return -1;
+    }
+    idx = (*pidx)++;
+    if (idx >= count || tab[idx].byte_code_len != b->byte_code_len)
+        goto mismatch;
+    if (!check)
+        b->native_code = tab[idx].func;
+    for(i = 0; i < b->cpool_count; i++) {
+        if (JS_VALUE_GET_TAG(b->cpool[i]) == JS_TAG_FUNCTION_BYTECODE) {
+            if (nc_set_rec(ctx, b->cpool[i], tab, count, pidx, check))
+                return -1;
+        }
+    }
+    if (idx == 0 && *pidx != count)
+        goto mismatch;
+    return 0;
+ mismatch:
+    JS_ThrowInternalError(ctx, "native code does not match the bytecode");
+    return -1;
+}
+
+int JS_SetNativeCode(JSContext *ctx, JSValueConst obj,
+                     const JSNativeCodeEntry *tab, int count)
+{
+    int idx;
+
+    obj = nc_get_bytecode(ctx, obj);
+    if (JS_IsException(obj))
+        return -1;
+    /* check that the table was generated from the same bytecode */
+    idx = 0;
+    if (nc_set_rec(ctx, obj, tab, count, &idx, true))
+        return -1;
+    idx = 0;
+    nc_set_rec(ctx, obj, tab, count, &idx, false);
+    return 0;
+}
+
+/*******************************************************************/
+/* whole-program optimization */
+
+typedef struct TSModule {
+    JSModuleDef *m;
+    bool is_root;
+    bool all_used; /* all the exports may be used */
+    JSAtom *names; /* export names used by the other modules */
+    int names_count;
+    int names_size;
+} TSModule;
+
+typedef struct TSState {
+    JSContext *ctx;
+    TSModule *tab;
+    int count;
+    int size;
+    bool changed;
+} TSState;
+
+static TSModule *ts_find_module(TSState *s, JSModuleDef *m)
+{
+    int i;
+    for(i = 0; i < s->count; i++) {
+        if (s->tab[i].m == m)
+            return &s->tab[i];
+    }
+    return NULL;
+}
+
+static int ts_add_module(TSState *s, JSModuleDef *m, bool is_root)
+{
+    TSModule *tm;
+    int i;
+
+    tm = ts_find_module(s, m);
+    if (tm) {
+        tm->is_root |= is_root;
+        return 0;
+    }
+    if (js_resize_array(s->ctx, (void **)&s->tab, sizeof(s->tab[0]),
+                        &s->size, s->count + 1))
+        return -1;
+    tm = &s->tab[s->count++];
+    memset(tm, 0, sizeof(*tm));
+    tm->m = m;
+    tm->is_root = is_root;
+    for(i = 0; i < m->req_module_entries_count; i++) {
+        JSModuleDef *m1 = m->req_module_entries[i].module;
+        if (m1 && ts_add_module(s, m1, false))
+            return -1;
+    }
+    return 0;
+}
+
+static bool ts_is_used(TSModule *tm, JSAtom name)
+{
+    int i;
+    if (tm->all_used)
+        return true;
+    for(i = 0; i < tm->names_count; i++) {
+        if (tm->names[i] == name)
+            return true;
+    }
+    return false;
+}
+
+/* mark the export 'name' of 'm' as used ('*' for all the exports) */
+static int ts_mark_used(TSState *s, JSModuleDef *m, JSAtom name)
+{
+    TSModule *tm;
+
+    if (!m)
+        return 0;
+    tm = ts_find_module(s, m);
+    if (!tm || ts_is_used(tm, name))
+        return 0;
+    s->changed = true;
+    if (name == JS_ATOM__star_) {
+        tm->all_used = true;
+        return 0;
+    }
+    if (js_resize_array(s->ctx, (void **)&tm->names, sizeof(tm->names[0]),
+                        &tm->names_size, tm->names_count + 1))
+        return -1;
+    tm->names[tm->names_count++] = name;
+    return 0;
+}
+
+static JSExportEntry *ts_find_export(JSModuleDef *m, JSAtom name)
+{
+    int i;
+    for(i = 0; i < m->export_entries_count; i++) {
+        if (m->export_entries[i].export_name == name)
+            return &m->export_entries[i];
+    }
+    return NULL;
+}
+
+/* propagate the used exports of 'tm' to the modules it imports from */
+static int ts_propagate(TSState *s, TSModule *tm)
+{
+    JSModuleDef *m = tm->m, *m1;
+    JSExportEntry *me;
+    int i, j;
+
+    for(i = 0; i < m->import_entries_count; i++) {
+        JSImportEntry *mi = &m->import_entries[i];
+        m1 = m->req_module_entries[mi->req_module_idx].module;
+        if (ts_mark_used(s, m1, mi->import_name))
+            return -1;
+    }
+    for(i = 0; i < m->export_entries_count; i++) {
+        me = &m->export_entries[i];
+        if (me->export_type == JS_EXPORT_TYPE_INDIRECT &&
+            ts_is_used(tm, me->export_name)) {
+            m1 = m->req_module_entries[me->u.req_module_idx].module;
+            if (ts_mark_used(s, m1, me->local_name))
+                return -1;
+        }
+    }
+    for(i = 0; i < m->star_export_entries_count; i++) {
+        m1 = m->req_module_entries[m->star_export_entries[i].req_module_idx].module;
+        if (tm->all_used) {
+            if (ts_mark_used(s, m1, JS_ATOM__star_))
+                return -1;
+            continue;
+        }
+        /* the names not exported by 'm' may come from any star export */
+        for(j = 0; j < tm->names_count; j++) {
+            if (!ts_find_export(m, tm->names[j]) &&
+                ts_mark_used(s, m1, tm->names[j]))
+                return -1;
+        }
+    }
+    return 0;
+}
+
+/* return true if 'b' or one of its nested functions contains 'op' */
+static int ts_has_opcode(JSContext *ctx, JSFunctionBytecode *b, int op)
+{
+    const uint8_t *bc;
+    int pos, i, ret;
+
+    if (b->is_lazy) {
+        b = js_lazy_compile_bytecode(ctx, b);
+        if (!b)
+            return -1;
+    }
+    bc = b->byte_code_buf;
+    for(pos = 0; pos < b->byte_code_len;
+        pos += short_opcode_info(bc[pos]).size) {
+        if (bc[pos] == op)
+            return true;
+    }
+    for(i = 0; i < b->cpool_count; i++) {
+        if (JS_VALUE_GET_TAG(b->cpool[i]) == JS_TAG_FUNCTION_BYTECODE) {
+            ret = ts_has_opcode(ctx, JS_VALUE_GET_PTR(b->cpool[i]), op);
+            if (ret)
+                return ret;
+        }
+    }
+    return false;
+}
+
+static void ts_remove_unused_exports(JSContext *ctx, TSModule *tm)
+{
+    JSModuleDef *m = tm->m;
+    JSExportEntry *me;
+    int i, j;
+
+    j = 0;
+    for(i = 0; i < m->export_entries_count; i++) {
+        me = &m->export_entries[i];
+        if (ts_is_used(tm, me->export_name)) {
+            m->export_entries[j++] = *me;
+        } else {
+            JS_FreeAtom(ctx, me->local_name);
+            JS_FreeAtom(ctx, me->export_name);
+        }
+    }
+    m->export_entries_count = j;
+}
+
+/* return the module variable index accessed by the instruction at 'pc'
+   or -1 */
+static int ts_get_var_ref_idx(const uint8_t *pc)
+{
+    int op = pc[0];
+
+    switch(short_opcode_info(op).fmt) {
+    case OP_FMT_var_ref:
+        return get_u16(pc + 1);
+    case OP_FMT_none_var_ref:
+        if (op >= OP_get_var_ref0 && op <= OP_get_var_ref3)
+            return op - OP_get_var_ref0;
+        if (op >= OP_put_var_ref0 && op <= OP_put_var_ref3)
+            return op - OP_put_var_ref0;
+        return op - OP_set_var_ref0;
+    default:
+        if (op == OP_make_var_ref_ref)
+            return get_u16(pc + 5);
+        return -1;
+    }
+}
+
+/* remove the function declarations of the module 'm' which are no longer
+   referenced. Their code is replaced by nops and their constant pool
+   entry by undefined. Return the number of removed functions or -1. */
+static int ts_remove_dead_functions(JSContext *ctx, JSModuleDef *m)
+{
+    JSFunctionBytecode *b = JS_VALUE_GET_PTR(m->func_obj);
+    uint8_t *bc = b->byte_code_buf;
+    int *var_use, *const_use, pos, pos1, op, idx, k, i, removed, ret;
+    bool changed;
+
+    if (b->rom_atoms)
+        return 0;
+    /* the code compiled by a direct eval() looks up the module variables
+       by name */
+    ret = ts_has_opcode(ctx, b, OP_eval);
+    if (ret == 0)
+        ret = ts_has_opcode(ctx, b, OP_apply_eval);
+    if (ret != 0)
+        return ret < 0 ? -1 : 0;
+    var_use = js_mallocz(ctx, sizeof(var_use[0]) *
+                         (b->closure_var_count + b->cpool_count + 1));
+    if (!var_use)
+        return -1;
+    const_use = var_use + b->closure_var_count;
+    removed = 0;
+    do {
+        changed = false;
+        memset(var_use, 0, sizeof(var_use[0]) *
+               (b->closure_var_count + b->cpool_count));
+        for(pos = 0; pos < b->byte_code_len;
+            pos += short_opcode_info(bc[pos]).size) {
+            op = bc[pos];
+            if (op == OP_push_const || op == OP_fclosure)
+                const_use[get_u32(bc + pos + 1)]++;
+            else if (op == OP_push_const8 || op == OP_fclosure8)
+                const_use[bc[pos + 1]]++;
+            idx = ts_get_var_ref_idx(bc + pos);
+            if (idx >= 0)
+                var_use[idx]++;
+        }
+        for(i = 0; i < m->export_entries_count; i++) {
+            JSExportEntry *me = &m->export_entries[i];
+            if (me->export_type == JS_EXPORT_TYPE_LOCAL)
+                var_use[me->u.local.var_idx]++;
+        }
+        for(i = 0; i < b->cpool_count; i++) {
+            JSFunctionBytecode *b1;
+            if (JS_VALUE_GET_TAG(b->cpool[i]) != JS_TAG_FUNCTION_BYTECODE)
+                continue;
+            b1 = JS_VALUE_GET_PTR(b->cpool[i]);
+            for(k = 0; k < b1->closure_var_count; k++) {
+                if (!b1->closure_var[k].is_local)
+                    var_use[b1->closure_var[k].var_idx]++;
+            }
+        }
+
+        /* hoisted function definition: fclosure [set_name] put_var_ref */
+        for(pos = 0; pos < b->byte_code_len;
+            pos += short_opcode_info(bc[pos]).size) {
+            op = bc[pos];
+            if (op == OP_fclosure)
+                k = get_u32(bc + pos + 1);
+            else if (op == OP_fclosure8)
+                k = bc[pos + 1];
+            else
+                continue;
+            pos1 = pos + short_opcode_info(op).size;
+            if (pos1 < b->byte_code_len && bc[pos1] == OP_set_name)
+                pos1 += short_opcode_info(OP_set_name).size;
+            if (pos1 >= b->byte_code_len)
+                continue;
+            op = bc[pos1];
+            if (op != OP_put_var_ref &&
+                !(op >= OP_put_var_ref0 && op <= OP_put_var_ref3))
+                continue;
+            idx = ts_get_var_ref_idx(bc + pos1);
+            if (const_use[k] != 1 || var_use[idx] != 1 ||
+                !b->closure_var[idx].is_local ||
+                JS_VALUE_GET_TAG(b->cpool[k]) != JS_TAG_FUNCTION_BYTECODE)
+                continue;
+            pos1 += short_opcode_info(op).size;
+            for(i = pos; i < pos1; i += short_opcode_info(bc[i]).size) {
+                if (bc[i] == OP_set_name)
+                    JS_FreeAtom(ctx, get_u32(bc + i + 1));
+            }
+            memset(bc + pos, OP_nop, pos1 - pos);
+            JS_FreeValue(ctx, b->cpool[k]);
+            b->cpool[k] = JS_UNDEFINED;
+            removed++;
+            changed = true;
+        }
+    } while (changed);
+    js_free(ctx, var_use);
+    return removed;
+}
+
+int JS_TreeShake(JSContext *ctx, JSValueConst *roots, int count)
+{
+    TSState ss, *s = &ss;
+    TSModule *tm;
+    bool has_dynamic_import;
+    int i, ret, removed;
+
+    memset(s, 0, sizeof(*s));
+    s->ctx = ctx;
+    has_dynamic_import = false;
+    removed = -1;
+    for(i = 0; i < count; i++) {
+        JSValueConst obj = roots[i];
+        if (JS_VALUE_GET_TAG(obj) == JS_TAG_MODULE) {
+            if (ts_add_module(s, JS_VALUE_GET_PTR(obj), true))
+                goto done;
+        } else if (JS_VALUE_GET_TAG(obj) == JS_TAG_FUNCTION_BYTECODE) {
+            ret = ts_has_opcode(ctx, JS_VALUE_GET_PTR(obj), OP_import);
+            if (ret < 0)
+                goto done;
+            has_dynamic_import |= ret;
+        } else {
+            JS_ThrowTypeError(ctx, "bytecode function or module expected");
+            goto done;
+        }
+    }
+    for(i = 0; i < s->count; i++) {
+        tm = &s->tab[i];
+        if (tm->m->init_func || JS_VALUE_GET_TAG(tm->m->func_obj) !=
+            JS_TAG_FUNCTION_BYTECODE) {
+            /* C module or already instantiated module: keep it as is */
+            tm->all_used = true;
+            continue;
+        }
+        if (tm->is_root)
+            tm->all_used = true;
+        ret = ts_has_opcode(ctx, JS_VALUE_GET_PTR(tm->m->func_obj),
+                            OP_import);
+        if (ret < 0)
+            goto done;
+        has_dynamic_import |= ret;
+    }
+
+    /* compute the used exports */
+    do {
+        s->changed = false;
+        for(i = 0; i < s->count; i++) {
+            tm = &s->tab[i];
+            if (tm->m->init_func ||
+                JS_VALUE_GET_TAG(tm->m->func_obj) != JS_TAG_FUNCTION_BYTECODE)
+                continue;
+            if (ts_propagate(s, tm))
+                goto done;
+        }
+    } while (s->changed);
+
+    removed = 0;
+    for(i = 0; i < s->count; i++) {
+        tm = &s->tab[i];
+        if (tm->m->init_func ||
+            JS_VALUE_GET_TAG(tm->m->func_obj) != JS_TAG_FUNCTION_BYTECODE)
+            continue;
+        /* a module loaded at run time may import any export */
+        if (!has_dynamic_import && !tm->all_used)
+            ts_remove_unused_exports(ctx, tm);
+        ret = ts_remove_dead_functions(ctx, tm->m);
+        if (ret < 0) {
+            removed = -1;
+            goto done;
+        }
+        removed += ret;
+    }
+ done:
+    for(i = 0; i < s->count; i++)
+        js_free(ctx, s->tab[i].names);
+    js_free(ctx, s->tab);
+    return removed;
+}
+
+static int ts_enum_atoms(JSContext *ctx, JSFunctionBytecode *b,
+                         JSAtomEnumFunc *func, void *opaque)
+{
+    const uint8_t *bc;
+    JSAtom atom;
+    int pos, op, i;
+
+    if (b->is_lazy) {
+        b = js_lazy_compile_bytecode(ctx, b);
+        if (!b)
+            return -1;
+    }
+    if (b->func_kind == JS_FUNC_ASYNC || b->func_kind == JS_FUNC_ASYNC_GENERATOR)
+        func(ctx, JS_ATOM_Promise, opaque);
+    bc = b->byte_code_buf;
+    for(pos = 0; pos < b->byte_code_len;
+        pos += short_opcode_info(op).size) {
+        op = bc[pos];
+        switch(short_opcode_info(op).fmt) {
+        case OP_FMT_atom:
+        case OP_FMT_atom_u8:
+        case OP_FMT_atom_u16:
+        case OP_FMT_atom_label_u8:
+        case OP_FMT_atom_label_u16:
+            func(ctx, bc_get_atom_operand(b, bc + pos + 1), opaque);
+            break;
+        default:
+            break;
+        }
+        switch(op) {
+        case OP_regexp:
+            func(ctx, JS_ATOM_RegExp, opaque);
+            break;
+        case OP_push_bigint_i32:
+            func(ctx, JS_ATOM_BigInt, opaque);
+            break;
+        case OP_eval:
+        case OP_apply_eval:
+            func(ctx, JS_ATOM_eval, opaque);
+            break;
+        case OP_import:
+            func(ctx, JS_ATOM_Promise, opaque);
+            func(ctx, JS_ATOM_eval, opaque);
+            break;
+        default:
+            break;
+        }
+    }
+    for(i = 0; i < b->cpool_count; i++) {
+        JSValueConst val = b->cpool[i];
+        switch(JS_VALUE_GET_TAG(val)) {
+        case JS_TAG_FUNCTION_BYTECODE:
+            if (ts_enum_atoms(ctx, JS_VALUE_GET_PTR(val), func, opaque))
+                return -1;
+            break;
+        case JS_TAG_STRING:
+            /* may be used as a computed property name */
+            atom = JS_ValueToAtom(ctx, val);
+            if (atom == JS_ATOM_NULL)
+                return -1;
+            func(ctx, atom, opaque);
+            JS_FreeAtom(ctx, atom);
+            break;
+        case JS_TAG_SHORT_BIG_INT:
+        case JS_TAG_BIG_INT:
+            func(ctx, JS_ATOM_BigInt, opaque);
+            break;
+        default:
+            break;
+        }
+    }
+    return 0;
+}
+
+int JS_EnumBytecodeAtoms(JSContext *ctx, JSValueConst obj,
+                         JSAtomEnumFunc *func, void *opaque)
+{
+    if (JS_VALUE_GET_TAG(obj) == JS_TAG_MODULE) {
+        JSModuleDef *m = JS_VALUE_GET_PTR(obj);
+        /* the evaluation of a module returns a promise */
+        func(ctx, JS_ATOM_Promise, opaque);
+        obj = m->func_obj;
+    }
+    if (JS_VALUE_GET_TAG(obj) != JS_TAG_FUNCTION_BYTECODE) {
+        JS_ThrowTypeError(ctx, "bytecode function expected");
+        return -1;
+    }
+    return ts_enum_atoms(ctx, JS_VALUE_GET_PTR(obj), func, opaque);
+}
+
 /*******************************************************************/
 /* runtime functions & objects */
 
@@ -39405,6 +45644,8 @@ static JSValue js_function_toString(JSContext *ctx, JSValueConst this_val,
     p = JS_VALUE_GET_OBJ(this_val);
     if (js_class_has_bytecode(p->class_id)) {
         JSFunctionBytecode *b = p->u.func.function_bytecode;
+        if (b->is_lazy && b->cpool_count)
+            b = JS_VALUE_GET_PTR(b->cpool[0]);
         /* `b->source` must be pure ASCII or UTF-8 encoded */
         if (b->source)
             return JS_NewStringLen(ctx, b->source, b->source_len);
@@ -42965,6 +49206,8 @@ static JSValue js_number_toString(JSContext *ctx, JSValueConst this_val,
     if (JS_VALUE_GET_TAG(val) == JS_TAG_INT) {
         char buf1[70];
         int len;
+        if (base == 10)
+            return js_new_string_int32(ctx, JS_VALUE_GET_INT(val));
         len = i64toa_radix(buf1, JS_VALUE_GET_INT(val), base);
         return js_new_string8_len(ctx, buf1, len);
     }
@@ -43615,13 +49858,48 @@ static int64_t string_advance_index(JSString *p, int64_t index, bool unicode)
     return index;
 }
 
+/* return the index of the first lone surrogate of 'p' or -1 if 'p' is
+   well-formed */
+static int js_string_find_invalid_codepoint(JSString *p)
+{
+    const uint16_t *s;
+    uint32_t c, i, n;
+    uint64_t v;
+
+    if (!p->is_wide_char)
+        return -1; // by definition well-formed
+    s = str16(p);
+    n = p->len;
+    i = 0;
+    for(;;) {
+        /* skip 4 code units at a time while none is a surrogate: a lane
+           of 'v' is zero iff the code unit is in 0xD800-0xDFFF */
+        while (i + 4 <= n) {
+            v = get_u64((const uint8_t *)&s[i]);
+            v = (v & 0xF800F800F800F800) ^ 0xD800D800D800D800;
+            if ((v - 0x0001000100010001) & ~v & 0x8000800080008000)
+                break;
+            i += 4;
+        }
+        if (i >= n)
+            return -1;
+        c = s[i];
+        if (is_surrogate(c)) {
+            if (is_lo_surrogate(c) || i + 1 == n || !is_lo_surrogate(s[i + 1]))
+                return i;
+            i += 2;
+        } else {
+            i++;
+        }
+    }
+}
+
 static JSValue js_string_isWellFormed(JSContext *ctx, JSValueConst this_val,
                                       int argc, JSValueConst *argv)
 {
     JSValue str;
     JSValue ret;
     JSString *p;
-    uint32_t c, i, n;
 
     ret = JS_TRUE;
     str = JS_ToStringCheckObject(ctx, this_val);
@@ -43629,24 +49907,9 @@ static JSValue js_string_isWellFormed(JSContext *ctx, JSValueConst this_val,
         return JS_EXCEPTION;
 
     p = JS_VALUE_GET_STRING(str);
-    if (!p->is_wide_char || p->len == 0)
-        goto done; // by definition well-formed
-
-    for (i = 0, n = p->len; i < n; i++) {
-        c = str16(p)[i];
-        if (!is_surrogate(c))
-            continue;
-        if (is_lo_surrogate(c) || i + 1 == n)
-            break;
-        c = str16(p)[++i];
-        if (!is_lo_surrogate(c))
-            break;
-    }
-
-    if (i < n)
+    if (js_string_find_invalid_codepoint(p) >= 0)
         ret = JS_FALSE;
 
-done:
     JS_FreeValue(ctx, str);
     return ret;
 }
@@ -43658,23 +49921,24 @@ static JSValue js_string_toWellFormed(JSContext *ctx, JSValueConst this_val,
     JSValue ret;
     JSString *p;
     uint32_t c, i, n;
+    int k;
 
     str = JS_ToStringCheckObject(ctx, this_val);
     if (JS_IsException(str))
         return JS_EXCEPTION;
 
     p = JS_VALUE_GET_STRING(str);
-    if (!p->is_wide_char || p->len == 0)
-        return str; // by definition well-formed
+    k = js_string_find_invalid_codepoint(p);
+    if (k < 0)
+        return str;
 
-    // TODO(bnoordhuis) don't clone when input is well-formed
     ret = js_new_string16_len(ctx, str16(p), p->len);
     JS_FreeValue(ctx, str);
     if (JS_IsException(ret))
         return JS_EXCEPTION;
 
     p = JS_VALUE_GET_STRING(ret);
-    for (i = 0, n = p->len; i < n; i++) {
+    for (i = k, n = p->len; i < n; i++) {
         c = str16(p)[i];
         if (!is_surrogate(c))
             continue;
@@ -44572,10 +50836,88 @@ exception:
     return ret;
 }
 
+/* true if the Latin-1 character 'c' changes under case conversion */
+static inline bool latin1_case_changes(uint32_t c, int to_lower)
+{
+    if (to_lower)
+        return (c - 'A') < 26 || ((c - 0xC0) < 0x1F && c != 0xD7);
+    else
+        return (c - 'a') < 26 || (c >= 0xDF && c != 0xF7) || c == 0xB5;
+}
+
+/* return the index of the first character of the 8 bit string 's'
+   that changes under case conversion, or 'len' if there is none */
+static int latin1_case_scan(const uint8_t *s, int len, int to_lower)
+{
+    const uint64_t ones = 0x0101010101010101;
+    const uint64_t high = 0x8080808080808080;
+    uint64_t v, lo, hi;
+    int i, end;
+
+    /* adding these to 7 bit bytes sets bit 7 iff the byte is >= 'A'
+       (resp. >= 'Z' + 1), without carrying into the next byte */
+    lo = ones * (0x80 - (to_lower ? 'A' : 'a'));
+    hi = ones * (0x80 - (to_lower ? 'Z' : 'z') - 1);
+    i = 0;
+    while (i < len) {
+        if (i + 8 <= len) {
+            v = get_u64(s + i);
+            if (!(v & high) && !(((v + lo) ^ (v + hi)) & high)) {
+                i += 8;
+                continue;
+            }
+        }
+        for(end = min_int(i + 8, len); i < end; i++) {
+            if (latin1_case_changes(s[i], to_lower))
+                return i;
+        }
+    }
+    return len;
+}
+
+/* case conversion of a 8 bit string. Return JS_UNDEFINED if the result
+   does not fit in a 8 bit string of the same length. 'val' is not freed. */
+static JSValue js_string_case_conv8(JSContext *ctx, JSValueConst val,
+                                    int to_lower)
+{
+    JSString *p, *q;
+    const uint8_t *s;
+    uint8_t *d;
+    int i, j, len;
+    uint32_t c;
+
+    p = JS_VALUE_GET_STRING(val);
+    s = str8(p);
+    len = p->len;
+    i = latin1_case_scan(s, len, to_lower);
+    if (i == len)
+        return js_dup(val);
+    if (!to_lower) {
+        /* U+00B5, U+00DF and U+00FF do not uppercase to Latin-1 */
+        for(j = i; j < len; j++) {
+            if (s[j] == 0xB5 || s[j] == 0xDF || s[j] == 0xFF)
+                return JS_UNDEFINED;
+        }
+    }
+    q = js_alloc_string(ctx, len, 0);
+    if (!q)
+        return JS_EXCEPTION;
+    d = str8(q);
+    memcpy(d, s, i);
+    for(; i < len; i++) {
+        c = s[i];
+        if (latin1_case_changes(c, to_lower))
+            c ^= 0x20;
+        d[i] = c;
+    }
+    d[len] = '\0';
+    return JS_MKPTR(JS_TAG_STRING, q);
+}
+
 static JSValue js_string_toLowerCase(JSContext *ctx, JSValueConst this_val,
                                      int argc, JSValueConst *argv, int to_lower)
 {
-    JSValue val;
+    JSValue val, ret;
     StringBuffer b_s, *b = &b_s;
     JSString *p;
     int i, c, j, l;
@@ -44587,6 +50929,13 @@ static JSValue js_string_toLowerCase(JSContext *ctx, JSValueConst this_val,
     p = JS_VALUE_GET_STRING(val);
     if (p->len == 0)
         return val;
+    if (!p->is_wide_char) {
+        ret = js_string_case_conv8(ctx, val, to_lower);
+        if (!JS_IsUndefined(ret)) {
+            JS_FreeValue(ctx, val);
+            return ret;
+        }
+    }
     if (string_buffer_init(ctx, b, p->len))
         goto fail;
     for(i = 0; i < p->len;) {
@@ -47099,23 +53448,27 @@ static JSValue json_parse_value(JSParseState *s)
             JSValue prop_val;
             JSAtom prop_name;
 
-            if (json_next_token(s))
+            if (json_next_prop_name(s, &prop_name))
                 goto fail;
             val = JS_NewObject(ctx);
-            if (JS_IsException(val))
+            if (JS_IsException(val)) {
+                JS_FreeAtom(ctx, prop_name);
                 goto fail;
-            if (s->token.val != '}') {
+            }
+            if (prop_name != JS_ATOM_NULL || s->token.val != '}') {
                 for(;;) {
-                    if (s->token.val == TOK_STRING) {
+                    if (prop_name != JS_ATOM_NULL) {
+                        /* already atomized, the token is the next one */
+                    } else if (s->token.val == TOK_STRING) {
                         prop_name = JS_ValueToAtom(ctx, s->token.u.str.str);
                         if (prop_name == JS_ATOM_NULL)
                             goto fail;
+                        if (json_next_token(s))
+                            goto fail1;
                     } else {
                         json_parse_error(s, s->token.ptr, "Expected property name or '}'");
                         goto fail;
                     }
-                    if (json_next_token(s))
-                        goto fail1;
                     if (s->token.val != ':') {
                         json_parse_error(s, s->token.ptr, "Expected ':' after property name");
                         goto fail1;
@@ -47140,7 +53493,7 @@ static JSValue json_parse_value(JSParseState *s)
                         json_parse_error(s, s->token.ptr, "Expected ',' or '}' after property value");
                         goto fail;
                     }
-                    if (json_next_token(s))
+                    if (json_next_prop_name(s, &prop_name))
                         goto fail;
                 }
             }
@@ -49178,7 +55531,7 @@ static uint32_t map_hash_key(JSContext *ctx, JSValueConst key)
         h = JS_VALUE_GET_INT(key);
         break;
     case JS_TAG_STRING:
-        h = hash_string(JS_VALUE_GET_STRING(key), 0);
+        h = js_string_hash(JS_VALUE_GET_STRING(key), JS_ATOM_TYPE_STRING);
         break;
     case JS_TAG_OBJECT:
     case JS_TAG_SYMBOL:
@@ -53613,9 +59966,10 @@ static JSValue js_bigint_asUintN(JSContext *ctx,
     if (bits == 0) {
         JS_FreeValue(ctx, a);
         res = __JS_NewShortBigInt(ctx, 0);
-    } else if (JS_VALUE_GET_TAG(a) == JS_TAG_SHORT_BIG_INT) {
+    } else if (JS_VALUE_GET_TAG(a) == JS_TAG_SHORT_BIG_INT &&
+               (bits < 64 || asIntN || JS_VALUE_GET_SHORT_BIG_INT(a) >= 0)) {
         /* fast case */
-        if (bits >= JS_SHORT_BIG_INT_BITS) {
+        if (bits >= 64) {
             res = a;
         } else {
             uint64_t v;
@@ -53627,32 +59981,44 @@ static JSValue js_bigint_asUintN(JSContext *ctx,
                 v = (int64_t)v >> shift;
             else
                 v = v >> shift;
-            res = __JS_NewShortBigInt(ctx, v);
+            res = JS_NewBigInt64(ctx, v);
         }
     } else {
-        JSBigInt *r, *p = JS_VALUE_GET_PTR(a);
-        if (bits >= p->len * JS_LIMB_BITS) {
+        JSBigIntBuf buf;
+        JSBigInt *r, *p;
+        if (JS_VALUE_GET_TAG(a) == JS_TAG_SHORT_BIG_INT)
+            p = js_bigint_set_short(&buf, a);
+        else
+            p = JS_VALUE_GET_PTR(a);
+        if (bits >= p->len * JS_LIMB_BITS &&
+            (asIntN || !js_bigint_sign(p))) {
             res = a;
+        } else if (bits > JS_BIGINT_MAX_SIZE * JS_LIMB_BITS) {
+            /* negative value with asUintN() */
+            JS_FreeValue(ctx, a);
+            return JS_ThrowRangeError(ctx, "BigInt is too large to allocate");
         } else {
             int len, shift, i;
-            js_limb_t v;
+            js_limb_t v, ext;
             len = (bits + JS_LIMB_BITS - 1) / JS_LIMB_BITS;
-            r = js_bigint_new(ctx, len);
+            /* one more limb for the sign of asUintN() */
+            r = js_bigint_new(ctx, len + 1);
             if (!r) {
                 JS_FreeValue(ctx, a);
                 return JS_EXCEPTION;
             }
-            r->len = len;
-            for(i = 0; i < len - 1; i++)
-                r->tab[i] = p->tab[i];
+            ext = -js_bigint_sign(p);
+            for(i = 0; i < len; i++)
+                r->tab[i] = i < p->len ? p->tab[i] : ext;
             shift = (-bits) & (JS_LIMB_BITS - 1);
             /* 0 <= shift <= JS_LIMB_BITS - 1 */
-            v = p->tab[len - 1] << shift;
+            v = r->tab[len - 1] << shift;
             if (asIntN)
                 v = (js_slimb_t)v >> shift;
             else
                 v = v >> shift;
             r->tab[len - 1] = v;
+            r->tab[len] = asIntN ? -(v >> (JS_LIMB_BITS - 1)) : 0;
             r = js_bigint_normalize(ctx, r);
             JS_FreeValue(ctx, a);
             res = JS_CompactBigInt(ctx, r);
@@ -54046,7 +60412,9 @@ static JSValue js_array_buffer_constructor3(JSContext *ctx,
             memset(abuf->data, 0, sab_alloc_len);
         } else {
             /* the allocation must be done after the object creation */
+            rt->alloc_kind = JS_ALLOC_KIND_ARRAY_BUFFER;
             abuf->data = js_mallocz(ctx, max_int(len, 1));
+            rt->alloc_kind = JS_ALLOC_KIND_OTHER;
             if (!abuf->data)
                 goto fail;
         }
@@ -58412,6 +64780,977 @@ void JS_AddIntrinsicDOMException(JSContext *ctx)
     ctx->class_proto[JS_CLASS_DOM_EXCEPTION] = proto;
 }
 
+/* Context cloning */
+
+/* An object reachable from the cloned context and its copy. The copies
+   are allocated first so that nothing needs to be undone but memory
+   blocks if the cloning fails, then they are initialized. */
+typedef struct JSCloneEntry {
+    JSGCObjectHeader *old;
+    void *new;
+} JSCloneEntry;
+
+typedef struct JSCloneState {
+    JSContext *ctx; /* cloned context */
+    JSContext *new_ctx;
+    JSCloneEntry *entries; /* in discovery order */
+    uint32_t entry_count;
+    uint32_t entry_size;
+    uint32_t *hash; /* entry index + 1, 0 if empty */
+    uint32_t hash_size; /* power of two */
+} JSCloneState;
+
+static uint32_t js_clone_hash(JSCloneState *s, const void *ptr)
+{
+    uint64_t h = (uintptr_t)ptr;
+    h *= 0x9E3779B97F4A7C15;
+    return (uint32_t)(h >> 32) & (s->hash_size - 1);
+}
+
+static int js_clone_resize_hash(JSCloneState *s)
+{
+    uint32_t i, h, new_size, *new_hash;
+
+    new_size = s->hash_size ? s->hash_size * 2 : 256;
+    new_hash = js_mallocz(s->ctx, sizeof(new_hash[0]) * new_size);
+    if (!new_hash)
+        return -1;
+    js_free(s->ctx, s->hash);
+    s->hash = new_hash;
+    s->hash_size = new_size;
+    for(i = 0; i < s->entry_count; i++) {
+        h = js_clone_hash(s, s->entries[i].old);
+        while (s->hash[h] != 0)
+            h = (h + 1) & (new_size - 1);
+        s->hash[h] = i + 1;
+    }
+    return 0;
+}
+
+static JSCloneEntry *js_clone_find(JSCloneState *s, const void *old)
+{
+    uint32_t h, idx;
+
+    h = js_clone_hash(s, old);
+    while ((idx = s->hash[h]) != 0) {
+        if (s->entries[idx - 1].old == old)
+            return &s->entries[idx - 1];
+        h = (h + 1) & (s->hash_size - 1);
+    }
+    return NULL;
+}
+
+/* return the copy of 'old', which must have been visited */
+static void *js_clone_get(JSCloneState *s, const void *old)
+{
+    JSCloneEntry *e = js_clone_find(s, old);
+    assert(e != NULL);
+    return e->new;
+}
+
+/* the copy is a new reference */
+static void *js_clone_dup(JSCloneState *s, const void *old)
+{
+    JSGCObjectHeader *h = js_clone_get(s, old);
+    h->ref_count++;
+    return h;
+}
+
+static JSContext *js_clone_realm(JSCloneState *s, JSContext *realm)
+{
+    if (realm == s->ctx)
+        realm = s->new_ctx;
+    return JS_DupContext(realm);
+}
+
+static JSValue js_clone_value(JSCloneState *s, JSValueConst val)
+{
+    switch(JS_VALUE_GET_TAG(val)) {
+    case JS_TAG_OBJECT:
+    case JS_TAG_FUNCTION_BYTECODE:
+        return JS_MKPTR(JS_VALUE_GET_TAG(val),
+                        js_clone_dup(s, JS_VALUE_GET_PTR(val)));
+    default:
+        /* strings, symbols and big integers are immutable */
+        return js_dup(val);
+    }
+}
+
+/* the code generation of the lazy functions is done before cloning:
+   the stubs are replaced in the template as well, like a first call
+   would do, so that the copies share nothing with the template */
+static JSFunctionBytecode *js_clone_resolve_bytecode(JSCloneState *s,
+                                                     JSFunctionBytecode *b)
+{
+    if (b->is_lazy)
+        return js_lazy_compile_bytecode(s->ctx, b);
+    return b;
+}
+
+static int js_clone_visit(JSCloneState *s, JSGCObjectHeader *old)
+{
+    JSCloneEntry *e;
+    uint32_t h;
+
+    if (s->hash_size && js_clone_find(s, old))
+        return 0;
+    if (s->entry_count >= s->entry_size) {
+        uint32_t new_size = s->entry_size ? s->entry_size * 2 : 256;
+        e = js_realloc(s->ctx, s->entries, sizeof(e[0]) * new_size);
+        if (!e)
+            return -1;
+        s->entries = e;
+        s->entry_size = new_size;
+    }
+    if (2 * (s->entry_count + 1) > s->hash_size) {
+        if (js_clone_resize_hash(s))
+            return -1;
+    }
+    e = &s->entries[s->entry_count++];
+    e->old = old;
+    e->new = NULL;
+    h = js_clone_hash(s, old);
+    while (s->hash[h] != 0)
+        h = (h + 1) & (s->hash_size - 1);
+    s->hash[h] = s->entry_count;
+    return 0;
+}
+
+static int js_clone_visit_value(JSCloneState *s, JSValue *pval)
+{
+    JSFunctionBytecode *b;
+
+    switch(JS_VALUE_GET_TAG(*pval)) {
+    case JS_TAG_OBJECT:
+        return js_clone_visit(s, JS_VALUE_GET_PTR(*pval));
+    case JS_TAG_FUNCTION_BYTECODE:
+        b = js_clone_resolve_bytecode(s, JS_VALUE_GET_PTR(*pval));
+        if (!b)
+            return -1;
+        if (b != JS_VALUE_GET_PTR(*pval)) {
+            /* the stub is replaced by the generated function */
+            JSValue v = *pval;
+            *pval = js_dup(JS_MKPTR(JS_TAG_FUNCTION_BYTECODE, b));
+            JS_FreeValue(s->ctx, v);
+        }
+        return js_clone_visit(s, &b->header);
+    case JS_TAG_MODULE:
+        JS_ThrowTypeError(s->ctx, "cannot clone a module");
+        return -1;
+    default:
+        return 0;
+    }
+}
+
+static int js_clone_visit_object(JSCloneState *s, JSObject *p)
+{
+    JSShapeProperty *prs;
+    JSProperty *pr;
+    JSShape *sh;
+    int i;
+
+    sh = p->shape;
+    if (js_clone_visit(s, &sh->header))
+        return -1;
+    for(i = 0, prs = get_shape_prop(sh); i < sh->prop_count; i++, prs++) {
+        pr = &p->prop[i];
+        if (prs->atom == JS_ATOM_NULL)
+            continue;
+        switch(prs->flags & JS_PROP_TMASK) {
+        case JS_PROP_NORMAL:
+            if (js_clone_visit_value(s, &pr->u.value))
+                return -1;
+            break;
+        case JS_PROP_GETSET:
+            if (pr->u.getset.getter &&
+                js_clone_visit(s, &pr->u.getset.getter->header))
+                return -1;
+            if (pr->u.getset.setter &&
+                js_clone_visit(s, &pr->u.getset.setter->header))
+                return -1;
+            break;
+        case JS_PROP_VARREF:
+            /* module bindings or mapped arguments */
+            goto unsupported;
+        case JS_PROP_AUTOINIT:
+            if (js_autoinit_get_id(pr) == JS_AUTOINIT_ID_MODULE_NS)
+                goto unsupported;
+            break;
+        }
+    }
+
+    switch(p->class_id) {
+    case JS_CLASS_OBJECT:
+    case JS_CLASS_ERROR:
+    case JS_CLASS_C_FUNCTION:
+        break;
+    case JS_CLASS_ARRAY:
+        for(i = 0; i < p->u.array.count; i++) {
+            if (js_clone_visit_value(s, &p->u.array.u.values[i]))
+                return -1;
+        }
+        break;
+    case JS_CLASS_NUMBER:
+    case JS_CLASS_STRING:
+    case JS_CLASS_BOOLEAN:
+    case JS_CLASS_SYMBOL:
+    case JS_CLASS_DATE:
+    case JS_CLASS_BIG_INT:
+        if (js_clone_visit_value(s, &p->u.object_data))
+            return -1;
+        break;
+    case JS_CLASS_REGEXP:
+        break;
+    case JS_CLASS_BYTECODE_FUNCTION:
+    case JS_CLASS_GENERATOR_FUNCTION:
+    case JS_CLASS_ASYNC_FUNCTION:
+    case JS_CLASS_ASYNC_GENERATOR_FUNCTION:
+        {
+            JSFunctionBytecode *b;
+            JSVarRef *var_ref;
+
+            if (p->u.func.function_bytecode->is_lazy) {
+                b = js_lazy_compile_function(s->ctx, p);
+                if (!b)
+                    return -1;
+            }
+            b = p->u.func.function_bytecode;
+            if (js_clone_visit(s, &b->header))
+                return -1;
+            if (p->u.func.home_object &&
+                js_clone_visit(s, &p->u.func.home_object->header))
+                return -1;
+            if (p->u.func.var_refs) {
+                for(i = 0; i < b->closure_var_count; i++) {
+                    var_ref = p->u.func.var_refs[i];
+                    if (!var_ref)
+                        continue;
+                    if (!var_ref->is_detached) {
+                        JS_ThrowTypeError(s->ctx, "cannot clone a running function");
+                        return -1;
+                    }
+                    if (js_clone_visit(s, &var_ref->header))
+                        return -1;
+                }
+            }
+        }
+        break;
+    case JS_CLASS_BOUND_FUNCTION:
+        {
+            JSBoundFunction *bf = p->u.bound_function;
+            if (js_clone_visit_value(s, &bf->func_obj) ||
+                js_clone_visit_value(s, &bf->this_val))
+                return -1;
+            for(i = 0; i < bf->argc; i++) {
+                if (js_clone_visit_value(s, &bf->argv[i]))
+                    return -1;
+            }
+        }
+        break;
+    case JS_CLASS_C_FUNCTION_DATA:
+        {
+            JSCFunctionDataRecord *fd = p->u.c_function_data_record;
+            for(i = 0; i < fd->data_len; i++) {
+                if (js_clone_visit_value(s, &fd->data[i]))
+                    return -1;
+            }
+        }
+        break;
+    case JS_CLASS_PROXY:
+        {
+            JSProxyData *pd = p->u.proxy_data;
+            if (js_clone_visit_value(s, &pd->target) ||
+                js_clone_visit_value(s, &pd->handler))
+                return -1;
+        }
+        break;
+    case JS_CLASS_MAP:
+    case JS_CLASS_SET:
+        {
+            JSMapState *ms = p->u.map_state;
+            struct list_head *el;
+            JSMapRecord *mr;
+            list_for_each(el, &ms->records) {
+                mr = list_entry(el, JSMapRecord, link);
+                if (mr->empty)
+                    continue;
+                if (js_clone_visit_value(s, &mr->key) ||
+                    js_clone_visit_value(s, &mr->value))
+                    return -1;
+            }
+        }
+        break;
+    default:
+    unsupported:
+        JS_ThrowTypeErrorAtom(s->ctx, "cannot clone %s objects",
+                              s->ctx->rt->class_array[p->class_id].class_name);
+        return -1;
+    }
+    return 0;
+}
+
+static int js_clone_alloc_object(JSCloneState *s, JSCloneEntry *e)
+{
+    JSContext *ctx = s->ctx;
+    JSObject *p = (JSObject *)e->old, *np;
+    int i;
+
+    ctx->rt->alloc_kind = JS_ALLOC_KIND_OBJECT;
+    np = js_slab_alloc(ctx, sizeof(JSObject));
+    if (np) {
+        memset(np, 0, sizeof(*np));
+        e->new = np;
+        np->prop = js_slab_alloc(ctx, sizeof(JSProperty) * p->shape->prop_size);
+    }
+    ctx->rt->alloc_kind = JS_ALLOC_KIND_OTHER;
+    if (!np || !np->prop)
+        return -1;
+
+    switch(p->class_id) {
+    case JS_CLASS_ARRAY:
+        if (p->u.array.count != 0) {
+            np->u.array.u.values = js_malloc(ctx, sizeof(JSValue) *
+                                             p->u.array.count);
+            if (!np->u.array.u.values)
+                return -1;
+        }
+        break;
+    case JS_CLASS_BYTECODE_FUNCTION:
+    case JS_CLASS_GENERATOR_FUNCTION:
+    case JS_CLASS_ASYNC_FUNCTION:
+    case JS_CLASS_ASYNC_GENERATOR_FUNCTION:
+        if (p->u.func.var_refs) {
+            i = p->u.func.function_bytecode->closure_var_count;
+            np->u.func.var_refs = js_mallocz(ctx, sizeof(JSVarRef *) * i);
+            if (!np->u.func.var_refs)
+                return -1;
+        }
+        break;
+    case JS_CLASS_BOUND_FUNCTION:
+        np->u.bound_function =
+            js_malloc(ctx, sizeof(JSBoundFunction) +
+                      sizeof(JSValue) * p->u.bound_function->argc);
+        if (!np->u.bound_function)
+            return -1;
+        break;
+    case JS_CLASS_C_FUNCTION_DATA:
+        np->u.c_function_data_record =
+            js_malloc(ctx, sizeof(JSCFunctionDataRecord) + sizeof(JSValue) *
+                      p->u.c_function_data_record->data_len);
+        if (!np->u.c_function_data_record)
+            return -1;
+        break;
+    case JS_CLASS_PROXY:
+        np->u.proxy_data = js_malloc(ctx, sizeof(JSProxyData));
+        if (!np->u.proxy_data)
+            return -1;
+        break;
+    case JS_CLASS_MAP:
+    case JS_CLASS_SET:
+        {
+            JSMapState *ms = p->u.map_state, *nms;
+            struct list_head *el;
+            JSMapRecord *mr, *nmr;
+
+            nms = js_mallocz(ctx, sizeof(*nms));
+            if (!nms)
+                return -1;
+            init_list_head(&nms->records);
+            np->u.map_state = nms;
+            nms->hash_table = js_malloc(ctx, sizeof(nms->hash_table[0]) *
+                                        ms->hash_size);
+            if (!nms->hash_table)
+                return -1;
+            list_for_each(el, &ms->records) {
+                mr = list_entry(el, JSMapRecord, link);
+                if (mr->empty)
+                    continue;
+                nmr = js_malloc(ctx, sizeof(*nmr));
+                if (!nmr)
+                    return -1;
+                list_add_tail(&nmr->link, &nms->records);
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+static int js_clone_alloc_bytecode(JSCloneState *s, JSCloneEntry *e)
+{
+    JSFunctionBytecode *b = (JSFunctionBytecode *)e->old, *nb;
+    JSContext *ctx = s->ctx;
+    size_t size, cpool_offset, vardefs_offset, closure_var_offset;
+    size_t byte_code_offset;
+    int local_count;
+
+    local_count = b->arg_count + b->var_count;
+    size = sizeof(*b);
+    cpool_offset = size;
+    size += b->cpool_count * sizeof(*b->cpool);
+    vardefs_offset = size;
+    if (b->vardefs)
+        size += local_count * sizeof(*b->vardefs);
+    closure_var_offset = size;
+    size += b->closure_var_count * sizeof(*b->closure_var);
+    byte_code_offset = size;
+    if (!b->rom_atoms)
+        size += b->byte_code_len;
+
+    ctx->rt->alloc_kind = JS_ALLOC_KIND_BYTECODE;
+    nb = js_malloc(ctx, size);
+    ctx->rt->alloc_kind = JS_ALLOC_KIND_OTHER;
+    if (!nb)
+        return -1;
+    memcpy(nb, b, sizeof(*b));
+    nb->header.ref_count = 0;
+    nb->pc2line_buf = NULL;
+    nb->source = NULL;
+    nb->source_blob = NULL;
+    e->new = nb;
+    if (b->cpool_count)
+        nb->cpool = (void *)((uint8_t *)nb + cpool_offset);
+    if (b->vardefs) {
+        nb->vardefs = (void *)((uint8_t *)nb + vardefs_offset);
+        memcpy(nb->vardefs, b->vardefs, local_count * sizeof(*b->vardefs));
+    }
+    if (b->closure_var_count) {
+        nb->closure_var = (void *)((uint8_t *)nb + closure_var_offset);
+        memcpy(nb->closure_var, b->closure_var,
+               b->closure_var_count * sizeof(*b->closure_var));
+    }
+    if (!b->rom_atoms) {
+        nb->byte_code_buf = (uint8_t *)nb + byte_code_offset;
+        memcpy(nb->byte_code_buf, b->byte_code_buf, b->byte_code_len);
+    }
+    if (b->debug_in_rom) {
+        nb->pc2line_buf = b->pc2line_buf;
+        nb->source = b->source;
+        return 0;
+    }
+    if (b->pc2line_buf) {
+        nb->pc2line_buf = js_malloc(ctx, b->pc2line_len);
+        if (!nb->pc2line_buf)
+            return -1;
+        memcpy(nb->pc2line_buf, b->pc2line_buf, b->pc2line_len);
+    }
+    if (b->source_blob) {
+        nb->source = b->source;
+        nb->source_blob = b->source_blob;
+        nb->source_blob->ref_count++;
+    } else if (b->source) {
+        nb->source = js_malloc(ctx, b->source_len + 1);
+        if (!nb->source)
+            return -1;
+        memcpy(nb->source, b->source, b->source_len + 1);
+    }
+    return 0;
+}
+
+static int js_clone_alloc_shape(JSCloneState *s, JSCloneEntry *e)
+{
+    JSShape *sh = (JSShape *)e->old, *nsh;
+    size_t hash_size, size;
+    void *sh_alloc;
+
+    hash_size = sh->prop_hash_mask + 1;
+    size = get_shape_size(hash_size, sh->prop_size);
+    s->ctx->rt->alloc_kind = JS_ALLOC_KIND_OBJECT;
+    sh_alloc = js_slab_alloc(s->ctx, size);
+    s->ctx->rt->alloc_kind = JS_ALLOC_KIND_OTHER;
+    if (!sh_alloc)
+        return -1;
+    memcpy(sh_alloc, get_alloc_from_shape(sh), size);
+    nsh = get_shape_from_alloc(sh_alloc, hash_size);
+    nsh->header.ref_count = 0;
+    e->new = nsh;
+    return 0;
+}
+
+/* visit the objects referenced by the entry 'idx' and allocate its copy */
+static int js_clone_alloc(JSCloneState *s, uint32_t idx)
+{
+    JSGCObjectHeader *gp = s->entries[idx].old;
+    JSCloneEntry *e;
+
+    switch(gp->gc_obj_type) {
+    case JS_GC_OBJ_TYPE_JS_OBJECT:
+        if (js_clone_visit_object(s, (JSObject *)gp))
+            return -1;
+        /* 'entries' may have been reallocated */
+        e = &s->entries[idx];
+        return js_clone_alloc_object(s, e);
+    case JS_GC_OBJ_TYPE_FUNCTION_BYTECODE:
+        {
+            JSFunctionBytecode *b = (JSFunctionBytecode *)gp;
+            int i;
+            for(i = 0; i < b->cpool_count; i++) {
+                if (js_clone_visit_value(s, &b->cpool[i]))
+                    return -1;
+            }
+        }
+        e = &s->entries[idx];
+        return js_clone_alloc_bytecode(s, e);
+    case JS_GC_OBJ_TYPE_VAR_REF:
+        {
+            JSVarRef *var_ref = (JSVarRef *)gp, *nvar_ref;
+            if (js_clone_visit_value(s, &var_ref->value))
+                return -1;
+            nvar_ref = js_slab_alloc(s->ctx, sizeof(JSVarRef));
+            if (!nvar_ref)
+                return -1;
+            memset(nvar_ref, 0, sizeof(*nvar_ref));
+            s->entries[idx].new = nvar_ref;
+        }
+        return 0;
+    case JS_GC_OBJ_TYPE_SHAPE:
+        {
+            JSShape *sh = (JSShape *)gp;
+            if (!sh->proto && sh->is_hashed) {
+                /* cannot be modified, so it is shared */
+                s->entries[idx].new = sh;
+                return 0;
+            }
+            if (sh->proto && js_clone_visit(s, &sh->proto->header))
+                return -1;
+        }
+        e = &s->entries[idx];
+        return js_clone_alloc_shape(s, e);
+    default:
+        abort();
+    }
+}
+
+/* free the copy of an entry before its initialization */
+static void js_clone_free_entry(JSCloneState *s, JSCloneEntry *e)
+{
+    JSRuntime *rt = s->ctx->rt;
+
+    if (!e->new || e->new == e->old)
+        return;
+    switch(e->old->gc_obj_type) {
+    case JS_GC_OBJ_TYPE_JS_OBJECT:
+        {
+            JSObject *p = (JSObject *)e->old, *np = e->new;
+            switch(p->class_id) {
+            case JS_CLASS_ARRAY:
+                js_free_rt(rt, np->u.array.u.values);
+                break;
+            case JS_CLASS_BYTECODE_FUNCTION:
+            case JS_CLASS_GENERATOR_FUNCTION:
+            case JS_CLASS_ASYNC_FUNCTION:
+            case JS_CLASS_ASYNC_GENERATOR_FUNCTION:
+                js_free_rt(rt, np->u.func.var_refs);
+                break;
+            case JS_CLASS_MAP:
+            case JS_CLASS_SET:
+                if (np->u.map_state) {
+                    JSMapState *nms = np->u.map_state;
+                    struct list_head *el, *el1;
+                    list_for_each_safe(el, el1, &nms->records) {
+                        js_free_rt(rt, list_entry(el, JSMapRecord, link));
+                    }
+                    js_free_rt(rt, nms->hash_table);
+                    js_free_rt(rt, nms);
+                }
+                break;
+            case JS_CLASS_BOUND_FUNCTION:
+            case JS_CLASS_C_FUNCTION_DATA:
+            case JS_CLASS_PROXY:
+                js_free_rt(rt, np->u.opaque);
+                break;
+            default:
+                break;
+            }
+            if (np->prop)
+                js_slab_free_rt(rt, np->prop,
+                                sizeof(JSProperty) * p->shape->prop_size);
+            js_slab_free_rt(rt, np, sizeof(JSObject));
+        }
+        break;
+    case JS_GC_OBJ_TYPE_FUNCTION_BYTECODE:
+        {
+            JSFunctionBytecode *nb = e->new;
+            if (!nb->debug_in_rom) {
+                js_free_rt(rt, nb->pc2line_buf);
+                js_free_function_source(rt, nb->source, nb->source_blob);
+            }
+            js_free_rt(rt, nb);
+        }
+        break;
+    case JS_GC_OBJ_TYPE_VAR_REF:
+        js_slab_free_rt(rt, e->new, sizeof(JSVarRef));
+        break;
+    case JS_GC_OBJ_TYPE_SHAPE:
+        {
+            JSShape *nsh = e->new;
+            js_slab_free_rt(rt, get_alloc_from_shape(nsh),
+                            get_shape_size(nsh->prop_hash_mask + 1,
+                                           nsh->prop_size));
+        }
+        break;
+    default:
+        abort();
+    }
+}
+
+static void js_clone_init_object(JSCloneState *s, JSObject *p, JSObject *np)
+{
+    JSShapeProperty *prs;
+    JSProperty *pr, *npr;
+    JSShape *sh;
+    int i;
+
+    np->extensible = p->extensible;
+    np->is_exotic = p->is_exotic;
+    np->fast_array = p->fast_array;
+    np->is_constructor = p->is_constructor;
+    np->is_uncatchable_error = p->is_uncatchable_error;
+    np->is_HTMLDDA = p->is_HTMLDDA;
+    np->class_id = p->class_id;
+    sh = p->shape;
+    np->shape = js_clone_dup(s, sh);
+    for(i = 0, prs = get_shape_prop(sh); i < sh->prop_count; i++, prs++) {
+        pr = &p->prop[i];
+        npr = &np->prop[i];
+        if (prs->atom == JS_ATOM_NULL) {
+            npr->u.value = JS_UNDEFINED;
+            continue;
+        }
+        switch(prs->flags & JS_PROP_TMASK) {
+        case JS_PROP_GETSET:
+            npr->u.getset.getter = NULL;
+            npr->u.getset.setter = NULL;
+            if (pr->u.getset.getter)
+                npr->u.getset.getter = js_clone_dup(s, pr->u.getset.getter);
+            if (pr->u.getset.setter)
+                npr->u.getset.setter = js_clone_dup(s, pr->u.getset.setter);
+            break;
+        case JS_PROP_AUTOINIT:
+            npr->u.init.realm_and_id =
+                (uintptr_t)js_clone_realm(s, js_autoinit_get_realm(pr)) |
+                js_autoinit_get_id(pr);
+            npr->u.init.opaque = pr->u.init.opaque;
+            break;
+        default:
+            npr->u.value = js_clone_value(s, pr->u.value);
+            break;
+        }
+    }
+
+    switch(p->class_id) {
+    case JS_CLASS_ARRAY:
+        np->u.array.count = p->u.array.count;
+        np->u.array.u1.size = p->u.array.count;
+        for(i = 0; i < p->u.array.count; i++) {
+            np->u.array.u.values[i] = js_clone_value(s, p->u.array.u.values[i]);
+        }
+        break;
+    case JS_CLASS_C_FUNCTION:
+        np->u.cfunc = p->u.cfunc;
+        if (p->u.cfunc.realm)
+            np->u.cfunc.realm = js_clone_realm(s, p->u.cfunc.realm);
+        break;
+    case JS_CLASS_NUMBER:
+    case JS_CLASS_STRING:
+    case JS_CLASS_BOOLEAN:
+    case JS_CLASS_SYMBOL:
+    case JS_CLASS_DATE:
+    case JS_CLASS_BIG_INT:
+        np->u.object_data = js_clone_value(s, p->u.object_data);
+        break;
+    case JS_CLASS_REGEXP:
+        np->u.regexp.pattern = p->u.regexp.pattern;
+        np->u.regexp.bytecode = p->u.regexp.bytecode;
+        js_dup(JS_MKPTR(JS_TAG_STRING, np->u.regexp.pattern));
+        js_dup(JS_MKPTR(JS_TAG_STRING, np->u.regexp.bytecode));
+        break;
+    case JS_CLASS_BYTECODE_FUNCTION:
+    case JS_CLASS_GENERATOR_FUNCTION:
+    case JS_CLASS_ASYNC_FUNCTION:
+    case JS_CLASS_ASYNC_GENERATOR_FUNCTION:
+        {
+            JSFunctionBytecode *b = p->u.func.function_bytecode;
+            np->u.func.function_bytecode = js_clone_dup(s, b);
+            if (p->u.func.home_object)
+                np->u.func.home_object = js_clone_dup(s, p->u.func.home_object);
+            if (p->u.func.var_refs) {
+                for(i = 0; i < b->closure_var_count; i++) {
+                    if (p->u.func.var_refs[i])
+                        np->u.func.var_refs[i] =
+                            js_clone_dup(s, p->u.func.var_refs[i]);
+                }
+            }
+        }
+        break;
+    case JS_CLASS_BOUND_FUNCTION:
+        {
+            JSBoundFunction *bf = p->u.bound_function;
+            JSBoundFunction *nbf = np->u.bound_function;
+            nbf->func_obj = js_clone_value(s, bf->func_obj);
+            nbf->this_val = js_clone_value(s, bf->this_val);
+            nbf->argc = bf->argc;
+            for(i = 0; i < bf->argc; i++)
+                nbf->argv[i] = js_clone_value(s, bf->argv[i]);
+        }
+        break;
+    case JS_CLASS_C_FUNCTION_DATA:
+        {
+            JSCFunctionDataRecord *fd = p->u.c_function_data_record;
+            JSCFunctionDataRecord *nfd = np->u.c_function_data_record;
+            nfd->func = fd->func;
+            nfd->length = fd->length;
+            nfd->data_len = fd->data_len;
+            nfd->magic = fd->magic;
+            for(i = 0; i < fd->data_len; i++)
+                nfd->data[i] = js_clone_value(s, fd->data[i]);
+        }
+        break;
+    case JS_CLASS_PROXY:
+        {
+            JSProxyData *pd = p->u.proxy_data;
+            JSProxyData *npd = np->u.proxy_data;
+            npd->target = js_clone_value(s, pd->target);
+            npd->handler = js_clone_value(s, pd->handler);
+            npd->is_func = pd->is_func;
+            npd->is_revoked = pd->is_revoked;
+        }
+        break;
+    case JS_CLASS_MAP:
+    case JS_CLASS_SET:
+        {
+            JSMapState *ms = p->u.map_state, *nms = np->u.map_state;
+            struct list_head *el, *nel;
+            JSMapRecord *mr, *nmr;
+            uint32_t h;
+
+            nms->is_weak = false;
+            nms->hash_size = ms->hash_size;
+            nms->record_count_threshold = ms->record_count_threshold;
+            for(h = 0; h < nms->hash_size; h++)
+                init_list_head(&nms->hash_table[h]);
+            /* the records were allocated in the same order */
+            nel = nms->records.next;
+            list_for_each(el, &ms->records) {
+                mr = list_entry(el, JSMapRecord, link);
+                if (mr->empty)
+                    continue;
+                nmr = list_entry(nel, JSMapRecord, link);
+                nel = nel->next;
+                nmr->ref_count = 1;
+                nmr->empty = false;
+                nmr->map = nms;
+                nmr->key = js_clone_value(s, mr->key);
+                nmr->value = js_clone_value(s, mr->value);
+                /* the hash of the object keys depends on their address */
+                h = map_hash_key(s->new_ctx, nmr->key) & (nms->hash_size - 1);
+                list_add_tail(&nmr->hash_link, &nms->hash_table[h]);
+                nms->record_count++;
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    add_gc_object(s->ctx->rt, &np->header, JS_GC_OBJ_TYPE_JS_OBJECT);
+}
+
+static void js_dup_bytecode_atoms(JSRuntime *rt, const uint8_t *bc_buf,
+                                  int bc_len)
+{
+    int pos, op;
+    const JSOpCode *oi;
+
+    for(pos = 0; pos < bc_len; pos += oi->size) {
+        op = bc_buf[pos];
+        oi = &short_opcode_info(op);
+        switch(oi->fmt) {
+        case OP_FMT_atom:
+        case OP_FMT_atom_u8:
+        case OP_FMT_atom_u16:
+        case OP_FMT_atom_label_u8:
+        case OP_FMT_atom_label_u16:
+            JS_DupAtomRT(rt, get_u32(bc_buf + pos + 1));
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+static void js_clone_init_bytecode(JSCloneState *s, JSFunctionBytecode *b,
+                                   JSFunctionBytecode *nb)
+{
+    JSRuntime *rt = s->ctx->rt;
+    int i;
+
+    nb->is_lazy = false;
+    nb->lazy_fd = NULL;
+    JS_DupAtomRT(rt, nb->func_name);
+    JS_DupAtomRT(rt, nb->filename);
+    if (nb->vardefs) {
+        for(i = 0; i < nb->arg_count + nb->var_count; i++)
+            JS_DupAtomRT(rt, nb->vardefs[i].var_name);
+    }
+    for(i = 0; i < nb->closure_var_count; i++)
+        JS_DupAtomRT(rt, nb->closure_var[i].var_name);
+    if (nb->rom_atoms)
+        nb->rom_atoms->ref_count++;
+    else
+        js_dup_bytecode_atoms(rt, nb->byte_code_buf, nb->byte_code_len);
+    for(i = 0; i < nb->cpool_count; i++)
+        nb->cpool[i] = js_clone_value(s, b->cpool[i]);
+    if (b->realm)
+        nb->realm = js_clone_realm(s, b->realm);
+    add_gc_object(rt, &nb->header, JS_GC_OBJ_TYPE_FUNCTION_BYTECODE);
+}
+
+static void js_clone_init_shape(JSCloneState *s, JSShape *sh, JSShape *nsh)
+{
+    JSRuntime *rt = s->ctx->rt;
+    JSShapeProperty *prs;
+    uint32_t h;
+    int i;
+
+    nsh->proto = NULL;
+    if (sh->proto)
+        nsh->proto = js_clone_dup(s, sh->proto);
+    h = shape_initial_hash(nsh->proto);
+    for(i = 0, prs = get_shape_prop(nsh); i < nsh->prop_count; i++, prs++) {
+        JS_DupAtomRT(rt, prs->atom);
+        h = shape_hash(shape_hash(h, prs->atom), prs->flags);
+    }
+    if (nsh->is_hashed) {
+        /* same hash as if the properties were added one by one */
+        nsh->hash = h;
+        if (2 * (rt->shape_hash_count + 1) > rt->shape_hash_size)
+            resize_shape_hash(rt, rt->shape_hash_bits + 1);
+        js_shape_hash_link(rt, nsh);
+    }
+    add_gc_object(rt, &nsh->header, JS_GC_OBJ_TYPE_SHAPE);
+}
+
+static void js_clone_init(JSCloneState *s, JSCloneEntry *e)
+{
+    if (e->new == e->old)
+        return; /* shared */
+    switch(e->old->gc_obj_type) {
+    case JS_GC_OBJ_TYPE_JS_OBJECT:
+        js_clone_init_object(s, (JSObject *)e->old, e->new);
+        break;
+    case JS_GC_OBJ_TYPE_FUNCTION_BYTECODE:
+        js_clone_init_bytecode(s, (JSFunctionBytecode *)e->old, e->new);
+        break;
+    case JS_GC_OBJ_TYPE_VAR_REF:
+        {
+            JSVarRef *var_ref = (JSVarRef *)e->old, *nvar_ref = e->new;
+            nvar_ref->is_detached = true;
+            nvar_ref->value = js_clone_value(s, var_ref->value);
+            nvar_ref->pvalue = &nvar_ref->value;
+            add_gc_object(s->ctx->rt, &nvar_ref->header, JS_GC_OBJ_TYPE_VAR_REF);
+        }
+        break;
+    case JS_GC_OBJ_TYPE_SHAPE:
+        js_clone_init_shape(s, (JSShape *)e->old, e->new);
+        break;
+    default:
+        abort();
+    }
+}
+
+/* apply 'func' to the JSValue fields of JSContext */
+#define JS_CONTEXT_VALUE_FIELDS(func)           \
+    func(function_proto);                       \
+    func(function_ctor);                        \
+    func(array_ctor);                           \
+    func(regexp_ctor);                          \
+    func(promise_ctor);                         \
+    func(error_ctor);                           \
+    func(error_back_trace);                     \
+    func(error_prepare_stack);                  \
+    func(error_stack_trace_limit);              \
+    func(iterator_ctor);                        \
+    func(iterator_ctor_getset);                 \
+    func(async_iterator_proto);                 \
+    func(array_proto_values);                   \
+    func(throw_type_error);                     \
+    func(eval_obj);                             \
+    func(global_obj);                           \
+    func(global_var_obj)
+
+JSContext *JS_CloneContext(JSContext *ctx)
+{
+    JSRuntime *rt = ctx->rt;
+    JSContext *new_ctx;
+    JSCloneState s_s, *s = &s_s;
+    uint32_t i;
+
+    if (!list_empty(&ctx->loaded_modules)) {
+        JS_ThrowTypeError(ctx, "cannot clone a context with modules");
+        return NULL;
+    }
+    new_ctx = js_new_context(rt);
+    if (!new_ctx) {
+        JS_ThrowOutOfMemory(ctx);
+        return NULL;
+    }
+    memset(s, 0, sizeof(*s));
+    s->ctx = ctx;
+    s->new_ctx = new_ctx;
+
+    /* find the objects reachable from the context and allocate their
+       copy. Nothing is modified in the runtime if it fails. */
+#define VISIT(field) if (js_clone_visit_value(s, &ctx->field)) goto fail
+    JS_CONTEXT_VALUE_FIELDS(VISIT);
+    for(i = 0; i < JS_NATIVE_ERROR_COUNT; i++) {
+        VISIT(native_error_proto[i]);
+    }
+    for(i = 0; i < rt->class_count; i++) {
+        VISIT(class_proto[i]);
+    }
+#undef VISIT
+    if (ctx->array_shape && js_clone_visit(s, &ctx->array_shape->header))
+        goto fail;
+    for(i = 0; i < s->entry_count; i++) {
+        if (js_clone_alloc(s, i))
+            goto fail;
+    }
+
+    /* initialize the copies */
+    for(i = 0; i < s->entry_count; i++)
+        js_clone_init(s, &s->entries[i]);
+#define CLONE(field) new_ctx->field = js_clone_value(s, ctx->field)
+    JS_CONTEXT_VALUE_FIELDS(CLONE);
+    for(i = 0; i < JS_NATIVE_ERROR_COUNT; i++) {
+        CLONE(native_error_proto[i]);
+    }
+    for(i = 0; i < rt->class_count; i++) {
+        CLONE(class_proto[i]);
+    }
+#undef CLONE
+    if (ctx->array_shape)
+        new_ctx->array_shape = js_clone_dup(s, ctx->array_shape);
+    new_ctx->binary_object_count = ctx->binary_object_count;
+    new_ctx->binary_object_size = ctx->binary_object_size;
+    new_ctx->time_origin = ctx->time_origin;
+    if (ctx->random_state)
+        js_random_init(new_ctx);
+    new_ctx->compile_regexp = ctx->compile_regexp;
+    new_ctx->eval_internal = ctx->eval_internal;
+    js_free(ctx, s->entries);
+    js_free(ctx, s->hash);
+    return new_ctx;
+ fail:
+    for(i = 0; i < s->entry_count; i++)
+        js_clone_free_entry(s, &s->entries[i]);
+    js_free(ctx, s->entries);
+    js_free(ctx, s->hash);
+    JS_FreeContext(new_ctx);
+    return NULL;
+}
+
 bool JS_DetectModule(const char *input, size_t input_len)
 {
 #ifndef QJS_DISABLE_PARSER
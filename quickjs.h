@@ -133,6 +133,9 @@ enum {
 typedef struct JSValue *JSValue;
 typedef const struct JSValue *JSValueConst;
 
+/* number of bits of the BigInt values stored in the JSValue */
+#define JS_SHORT_BIG_INT_BITS 32
+
 #define JS_MKVAL(tag, val)       ((JSValue)((tag) | (intptr_t)(val) << 4))
 #define JS_MKPTR(tag, ptr)       ((JSValue)((tag) | (intptr_t)(ptr)))
 #define JS_VALUE_GET_NORM_TAG(v) ((int)((intptr_t)(v) & 15))
@@ -166,6 +169,7 @@ static inline bool JS_VALUE_IS_NAN(JSValue v)
 
 typedef uint64_t JSValue;
 
+#define JS_SHORT_BIG_INT_BITS 32
 #define JS_VALUE_GET_TAG(v) (int)((v) >> 32)
 #define JS_VALUE_GET_INT(v) (int)(v)
 #define JS_VALUE_GET_BOOL(v) (int)(v)
@@ -234,11 +238,14 @@ static inline bool JS_VALUE_IS_NAN(JSValue v)
 
 #else /* !JS_NAN_BOXING */
 
+/* int64 BigInt values are stored in the JSValue without allocation */
+#define JS_SHORT_BIG_INT_BITS 64
+
 typedef union JSValueUnion {
     int32_t int32;
     double float64;
     void *ptr;
-    int32_t short_big_int;
+    int64_t short_big_int;
 } JSValueUnion;
 
 typedef struct JSValue {
@@ -449,6 +456,12 @@ JS_EXTERN void JS_SetMaxStackSize(JSRuntime *rt, size_t stack_size);
    used to check stack overflow. */
 JS_EXTERN void JS_UpdateStackTop(JSRuntime *rt);
 JS_EXTERN JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque);
+/* runtime allocating its memory from large arenas. JS_FreeRuntime()
+   does not free the objects one by one: it only calls the finalizers
+   of the JS_NewClass() classes, the C closure opaque finalizers, the
+   ArrayBuffer free functions and the runtime finalizers, then releases
+   the arenas at once. The pending jobs are dropped. */
+JS_EXTERN JSRuntime *JS_NewArenaRuntime(void);
 JS_EXTERN void JS_FreeRuntime(JSRuntime *rt);
 JS_EXTERN void *JS_GetRuntimeOpaque(JSRuntime *rt);
 JS_EXTERN void JS_SetRuntimeOpaque(JSRuntime *rt, void *opaque);
@@ -458,6 +471,43 @@ typedef void JS_MarkFunc(JSRuntime *rt, JSGCObjectHeader *gp);
 JS_EXTERN void JS_MarkValue(JSRuntime *rt, JSValueConst val,
                             JS_MarkFunc *mark_func);
 JS_EXTERN void JS_RunGC(JSRuntime *rt);
+/* collect cycles incrementally, spending about budget_us microseconds.
+   A cycle of steps looks for the garbage cycles in the whole heap while
+   the program runs between the steps. Its last step frees the cycles
+   found: its duration is proportional to the garbage freed and to the
+   objects modified during the cycle. Return true when a cycle is
+   complete. JS_RunGC() cancels the current cycle. */
+JS_EXTERN bool JS_RunGCStep(JSRuntime *rt, int64_t budget_us);
+/* when the GC threshold is reached, run JS_RunGCStep() with this
+   budget instead of JS_RunGC(). The steps of a cycle are spaced so
+   that the heap grows by about the heap growth percent during the
+   cycle, and are 4 times longer when the program allocates faster than
+   that. 0 (default) disables it. */
+JS_EXTERN void JS_SetGCStepBudget(JSRuntime *rt, int64_t budget_us);
+/* after each automatic collection, the GC threshold is set to the
+   remaining heap size plus 'percent' of it (50 by default). The growth
+   adapts between 'percent' and 8 times 'percent': it increases when the
+   collections free little memory or take more than 10% of the time and
+   decreases when they free most of the heap. */
+JS_EXTERN void JS_SetGCHeapGrowth(JSRuntime *rt, int percent);
+/* when not 0, the growth also decreases when a partial collection
+   takes longer than pause_us microseconds */
+JS_EXTERN void JS_SetGCTargetPause(JSRuntime *rt, int64_t pause_us);
+
+/* statistics of the automatic collections */
+typedef struct JSGCStats {
+    int64_t gc_count; /* number of collections */
+    int64_t full_gc_count; /* number of collections of the whole heap */
+    int64_t total_time_us; /* time spent in the collections */
+    int64_t last_time_us; /* duration of the last collection */
+    size_t heap_size; /* current heap size, in bytes */
+    size_t gc_threshold; /* heap size of the next collection */
+    size_t last_freed; /* bytes freed by the last collection */
+    size_t alloc_rate; /* bytes allocated per second before the last one */
+    int heap_growth; /* current growth of the threshold, in percent */
+} JSGCStats;
+
+JS_EXTERN void JS_GetGCStats(JSRuntime *rt, JSGCStats *s);
 JS_EXTERN bool JS_IsLiveObject(JSRuntime *rt, JSValueConst obj);
 
 JS_EXTERN JSContext *JS_NewContext(JSRuntime *rt);
@@ -469,6 +519,16 @@ JS_EXTERN JSRuntime *JS_GetRuntime(JSContext *ctx);
 JS_EXTERN void JS_SetClassProto(JSContext *ctx, JSClassID class_id, JSValue obj);
 JS_EXTERN JSValue JS_GetClassProto(JSContext *ctx, JSClassID class_id);
 JS_EXTERN JSValue JS_GetFunctionProto(JSContext *ctx);
+/* create a context of the same runtime whose global environment is a
+   deep copy of the one of 'ctx'. It is faster than creating a new
+   context and running the same initialization code: 'ctx' is typically
+   set up once with the intrinsic objects and a prelude, then only used
+   as a template. Cloning generates the code of the functions of 'ctx'
+   whose compilation was deferred by JS_SetLazyCompilation(), as if they
+   had been called; 'ctx' is otherwise not modified. Modules, host
+   objects and objects such as promises, typed arrays or weak maps
+   cannot be cloned. Return NULL with an exception in 'ctx' if error. */
+JS_EXTERN JSContext *JS_CloneContext(JSContext *ctx);
 
 /* the following functions are used to select the intrinsic object to
    save memory */
@@ -530,10 +590,25 @@ typedef struct JSMemoryUsage {
     int64_t c_func_count, array_count;
     int64_t fast_array_count, fast_array_elements;
     int64_t binary_object_count, binary_object_size;
+    int64_t str_slice_count, str_slice_retained_size;
 } JSMemoryUsage;
 
 JS_EXTERN void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s);
 JS_EXTERN void JS_DumpMemoryUsage(FILE *fp, const JSMemoryUsage *s, JSRuntime *rt);
+/* write a heap snapshot in the Chrome DevTools .heapsnapshot format.
+   Return 0 if OK, -1 on error. */
+JS_EXTERN int JS_WriteHeapSnapshot(JSRuntime *rt, FILE *f);
+/* sample the allocations: about every 'interval' allocated bytes, the
+   JS stack (at most 'max_depth' frames, up to 64) and the kind of the
+   allocation are recorded. The previous samples are discarded. Return
+   0 if OK, -1 if out of memory. */
+JS_EXTERN int JS_StartAllocationSampling(JSRuntime *rt, size_t interval,
+                                         int max_depth);
+/* stop the sampling. The samples are kept until the next start. */
+JS_EXTERN void JS_StopAllocationSampling(JSRuntime *rt);
+/* write the samples in the Chrome DevTools .heapprofile format (sampling
+   heap profile). Return 0 if OK, -1 on error or if there are no samples. */
+JS_EXTERN int JS_WriteAllocationProfile(JSRuntime *rt, FILE *f);
 
 /* atom support */
 #define JS_ATOM_NULL 0
@@ -620,13 +695,17 @@ typedef struct JSClassDef {
     JSClassExoticMethods *exotic;
 } JSClassDef;
 
-#define JS_EVAL_OPTIONS_VERSION 1
+#define JS_EVAL_OPTIONS_VERSION 2
 
 typedef struct JSEvalOptions {
   int version;
   int eval_flags;
   const char *filename;
   int line_num;
+  // since version 2: bytecode optimization level. 0 selects the default
+  // (constant folding, copy propagation and dead store elimination); a
+  // negative value keeps only the peephole optimizations.
+  int opt_level;
   // can add new fields in ABI-compatible manner by incrementing JS_EVAL_OPTIONS_VERSION
 } JSEvalOptions;
 
@@ -1069,6 +1148,18 @@ typedef int JSInterruptHandler(JSRuntime *rt, void *opaque);
 JS_EXTERN void JS_SetInterruptHandler(JSRuntime *rt, JSInterruptHandler *cb, void *opaque);
 /* if can_block is true, Atomics.wait() can be used */
 JS_EXTERN void JS_SetCanBlock(JSRuntime *rt, bool can_block);
+/* if enable is true, the bytecode of the inner functions is generated
+   when they are first called. It speeds up the loading of scripts whose
+   functions are mostly not called, but their compilation state is kept
+   in memory until then. Disabled by default. */
+JS_EXTERN void JS_SetLazyCompilation(JSRuntime *rt, bool enable);
+/* if enable is true, the functions of a script keep their source for
+   Function.prototype.toString() as a slice of one shared copy of the
+   script instead of a copy each, so nested functions no longer
+   duplicate their text. The copy is freed with the last function
+   referencing it: a single small function kept alive keeps the whole
+   script in memory. Disabled by default. */
+JS_EXTERN void JS_SetSharedFunctionSource(JSRuntime *rt, bool enable);
 /* set the [IsHTMLDDA] internal slot */
 JS_EXTERN void JS_SetIsHTMLDDA(JSContext *ctx, JSValueConst obj);
 
@@ -1119,7 +1210,7 @@ JS_EXTERN uint8_t *JS_WriteObject2(JSContext *ctx, size_t *psize, JSValueConst o
                                    int flags, JSSABTab *psab_tab);
 
 #define JS_READ_OBJ_BYTECODE  (1 << 0) /* allow function/module */
-#define JS_READ_OBJ_ROM_DATA  (0)      /* avoid duplicating 'buf' data (obsolete, broken by ICs) */
+#define JS_READ_OBJ_ROM_DATA  (1 << 1) /* execute the bytecode in place: 'buf' must outlive the functions */
 #define JS_READ_OBJ_SAB       (1 << 2) /* allow SharedArrayBuffer */
 #define JS_READ_OBJ_REFERENCE (1 << 3) /* allow object references */
 JS_EXTERN JSValue JS_ReadObject(JSContext *ctx, const uint8_t *buf, size_t buf_len, int flags);
@@ -1132,6 +1223,43 @@ JS_EXTERN JSValue JS_EvalFunction(JSContext *ctx, JSValue fun_obj);
    returns a module. */
 JS_EXTERN int JS_ResolveModule(JSContext *ctx, JSValueConst obj);
 
+/* Ahead-of-time compilation: JS_WriteNativeCode() translates the
+   functions of a compiled script or module to C source code (returned
+   as a js_malloc'd string of *psize bytes) defining the table
+   'c_name'_native[] of 'c_name'_native_count entries. Once compiled,
+   the table is installed with JS_SetNativeCode() on the object
+   returned by JS_ReadObject() for the same bytecode. The functions
+   which cannot be translated stay interpreted. */
+typedef JSValue JSNativeCodeFunc(JSContext *ctx, JSValueConst this_val,
+                                 JSValue *arg_buf, JSValue *var_buf);
+typedef struct JSNativeCodeEntry {
+    JSNativeCodeFunc *func; /* NULL if interpreted */
+    uint32_t byte_code_len; /* used to check the bytecode */
+} JSNativeCodeEntry;
+JS_EXTERN char *JS_WriteNativeCode(JSContext *ctx, size_t *psize,
+                                   JSValueConst obj, const char *c_name);
+JS_EXTERN int JS_SetNativeCode(JSContext *ctx, JSValueConst obj,
+                               const JSNativeCodeEntry *tab, int count);
+/* only exported for the generated code */
+JS_EXTERN int JS_NativeCodeExecOp(JSContext *ctx, uint32_t pos, int op,
+                                  JSValue *sp);
+
+/* Whole-program optimization for ahead-of-time compilers. 'roots' are
+   the scripts and modules of a program compiled with
+   JS_EVAL_FLAG_COMPILE_ONLY whose exports are kept. The exports of the
+   modules they import which no module imports are removed, then the
+   module function declarations which are no longer referenced. Return
+   the number of removed functions or -1 if exception. */
+JS_EXTERN int JS_TreeShake(JSContext *ctx, JSValueConst *roots, int count);
+/* Call 'func' on the atoms which the compiled script or module 'obj'
+   may use to reach the global object: identifiers, property names and
+   string constants, and the constructors implied by its syntax (RegExp
+   for regexp literals, BigInt for BigInt literals, Promise for modules
+   and async code, eval for direct eval and import()). */
+typedef void JSAtomEnumFunc(JSContext *ctx, JSAtom atom, void *opaque);
+JS_EXTERN int JS_EnumBytecodeAtoms(JSContext *ctx, JSValueConst obj,
+                                   JSAtomEnumFunc *func, void *opaque);
+
 /* only exported for os.Worker() */
 JS_EXTERN JSAtom JS_GetScriptOrModuleName(JSContext *ctx, int n_stack_levels);
 /* only exported for os.Worker() */
@@ -3,8 +3,6 @@ import * as os from "qjs:os";
 import * as bjson from "qjs:bjson";
 
 // See quickjs.h
-const JS_READ_OBJ_BYTECODE = 1 << 0;
-const JS_READ_OBJ_REFERENCE = 1 << 3;
 const JS_WRITE_OBJ_BYTECODE = 1 << 0;
 const JS_WRITE_OBJ_REFERENCE = 1 << 3;
 const JS_WRITE_OBJ_STRIP_SOURCE = 1 << 4;
@@ -29,10 +27,6 @@ function encodeAscii(txt) {
   return new Uint8Array(txt.split('').map(c => c.charCodeAt(0)));
 }
 
-function decodeAscii(buf) {
-  return Array.from(buf).map(c => String.fromCharCode(c)).join('')
-}
-
 export function compileStandalone(inFile, outFile, targetExe) {
   // Step 1: compile the source file to bytecode
   const js = std.loadFile(inFile);
@@ -78,52 +72,3 @@ export function compileStandalone(inFile, outFile, targetExe) {
   }
   os.close(newFd);
 }
-
-export function runStandalone() {
-  const file = os.exePath() ?? globalThis.argv0;
-  const exe = std.open(file, 'rb');
-
-  if (!exe) {
-    throw new Error(`failed to open executable: ${file}`);
-  }
-
-  let r = exe.seek(-Trailer.Size, std.SEEK_END);
-  if (r < 0) {
-    throw new Error(`seek error: ${-r}`);
-  }
-
-  const trailer = new Uint8Array(Trailer.Size);
-
-  exe.read(trailer.buffer, 0, Trailer.Size);
-
-  const magic = new Uint8Array(trailer.buffer, 0, Trailer.MagicSize);
-
-  // Shouldn't happen since qjs.c checks for it.
-  if (decodeAscii(magic) !== Trailer.Magic) {
-    exe.close();
-    throw new Error('corrupted binary, magic mismatch');
-  }
-
-  const dw = new DataView(trailer.buffer, Trailer.MagicSize, Trailer.DataSize);
-  const offset = dw.getUint32(0, true /* little-endian */);
-  const bytecode = new Uint8Array(offset - Trailer.Size);
-
-  r = exe.seek(offset, std.SEEK_SET);
-  if (r < 0) {
-    exe.close();
-    throw new Error(`seek error: ${-r}`);
-  }
-
-  exe.read(bytecode.buffer, 0, bytecode.length);
-  if (exe.error()) {
-    exe.close();
-    throw new Error('read error');
-  }
-  exe.close();
-
-  const code = bjson.read(bytecode.buffer, 0, bytecode.length, JS_READ_OBJ_BYTECODE | JS_READ_OBJ_REFERENCE);
-
-  return std.evalScript(code, {
-    eval_module: true
-  });
-}
@@ -0,0 +1,7 @@
+function helper(x) { return x * 2 }
+function unusedHelper() { return new Proxy({}, {}) }
+
+export function used(x) { return helper(x) + 1 }
+export function unused() { return unusedHelper() }
+export const answer = 42
+export * from "./fixture_string_exports.js"
@@ -0,0 +1,4 @@
+// a function only referenced by a direct eval() must be kept
+function viaEval() { return "viaEval" }
+
+export const top = eval("viaEval()")
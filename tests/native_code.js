@@ -0,0 +1,117 @@
+"use strict"
+// compiled with `qjsc -e -a`: the functions without unsupported opcodes
+// are translated to C
+
+function assert(actual, expected) {
+    if (actual !== expected && !(actual !== actual && expected !== expected))
+        throw Error(`expected ${expected}, got ${actual}`)
+}
+
+function assertThrows(ctor, f) {
+    let ok = false
+    try {
+        f()
+    } catch (e) {
+        ok = e instanceof ctor
+    }
+    if (!ok) throw Error(`expected ${ctor.name}`)
+}
+
+function fib(n) { return n < 2 ? n : fib(n - 1) + fib(n - 2) }
+
+function sum(n) {
+    let s = 0
+    for (let i = 0; i < n; i++) s += i
+    return s
+}
+
+function arith(a, b) {
+    return [a + b, a - b, a * b, a / b, a % b, a ** 2, a & b, a | b,
+            a ^ b, a << b, a >> b, a >>> b, -a, +a, ~a, a < b, a <= b,
+            a > b, a >= b, a == b, a != b, a === b, a !== b]
+}
+
+function big(a, b) {
+    return a * b + 1n
+}
+
+function overflow() {
+    let i = 0x7fffffff
+    let j = -0x80000000
+    i++
+    j--
+    let k = 0x7fffffff
+    k += 1
+    return [i, j, k, 0x40000000 * 4, 0 * -1, i++, ++j]
+}
+
+function strings(a) {
+    let s = ""
+    for (const c of [1, 2, 3]) s += c
+    return a + s + typeof a + (a in { x: 1 })
+}
+
+function objects() {
+    const o = { a: 1, b: [1, 2, 3] }
+    o.c = o.b.length
+    o.b[1] = 5
+    delete o.a
+    return JSON.stringify(o) + ("a" in o)
+}
+
+function closures() {
+    let c = 0
+    const inc = () => ++c
+    inc()
+    inc()
+    return c
+}
+
+function tdz() {
+    x = 1
+    let x
+}
+
+function thrower(a, b) {
+    return a + b.c.d
+}
+
+function tail(n) {
+    return n === 0 ? "done" : tail(n - 1)
+}
+
+function method() {
+    return [3, 1, 2].sort().join(",")
+}
+
+function Point(x, y) {
+    this.x = x
+    this.y = y
+}
+
+function construct() {
+    const p = new Point(1, 2)
+    return p.x + p.y + "" + (p instanceof Point)
+}
+
+assert(fib(20), 6765)
+assert(sum(100000), 4999950000)
+assert(arith(7, 3).join(), "10,4,21,2.3333333333333335,1,49,3,7,4,56,0,0,-7,7,-8,false,false,true,true,false,true,false,true")
+assert(arith(1.5, "2").join(), "1.52,-0.5,3,0.75,1.5,2.25,0,3,3,4,0,0,-1.5,1.5,-2,true,true,false,false,false,true,false,true")
+assert(big(2n, 3n), 7n)
+assert(overflow().join(), "2147483648,-2147483649,2147483648,4294967296,0,2147483648,-2147483648")
+assert(Object.is(overflow()[4], -0), true)
+assert(strings("x"), "x123stringtrue")
+assert(objects(), '{"b":[1,5,3],"c":3}false')
+assert(closures(), 2)
+assertThrows(ReferenceError, tdz)
+assertThrows(TypeError, () => thrower(1, {}))
+assert(thrower("a", { c: { d: "b" } }), "ab")
+assert(tail(100), "done")
+assert(method(), "1,2,3")
+assert(construct(), "3true")
+try {
+    thrower(1, {})
+} catch (e) {
+    assert(e.stack.includes("at thrower"), true)
+}
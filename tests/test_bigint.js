@@ -78,6 +78,83 @@ function test_bigint2()
     assertThrows(SyntaxError, () => { BigInt("  123  r") } );
 }
 
+function test_bigint64()
+{
+    var a, b, ta;
+
+    /* values around the int64 range */
+    a = 2n ** 63n - 1n;
+    b = -(2n ** 63n);
+    assert(a + 1n, 9223372036854775808n);
+    assert(b - 1n, -9223372036854775809n);
+    assert(a + b, -1n);
+    assert(-b, 9223372036854775808n);
+    assert(b / -1n, 9223372036854775808n);
+    assert(b % -1n, 0n);
+    assert(3037000500n * 3037000500n, 9223372037000250000n);
+    assert(-3037000499n * 3037000499n, -9223372030926249001n);
+    assert(b * 1n, b);
+    assert(b * -1n, 9223372036854775808n);
+    assert(4294967296n * -2147483648n, b);
+    assert(1n << 63n, 9223372036854775808n);
+    assert(-1n << 63n, b);
+    assert(3n << 62n, 13835058055282163712n);
+    assert(b >> 63n, -1n);
+    assert(a >> 62n, 1n);
+    assert(a * 2n / 2n, a);
+    assert(a == 9223372036854775807n, true);
+    assert(a + 1n > a, true);
+    assert(BigInt.asIntN(64, a + 1n), b);
+    assert(BigInt.asUintN(64, -1n), 18446744073709551615n);
+    assert(BigInt.asUintN(32, -1n), 4294967295n);
+    assert(BigInt.asUintN(100, -(2n ** 40n)), 2n ** 100n - 2n ** 40n);
+    assert(BigInt.asIntN(64, 2n ** 64n - 1n), -1n);
+
+    ta = new BigInt64Array(2);
+    ta[0] = a;
+    ta[1] = a + 2n;
+    assert(ta[0], a);
+    assert(ta[1], b + 1n);
+    ta = new BigUint64Array(1);
+    ta[0] = -1n;
+    assert(ta[0], 18446744073709551615n);
+}
+
+function test_bigint_large()
+{
+    var a, b, p, s, i;
+
+    /* large enough for the Karatsuba multiplication, the recursive
+       division and the divide and conquer radix conversion */
+    a = 3n ** 20000n - 1n;
+    b = -(7n ** 7000n) + 12345n;
+    p = a * b;
+    assert(p / b, a);
+    assert(p % b, 0n);
+    assert((p - 17n) % a, -17n);
+    assert((a * a - 1n) / (a + 1n), a - 1n);
+    assert((a * a + a) / a, a + 1n);
+    assert(p, b * a);
+    assert((a + 1n) * (a - 1n), a * a - 1n);
+
+    s = String(10n ** 5000n);
+    assert(s.length, 5001);
+    assert(s, "1" + "0".repeat(5000));
+    assert(String(10n ** 5000n - 1n), "9".repeat(5000));
+    s = String(a);
+    assert(s.slice(0, 12), "266130342721");
+    assert(s.slice(-12), "253104400000");
+    assert(BigInt(s), a);
+    assert(BigInt("-" + s), -a);
+    assert(BigInt("0x" + a.toString(16)), a);
+    for(i = 2; i <= 36; i++) {
+        s = a.toString(i);
+        assert(parseInt(s.slice(-1), i), Number(a % BigInt(i)));
+        assert(BigInt(i) ** BigInt(s.length - 1) <= a);
+        assert(a < BigInt(i) ** BigInt(s.length));
+    }
+}
+
 function test_bigint_map()
 {
     var m = new Map();
@@ -104,4 +181,6 @@ function test_bigint_map()
 
 test_bigint1();
 test_bigint2();
+test_bigint64();
+test_bigint_large();
 test_bigint_map();
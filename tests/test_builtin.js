@@ -379,6 +379,18 @@ function test_string()
 
     assert("abc".padStart(Infinity, ""), "abc");
 
+    assert("Content-Type: TEXT/html".toLowerCase(), "content-type: text/html");
+    assert("content-type: text/html".toUpperCase(), "CONTENT-TYPE: TEXT/HTML");
+    assert("\xc0\xd7\xdeZ@[".toLowerCase(), "\xe0\xd7\xfez@[");
+    assert("\xe0\xf7\xfez`{".toUpperCase(), "\xc0\xf7\xdeZ`{");
+    assert("stra\xdfe \xb5 \xff".toUpperCase(), "STRASSE Μ Ÿ");
+    assert("ΣAΣ".toLowerCase(), "σaς");
+
+    assert("abcdefgh😀".isWellFormed(), true);
+    assert("abcdefgh\ud83d".isWellFormed(), false);
+    assert("abcdefgh\ude00ijkl".isWellFormed(), false);
+    assert("abc\ud83dxyz\ude00ሴ".toWellFormed(), "abc�xyz�ሴ");
+
     assert(qjs.getStringKind("xyzzy".slice(1)),
            /*JS_STRING_KIND_NORMAL*/0);
     assert(qjs.getStringKind("xyzzy".repeat(512).slice(1)),
@@ -422,6 +434,13 @@ function test_number()
     assert(parseFloat("-Infinity"), -Infinity);
     assert(parseFloat("123.2"), 123.2);
     assert(parseFloat("123.2e3"), 123200);
+    assert(parseFloat("9007199254740993"), 9007199254740992);
+    assert(parseFloat("4503599627370497.5"), 4503599627370498);
+    assert(parseFloat("2.2250738585072011e-308"), 2.225073858507201e-308);
+    assert(parseFloat("1.7976931348623158e308"), Number.MAX_VALUE);
+    assert(parseFloat("2.4703282292062328e-324"), Number.MIN_VALUE);
+    assert(parseFloat("7.2911220195563975e-304"), 2**-1007);
+    assert(JSON.parse("[0.1,-2.5e-3,1e23]"), [0.1, -0.0025, 1e23]);
     assert(Number.isNaN(Number("+")));
     assert(Number.isNaN(Number("-")));
     assert(Number.isNaN(Number("\x00a")));
@@ -429,6 +448,13 @@ function test_number()
     assert((1-2**-53).toString(12), "0.bbbbbbbbbbbbbba");
     assert((1000000000000000128).toString(), "1000000000000000100");
     assert((1000000000000000128).toFixed(0), "1000000000000000128");
+    assert((0.1 + 0.2).toString(), "0.30000000000000004");
+    assert((2**554).toString(), "5.896816288783659e+166");
+    assert((2**-1022).toString(), "2.2250738585072014e-308");
+    assert(Number.MAX_VALUE.toString(), "1.7976931348623157e+308");
+    assert(Number.MIN_VALUE.toString(), "5e-324");
+    assert((2 * Number.MIN_VALUE).toString(), "1e-323");
+    assert((-1e-7).toString(), "-1e-7");
     assert((25).toExponential(0), "3e+1");
     assert((-25).toExponential(0), "-3e+1");
     assert((2.5).toPrecision(1), "3");
@@ -639,6 +665,15 @@ function test_json()
     assert(a.z, null);
     assert(JSON.stringify(a), s);
 
+    /* property names with and without escapes */
+    a = JSON.parse('{\n "a": 1,\r\n\t"10" : 2, "\\u0062": 3, "é": 4 }');
+    assert(a.a, 1);
+    assert(a[10], 2);
+    assert(a.b, 3);
+    assert(a["é"], 4);
+    assertThrows(SyntaxError, () => JSON.parse('{"a":1,}'));
+    assertThrows(SyntaxError, () => JSON.parse('{"a" 1}'));
+
     /* indentation test */
     assert(JSON.stringify([[{x:1,y:{},z:[]},2,3]],undefined,1),
 `[
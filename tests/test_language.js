@@ -721,6 +721,23 @@ function test_parse_semicolon()
     }
 }
 
+function test_long_tokens()
+{
+    /* exercise the word at a time scanning of the tokenizer */
+    var id = "abcdefghijklmnopqrstuvwxyz_$ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    var name = id + "\u00e9" + id + "\\u0061" + id;
+    assert((0, eval)("var " + name + " = 1; " + name), 1);
+    assert((0, eval)(id + "\u00e9" + id + "a" + id), 1);
+    assert(eval("/* 0123456789 ** / 0123456789\n */ 1 // 0123456789abcdef\n + 1"), 2);
+    assert(eval("'0123456789abcdef\\n0123456789abcdef\u00e9\\'0123456789'").length, 45);
+    assert(eval("`0123456789abcdef${1 + 1}$0123456789abcdef\r\n0123456789`"),
+           "0123456789abcdef2$0123456789abcdef\n0123456789");
+    assert(JSON.parse('        {"0123456789abcdef": "0123456789abcdef\\u0041",       "a": true}')["0123456789abcdef"],
+           "0123456789abcdefA");
+    assert_throws(SyntaxError, () => eval("'0123456789abcdef0123456789\n'"));
+    assert_throws(SyntaxError, () => eval("/* 0123456789abcdef0123456789"));
+}
+
 test_op1();
 test_cvt();
 test_eq();
@@ -746,3 +763,4 @@ test_number_literals();
 test_syntax();
 test_optional_chaining();
 test_parse_semicolon();
+test_long_tokens();
@@ -0,0 +1,83 @@
+// run by qjs itself: runs `qjs --module-cache DIR` on a small module graph
+import * as std from "qjs:std";
+import * as os from "qjs:os";
+import { assert } from "./assert.js";
+
+const qjs = os.exePath() ?? globalThis.argv0;
+const dir = `${std.getenv("TMPDIR") ?? "/tmp"}/qjs-module-cache-${os.getpid()}`;
+const cache = `${dir}/cache`;
+
+function run()
+{
+    const f = std.popen(`"${qjs}" --module-cache "${cache}" "${dir}/main.js" 2>&1`, "r");
+    const out = f.readAsString();
+    f.close();
+    return out.trim();
+}
+
+function entries()
+{
+    const [names] = os.readdir(cache);
+    return names.filter(n => n.endsWith(".qjbc")).map(n => `${cache}/${n}`);
+}
+
+function mtime(path)
+{
+    const [st, err] = os.stat(path);
+    assert(err, 0);
+    return st.mtime;
+}
+
+function test_module_cache()
+{
+    let path, data;
+
+    std.writeFile(`${dir}/main.js`, 'import { value } from "./dep.js"; print(value);\n');
+    std.writeFile(`${dir}/dep.js`, "export const value = 1;\n");
+
+    // miss: only the imported module is cached
+    assert(run(), "1");
+    assert(entries().length, 1);
+    [path] = entries();
+
+    // hit: the entry is not written again
+    os.utimes(path, 1000, 1000);
+    assert(run(), "1");
+    assert(mtime(path), 1000);
+
+    // the source changed: compiled and written again
+    std.writeFile(`${dir}/dep.js`, "export const value = 2;\n");
+    assert(run(), "2");
+    assert(mtime(path) !== 1000, true);
+
+    // truncated entry
+    data = std.loadFile(path, { binary: true });
+    std.writeFile(path, data.slice(0, data.length >> 1));
+    os.utimes(path, 1000, 1000);
+    assert(run(), "2");
+    assert(mtime(path) !== 1000, true);
+    assert(std.loadFile(path, { binary: true }).length, data.length);
+
+    // corrupted bytecode
+    data = std.loadFile(path, { binary: true });
+    data.fill(0xff, data.length - 16);
+    std.writeFile(path, data);
+    os.utimes(path, 1000, 1000);
+    assert(run(), "2");
+    assert(mtime(path) !== 1000, true);
+}
+
+if (os.platform !== "win32") {
+    os.mkdir(dir);
+    os.mkdir(cache);
+    try {
+        test_module_cache();
+    } finally {
+        for (const p of entries())
+            os.remove(p);
+        os.remove(cache);
+        os.remove(`${dir}/main.js`);
+        os.remove(`${dir}/dep.js`);
+        os.remove(dir);
+    }
+}
@@ -0,0 +1,48 @@
+// run by qjs itself: runs `qjs --module-threads n` on a small module graph
+import * as std from "qjs:std";
+import * as os from "qjs:os";
+import { assert } from "./assert.js";
+
+const qjs = os.exePath() ?? globalThis.argv0;
+const dir = `${std.getenv("TMPDIR") ?? "/tmp"}/qjs-module-threads-${os.getpid()}`;
+const files = {
+    "main.js": 'import { a } from "./a.js";\n' +
+               'import { b } from "./b.js";\n' +
+               'print(a + b, import.meta.main);\n',
+    "a.js": 'import { c } from "./c.js";\nexport const a = c + 1;\n',
+    "b.js": 'import { c } from "./c.js";\nexport const b = c * 10;\n',
+    "c.js": "export const c = 4;\n",
+    "bad.js": 'import { d } from "./d.js";\nprint(d);\n',
+    "d.js": "export const d = 1;\nexport const e = ;\n",
+};
+
+function run(name)
+{
+    const f = std.popen(`"${qjs}" --module-threads 4 "${dir}/${name}" 2>&1`, "r");
+    const out = f.readAsString();
+    f.close();
+    return out;
+}
+
+function test_module_threads()
+{
+    let out;
+
+    assert(run("main.js").trim(), "45 true");
+    out = run("bad.js");
+    assert(out.includes("SyntaxError"), true, out);
+    assert(out.includes(`${dir}/d.js:2`), true, out);
+}
+
+if (os.platform !== "win32") {
+    os.mkdir(dir);
+    try {
+        for (const [name, source] of Object.entries(files))
+            std.writeFile(`${dir}/${name}`, source);
+        test_module_threads();
+    } finally {
+        for (const name of Object.keys(files))
+            os.remove(`${dir}/${name}`);
+        os.remove(dir);
+    }
+}
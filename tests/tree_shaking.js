@@ -0,0 +1,17 @@
+// compiled with `qjsc -e -t`: the unused exports and functions of the
+// imported modules and the unused intrinsic objects are removed
+import { used, answer } from "./fixture_tree_shaking.js"
+import { top } from "./fixture_tree_shaking_eval.js"
+
+function assert(actual, expected) {
+    if (actual !== expected)
+        throw Error(`expected ${expected}, got ${actual}`)
+}
+
+assert(used(20), 41)
+assert(answer, 42)
+assert(top, "viaEval")
+assert(JSON.stringify([1]), "[1]")
+// pruned intrinsic objects, the names are hidden from the analysis
+assert(globalThis["Pro" + "xy"], undefined)
+assert(globalThis["Weak" + "Ref"], undefined)